@@ -7,22 +7,17 @@
 #include "vmath.h"
 
 struct SceneParameters {
-    int IndexCount;
+    PezLods Torus;
     float Theta;
     Matrix4 Projection;
-    Matrix4 Modelview;
-    Matrix4 ViewMatrix;
-    Matrix4 ModelMatrix;
-    Matrix3 NormalMatrix;
+    PezTransforms Transforms;
     Vector4 ClipPlane;
-    GLfloat PackedNormalMatrix[9];
 } Scene;
 
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
-#define a(x) glGetAttribLocation(CurrentProgram(), x)
 
 PezConfig PezGetConfig()
 {
@@ -35,65 +30,6 @@ PezConfig PezGetConfig()
     return config;
 }
 
-static void CreateTorus(float major, float minor, int slices, int stacks)
-{
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    int vertexCount = slices * stacks * 3;
-    int vertexStride = sizeof(float) * 3;
-    GLsizeiptr size = vertexCount * vertexStride;
-    GLfloat* positions = (GLfloat*) malloc(size);
-
-    GLfloat* position = positions;
-    for (int slice = 0; slice < slices; slice++) {
-        float theta = slice * 2.0f * Pi / slices;
-        for (int stack = 0; stack < stacks; stack++) {
-            float phi = stack * 2.0f * Pi / stacks;
-            float beta = major + minor * cos(phi);
-            *position++ = cos(theta) * beta;
-            *position++ = sin(theta) * beta;
-            *position++ = sin(phi) * minor;
-        }
-    }
-
-    GLuint handle;
-    glGenBuffers(1, &handle);
-    glBindBuffer(GL_ARRAY_BUFFER, handle);
-    glBufferData(GL_ARRAY_BUFFER, size, positions, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(a("Position"));
-    glVertexAttribPointer(a("Position"), 3, GL_FLOAT, GL_FALSE,
-                          vertexStride, 0);
-
-    free(positions);
-
-    Scene.IndexCount = slices * stacks * 6;
-    size = Scene.IndexCount * sizeof(GLushort);
-    GLushort* indices = (GLushort*) malloc(size);
-    GLushort* index = indices;
-    int v = 0;
-    for (int i = 0; i < slices - 1; i++) {
-        for (int j = 0; j < stacks; j++) {
-            int next = (j + 1) % stacks;
-            *index++ = v+next+stacks; *index++ = v+next; *index++ = v+j;
-            *index++ = v+j; *index++ = v+j+stacks; *index++ = v+next+stacks;
-        }
-        v += stacks;
-    }
-    for (int j = 0; j < stacks; j++) {
-        int next = (j + 1) % stacks;
-        *index++ = next; *index++ = v+next; *index++ = v+j;
-        *index++ = v+j; *index++ = j; *index++ = next;
-    }
-
-    glGenBuffers(1, &handle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, GL_STATIC_DRAW);
-
-    free(indices);
-}
-
 void PezInitialize()
 {
     LoadProgram("VS", "GS", "FS");
@@ -107,13 +43,16 @@ void PezInitialize()
 
     const float MajorRadius = 8.0f, MinorRadius = 2.0f;
     const int Slices = 40, Stacks = 10;
-    CreateTorus(MajorRadius, MinorRadius, Slices, Stacks);
+    Scene.Torus = pezGenTorus(MajorRadius, MinorRadius, Slices, Stacks, 1);  // one level, for the one fixed view
     Scene.Theta = 0;
     Scene.ClipPlane = (Vector4){0, 1, 0, 7};
 
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CLIP_DISTANCE0);
     glClearColor(0.5f, 0.6f, 0.7f, 1.0f);
+
+    // Let PezUpdate run alongside PezRender, which reads a snapshot of the scene.
+    pezDoubleBuffer(&Scene, sizeof(Scene));
 }
 
 void PezUpdate(float seconds)
@@ -122,32 +61,23 @@ void PezUpdate(float seconds)
     Scene.Theta += seconds * RadiansPerSecond;
     
     // Create the model-view matrix:
-    Scene.ModelMatrix = M4MakeRotationZ(Scene.Theta);
+    Matrix4 model = M4MakeRotationZ(Scene.Theta);
     Point3 eye = {0, -75, 25};
     Point3 target = {0, 0, 0};
     Vector3 up = {0, 1, 0};
-    Scene.ViewMatrix = M4MakeLookAt(eye, target, up);
-    Scene.Modelview = M4Mul(Scene.ViewMatrix, Scene.ModelMatrix);
-    Scene.NormalMatrix = M4GetUpper3x3(Scene.Modelview);
-    for (int i = 0; i < 9; ++i)
-        Scene.PackedNormalMatrix[i] = M3GetElem(Scene.NormalMatrix, i/3, i%3);
+    Matrix4 view = M4MakeLookAt(eye, target, up);
+    pezPackTransforms(&Scene.Transforms, (float*) &Scene.Projection, (float*) &view, (float*) &model);
 }
 
 void PezRender()
 {
-    float* pModel = (float*) &Scene.ModelMatrix;
-    float* pView = (float*) &Scene.ViewMatrix;
-    float* pModelview = (float*) &Scene.Modelview;
-    float* pProjection = (float*) &Scene.Projection;
-    float* pNormalMatrix = &Scene.PackedNormalMatrix[0];
-    glUniformMatrix4fv(u("ViewMatrix"), 1, 0, pView);
-    glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pModel);
-    glUniformMatrix4fv(u("Modelview"), 1, 0, pModelview);
-    glUniformMatrix4fv(u("Projection"), 1, 0, pProjection);
-    glUniformMatrix3fv(u("NormalMatrix"), 1, 0, pNormalMatrix);
-    glUniform4fv(u("ClipPlane"), 1, &Scene.ClipPlane.x);
+    const struct SceneParameters* scene = (const struct SceneParameters*) pezGetRenderState(&Scene);
+    PezUniforms transforms = pezWriteUniforms(&scene->Transforms, sizeof(PezTransforms));
+    pezCommitUniforms();
+    pezBindUniforms(0, transforms);
+    glUniform4fv(u("ClipPlane"), 1, &scene->ClipPlane.x);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glDrawElements(GL_TRIANGLES, Scene.IndexCount, GL_UNSIGNED_SHORT, 0);
+    pezDrawLod(scene->Torus, 0);
 }
 
 void PezHandleMouse(int x, int y, int action)
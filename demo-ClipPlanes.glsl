@@ -1,13 +1,17 @@
 -- VS
 
-in vec4 Position;
+layout(location = 0) in vec4 Position;
 out vec3 vPosition;
 out float gl_ClipDistance[1];
 
-uniform mat4 Projection;
-uniform mat4 Modelview;
-uniform mat4 ViewMatrix;
-uniform mat4 ModelMatrix;
+layout(std140, binding = 0) uniform Transforms
+{
+    mat4 Projection;
+    mat4 ViewMatrix;
+    mat4 ModelMatrix;
+    mat4 Modelview;
+    mat3 NormalMatrix;
+};
 uniform vec4 ClipPlane;
 
 void main()
@@ -23,7 +27,14 @@ out vec2 gDistance;
 out vec3 gNormal;
 in vec3 vPosition[3];
 
-uniform mat3 NormalMatrix;
+layout(std140, binding = 0) uniform Transforms
+{
+    mat4 Projection;
+    mat4 ViewMatrix;
+    mat4 ModelMatrix;
+    mat4 Modelview;
+    mat3 NormalMatrix;
+};
 layout(triangles) in;
 layout(triangle_strip, max_vertices = 3) out;
 
@@ -2,6 +2,7 @@
 // Licensed under the Creative Commons Attribution 3.0 Unported License. 
 // http://creativecommons.org/licenses/by/3.0/
 
+#include <stdlib.h>
 #include "pez.h"
 #include "vmath.h"
 
@@ -11,6 +12,12 @@ static const float FieldOfView = 0.7f;
 static const int GridSize = 96;
 static const int ViewSamples = 96 * 2;
 static const int LightSamples = 96;
+static const int LightSlicesPerFrame = 96; // lower values amortize the light cache over several frames
+static bool LightOrbits = false;         // click to toggle; a moving light rebuilds the cache every frame
+static const int Downsample = 2;         // 1 = full resolution, 2 = half, 4 = quarter
+static const bool TemporalJitter = true; // jitter rays and accumulate them over several frames
+static const float HistoryWeight = 0.8f;
+static const float ReportInterval = 2.0f; // seconds between quality/speed reports
 
 PezConfig PezGetConfig()
 {
@@ -36,10 +43,40 @@ struct VolumesRec {
     Volume LightCache;
 } Volumes;
 
+struct LightCacheStateRec {
+    Point3 LightPosition;
+    bool DensityDirty;
+    int PendingSlices;
+    int NextSlice;
+    int Frames;     // since the last report
+    int Rebuilds;   // frames since the last report that regenerated slices
+} LightCacheState;
+
+// The raymarch writes color, and the distance to the first opaque sample along
+// each ray, which places each texel for reprojection and for upsampling.
+struct TargetsRec {
+    PezTarget* Trace;
+    PezTarget* History[2];
+    PezTarget* Reference;
+} Targets;
+
+static const GLfloat ClearValues[8] = {
+    0, 0, 0, 0,     // transparent
+    1000, 0, 0, 0,  // farthest
+};
+
+struct FrameRec {
+    unsigned int Index;
+    float ReportTimer;
+    bool Report;
+    GLuint Queries[2];
+} Frame;
+
 struct MatricesRec {
     Matrix4 Projection;
     Matrix4 Modelview;
     Matrix4 ModelviewProjection;
+    Matrix4 PreviousModelviewProjection;
 } Matrices;
 
 struct VbosRec {
@@ -50,10 +87,15 @@ struct VbosRec {
 struct ProgramsRec {
     GLuint Raycast;
     GLuint Light;
+    GLuint Accumulate;
+    GLuint Upsample;
 } Programs;
 
 static GLuint LoadProgram(char* vs, char* gs, char* fs);
 static Volume CreateVolume(GLsizei w, GLsizei h, GLsizei d, int numComponents);
+static void RenderVolume(GLsizei width, GLsizei height, bool jitter);
+static void GetPixelOffset(bool jitter, float* offset);
+static void DrawQuad();
 static GLuint CurrentProgram();
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
@@ -61,8 +103,12 @@ static GLuint CurrentProgram();
 
 void PezInitialize()
 {
+    PezAsset smoke = pezLoadPixelsAsync("Smoke96.pbo");
+
     Programs.Raycast = LoadProgram("VS", "GS", "FS");
     Programs.Light = LoadProgram("Fluid.Vertex", "Fluid.PickLayer", "Light.Cache");
+    Programs.Accumulate = LoadProgram("Quad.VS", 0, "Accumulate.FS");
+    Programs.Upsample = LoadProgram("Quad.VS", 0, "Upsample.FS");
 
     GLuint vao;
     glGenVertexArrays(1, &vao);
@@ -81,12 +127,32 @@ void PezInitialize()
     Volumes.Density = CreateVolume(GridSize, GridSize, GridSize, 1);
     Volumes.LightCache = CreateVolume(GridSize, GridSize, GridSize, 1);
 
-    PezPixels pixels = pezLoadPixels("Smoke96.pbo");
+    PezPixels pixels = pezGetAssetPixels(smoke);
+    pezFreeAsset(smoke);
     glBindTexture(GL_TEXTURE_3D, Volumes.Density.TextureHandle);
     glTexImage3D(GL_TEXTURE_3D, 0, pixels.InternalFormat,
         pixels.Width, pixels.Height, pixels.Depth,
         0, pixels.Format, pixels.Type, pixels.Frames);
     pezFreePixels(pixels);
+    LightCacheState.DensityDirty = true;
+
+    PezTargetDesc desc = {0};
+    desc.Divisor = Downsample;
+    desc.ColorFormats[0] = GL_RGBA16F;
+    desc.ColorFormats[1] = GL_R32F;
+    desc.Filter = GL_NEAREST;
+    Targets.Trace = pezAcquireTarget(desc);
+    desc.Filter = GL_LINEAR; // the history is resampled where it's reprojected
+    Targets.History[0] = pezAcquireTarget(desc);
+    Targets.History[1] = pezAcquireTarget(desc);
+    pezClearTarget(Targets.History[0], ClearValues);
+    pezClearTarget(Targets.History[1], ClearValues);
+    desc.Divisor = 1;
+    desc.ColorFormats[1] = GL_NONE;
+    desc.Filter = GL_NEAREST;
+    Targets.Reference = pezAcquireTarget(desc);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glGenQueries(2, Frame.Queries);
 
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
@@ -98,31 +164,151 @@ void PezInitialize()
 void PezRender()
 {
     PezConfig cfg = PezGetConfig();
-    Vector3 rayOrigin = V4GetXYZ(M4MulP3(M4Transpose(Matrices.Modelview), EyePosition));
-    GLfloat* mvp = &Matrices.ModelviewProjection.col0.x;
-    GLfloat* mv = &Matrices.Modelview.col0.x;
-    GLfloat* proj = &Matrices.Projection.col0.x;
+    Frame.Index++;
+
+    // Mark the light cache as stale if its inputs have changed:
+    if (LightCacheState.DensityDirty ||
+        LightCacheState.LightPosition.x != LightPosition.x ||
+        LightCacheState.LightPosition.y != LightPosition.y ||
+        LightCacheState.LightPosition.z != LightPosition.z) {
+        LightCacheState.LightPosition = LightPosition;
+        LightCacheState.DensityDirty = false;
+        LightCacheState.PendingSlices = GridSize;
+    }
+
+    // Regenerate a subset of the light cache slices:
+    LightCacheState.Frames++;
+    if (LightCacheState.PendingSlices > 0) {
+        LightCacheState.Rebuilds++;
+        int sliceCount = LightSlicesPerFrame;
+        if (sliceCount > LightCacheState.PendingSlices)
+            sliceCount = LightCacheState.PendingSlices;
+        glDisable(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, Volumes.LightCache.FboHandle);
+        glViewport(0, 0, Volumes.LightCache.Width, Volumes.LightCache.Height);
+        glBindBuffer(GL_ARRAY_BUFFER, Vbos.FullscreenQuad);
+        glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, 2 * sizeof(short), 0);
+        glBindTexture(GL_TEXTURE_3D, Volumes.Density.TextureHandle);
+        glUseProgram(Programs.Light);
+        glUniform3fv(u("LightPosition"), 1, &LightCacheState.LightPosition.x);
+        glUniform1f(u("LightStep"), sqrtf(2.0f) / LightSamples);
+        glUniform1i(u("LightSamples"), LightSamples);
+        glUniform1f(u("InverseSize"), 1.0f / GridSize);
+        while (sliceCount > 0) {
+            int first = LightCacheState.NextSlice;
+            int count = sliceCount;
+            if (first + count > GridSize)
+                count = GridSize - first;
+            glUniform1i(u("LayerOffset"), first);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+            LightCacheState.NextSlice = (first + count) % GridSize;
+            LightCacheState.PendingSlices -= count;
+            sliceCount -= count;
+        }
+    }
+
+    // Report how often the light cache was reused:
+    if (Frame.Report) {
+        int hits = LightCacheState.Frames - LightCacheState.Rebuilds;
+        pezPrintString("Light cache: %d of %d frames reused it (%.0f%%)\n",
+            hits, LightCacheState.Frames, 100.0f * hits / LightCacheState.Frames);
+        LightCacheState.Frames = LightCacheState.Rebuilds = 0;
+    }
 
-    // Generate the light cache:
+    // Render the full-resolution image that the reduced path is compared against:
+    if (Frame.Report && Downsample > 1) {
+        glBeginQuery(GL_TIME_ELAPSED, Frame.Queries[0]);
+        pezClearTarget(Targets.Reference, ClearValues);
+        glEnable(GL_BLEND);
+        RenderVolume(Targets.Reference->Width, Targets.Reference->Height, false);
+        glEndQuery(GL_TIME_ELAPSED);
+        glBeginQuery(GL_TIME_ELAPSED, Frame.Queries[1]);
+    }
+
+    if (Downsample == 1) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glClearColor(0, 0, 0, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glEnable(GL_BLEND);
+        RenderVolume(cfg.Width, cfg.Height, TemporalJitter);
+        Frame.Report = false;
+        return;
+    }
+
+    // Raymarch into the low-resolution target:
+    PezTarget* trace = Targets.Trace;
+    pezClearTarget(trace, ClearValues);
     glDisable(GL_BLEND);
-    glBindFramebuffer(GL_FRAMEBUFFER, Volumes.LightCache.FboHandle);
-    glViewport(0, 0, Volumes.LightCache.Width, Volumes.LightCache.Height);
-    glBindBuffer(GL_ARRAY_BUFFER, Vbos.FullscreenQuad);
-    glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, 2 * sizeof(short), 0);
-    glBindTexture(GL_TEXTURE_3D, Volumes.Density.TextureHandle);
-    glUseProgram(Programs.Light);
-    glUniform3fv(u("LightPosition"), 1, &LightPosition.x);
-    glUniform1f(u("LightStep"), sqrtf(2.0f) / LightSamples);
-    glUniform1i(u("LightSamples"), LightSamples);
-    glUniform1f(u("InverseSize"), 1.0f / GridSize);
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GridSize);
-
-    // Perform raycasting:
+    RenderVolume(trace->Width, trace->Height, TemporalJitter);
+
+    // Blend the jittered samples with the previous frames, reprojecting them
+    // from where the last frame saw the same point:
+    if (TemporalJitter) {
+        PezTarget* src = Targets.History[Frame.Index % 2];
+        PezTarget* dst = Targets.History[(Frame.Index + 1) % 2];
+        Matrix4 reprojection = M4Mul(Matrices.PreviousModelviewProjection, M4Inverse(Matrices.Modelview));
+        float offset[2];
+        GetPixelOffset(true, offset);
+        glBindFramebuffer(GL_FRAMEBUFFER, dst->Fbo);
+        glUseProgram(Programs.Accumulate);
+        glUniform1f(u("HistoryWeight"), Frame.Index > 1 ? HistoryWeight : 0.0f);
+        glUniformMatrix4fv(u("Reprojection"), 1, 0, &reprojection.col0.x);
+        glUniform1f(u("FocalLength"), 1.0f / tanf(FieldOfView / 2));
+        glUniform2fv(u("PixelOffset"), 1, offset);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, trace->ColorTextures[0]);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, trace->ColorTextures[1]);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, src->ColorTextures[0]);
+        DrawQuad();
+        trace = dst;
+    }
+
+    // Upsample to the window, preserving edges where the depth changes abruptly:
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glViewport(0, 0, cfg.Width, cfg.Height);
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT);
     glEnable(GL_BLEND);
+    glUseProgram(Programs.Upsample);
+    glUniform1f(u("Downsample"), (float) Downsample);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, trace->ColorTextures[0]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, trace->ColorTextures[1]);
+    DrawQuad();
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Print the cost and error of the reduced path next to the full-resolution path:
+    if (Frame.Report) {
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 fullTime, reducedTime;
+        glGetQueryObjectui64v(Frame.Queries[0], GL_QUERY_RESULT, &fullTime);
+        glGetQueryObjectui64v(Frame.Queries[1], GL_QUERY_RESULT, &reducedTime);
+        pezPrintString("Full res: %.2f ms | 1/%d res: %.2f ms, PSNR %.1f dB\n",
+            fullTime / 1000000.0, Downsample, reducedTime / 1000000.0,
+            pezComputePsnr(Targets.Reference));
+        Frame.Report = false;
+    }
+}
+
+static void RenderVolume(GLsizei width, GLsizei height, bool jitter)
+{
+    Vector3 rayOrigin = V4GetXYZ(M4MulP3(M4Transpose(Matrices.Modelview), EyePosition));
+    GLfloat* mvp = &Matrices.ModelviewProjection.col0.x;
+    GLfloat* mv = &Matrices.Modelview.col0.x;
+    GLfloat* proj = &Matrices.Projection.col0.x;
+
+    float offset[2];
+    GetPixelOffset(jitter, offset);
+
+    glViewport(0, 0, width, height);
     glBindBuffer(GL_ARRAY_BUFFER, Vbos.CubeCenter);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
     glActiveTexture(GL_TEXTURE0);
@@ -139,19 +325,36 @@ void PezRender()
     glUniform1i(u("LightCache"), 1);
     glUniform3fv(u("RayOrigin"), 1, &rayOrigin.x);
     glUniform1f(u("FocalLength"), 1.0f / tanf(FieldOfView / 2));
-    glUniform2f(u("WindowSize"), (float) cfg.Width, (float) cfg.Height);
+    glUniform2f(u("WindowSize"), (float) width, (float) height);
     glUniform1f(u("StepSize"), sqrtf(3.0f) / ViewSamples); // should be sqrt(2)
+    glUniform1i(u("Jitter"), jitter);
+    glUniform1ui(u("FrameIndex"), Frame.Index);
+    glUniform2fv(u("PixelOffset"), 1, offset);
     glDrawArrays(GL_POINTS, 0, 1);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_3D, 0);
     glActiveTexture(GL_TEXTURE0);
 }
 
+// Cycles through the centers of the full-resolution pixels that each texel
+// of the raymarch covers, so that accumulated frames cover all of them.
+static void GetPixelOffset(bool jitter, float* offset)
+{
+    int sample = jitter ? Frame.Index % (Downsample * Downsample) : 0;
+    offset[0] = jitter ? (sample % Downsample + 0.5f) / Downsample - 0.5f : 0;
+    offset[1] = jitter ? (sample / Downsample + 0.5f) / Downsample - 0.5f : 0;
+}
+
 void PezUpdate(float dt)
 {
     static float theta = 0;
+    static float lightTheta = 0;
     theta += dt / 2.0f;
+    if (LightOrbits)
+        lightTheta += dt;
     
+    Matrices.PreviousModelviewProjection = Matrices.ModelviewProjection;
+
     Vector3 up = {1, 0, 0}; Point3 target = {0, 0, 0};
     Matrix4 view = M4MakeLookAt(EyePosition, target, up);
     Matrix4 spin = M4MakeRotationX(sin(theta / 4) * Pi / 2);
@@ -159,7 +362,7 @@ void PezUpdate(float dt)
     Matrices.Modelview = M4Mul(view, model);
     
     Point3 p = {1, 1, 2};
-    LightPosition = T3MulP3(T3MakeRotationY(2 * theta), p);
+    LightPosition = T3MulP3(T3MakeRotationY(lightTheta), p);
 
     PezConfig cfg = PezGetConfig();
     float aspectRatio = (float) cfg.Width / cfg.Height;
@@ -168,10 +371,18 @@ void PezUpdate(float dt)
         0.0f, 1.0f);
 
     Matrices.ModelviewProjection = M4Mul(Matrices.Projection, Matrices.Modelview);
+
+    Frame.ReportTimer += dt;
+    if (Frame.ReportTimer > ReportInterval) {
+        Frame.ReportTimer = 0;
+        Frame.Report = true;
+    }
 }
 
 void PezHandleMouse(int x, int y, int action)
 {
+    if (action == PEZ_UP)
+        LightOrbits = !LightOrbits;
 }
 
 static GLuint LoadProgram(char* vsKey, char* gsKey, char* fsKey)
@@ -281,6 +492,13 @@ static Volume CreateVolume(GLsizei w, GLsizei h, GLsizei d, int numComponents)
     return volume;
 }
 
+static void DrawQuad()
+{
+    glBindBuffer(GL_ARRAY_BUFFER, Vbos.FullscreenQuad);
+    glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, 2 * sizeof(short), 0);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
 static GLuint CurrentProgram()
 {
     GLuint p;
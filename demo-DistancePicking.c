@@ -8,20 +8,13 @@
 #include "pez.h"
 #include "vmath.h"
 
-typedef struct {
-    int VertexCount;
-    int IndexCount;
-    GLuint Vao;
-} MeshPod;
-
 typedef struct {
     Matrix4 Projection;
     Matrix4 Ortho;
-    Matrix4 Modelview;
     Matrix4 View;
     Matrix4 Model;
-    Matrix3 Normal;
-    GLfloat PackedNormal[9];
+    PezTransforms Packed;
+    PezTransforms Sprite;
 } TransformsPod;
 
 struct {
@@ -35,25 +28,23 @@ struct {
     GLuint SpriteProgram;
     GLuint ErodeProgram;
     GLuint QuadVao;
-    GLuint OffscreenFbo;
+    GLuint QuadVbo;
+    PezTarget* Offscreen;
+    GLsizei Width;  // of the target that the quad and projections were built for
+    GLsizei Height;
     GLuint ColorTexture;
     GLenum ColorAttachment;
     GLenum DistanceAttachments[2]; // ping-pong
     GLuint DistanceTextures[2]; // ping-pong
-    MeshPod TrefoilKnot;
+    PezLods TrefoilKnot;
     TransformsPod Transforms;
 } Globals;
 
-typedef struct {
-    Vector3 Position;
-    Vector3 Normal;
-} Vertex;
-
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
-static MeshPod CreateTrefoil();
-static GLuint CreateRenderTarget();
-static GLuint CreateQuad(int sourceWidth, int sourceHeight, int destWidth, int destHeight);
+static PezTarget* CreateRenderTarget();
+static void CreateQuad(int sourceWidth, int sourceHeight, int destWidth, int destHeight);
+static void FitToTarget();
 static void SwapPingPong();
 static void DrawBuffers(const char* fsOut0, GLenum attachment0,
                         const char* fsOut1, GLenum attachment1);
@@ -76,7 +67,6 @@ PezConfig PezGetConfig()
 
 void PezInitialize()
 {
-    const PezConfig cfg = PezGetConfig();
     pezSwAddDirective("*", "#extension GL_ARB_explicit_attrib_location : enable");
 
     // Compile shaders
@@ -86,18 +76,10 @@ void PezInitialize()
     Globals.ErodeProgram = LoadProgram("Quad.VS", 0, "Erode.FS");
     Globals.LitProgram = LoadProgram("Lit.VS", 0, "Lit.FS");
 
-    // Set up viewport
-    float fovy = 16 * TwoPi / 180;
-    float aspect = (float) cfg.Width / cfg.Height;
-    float zNear = 0.1, zFar = 300;
-    Globals.Transforms.Projection = M4MakePerspective(fovy, aspect, zNear, zFar);
-    Globals.Transforms.Ortho = M4MakeOrthographic(0, cfg.Width, cfg.Height, 0, 0, 1);
-
-    // Create geometry
-    Globals.QuadVao = CreateQuad(cfg.Width, -cfg.Height, cfg.Width, cfg.Height);
-    glUseProgram(Globals.LitProgram);
-    Globals.TrefoilKnot = CreateTrefoil();
-    Globals.OffscreenFbo = CreateRenderTarget();
+    // Create geometry and the viewport-sized state
+    Globals.TrefoilKnot = pezGenTrefoil(128, 32, 1);    // one level, for the one fixed view
+    Globals.Offscreen = CreateRenderTarget();
+    FitToTarget();
 
     // Misc Initialization
     glGenQueries(1, &Globals.QueryObject);
@@ -118,26 +100,23 @@ void PezUpdate(float seconds)
     Point3 target = {0, 0, 0};
     Vector3 up = {0, 1, 0};
     Globals.Transforms.View = M4MakeLookAt(eye, target, up);
-    Globals.Transforms.Modelview = M4Mul(Globals.Transforms.View, Globals.Transforms.Model);
-    Globals.Transforms.Normal = M4GetUpper3x3(Globals.Transforms.Modelview);
-    for (int i = 0; i < 9; ++i)
-        Globals.Transforms.PackedNormal[i] = M3GetElem(Globals.Transforms.Normal, i/3, i%3);
+    pezPackTransforms(&Globals.Transforms.Packed, (float*) &Globals.Transforms.Projection,
+                      (float*) &Globals.Transforms.View, (float*) &Globals.Transforms.Model);
 }
 
 void PezRender()
 {
-    float* pModel = (float*) &Globals.Transforms.Model;
-    float* pView = (float*) &Globals.Transforms.View;
-    float* pModelview = (float*) &Globals.Transforms.Modelview;
-    float* pProjection = (float*) &Globals.Transforms.Projection;
-    float* pNormalMatrix = &Globals.Transforms.PackedNormal[0];
-    MeshPod* mesh = &Globals.TrefoilKnot;
+    FitToTarget();
+    PezUniforms transforms = pezWriteUniforms(&Globals.Transforms.Packed, sizeof(PezTransforms));
+    PezUniforms spriteTransforms = pezWriteUniforms(&Globals.Transforms.Sprite, sizeof(PezTransforms));
+    pezCommitUniforms();
     float initColor[4] = { 0.5f, 0.6f, 0.7f, 1.0f };
     float initDistance[4] = { 0, 0, FLT_MAX, 0 };
     int MaxPassCount = 50;
-    const float w = PezGetConfig().Width;
-    const float h = PezGetConfig().Height;
+    const float w = Globals.Offscreen->Width;
+    const float h = Globals.Offscreen->Height;
     bool isComputingDistance = true;
+    glViewport(0, 0, w, h);
 
     Point3 lightPosition = { 0.25, 0.25, 1.0 };
     bool spinLight = false;
@@ -146,32 +125,26 @@ void PezRender()
     }
 
     // Create the seed texture and perform lighting simultaneously:
-    glBindFramebuffer(GL_FRAMEBUFFER, Globals.OffscreenFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, Globals.Offscreen->Fbo);
     glUseProgram(Globals.LitProgram);
     DrawBuffers("FragColor", Globals.ColorAttachment,
                 "DistanceMap", Globals.DistanceAttachments[0]);
-    glBindVertexArray(mesh->Vao);
-
     glUniform3fv(u("LightPosition"), 1, &lightPosition.x);
-    glUniformMatrix4fv(u("ViewMatrix"), 1, 0, pView);
-    glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pModel);
-    glUniformMatrix4fv(u("Modelview"), 1, 0, pModelview);
-    glUniformMatrix4fv(u("Projection"), 1, 0, pProjection);
-    glUniformMatrix3fv(u("NormalMatrix"), 1, 0, pNormalMatrix);
+    pezBindUniforms(0, transforms);
     glClear(GL_DEPTH_BUFFER_BIT);
     glClearBufferfv(GL_COLOR, 0, initColor);
     if (isComputingDistance) {
         glClearBufferfv(GL_COLOR, 1, initDistance);
     }
     glEnable(GL_DEPTH_TEST);
-    glDrawElements(GL_TRIANGLES, mesh->IndexCount, GL_UNSIGNED_SHORT, 0);
+    pezDrawLod(Globals.TrefoilKnot, 0);
     glDisable(GL_DEPTH_TEST);
 
     // Compute a distance field, first with horizontal passes, then with vertical passes:
     glUseProgram(Globals.ErodeProgram);
     glUniform2f(u("InverseViewport"), 1.0f / w, 1.0f / h);
     glBindVertexArray(Globals.QuadVao);
-    glUniform2f(u("Offset"), 1.0f / PezGetConfig().Width, 0);
+    glUniform2f(u("Offset"), 1.0f / w, 0);
     for (int pass = 0, isVertical = 0; isComputingDistance; ++pass) {
         
         // Swap the source & destination surfaces and bind them:
@@ -189,7 +162,7 @@ void PezRender()
         if (!isVertical) {
             isVertical = !isVertical;
             pass = 0;
-            glUniform2f(u("Offset"), 0, 1.0f / PezGetConfig().Height);
+            glUniform2f(u("Offset"), 0, 1.0f / h);
         } else {
             break;
         }
@@ -204,10 +177,7 @@ void PezRender()
         glUseProgram(Globals.QuadProgram);
         glBindVertexArray(Globals.QuadVao);
         glBindTexture(GL_TEXTURE_2D, Globals.DistanceTextures[0]);
-        glUniform3f(u("Scale"),
-                    1.0f / PezGetConfig().Width,
-                    1.0f / PezGetConfig().Width,
-                    1.0f / 100.0f );
+        glUniform3f(u("Scale"), 1.0f / w, 1.0f / w, 1.0f / 100.0f);
     } else {
         glUseProgram(Globals.SoftProgram);
         glBindVertexArray(Globals.QuadVao);
@@ -240,16 +210,8 @@ void PezRender()
         glUniform2f(u("MouseLocation"), x, y);
     }
 
-    Matrix4 i = M4MakeIdentity();
-    float* pIdentity = (float*) &i;
-    float* pOrtho = (float*) &Globals.Transforms.Ortho;
-
     glBindTexture(GL_TEXTURE_2D, Globals.DistanceTextures[0]);
-    glUniformMatrix4fv(u("ViewMatrix"), 1, 0, pIdentity);
-    glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pIdentity);
-    glUniformMatrix4fv(u("Modelview"), 1, 0, pIdentity);
-    glUniformMatrix4fv(u("Projection"), 1, 0, pOrtho);
-    glUniformMatrix3fv(u("NormalMatrix"), 1, 0, pNormalMatrix);
+    pezBindUniforms(0, spriteTransforms);
     glUniform2f(u("SpriteSize"), 32, 32);
     glUniform2f(u("HalfViewport"), w / 2.0f, h / 2.0f);
     glUniform2f(u("InverseViewport"), 1.0f / w, 1.0f / h);
@@ -327,59 +289,56 @@ static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKe
     return programHandle;
 }
 
-static GLuint CreateRenderTarget()
+// The projections and the full-screen quad follow the offscreen target, which
+// the pool resizes along with the window.
+static void FitToTarget()
 {
-    GLuint* colorTexture = &Globals.ColorTexture;
-
-    pezCheck(GL_NO_ERROR == glGetError(), "OpenGL error on line %d",  __LINE__);
-    PezConfig cfg = PezGetConfig();
-
-    glGenTextures(1, colorTexture);
-    glBindTexture(GL_TEXTURE_2D, *colorTexture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cfg.Width, cfg.Height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create color texture.");
-
-    GLuint* distanceTexture = &Globals.DistanceTextures[0];
-    for (int i = 0; i < 2; i++) {
-        glGenTextures(1, distanceTexture);
-        glBindTexture(GL_TEXTURE_2D, *distanceTexture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, cfg.Width, cfg.Height, 0, GL_RGB, GL_HALF_FLOAT, 0);
-        pezCheck(GL_NO_ERROR == glGetError(), "Unable to create distance texture.");
-        ++distanceTexture;
+    GLsizei w = Globals.Offscreen->Width;
+    GLsizei h = Globals.Offscreen->Height;
+    if (w == Globals.Width && h == Globals.Height) {
+        return;
     }
-    distanceTexture = &Globals.DistanceTextures[0];
+    Globals.Width = w;
+    Globals.Height = h;
 
-    Globals.ColorAttachment         = GL_COLOR_ATTACHMENT0; 
+    float fovy = 16 * TwoPi / 180;
+    float aspect = (float) w / h;
+    float zNear = 0.1, zFar = 300;
+    Globals.Transforms.Projection = M4MakePerspective(fovy, aspect, zNear, zFar);
+    Globals.Transforms.Ortho = M4MakeOrthographic(0, w, h, 0, 0, 1);
+    Matrix4 identity = M4MakeIdentity();
+    pezPackTransforms(&Globals.Transforms.Sprite, (float*) &Globals.Transforms.Ortho,
+                      (float*) &identity, (float*) &identity);
+    pezPackTransforms(&Globals.Transforms.Packed, (float*) &Globals.Transforms.Projection,
+                      (float*) &Globals.Transforms.View, (float*) &Globals.Transforms.Model);
+    CreateQuad(w, -h, w, h);
+}
+
+// The offscreen target comes from the pez pool, which reallocates it in
+// place when the window is resized, so the texture names stay valid.
+static PezTarget* CreateRenderTarget()
+{
+    PezTargetDesc desc = {0};
+    desc.ColorFormats[0] = GL_RGB8;
+    desc.ColorFormats[1] = GL_RGB16F;
+    desc.ColorFormats[2] = GL_RGB16F;
+    desc.DepthFormat = GL_DEPTH_COMPONENT24;
+    desc.Filter = GL_NEAREST;
+    PezTarget* target = pezAcquireTarget(desc);
+
+    Globals.ColorTexture            = target->ColorTextures[0];
+    Globals.DistanceTextures[0]     = target->ColorTextures[1];
+    Globals.DistanceTextures[1]     = target->ColorTextures[2];
+    Globals.ColorAttachment         = GL_COLOR_ATTACHMENT0;
     Globals.DistanceAttachments[0]  = GL_COLOR_ATTACHMENT1;
     Globals.DistanceAttachments[1]  = GL_COLOR_ATTACHMENT2;
 
-    GLuint fboHandle;
-    glGenFramebuffers(1, &fboHandle);
-    glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, Globals.ColorAttachment,        GL_TEXTURE_2D, *colorTexture, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, Globals.DistanceAttachments[0], GL_TEXTURE_2D, distanceTexture[0], 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, Globals.DistanceAttachments[1], GL_TEXTURE_2D, distanceTexture[1], 0);
-
-    GLuint depthBuffer;
-    glGenRenderbuffers(1, &depthBuffer);
-    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, cfg.Width, cfg.Height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
-
-    pezCheck(GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER), "Invalid FBO.");
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    return fboHandle;
+    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create render target");
+    return target;
 }
 
-static GLuint CreateQuad(int sourceWidth, int sourceHeight, int destWidth, int destHeight)
+// Builds the quad on the first call, and refills its buffer on later ones.
+static void CreateQuad(int sourceWidth, int sourceHeight, int destWidth, int destHeight)
 {
     // Stretch to fit:
     float q[] = {
@@ -410,130 +369,22 @@ static GLuint CreateQuad(int sourceWidth, int sourceHeight, int destWidth, int d
         q[4] = q[12] = sourceRatio / destRatio;
     }
 
-    GLuint vbo, vao;
+    if (Globals.QuadVao) {
+        glBindBuffer(GL_ARRAY_BUFFER, Globals.QuadVbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(q), q, GL_STATIC_DRAW);
+        return;
+    }
+
     glUseProgram(Globals.QuadProgram);
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glGenVertexArrays(1, &Globals.QuadVao);
+    glBindVertexArray(Globals.QuadVao);
+    glGenBuffers(1, &Globals.QuadVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, Globals.QuadVbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(q), q, GL_STATIC_DRAW);
     glVertexAttribPointer(a("Position"), 2, GL_FLOAT, GL_FALSE, 16, 0);
     glVertexAttribPointer(a("TexCoord"), 2, GL_FLOAT, GL_FALSE, 16, offset(8));
     glEnableVertexAttribArray(a("Position"));
     glEnableVertexAttribArray(a("TexCoord"));
-    return vao;
-}
-
-static Vector3 EvaluateTrefoil(float s, float t)
-{
-    const float a = 0.5f; const float b = 0.3f;
-    const float c = 0.5f; const float d = 0.1f;
-    const float u = (1 - s) * 2 * TwoPi;
-    const float v = t * TwoPi;
-    const float r = a + b * cos(1.5f * u);
-    const float x = r * cos(u);
-    const float y = r * sin(u);
-    const float z = c * sin(1.5f * u);
-
-    Vector3 dv;
-    dv.x = -1.5f * b * sin(1.5f * u) * cos(u) - (a + b * cos(1.5f * u)) * sin(u);
-    dv.y = -1.5f * b * sin(1.5f * u) * sin(u) + (a + b * cos(1.5f * u)) * cos(u);
-    dv.z = 1.5f * c * cos(1.5f * u);
-
-    Vector3 q = V3Normalize(dv);
-    Vector3 qvn = V3Normalize((Vector3){q.y, -q.x, 0});
-    Vector3 ww = V3Cross(q, qvn);
-
-    Vector3 range;
-    range.x = x + d * (qvn.x * cos(v) + ww.x * sin(v));
-    range.y = y + d * (qvn.y * cos(v) + ww.y * sin(v));
-    range.z = z + d * ww.z * sin(v);
-    return range;
-}
-
-static MeshPod CreateTrefoil()
-{
-    const int Slices = 128;
-    const int Stacks = 32;
-    const int VertexCount = Slices * Stacks;
-    const int IndexCount = VertexCount * 6;
-
-    MeshPod mesh;
-    glGenVertexArrays(1, &mesh.Vao);
-    glBindVertexArray(mesh.Vao);
-
-    // Create a buffer with interleaved positions and normals
-    if (true) {
-        Vertex verts[VertexCount];
-        Vertex* pVert = &verts[0];
-        float ds = 1.0f / Slices;
-        float dt = 1.0f / Stacks;
-
-        // The upper bounds in these loops are tweaked to reduce the
-        // chance of precision error causing an incorrect # of iterations.
-        for (float s = 0; s < 1 - ds / 2; s += ds) {
-            for (float t = 0; t < 1 - dt / 2; t += dt) {
-                const float E = 0.01f;
-                Vector3 p = EvaluateTrefoil(s, t);
-                Vector3 u = V3Sub(EvaluateTrefoil(s + E, t), p);
-                Vector3 v = V3Sub(EvaluateTrefoil(s, t + E), p);
-                Vector3 n = V3Normalize(V3Cross(u, v));
-                pVert->Position = p;
-                pVert->Normal = n;
-                ++pVert;
-            }
-        }
-
-        pezCheck(pVert - &verts[0] == VertexCount, "Tessellation error.");
-
-        GLuint vbo;
-        GLsizeiptr size = sizeof(verts);
-        const GLvoid* data = &verts[0].Position.x;
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit indices
-    if (true) {
-        GLushort inds[IndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort i = 0; i < Slices; i++) {
-            for (GLushort j = 0; j < Stacks; j++) {
-                *pIndex++ = (n + j + Stacks) % VertexCount;
-                *pIndex++ = n + (j + 1) % Stacks;
-                *pIndex++ = n + j;
-                
-                *pIndex++ = (n + (j + 1) % Stacks + Stacks) % VertexCount;
-                *pIndex++ = (n + (j + 1) % Stacks) % VertexCount;
-                *pIndex++ = (n + j + Stacks) % VertexCount;
-            }
-            n += Stacks;
-        }
-
-        pezCheck(n == VertexCount, "Tessellation error.");
-        pezCheck(pIndex - &inds[0] == IndexCount, "Tessellation error.");
-
-        GLuint handle;
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &handle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    mesh.VertexCount = VertexCount;
-    mesh.IndexCount = IndexCount;
-
-    glVertexAttribPointer(a("Position"), 3, GL_FLOAT, GL_FALSE, 24, 0);
-    glVertexAttribPointer(a("Normal"), 3, GL_FLOAT, GL_FALSE, 24, offset(12));
-    glEnableVertexAttribArray(a("Position"));
-    glEnableVertexAttribArray(a("Normal"));
-
-    return mesh;
 }
 
 static void SwapPingPong()
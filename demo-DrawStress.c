@@ -0,0 +1,301 @@
+// Draw Stress OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License. 
+// http://creativecommons.org/licenses/by/3.0/
+//
+// Draws a block of 50,000 spinning shapes, one draw call each.  The shapes'
+// bounding spheres are culled against the view frustum, then the draws of the
+// visible ones are recorded into a pez command list by a parallel-for, each
+// with its own uniform block, and sorted and replayed on the main thread.
+// Culling, recording and submission times are printed every couple of seconds.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <time.h>
+#include "pez.h"
+#include "vmath.h"
+
+enum { ProgramCount = 2, MeshCount = 3 };
+enum { BlocksX = 50, BlocksY = 40, BlocksZ = 25 };
+enum { ObjectCount = BlocksX * BlocksY * BlocksZ };
+static const int RecordGrain = 512;
+static const float Spacing = 2.0f;
+static const float ReportInterval = 2.0f;
+
+typedef struct {
+    int IndexCount;
+    GLuint Vao;
+} MeshPod;
+
+// std140 layouts of the blocks in the shaders:
+typedef struct {
+    Matrix4 ViewProjection;
+    Vector4 LightDirection;
+} FrameBlock;
+
+typedef struct {
+    Matrix4 Model;
+    Vector4 Color;
+} ObjectBlock;
+
+struct {
+    float Time;
+    float Theta;
+    FrameBlock Frame;
+    Matrix4 Projection;
+    GLuint Programs[ProgramCount];
+    MeshPod Meshes[MeshCount];
+    PezCommandList Commands;
+    PezSpheres Bounds;
+    int* Visible;
+    int VisibleCount;
+    int Frames;
+    double CullSeconds;
+    double RecordSeconds;
+    double SubmitSeconds;
+    float SinceReport;
+} Globals;
+
+static GLuint LoadProgram(const char* vsKey, const char* fsKey);
+static MeshPod CreateMesh(const float* corners, const int* triangles, int triangleCount);
+static void RecordJob(void* data, int begin, int end);
+static double GetSeconds();
+
+PezConfig PezGetConfig()
+{
+    PezConfig config;
+    config.Title = __FILE__;
+    config.Width = 853;
+    config.Height = 480;
+    config.Multisampling = true;
+    config.VerticalSync = false;
+    return config;
+}
+
+void PezInitialize()
+{
+    const PezConfig cfg = PezGetConfig();
+
+    Globals.Programs[0] = LoadProgram("VS", "Lit.FS");
+    Globals.Programs[1] = LoadProgram("VS", "Toon.FS");
+
+    static const float CubeCorners[] = {
+        -1,-1,-1,  1,-1,-1,  -1, 1,-1,  1, 1,-1,
+        -1,-1, 1,  1,-1, 1,  -1, 1, 1,  1, 1, 1 };
+    static const int CubeTriangles[] = {
+        0,2,1, 1,2,3,  4,5,6, 5,7,6,  0,1,4, 1,5,4,
+        2,6,3, 3,6,7,  0,4,2, 2,4,6,  1,3,5, 3,7,5 };
+    static const float OctahedronCorners[] = {
+        1,0,0, -1,0,0, 0,1,0, 0,-1,0, 0,0,1, 0,0,-1 };
+    static const int OctahedronTriangles[] = {
+        0,2,4, 2,1,4, 1,3,4, 3,0,4,  2,0,5, 1,2,5, 3,1,5, 0,3,5 };
+    static const float TetrahedronCorners[] = {
+        1,1,1, 1,-1,-1, -1,1,-1, -1,-1,1 };
+    static const int TetrahedronTriangles[] = {
+        0,1,2, 0,3,1, 0,2,3, 1,3,2 };
+    Globals.Meshes[0] = CreateMesh(CubeCorners, CubeTriangles, countof(CubeTriangles) / 3);
+    Globals.Meshes[1] = CreateMesh(OctahedronCorners, OctahedronTriangles, countof(OctahedronTriangles) / 3);
+    Globals.Meshes[2] = CreateMesh(TetrahedronCorners, TetrahedronTriangles, countof(TetrahedronTriangles) / 3);
+
+    float fovy = 30 * TwoPi / 360;
+    float aspect = (float) cfg.Width / cfg.Height;
+    Globals.Projection = M4MakePerspective(fovy, aspect, 1, 500);
+    Globals.Frame.LightDirection = (Vector4){0.48f, 0.64f, 0.6f, 0};
+    Globals.Commands = pezCreateCommandList();
+
+    // The shapes spin in place, so their bounds never change.
+    Globals.Bounds = pezCreateSpheres(ObjectCount);
+    Globals.Visible = (int*) malloc(ObjectCount * sizeof(int));
+    pezCheck(Globals.Bounds.Count == ObjectCount && Globals.Visible, "Out of memory.");
+    for (int i = 0; i < ObjectCount; i++) {
+        int x = i % BlocksX, y = i / BlocksX % BlocksY, z = i / (BlocksX * BlocksY);
+        Globals.Bounds.X[i] = (x - BlocksX / 2) * Spacing;
+        Globals.Bounds.Y[i] = (y - BlocksY / 2) * Spacing;
+        Globals.Bounds.Z[i] = (z - BlocksZ / 2) * Spacing;
+        Globals.Bounds.Radius[i] = 0.6f * sqrtf(3);
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glClearColor(0.5f, 0.6f, 0.7f, 1.0f);
+}
+
+void PezUpdate(float seconds)
+{
+    const float RadiansPerSecond = 0.2f;
+    Globals.Time += seconds;
+    Globals.Theta += seconds * RadiansPerSecond;
+
+    Point3 eye = {180 * sin(Globals.Theta), 40, 180 * cos(Globals.Theta)};
+    Point3 target = {0, 0, 0};
+    Vector3 up = {0, 1, 0};
+    Matrix4 view = M4MakeLookAt(eye, target, up);
+    Globals.Frame.ViewProjection = M4Mul(Globals.Projection, view);
+
+    Globals.SinceReport += seconds;
+    if (Globals.SinceReport >= ReportInterval && Globals.Frames) {
+        pezPrintString("%d of %d drawn: cull %.2f ms, record %.2f ms, submit %.2f ms\n",
+                       Globals.VisibleCount, ObjectCount,
+                       1000 * Globals.CullSeconds / Globals.Frames,
+                       1000 * Globals.RecordSeconds / Globals.Frames,
+                       1000 * Globals.SubmitSeconds / Globals.Frames);
+        Globals.Frames = 0;
+        Globals.CullSeconds = Globals.RecordSeconds = Globals.SubmitSeconds = 0;
+        Globals.SinceReport = 0;
+    }
+}
+
+void PezRender()
+{
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    double start = GetSeconds();
+    PezFrustum frustum;
+    pezExtractFrustum(&frustum, (const float*) &Globals.Frame.ViewProjection);
+    Globals.VisibleCount = pezCullSpheres(&frustum, Globals.Bounds, Globals.Visible);
+    double culled = GetSeconds();
+    pezParallelFor(Globals.VisibleCount, RecordGrain, RecordJob, 0);
+    double recorded = GetSeconds();
+    pezSubmitCommands(Globals.Commands);
+    double submitted = GetSeconds();
+
+    Globals.CullSeconds += culled - start;
+    Globals.RecordSeconds += recorded - culled;
+    Globals.SubmitSeconds += submitted - recorded;
+    Globals.Frames++;
+}
+
+void PezHandleMouse(int x, int y, int action)
+{
+}
+
+// Cheap integer hash, so that neighbouring shapes differ in mesh and program.
+static unsigned int Hash(unsigned int x)
+{
+    x = (x ^ 61) ^ (x >> 16);
+    x *= 9;
+    x ^= x >> 4;
+    x *= 0x27d4eb2d;
+    x ^= x >> 15;
+    return x;
+}
+
+static void RecordJob(void* data, int begin, int end)
+{
+    PezCommandBuffer* commands = pezBeginCommands(Globals.Commands);
+    pezCmdSetUniforms(commands, 0, &Globals.Frame, sizeof(FrameBlock));
+
+    for (int v = begin; v < end; v++) {
+        int i = Globals.Visible[v];
+        unsigned int hash = Hash(i);
+        const MeshPod* mesh = &Globals.Meshes[hash % MeshCount];
+        GLuint program = Globals.Programs[(hash >> 8) % ProgramCount];
+
+        int x = i % BlocksX, y = i / BlocksX % BlocksY, z = i / (BlocksX * BlocksY);
+        float phase = (hash >> 16) * (TwoPi / 65536);
+        float angle = Globals.Time + phase;
+        Vector3 center = {(x - BlocksX / 2) * Spacing, (y - BlocksY / 2) * Spacing, (z - BlocksZ / 2) * Spacing};
+        Vector3 scale = {0.6f, 0.6f, 0.6f};
+        Vector3 spin = {angle, 0.7f * angle, phase};
+
+        ObjectBlock object;
+        object.Model = M4MakeRotationZYX(spin);
+        object.Model = M4PrependScale(scale, object.Model);
+        object.Model.col3 = (Vector4){center.x, center.y, center.z, 1};
+        object.Color = (Vector4){(float) x / BlocksX, (float) y / BlocksY, (float) z / BlocksZ, 1};
+
+        pezCmdBindProgram(commands, program);
+        pezCmdBindVertexArray(commands, mesh->Vao);
+        pezCmdSetUniforms(commands, 1, &object, sizeof(object));
+        pezCmdDrawElements(commands, GL_TRIANGLES, mesh->IndexCount, GL_UNSIGNED_SHORT, 0);
+    }
+}
+
+static double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Builds a flat-shaded mesh with three vertices per triangle, so that each
+// face gets its own normal.
+static MeshPod CreateMesh(const float* corners, const int* triangles, int triangleCount)
+{
+    typedef struct {
+        Vector3 Position;
+        Vector3 Normal;
+    } Vertex;
+
+    int vertexCount = triangleCount * 3;
+    Vertex* verts = (Vertex*) malloc(vertexCount * sizeof(Vertex));
+    GLushort* indices = (GLushort*) malloc(vertexCount * sizeof(GLushort));
+    for (int t = 0; t < triangleCount; t++) {
+        Vector3 p[3];
+        for (int k = 0; k < 3; k++) {
+            const float* c = corners + 3 * triangles[3 * t + k];
+            p[k] = (Vector3){c[0], c[1], c[2]};
+        }
+        Vector3 n = V3Normalize(V3Cross(V3Sub(p[1], p[0]), V3Sub(p[2], p[0])));
+        for (int k = 0; k < 3; k++) {
+            verts[3 * t + k].Position = p[k];
+            verts[3 * t + k].Normal = n;
+            indices[3 * t + k] = (GLushort) (3 * t + k);
+        }
+    }
+
+    MeshPod mesh;
+    mesh.IndexCount = vertexCount;
+    glGenVertexArrays(1, &mesh.Vao);
+    glBindVertexArray(mesh.Vao);
+
+    GLuint handles[2];
+    glGenBuffers(2, handles);
+    glBindBuffer(GL_ARRAY_BUFFER, handles[0]);
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), verts, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handles[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, vertexCount * sizeof(GLushort), indices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*) sizeof(Vector3));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+
+    free(verts);
+    free(indices);
+    return mesh;
+}
+
+static GLuint LoadProgram(const char* vsKey, const char* fsKey)
+{
+    GLchar spew[256];
+    GLint compileSuccess;
+    GLuint programHandle = glCreateProgram();
+
+    const char* vsSource = pezGetShader(vsKey);
+    pezCheck(vsSource != 0, "Can't find vshader: %s\n", vsKey);
+    GLuint vsHandle = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vsHandle, 1, &vsSource, 0);
+    glCompileShader(vsHandle);
+    glGetShaderiv(vsHandle, GL_COMPILE_STATUS, &compileSuccess);
+    glGetShaderInfoLog(vsHandle, sizeof(spew), 0, spew);
+    pezCheck(compileSuccess, "Can't compile vshader:\n%s", spew);
+    glAttachShader(programHandle, vsHandle);
+
+    const char* fsSource = pezGetShader(fsKey);
+    pezCheck(fsSource != 0, "Can't find fshader: %s\n", fsKey);
+    GLuint fsHandle = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fsHandle, 1, &fsSource, 0);
+    glCompileShader(fsHandle);
+    glGetShaderiv(fsHandle, GL_COMPILE_STATUS, &compileSuccess);
+    glGetShaderInfoLog(fsHandle, sizeof(spew), 0, spew);
+    pezCheck(compileSuccess, "Can't compile fshader:\n%s", spew);
+    glAttachShader(programHandle, fsHandle);
+
+    glLinkProgram(programHandle);
+    GLint linkSuccess;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &linkSuccess);
+    glGetProgramInfoLog(programHandle, sizeof(spew), 0, spew);
+    pezCheck(linkSuccess, "Can't link shaders:\n%s", spew);
+    return programHandle;
+}
@@ -0,0 +1,64 @@
+
+-- VS
+
+layout(location = 0) in vec3 Position;
+layout(location = 1) in vec3 Normal;
+
+layout(std140, binding = 0) uniform Frame
+{
+    mat4 ViewProjection;
+    vec4 LightDirection;
+};
+
+layout(std140, binding = 1) uniform Object
+{
+    mat4 Model;
+    vec4 Color;
+};
+
+out vec3 vNormal;
+out vec4 vColor;
+
+void main()
+{
+    vNormal = mat3(Model) * Normal;
+    vColor = Color;
+    gl_Position = ViewProjection * Model * vec4(Position, 1);
+}
+
+-- Lit.FS
+
+layout(std140, binding = 0) uniform Frame
+{
+    mat4 ViewProjection;
+    vec4 LightDirection;
+};
+
+in vec3 vNormal;
+in vec4 vColor;
+out vec4 FragColor;
+
+void main()
+{
+    float df = max(0.0, dot(normalize(vNormal), LightDirection.xyz));
+    FragColor = vec4(vColor.rgb * (0.2 + 0.8 * df), 1);
+}
+
+-- Toon.FS
+
+layout(std140, binding = 0) uniform Frame
+{
+    mat4 ViewProjection;
+    vec4 LightDirection;
+};
+
+in vec3 vNormal;
+in vec4 vColor;
+out vec4 FragColor;
+
+void main()
+{
+    float df = max(0.0, dot(normalize(vNormal), LightDirection.xyz));
+    df = df < 0.3 ? 0.3 : df < 0.7 ? 0.6 : 1.0;
+    FragColor = vec4(vColor.rgb * df, 1);
+}
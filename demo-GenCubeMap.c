@@ -4,20 +4,36 @@
 // http://creativecommons.org/licenses/by/3.0/
 
 #include <stdlib.h>
-#include <png.h>
 #include "pez.h"
 #include "vmath.h"
 
-typedef struct {
+typedef enum {
+    UpdateEveryFrame,       // all six faces, every frame
+    UpdateEveryNthFrame,    // all six faces, once every UpdateInterval frames
+    UpdateOneFacePerFrame,  // one face per frame, so a full refresh takes six frames
+} CubeMapUpdate;
+
+static const CubeMapUpdate UpdateMode = UpdateEveryFrame;
+static const int UpdateInterval = 4;
+static const int CubeMapSize = 512;
+static const int AllFaces = 0x3f;
+
+struct CubeMapRec {
     GLuint ColorTexture;
-    GLuint DepthBuffer;
-    GLuint Fbo;
-    int Width;
-    int Height;
-} RenderTarget;
+    GLuint DepthTexture;
+    GLuint LayeredFbo;
+    GLuint FaceFbos[6];
+    Matrix4 ViewProjection[6];
+    int Frame;
+    int NextFace;
+} CubeMap;
+
+typedef struct MeshRec {
+    GLuint Vao;
+    int IndexCount;
+} Mesh;
 
 struct GlobalsParameters {
-    int IndexCount;
     float Theta;
     float Time;
     Matrix4 Projection;
@@ -25,19 +41,25 @@ struct GlobalsParameters {
     Matrix4 ViewMatrix;
     Matrix4 ModelMatrix;
     Matrix3 NormalMatrix;
+    Matrix4 SphereMatrix;
+    Point3 EyePosition;
     GLuint LavaTexture;
     GLuint CloudTexture;
     GLuint LavaProgram;
+    GLuint CubeMapProgram;
     GLuint ReflectionProgram;
-    GLuint TorusVao;
-    GLuint SphereVao;
+    Mesh Torus;
+    Mesh Sphere;
 } Globals;
 
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
-static GLuint LoadTexture(const char* filename);
-static GLuint CreateTorus(float major, float minor, int slices, int stacks);
-static GLuint CreateSphere(float radius, int slices, int stacks);
+static GLuint LoadTexture(PezAsset asset);
+static Mesh CreateTorus(float major, float minor, int slices, int stacks);
+static Mesh CreateSphere(int slices, int stacks);
+static void CreateCubeMap();
+static void UpdateCubeMap();
+static void DrawTorus();
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define a(x) glGetAttribLocation(CurrentProgram(), x)
@@ -56,11 +78,11 @@ PezConfig PezGetConfig()
     return config;
 }
 
-static GLuint CreateTorus(float major, float minor, int slices, int stacks)
+static Mesh CreateTorus(float major, float minor, int slices, int stacks)
 {
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    Mesh mesh;
+    glGenVertexArrays(1, &mesh.Vao);
+    glBindVertexArray(mesh.Vao);
 
     int vertexCount = slices * stacks * 3;
     int vertexStride = sizeof(float) * 5;
@@ -94,8 +116,8 @@ static GLuint CreateTorus(float major, float minor, int slices, int stacks)
 
     free(verts);
 
-    Globals.IndexCount = (slices-1) * (stacks-1) * 6;
-    size = Globals.IndexCount * sizeof(GLushort);
+    mesh.IndexCount = (slices-1) * (stacks-1) * 6;
+    size = mesh.IndexCount * sizeof(GLushort);
     GLushort* indices = (GLushort*) malloc(size);
     GLushort* index = indices;
     int v = 0;
@@ -116,14 +138,15 @@ static GLuint CreateTorus(float major, float minor, int slices, int stacks)
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, GL_STATIC_DRAW);
 
     free(indices);
-    return vao;
+    return mesh;
 }
 
-static GLuint CreateSphere(float radius, int slices, int stacks)
+// Builds a unit sphere; SphereMatrix scales it.
+static Mesh CreateSphere(int slices, int stacks)
 {
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    Mesh mesh;
+    glGenVertexArrays(1, &mesh.Vao);
+    glBindVertexArray(mesh.Vao);
 
     int vertexCount = slices * stacks * 3;
     int vertexStride = sizeof(float) * 5;
@@ -156,8 +179,8 @@ static GLuint CreateSphere(float radius, int slices, int stacks)
 
     free(verts);
 
-    Globals.IndexCount = (slices-1) * (stacks-1) * 6;
-    size = Globals.IndexCount * sizeof(GLushort);
+    mesh.IndexCount = (slices-1) * (stacks-1) * 6;
+    size = mesh.IndexCount * sizeof(GLushort);
     GLushort* indices = (GLushort*) malloc(size);
     GLushort* index = indices;
     int v = 0;
@@ -178,11 +201,15 @@ static GLuint CreateSphere(float radius, int slices, int stacks)
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, GL_STATIC_DRAW);
 
     free(indices);
-    return vao;
+    return mesh;
 }
 
 void PezInitialize()
 {
+    // Decode the textures on the loader threads while the shaders compile:
+    PezAsset cloud = pezLoadTextureAsync("cloud.png", true);
+    PezAsset lava = pezLoadTextureAsync("lavatile.png", true);
+
     PezConfig cfg = PezGetConfig();
 
     float fovy = 170 * TwoPi / 180;
@@ -196,14 +223,17 @@ void PezInitialize()
     const int Slices = 60, Stacks = 30;
 
     Globals.LavaProgram = LoadProgram("TheGameMaker.VS", 0, "TheGameMaker.FS");
-    Globals.TorusVao = CreateTorus(MajorRadius, MinorRadius, Slices, Stacks);
+    Globals.Torus = CreateTorus(MajorRadius, MinorRadius, Slices, Stacks);
+    Globals.CubeMapProgram = LoadProgram("CubeMap.VS", "CubeMap.GS", "TheGameMaker.FS");
 
     Globals.ReflectionProgram = LoadProgram("Reflection.VS", 0, "Reflection.FS");
-    Globals.SphereVao = CreateSphere(Radius, Slices, Stacks);
+    Globals.Sphere = CreateSphere(Slices, Stacks);
+    Globals.SphereMatrix = M4MakeScale((Vector3){Radius, Radius, Radius});
+
+    CreateCubeMap();
 
-    // Load textures
-    Globals.CloudTexture = LoadTexture("cloud.png");
-    Globals.LavaTexture = LoadTexture("lavatile.png");
+    Globals.CloudTexture = LoadTexture(cloud);
+    Globals.LavaTexture = LoadTexture(lava);
 
     glClearColor(0.1, 0.1, 0.1, 0);
     glBlendFunc(GL_ONE, GL_ONE);
@@ -220,6 +250,7 @@ void PezUpdate(float seconds)
     Point3 eye = {0, 0, -80};
     Point3 target = {0, 0, 0};
     Vector3 up = {0, 1, 0};
+    Globals.EyePosition = eye;
     Globals.ViewMatrix = M4MakeLookAt(eye, target, up);
     Globals.Modelview = M4Mul(Globals.ViewMatrix, Globals.ModelMatrix);
     Globals.NormalMatrix = M4GetUpper3x3(Globals.Modelview);
@@ -227,29 +258,150 @@ void PezUpdate(float seconds)
 
 void PezRender()
 {
-    float* pModel = (float*) &Globals.ModelMatrix;
-    float* pView = (float*) &Globals.ViewMatrix;
     float* pModelview = (float*) &Globals.Modelview;
     float* pProjection = (float*) &Globals.Projection;
+    float* pView = (float*) &Globals.ViewMatrix;
+    float* pSphere = (float*) &Globals.SphereMatrix;
+
+    UpdateCubeMap();
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, PezGetConfig().Width, PezGetConfig().Height);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
     glEnable(GL_DEPTH_TEST);
+
     glUseProgram(Globals.LavaProgram);
-    glBindVertexArray(Globals.TorusVao);
-    glUniformMatrix4fv(u("ViewMatrix"), 1, 0, pView);
-    glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pModel);
     glUniformMatrix4fv(u("Modelview"), 1, 0, pModelview);
     glUniformMatrix4fv(u("Projection"), 1, 0, pProjection);
+    DrawTorus();
+
+    glUseProgram(Globals.ReflectionProgram);
+    glBindVertexArray(Globals.Sphere.Vao);
+    glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pSphere);
+    glUniformMatrix4fv(u("ViewMatrix"), 1, 0, pView);
+    glUniformMatrix4fv(u("Projection"), 1, 0, pProjection);
+    glUniform3fv(u("EyePosition"), 1, &Globals.EyePosition.x);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, CubeMap.ColorTexture);
+    glDrawElements(GL_TRIANGLES, Globals.Sphere.IndexCount, GL_UNSIGNED_SHORT, 0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    glDisable(GL_DEPTH_TEST);
+}
+
+// Draws the torus with whichever lava program is current.
+static void DrawTorus()
+{
+    glBindVertexArray(Globals.Torus.Vao);
     glUniform1f(u("time"), Globals.Time * 3);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, Globals.CloudTexture);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, Globals.LavaTexture);
-    glDrawElements(GL_TRIANGLES, Globals.IndexCount, GL_UNSIGNED_SHORT, 0);
+    glDrawElements(GL_TRIANGLES, Globals.Torus.IndexCount, GL_UNSIGNED_SHORT, 0);
     glActiveTexture(GL_TEXTURE0);
+}
+
+// Renders the environment around the sphere into the cube map.  All six
+// faces go out in a single draw: the geometry shader is instanced once per
+// face and routes each triangle to its layer with gl_Layer, skipping faces
+// that are masked off or whose frustum doesn't contain the triangle.
+static void UpdateCubeMap()
+{
+    int faceMask = 0;
+    GLuint fbo = CubeMap.LayeredFbo;
+
+    switch (UpdateMode) {
+    case UpdateEveryFrame:
+        faceMask = AllFaces;
+        break;
+    case UpdateEveryNthFrame:
+        faceMask = (CubeMap.Frame % UpdateInterval) ? 0 : AllFaces;
+        break;
+    case UpdateOneFacePerFrame:
+        faceMask = 1 << CubeMap.NextFace;
+        fbo = CubeMap.FaceFbos[CubeMap.NextFace];
+        CubeMap.NextFace = (CubeMap.NextFace + 1) % 6;
+        break;
+    }
+    CubeMap.Frame++;
+    if (!faceMask) {
+        return;
+    }
+
+    float* pModel = (float*) &Globals.ModelMatrix;
+    float* pViewProjection = (float*) &CubeMap.ViewProjection[0];
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, CubeMapSize, CubeMapSize);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+
+    glUseProgram(Globals.CubeMapProgram);
+    glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pModel);
+    glUniformMatrix4fv(u("ViewProjection"), 6, 0, pViewProjection);
+    glUniform1i(u("FaceMask"), faceMask);
+    DrawTorus();
+
     glDisable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static void CreateCubeMap()
+{
+    const Point3 center = {0, 0, 0};
+    const Vector3 targets[6] = {
+        {+1, 0, 0}, {-1, 0, 0}, {0, +1, 0}, {0, -1, 0}, {0, 0, +1}, {0, 0, -1} };
+    const Vector3 ups[6] = {
+        {0, -1, 0}, {0, -1, 0}, {0, 0, +1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0} };
+    Matrix4 projection = M4MakePerspective(Pi / 2, 1, 1, 100);
+    for (int face = 0; face < 6; face++) {
+        Point3 target = P3AddV3(center, targets[face]);
+        Matrix4 view = M4MakeLookAt(center, target, ups[face]);
+        CubeMap.ViewProjection[face] = M4Mul(projection, view);
+    }
+
+    glGenTextures(1, &CubeMap.ColorTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, CubeMap.ColorTexture);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGBA8, CubeMapSize, CubeMapSize);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    pezCheck(OpenGLError);
+
+    // Layered rendering needs every attachment to be layered, so depth is a
+    // cube map too rather than a renderbuffer.
+    glGenTextures(1, &CubeMap.DepthTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, CubeMap.DepthTexture);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_DEPTH_COMPONENT24, CubeMapSize, CubeMapSize);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    pezCheck(OpenGLError);
+
+    glGenFramebuffers(1, &CubeMap.LayeredFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, CubeMap.LayeredFbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, CubeMap.ColorTexture, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, CubeMap.DepthTexture, 0);
+    pezCheck(GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER), "Invalid layered FBO.");
+
+    // Single-face FBOs let the one-face-per-frame mode clear only the face
+    // it's about to redraw.
+    glGenFramebuffers(6, CubeMap.FaceFbos);
+    for (int face = 0; face < 6; face++) {
+        GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+        glBindFramebuffer(GL_FRAMEBUFFER, CubeMap.FaceFbos[face]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, CubeMap.ColorTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, CubeMap.DepthTexture, 0);
+        pezCheck(GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER), "Invalid face FBO.");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    CubeMap.Frame = 0;
+    CubeMap.NextFace = 0;
 }
 
 void PezHandleMouse(int x, int y, int action)
@@ -310,66 +462,16 @@ static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKe
     return programHandle;
 }
 
-static GLuint LoadTexture(const char* filename)
+static GLuint LoadTexture(PezAsset asset)
 {
-    unsigned long w, h;
-    int color_type, bit_depth, row_stride;
-    png_bytep image;
-
-    if (true) {
-        FILE *fp = fopen(filename, "rb");
-        pezCheck(fp ? 1 : 0, "Can't find %s", filename);
-        unsigned char header[8];
-        fread(header, 1, 8, fp);
-        bool isPng = !png_sig_cmp(header, 0, 8);
-        pezCheck(isPng, "%s is not a valid PNG file.", filename);
-        png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-        pezCheckPointer(png_ptr, "PNG error line %d", __LINE__);
-        png_infop info_ptr = png_create_info_struct(png_ptr);
-        pezCheckPointer(info_ptr, "PNG error line %d", __LINE__);
-        png_init_io(png_ptr, fp);
-        png_set_sig_bytes(png_ptr, 8);
-        png_read_info(png_ptr, info_ptr);
-        w = png_get_image_width(png_ptr, info_ptr);
-        h = png_get_image_height(png_ptr, info_ptr);
-        color_type = png_get_color_type(png_ptr, info_ptr);
-        bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-        pezPrintString("%s %dx%d bpp=%d ct=%d\n", filename, w, h, bit_depth, color_type);
-        png_read_update_info(png_ptr, info_ptr);
-        row_stride = png_get_rowbytes(png_ptr,info_ptr);
-        image = (png_bytep) malloc(h * row_stride);
-        png_bytep* row_pointers = (png_bytep*) malloc(sizeof(png_bytep) * h);
-        png_bytep row = image;
-        for (int y = h-1; y >= 0; y--, row += row_stride) {
-            row_pointers[y] = row;
-        }
-        png_read_image(png_ptr, row_pointers);
-        free(row_pointers);
-        fclose(fp);
-        png_destroy_read_struct(&png_ptr, &info_ptr, png_infopp_NULL);
-    }
-
-    pezCheck(bit_depth == 8, "Bit depth must be 8.");
-
-    GLenum type = 0;
-    switch (color_type) {
-    case PNG_COLOR_TYPE_RGB:  type = GL_RGB;  break;
-    case PNG_COLOR_TYPE_RGBA: type = GL_RGBA; break;
-    case PNG_COLOR_TYPE_GRAY: type = GL_RED;  break;
-    default: pezFatal("Unknown color type: %d.", color_type);
-    }
-
-    GLuint handle;
-    glGenTextures(1, &handle);
+    GLuint handle = pezGetAssetTexture(asset);
+    pezFreeAsset(asset);
     glBindTexture(GL_TEXTURE_2D, handle);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, type, w, h, 0, type, GL_UNSIGNED_BYTE, image);
     glGenerateMipmap(GL_TEXTURE_2D);
     pezCheck(OpenGLError);
-
-    free(image);
     return handle;
 }
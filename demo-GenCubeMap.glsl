@@ -1,8 +1,8 @@
 
 -- TheGameMaker.VS
 
-in vec4 Position;
-in vec2 TexCoord;
+layout(location = 0) in vec4 Position;
+layout(location = 1) in vec2 TexCoord;
 
 uniform mat4 Projection;
 uniform mat4 Modelview;
@@ -54,6 +54,61 @@ void main( void ) {
     FragColor = temp;
 }
 
+-- CubeMap.VS
+
+layout(location = 0) in vec4 Position;
+layout(location = 1) in vec2 TexCoord;
+
+uniform mat4 ModelMatrix;
+
+out vec2 vTex;
+
+void main()
+{
+    vTex = vec2( 5.0, 1.0 ) * TexCoord;
+    gl_Position = ModelMatrix * Position;
+}
+
+-- CubeMap.GS
+
+// One invocation per cube face.  Each invocation drops the triangle if its
+// face isn't being updated this frame or if all three corners lie outside
+// the same plane of the face's frustum.
+
+layout(triangles, invocations = 6) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec2 vTex[3];
+out vec2 vTexCoord;
+
+uniform mat4 ViewProjection[6];
+uniform int FaceMask;
+
+void main()
+{
+    int face = gl_InvocationID;
+    if ((FaceMask & (1 << face)) == 0)
+        return;
+
+    vec4 clip[3];
+    ivec3 below = ivec3(0), above = ivec3(0);
+    for (int i = 0; i < 3; i++) {
+        clip[i] = ViewProjection[face] * gl_in[i].gl_Position;
+        below += ivec3(lessThan(clip[i].xyz, -clip[i].www));
+        above += ivec3(greaterThan(clip[i].xyz, clip[i].www));
+    }
+    if (any(equal(below, ivec3(3))) || any(equal(above, ivec3(3))))
+        return;
+
+    for (int i = 0; i < 3; i++) {
+        gl_Layer = face;
+        gl_Position = clip[i];
+        vTexCoord = vTex[i];
+        EmitVertex();
+    }
+    EndPrimitive();
+}
+
 -- Quad.VS
 
 in vec2 Position;
@@ -118,25 +173,35 @@ void main()
 
 -- Reflection.VS
 
-in vec4 Position;
-in vec2 TexCoord;
+layout(location = 0) in vec4 Position;
 
 uniform mat4 Projection;
-uniform mat4 Modelview;
+uniform mat4 ViewMatrix;
+uniform mat4 ModelMatrix;
 
-out vec2 vTexCoord;
+out vec3 vPosition;
+out vec3 vNormal;
 
 void main()
 {
-    vTexCoord = vec2( 5.0, 1.0 ) * TexCoord;
-    gl_Position = Projection * Modelview * Position;
+    vec4 world = ModelMatrix * Position;
+    vPosition = world.xyz;
+    vNormal = Position.xyz;
+    gl_Position = Projection * ViewMatrix * world;
 }
 
 -- Reflection.FS
 
+in vec3 vPosition;
+in vec3 vNormal;
 out vec4 FragColor;
 
+layout(binding=2) uniform samplerCube Environment;
+uniform vec3 EyePosition;
+
 void main()
 {
-    FragColor = vec4(1);
+    vec3 incident = normalize(vPosition - EyePosition);
+    vec3 R = reflect(incident, normalize(vNormal));
+    FragColor = texture(Environment, R);
 }
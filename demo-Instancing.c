@@ -0,0 +1,328 @@
+// Instancing OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License. 
+// http://creativecommons.org/licenses/by/3.0/
+//
+// Toon-shaded trefoil knots in a cubic grid, drawn with a pez instance set:
+// the knots are culled against the view frustum on the job threads and the
+// visible ones go out in a single instanced draw.  The demo steps through
+// 1, 10, 100, 1k, 10k and 100k knots, a few seconds each, and prints the
+// average frame and culling times for each count.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "pez.h"
+#include "vmath.h"
+
+typedef struct {
+    int VertexCount;
+    int IndexCount;
+    GLuint Vao;
+} MeshPod;
+
+static const int InstanceCounts[] = { 1, 10, 100, 1000, 10000, 100000 };
+static const float StepSeconds = 3.0f;
+static const float Spacing = 2.2f;
+static const float KnotRadius = 0.9f;
+
+struct {
+    float Theta;
+    int Step;
+    float Extent;
+    GLuint LitProgram;
+    MeshPod TrefoilKnot;
+    PezInstances Instances;
+    Matrix4 Projection;
+    Matrix4 View;
+    PezTransforms Transforms;
+    float StepTime;
+    int Frames;
+    int VisibleSum;
+    double CullSeconds;
+} Globals;
+
+typedef struct {
+    Vector3 Position;
+    Vector3 Normal;
+} Vertex;
+
+static GLuint LoadProgram(const char* vsKey, const char* fsKey);
+static MeshPod CreateTrefoil();
+static void PlaceInstances(int count);
+static double GetSeconds();
+
+#define offset(x) ((const GLvoid*)x)
+
+PezConfig PezGetConfig()
+{
+    PezConfig config;
+    config.Title = __FILE__;
+    config.Width = 853;
+    config.Height = 480;
+    config.Multisampling = true;
+    config.VerticalSync = false;
+    return config;
+}
+
+void PezInitialize()
+{
+    const PezConfig cfg = PezGetConfig();
+
+    // Compile shaders
+    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.FS");
+
+    // Set up viewport
+    float fovy = 16 * TwoPi / 180;
+    float aspect = (float) cfg.Width / cfg.Height;
+    float zNear = 0.1, zFar = 300;
+    Globals.Projection = M4MakePerspective(fovy, aspect, zNear, zFar);
+
+    // Create geometry and the instances that copy it
+    int capacity = InstanceCounts[countof(InstanceCounts) - 1];
+    Globals.TrefoilKnot = CreateTrefoil();
+    Globals.Instances = pezCreateInstances(capacity, KnotRadius);
+    pezAttachInstances(Globals.Instances, Globals.TrefoilKnot.Vao, 2);
+    PlaceInstances(InstanceCounts[0]);
+
+    // Misc Initialization
+    Globals.Theta = 0;
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.5f, 0.6f, 0.7f, 1.0f);
+}
+
+void PezUpdate(float seconds)
+{
+    const float RadiansPerSecond = 0.3f;
+    Globals.Theta += seconds * RadiansPerSecond;
+
+    // Circle just inside the grid, so that much of it is behind the camera:
+    float distance = 0.5f * Globals.Extent + 3;
+    Point3 eye = {distance * sin(Globals.Theta), 0.2f * Globals.Extent, distance * cos(Globals.Theta)};
+    Point3 target = {0, 0, 0};
+    Vector3 up = {0, 1, 0};
+    Globals.View = M4MakeLookAt(eye, target, up);
+    Matrix4 identity = M4MakeIdentity();
+    pezPackTransforms(&Globals.Transforms, (float*) &Globals.Projection,
+                      (float*) &Globals.View, (float*) &identity);
+
+    // Report on this instance count and move on to the next once it's had its turn:
+    Globals.StepTime += seconds;
+    if (Globals.StepTime >= StepSeconds && Globals.Frames) {
+        pezPrintString("%6d instances: %7d visible, frame %7.2f ms, cull %6.2f ms\n",
+                       InstanceCounts[Globals.Step],
+                       Globals.VisibleSum / Globals.Frames,
+                       1000 * Globals.StepTime / Globals.Frames,
+                       1000 * Globals.CullSeconds / Globals.Frames);
+        Globals.Step = (Globals.Step + 1) % countof(InstanceCounts);
+        PlaceInstances(InstanceCounts[Globals.Step]);
+    }
+}
+
+void PezRender()
+{
+    PezUniforms transforms = pezWriteUniforms(&Globals.Transforms, sizeof(PezTransforms));
+    pezCommitUniforms();
+
+    Matrix4 viewProjection = M4Mul(Globals.Projection, Globals.View);
+    double start = GetSeconds();
+    int visible = pezCullInstances(Globals.Instances, (float*) &viewProjection);
+    Globals.CullSeconds += GetSeconds() - start;
+    Globals.VisibleSum += visible;
+    Globals.Frames++;
+
+    MeshPod* mesh = &Globals.TrefoilKnot;
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glUseProgram(Globals.LitProgram);
+    glBindVertexArray(mesh->Vao);
+    pezBindUniforms(0, transforms);
+    pezDrawInstances(Globals.Instances, GL_TRIANGLES, mesh->IndexCount, GL_UNSIGNED_SHORT, 0);
+}
+
+void PezHandleMouse(int x, int y, int action)
+{
+}
+
+// Fills a cube of the given number of slots, starting from one corner, with
+// knots at assorted angles.
+static void PlaceInstances(int count)
+{
+    int side = (int) ceil(cbrt((double) count));
+    GLfloat* transforms = pezGetInstanceTransforms(Globals.Instances);
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        int x = i % side, y = i / side % side, z = i / (side * side);
+        Vector3 angles = {TwoPi * rand() / RAND_MAX, TwoPi * rand() / RAND_MAX, 0};
+        Matrix4 model = M4MakeRotationZYX(angles);
+        model.col3 = (Vector4){(x - 0.5f * (side - 1)) * Spacing,
+                               (y - 0.5f * (side - 1)) * Spacing,
+                               (z - 0.5f * (side - 1)) * Spacing, 1};
+        memcpy(transforms + 16 * i, &model, sizeof(model));
+    }
+    pezSetInstanceCount(Globals.Instances, count);
+
+    Globals.Extent = side * Spacing;
+    Globals.StepTime = 0;
+    Globals.Frames = 0;
+    Globals.VisibleSum = 0;
+    Globals.CullSeconds = 0;
+}
+
+static double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static GLuint LoadProgram(const char* vsKey, const char* fsKey)
+{
+    GLchar spew[256];
+    GLint compileSuccess;
+    GLuint programHandle = glCreateProgram();
+
+    const char* vsSource = pezGetShader(vsKey);
+    pezCheck(vsSource != 0, "Can't find vshader: %s\n", vsKey);
+    GLuint vsHandle = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vsHandle, 1, &vsSource, 0);
+    glCompileShader(vsHandle);
+    glGetShaderiv(vsHandle, GL_COMPILE_STATUS, &compileSuccess);
+    glGetShaderInfoLog(vsHandle, sizeof(spew), 0, spew);
+    pezCheck(compileSuccess, "Can't compile vshader:\n%s", spew);
+    glAttachShader(programHandle, vsHandle);
+
+    const char* fsSource = pezGetShader(fsKey);
+    pezCheck(fsSource != 0, "Can't find fshader: %s\n", fsKey);
+    GLuint fsHandle = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fsHandle, 1, &fsSource, 0);
+    glCompileShader(fsHandle);
+    glGetShaderiv(fsHandle, GL_COMPILE_STATUS, &compileSuccess);
+    glGetShaderInfoLog(fsHandle, sizeof(spew), 0, spew);
+    pezCheck(compileSuccess, "Can't compile fshader:\n%s", spew);
+    glAttachShader(programHandle, fsHandle);
+
+    glLinkProgram(programHandle);
+    GLint linkSuccess;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &linkSuccess);
+    glGetProgramInfoLog(programHandle, sizeof(spew), 0, spew);
+    pezCheck(linkSuccess, "Can't link shaders:\n%s", spew);
+    return programHandle;
+}
+
+static Vector3 EvaluateTrefoil(float s, float t)
+{
+    const float a = 0.5f;
+    const float b = 0.3f;
+    const float c = 0.5f;
+    const float d = 0.1f;
+    const float u = (1 - s) * 2 * TwoPi;
+    const float v = t * TwoPi;
+    const float r = a + b * cos(1.5f * u);
+    const float x = r * cos(u);
+    const float y = r * sin(u);
+    const float z = c * sin(1.5f * u);
+
+    Vector3 dv;
+    dv.x = -1.5f * b * sin(1.5f * u) * cos(u) - (a + b * cos(1.5f * u)) * sin(u);
+    dv.y = -1.5f * b * sin(1.5f * u) * sin(u) + (a + b * cos(1.5f * u)) * cos(u);
+    dv.z = 1.5f * c * cos(1.5f * u);
+
+    Vector3 q = V3Normalize(dv);
+    Vector3 qvn = V3Normalize((Vector3){q.y, -q.x, 0});
+    Vector3 ww = V3Cross(q, qvn);
+        
+    Vector3 range;
+    range.x = x + d * (qvn.x * cos(v) + ww.x * sin(v));
+    range.y = y + d * (qvn.y * cos(v) + ww.y * sin(v));
+    range.z = z + d * ww.z * sin(v);
+    return range;
+}
+
+static MeshPod CreateTrefoil()
+{
+    // Much coarser than ToonShading's, since there can be 100k of these:
+    const int Slices = 64;
+    const int Stacks = 8;
+    const int VertexCount = Slices * Stacks;
+    const int IndexCount = VertexCount * 6;
+
+    MeshPod mesh;
+    glGenVertexArrays(1, &mesh.Vao);
+    glBindVertexArray(mesh.Vao);
+
+    // Create a buffer with interleaved positions and normals
+    if (1) {
+        Vertex verts[VertexCount];
+        Vertex* pVert = &verts[0];
+        float ds = 1.0f / Slices;
+        float dt = 1.0f / Stacks;
+
+        // The upper bounds in these loops are tweaked to reduce the
+        // chance of precision error causing an incorrect # of iterations.
+        for (float s = 0; s < 1 - ds / 2; s += ds) {
+            for (float t = 0; t < 1 - dt / 2; t += dt) {
+                const float E = 0.01f;
+                Vector3 p = EvaluateTrefoil(s, t);
+                Vector3 u = V3Sub(EvaluateTrefoil(s + E, t), p);
+                Vector3 v = V3Sub(EvaluateTrefoil(s, t + E), p);
+                Vector3 n = V3Normalize(V3Cross(u, v));
+                pVert->Position = p;
+                pVert->Normal = n;
+                ++pVert;
+            }
+        }
+
+        pezCheck(pVert - &verts[0] == VertexCount, "Tessellation error.");
+
+        GLuint vbo;
+        GLsizeiptr size = sizeof(verts);
+        const GLvoid* data = &verts[0].Position.x;
+        GLenum usage = GL_STATIC_DRAW;
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, size, data, usage);
+    }
+
+    // Create a buffer of 16-bit indices
+    if (1) {
+        GLushort inds[IndexCount];
+        GLushort* pIndex = &inds[0];
+        GLushort n = 0;
+        for (GLushort i = 0; i < Slices; i++) {
+            for (GLushort j = 0; j < Stacks; j++) {
+                *pIndex++ = (n + j + Stacks) % VertexCount;
+                *pIndex++ = n + (j + 1) % Stacks;
+                *pIndex++ = n + j;
+                
+                *pIndex++ = (n + (j + 1) % Stacks + Stacks) % VertexCount;
+                *pIndex++ = (n + (j + 1) % Stacks) % VertexCount;
+                *pIndex++ = (n + j + Stacks) % VertexCount;
+            }
+            n += Stacks;
+        }
+
+        pezCheck(n == VertexCount, "Tessellation error.");
+        pezCheck(pIndex - &inds[0] == IndexCount, "Tessellation error.");
+
+        GLuint handle;
+        GLsizeiptr size = sizeof(inds);
+        const GLvoid* data = &inds[0];
+        GLenum usage = GL_STATIC_DRAW;
+        glGenBuffers(1, &handle);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
+    }
+
+    mesh.VertexCount = VertexCount;
+    mesh.IndexCount = IndexCount;
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 24, 0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 24, offset(12));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    return mesh;
+}
@@ -0,0 +1,79 @@
+-- Lit.VS
+
+layout(location = 0) in vec4 Position;
+layout(location = 1) in vec3 Normal;
+layout(location = 2) in mat4 InstanceTransform;
+
+out vec3 vNormal;
+
+layout(std140, binding = 0) uniform Transforms
+{
+    mat4 Projection;
+    mat4 ViewMatrix;
+    mat4 ModelMatrix;
+    mat4 Modelview;
+    mat3 NormalMatrix;
+};
+
+void main()
+{
+    mat4 modelview = ViewMatrix * InstanceTransform;
+    gl_Position = Projection * modelview * Position;
+    vNormal = mat3(modelview) * Normal;
+}
+
+-- Lit.FS
+
+in vec3 vNormal;
+out vec4 FragColor;
+
+uniform vec3 LightPosition = vec3(0.25, 0.25, 1.0);
+uniform vec3 AmbientMaterial = vec3(0.04, 0.04, 0.04);
+uniform vec3 SpecularMaterial = vec3(0.5, 0.5, 0.5);
+uniform vec3 FrontMaterial = vec3(0.75, 0.75, 0.5);
+uniform vec3 BackMaterial = vec3(0.5, 0.5, 0.75);
+uniform float Shininess = 50;
+
+const float A = 0.1;
+const float B = 0.3;
+const float C = 0.6;
+const float D = 1.0;
+
+void main()
+{
+    vec3 N = normalize(vNormal);
+    if (!gl_FrontFacing)
+       N = -N;
+
+    vec3 L = normalize(LightPosition);
+    vec3 Eye = vec3(0, 0, 1);
+    vec3 H = normalize(L + Eye);
+    
+    float df = max(0.0, dot(N, L));
+    float E = fwidth(df);
+    if (df > A - E && df < A + E)
+        df = mix(A, B, smoothstep(A - E, A + E, df));
+    else if (df > B - E && df < B + E)
+        df = mix(B, C, smoothstep(B - E, B + E, df));
+    else if (df > C - E && df < C + E)
+        df = mix(C, D, smoothstep(C - E, C + E, df));
+    else if (df < A) df = 0.0;
+    else if (df < B) df = B;
+    else if (df < C) df = C;
+    else df = D;
+
+    float sf = max(0.0, dot(N, H));
+    sf = pow(sf, Shininess);
+    E = fwidth(sf);
+    if (sf > 0.5 - E && sf < 0.5 + E)
+        sf = clamp(0.5 * (sf - 0.5 + E) / E, 0.0, 1.0);
+    else
+        sf = step(0.5, sf);
+
+    vec3 color = gl_FrontFacing ? FrontMaterial : BackMaterial;
+    vec3 lighting = AmbientMaterial + df * color;
+    if (gl_FrontFacing)
+        lighting += sf * SpecularMaterial;
+
+    FragColor = vec4(lighting, 1);
+}
@@ -3,18 +3,9 @@
 // http://creativecommons.org/licenses/by/3.0/
 
 #include <stdlib.h>
-#include <png.h>
 #include "pez.h"
 #include "vmath.h"
 
-typedef struct {
-    GLuint ColorTexture;
-    GLuint DepthBuffer;
-    GLuint Fbo;
-    int Width;
-    int Height;
-} RenderTarget;
-
 struct GlobalsParameters {
     int IndexCount;
     float Theta;
@@ -26,21 +17,23 @@ struct GlobalsParameters {
     Matrix3 NormalMatrix;
     GLuint LavaTexture;
     GLuint CloudTexture;
-    GLuint HipassProgram;
+    GLuint DownsampleProgram;
+    GLuint UpsampleProgram;
     GLuint QuadProgram;
     GLuint LavaProgram;
-    GLuint BlurProgram;
     GLuint TorusVao;
     GLuint QuadVao;
-    RenderTarget Scene;
-    RenderTarget Small[2];
+    GLsizeiptr TargetMemory;
 } Globals;
 
+static const int BloomLevels = 6;  // each level halves the resolution of the previous
+static const float BloomThreshold = 1.0f;
+static const float BloomIntensity = 1.0f;
+
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
-static GLuint LoadTexture(const char* filename);
+static GLuint LoadTexture(PezAsset asset);
 static GLuint CreateTorus(float major, float minor, int slices, int stacks);
-static RenderTarget CreateRenderTarget(int width, int height, bool depth);
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define a(x) glGetAttribLocation(CurrentProgram(), x)
@@ -124,16 +117,16 @@ static GLuint CreateTorus(float major, float minor, int slices, int stacks)
 
 void PezInitialize()
 {
-    Globals.HipassProgram = LoadProgram("Quad.VS", 0, "Hipass.FS");
+    // Decode the textures on the loader threads while the shaders compile:
+    PezAsset cloud = pezLoadTextureAsync("cloud.png", true);
+    PezAsset lava = pezLoadTextureAsync("lavatile.png", true);
+
+    Globals.DownsampleProgram = LoadProgram("Quad.VS", 0, "Downsample.FS");
+    Globals.UpsampleProgram = LoadProgram("Quad.VS", 0, "Upsample.FS");
     Globals.QuadProgram = LoadProgram("Quad.VS", 0, "Quad.FS");
-    Globals.BlurProgram = LoadProgram("Quad.VS", 0, "Blur.FS");
     Globals.LavaProgram = LoadProgram("TheGameMaker.VS", 0, "TheGameMaker.FS");
 
     PezConfig cfg = PezGetConfig();
-    Globals.Scene = CreateRenderTarget(cfg.Width, cfg.Height, true);
-    int d = 6;
-    Globals.Small[0] = CreateRenderTarget(cfg.Width/d, cfg.Height/d, false);
-    Globals.Small[1] = CreateRenderTarget(cfg.Width/d, cfg.Height/d, false);
 
     float fovy = 170 * TwoPi / 180;
     float aspect = (float) cfg.Width / cfg.Height;
@@ -149,9 +142,8 @@ void PezInitialize()
 
     Globals.Theta = 0;
 
-    // Load textures
-    Globals.CloudTexture = LoadTexture("cloud.png");
-    Globals.LavaTexture = LoadTexture("lavatile.png");
+    Globals.CloudTexture = LoadTexture(cloud);
+    Globals.LavaTexture = LoadTexture(lava);
 
     glClearColor(0, 0, 0, 0);
     glBlendFunc(GL_ONE, GL_ONE);
@@ -175,36 +167,27 @@ void PezUpdate(float seconds)
 
 void PezRender()
 {
-    PezConfig cfg = PezGetConfig();
     float* pModel = (float*) &Globals.ModelMatrix;
     float* pView = (float*) &Globals.ViewMatrix;
     float* pModelview = (float*) &Globals.Modelview;
     float* pProjection = (float*) &Globals.Projection;
-    int w = Globals.Small[0].Width;
-    int h = Globals.Small[0].Height;
-    const float hoffsets[10] = {
-        -2.0f / w, 0,
-        -1.0f / w, 0,
-        0, 0,
-        +1.0f / w, 0,
-        +2.0f / w, 0,
-    };
-    const float voffsets[10] = {
-        0, -2.0f / h,
-        0, -1.0f / h,
-        0, 0,
-        0, +1.0f / h,
-        0, +2.0f / h,
-    };
-    const float weights[5] = {
-        1.0f / 16.0f,
-        4.0f / 16.0f,
-        6.0f / 16.0f,
-        4.0f / 16.0f,
-        1.0f / 16.0f,
-    };
-
-    glBindFramebuffer(GL_FRAMEBUFFER, Globals.Scene.Fbo);
+
+    // Fetch this frame's render targets from the pool:
+    PezTargetDesc desc = {0};
+    desc.ColorFormats[0] = GL_RGB8;
+    desc.DepthFormat = GL_DEPTH_COMPONENT24;
+    PezTarget* scene = pezAcquireTarget(desc);
+    PezTarget* bloom[16];
+    pezCheck(BloomLevels <= countof(bloom), "Too many bloom levels.");
+    desc.ColorFormats[0] = GL_R11F_G11F_B10F;
+    desc.DepthFormat = GL_NONE;
+    for (int level = 0; level < BloomLevels; level++) {
+        desc.Divisor = 2 << level;
+        bloom[level] = pezAcquireTarget(desc);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scene->Fbo);
+    glViewport(0, 0, scene->Width, scene->Height);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     glEnable(GL_DEPTH_TEST);
@@ -223,46 +206,64 @@ void PezRender()
     glActiveTexture(GL_TEXTURE0);
     glDisable(GL_DEPTH_TEST);
 
-    // Downsample
-    glBindFramebuffer(GL_FRAMEBUFFER, Globals.Small[0].Fbo);
-    glViewport(0, 0, w, h);
-    glUseProgram(Globals.HipassProgram);
-    glBindTexture(GL_TEXTURE_2D, Globals.Scene.ColorTexture);
+    // Build the bloom pyramid, applying the hipass on the first downsample:
     glBindVertexArray(Globals.QuadVao);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Horizontal Pass
-    glBindFramebuffer(GL_FRAMEBUFFER, Globals.Small[1].Fbo);
-    glUseProgram(Globals.BlurProgram);
-    glUniform2fv(u("Offsets"), 5, hoffsets);
-    glUniform1fv(u("Weights"), 5, weights);
-    glBindTexture(GL_TEXTURE_2D, Globals.Small[0].ColorTexture);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(Globals.DownsampleProgram);
+    PezTarget* source = scene;
+    for (int level = 0; level < BloomLevels; level++) {
+        PezTarget* dest = bloom[level];
+        glBindFramebuffer(GL_FRAMEBUFFER, dest->Fbo);
+        glViewport(0, 0, dest->Width, dest->Height);
+        glUniform2f(u("TexelSize"), 1.0f / source->Width, 1.0f / source->Height);
+        glUniform1f(u("Threshold"), level == 0 ? BloomThreshold : 0.0f);
+        glBindTexture(GL_TEXTURE_2D, source->ColorTextures[0]);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        source = dest;
+    }
 
-    // Vertical Pass
-    glBindFramebuffer(GL_FRAMEBUFFER, Globals.Small[0].Fbo);
-    glUniform2fv(u("Offsets"), 5, voffsets);
-    glBindTexture(GL_TEXTURE_2D, Globals.Small[1].ColorTexture);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    // Walk back up the pyramid, accumulating each level into the next larger one:
+    glEnable(GL_BLEND);
+    glUseProgram(Globals.UpsampleProgram);
+    for (int level = BloomLevels - 1; level > 0; level--) {
+        PezTarget* src = bloom[level];
+        PezTarget* dest = bloom[level - 1];
+        glBindFramebuffer(GL_FRAMEBUFFER, dest->Fbo);
+        glViewport(0, 0, dest->Width, dest->Height);
+        glUniform2f(u("TexelSize"), 1.0f / src->Width, 1.0f / src->Height);
+        glBindTexture(GL_TEXTURE_2D, src->ColorTextures[0]);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        pezReleaseTarget(src);
+    }
+    glDisable(GL_BLEND);
     glBindTexture(GL_TEXTURE_2D, 0);
 
     // Blit full-res unprocessed scene to screen:
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, cfg.Width, cfg.Height);
+    glViewport(0, 0, scene->Width, scene->Height);
     glUseProgram(Globals.QuadProgram);
     glUniform1f(u("Alpha"), 1.0);
-    glBindTexture(GL_TEXTURE_2D, Globals.Scene.ColorTexture);
+    glBindTexture(GL_TEXTURE_2D, scene->ColorTextures[0]);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     glBindTexture(GL_TEXTURE_2D, 0);
 
-    // Additive blending with the blurred image:
+    // Additive blending with the top of the bloom pyramid:
     glEnable(GL_BLEND);
-    glBindTexture(GL_TEXTURE_2D, Globals.Small[0].ColorTexture);
+    glUseProgram(Globals.UpsampleProgram);
+    glUniform2f(u("TexelSize"), 1.0f / bloom[0]->Width, 1.0f / bloom[0]->Height);
+    glUniform1f(u("Intensity"), BloomIntensity);
+    glBindTexture(GL_TEXTURE_2D, bloom[0]->ColorTextures[0]);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glUniform1f(u("Intensity"), 1.0f);
     glBindTexture(GL_TEXTURE_2D, 0);
     glDisable(GL_BLEND);
+
+    pezReleaseTarget(bloom[0]);
+    pezReleaseTarget(scene);
+
+    if (Globals.TargetMemory != pezGetTargetMemory()) {
+        Globals.TargetMemory = pezGetTargetMemory();
+        pezPrintString("Render targets: %.1f MB\n", Globals.TargetMemory / (1024.0 * 1024.0));
+    }
 }
 
 void PezHandleMouse(int x, int y, int action)
@@ -323,101 +324,16 @@ static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKe
     return programHandle;
 }
 
-static GLuint LoadTexture(const char* filename)
+static GLuint LoadTexture(PezAsset asset)
 {
-    unsigned long w, h;
-    int color_type, bit_depth, row_stride;
-    png_bytep image;
-
-    if (true) {
-        FILE *fp = fopen(filename, "rb");
-        pezCheck(fp ? 1 : 0, "Can't find %s", filename);
-        unsigned char header[8];
-        fread(header, 1, 8, fp);
-        bool isPng = !png_sig_cmp(header, 0, 8);
-        pezCheck(isPng, "%s is not a valid PNG file.", filename);
-        png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-        pezCheckPointer(png_ptr, "PNG error line %d", __LINE__);
-        png_infop info_ptr = png_create_info_struct(png_ptr);
-        pezCheckPointer(info_ptr, "PNG error line %d", __LINE__);
-        png_init_io(png_ptr, fp);
-        png_set_sig_bytes(png_ptr, 8);
-        png_read_info(png_ptr, info_ptr);
-        w = png_get_image_width(png_ptr, info_ptr);
-        h = png_get_image_height(png_ptr, info_ptr);
-        color_type = png_get_color_type(png_ptr, info_ptr);
-        bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-        pezPrintString("%s %dx%d bpp=%d ct=%d\n", filename, w, h, bit_depth, color_type);
-        png_read_update_info(png_ptr, info_ptr);
-        row_stride = png_get_rowbytes(png_ptr,info_ptr);
-        image = (png_bytep) malloc(h * row_stride);
-        png_bytep* row_pointers = (png_bytep*) malloc(sizeof(png_bytep) * h);
-        png_bytep row = image;
-        for (int y = h-1; y >= 0; y--, row += row_stride) {
-            row_pointers[y] = row;
-        }
-        png_read_image(png_ptr, row_pointers);
-        free(row_pointers);
-        fclose(fp);
-        png_destroy_read_struct(&png_ptr, &info_ptr, png_infopp_NULL);
-    }
-
-    pezCheck(bit_depth == 8, "Bit depth must be 8.");
-
-    GLenum type = 0;
-    switch (color_type) {
-    case PNG_COLOR_TYPE_RGB:  type = GL_RGB;  break;
-    case PNG_COLOR_TYPE_RGBA: type = GL_RGBA; break;
-    case PNG_COLOR_TYPE_GRAY: type = GL_RED;  break;
-    default: pezFatal("Unknown color type: %d.", color_type);
-    }
-
-    GLuint handle;
-    glGenTextures(1, &handle);
+    GLuint handle = pezGetAssetTexture(asset);
+    pezFreeAsset(asset);
     glBindTexture(GL_TEXTURE_2D, handle);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, type, w, h, 0, type, GL_UNSIGNED_BYTE, image);
     glGenerateMipmap(GL_TEXTURE_2D);
     pezCheck(OpenGLError);
-
-    free(image);
     return handle;
 }
-
-static RenderTarget CreateRenderTarget(int width, int height, bool depth)
-{
-    pezCheck(GL_NO_ERROR == glGetError(), "OpenGL error on line %d",  __LINE__);
-
-    RenderTarget rt;
-    rt.Width = width;
-    rt.Height = height;
-
-    glGenTextures(1, &rt.ColorTexture);
-    glBindTexture(GL_TEXTURE_2D, rt.ColorTexture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create color texture.");
-
-    glGenFramebuffers(1, &rt.Fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, rt.Fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rt.ColorTexture, 0);
-
-    if (depth) {
-        glGenRenderbuffers(1, &rt.DepthBuffer);
-        glBindRenderbuffer(GL_RENDERBUFFER, rt.DepthBuffer);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rt.DepthBuffer);
-    } else {
-        rt.DepthBuffer = 0;
-    }
-
-    pezCheck(GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER), "Invalid FBO.");
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    return rt;
-}
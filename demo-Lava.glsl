@@ -72,51 +72,76 @@ void main()
     gl_Position = vec4(2*vTexCoord-1,0,1);
 }
 
--- Blur.FS
+-- Quad.FS
 
 in vec2 vTexCoord;
 layout(location = 0) out vec4 FragColor;
 uniform sampler2D Sampler;
-uniform vec2 Offsets[5];
-uniform float Weights[5];
+uniform float Alpha = 1.0;
 
 void main()
 {
-    FragColor = vec4(0);
-    for (int i = 0; i < 5; i++) {
-        float w = Weights[i];
-        vec2 o = Offsets[i];
-        FragColor += w * texture(Sampler, vTexCoord + o);
+    FragColor = texture(Sampler, vTexCoord);
+    if (gl_FragCoord.x < 1 || gl_FragCoord.x > 1279 || gl_FragCoord.y < 1 || gl_FragCoord.y > 799) {
+        FragColor.rgb = vec3(0.5);
     }
+    FragColor.a *= Alpha;
 }
 
--- Quad.FS
+-- Downsample.FS
+
+// 13-tap downsample from "Next Generation Post Processing in Call of Duty:
+// Advanced Warfare" (Jimenez, 2014).  Five overlapping 2x2 boxes are
+// weighted so that the filter is wide enough to avoid flickering.
 
 in vec2 vTexCoord;
 layout(location = 0) out vec4 FragColor;
 uniform sampler2D Sampler;
-uniform float Alpha = 1.0;
+uniform vec2 TexelSize;
+uniform float Threshold = 0.0;
+const vec3 Black = vec3(0, 0, 0);
+
+vec3 Fetch(float x, float y)
+{
+    return texture(Sampler, vTexCoord + TexelSize * vec2(x, y)).rgb;
+}
 
 void main()
 {
-    FragColor = texture(Sampler, vTexCoord);
-    if (gl_FragCoord.x < 1 || gl_FragCoord.x > 1279 || gl_FragCoord.y < 1 || gl_FragCoord.y > 799) {
-        FragColor.rgb = vec3(0.5);
-    }
-    FragColor.a *= Alpha;
+    vec3 a = Fetch(-2, +2), b = Fetch(0, +2), c = Fetch(+2, +2);
+    vec3 d = Fetch(-2,  0), e = Fetch(0,  0), f = Fetch(+2,  0);
+    vec3 g = Fetch(-2, -2), h = Fetch(0, -2), i = Fetch(+2, -2);
+    vec3 j = Fetch(-1, +1), k = Fetch(+1, +1);
+    vec3 l = Fetch(-1, -1), m = Fetch(+1, -1);
+
+    vec3 color = (j + k + l + m) * 0.125;
+    color += (a + c + g + i) * 0.03125;
+    color += (b + d + f + h) * 0.0625;
+    color += e * 0.125;
+
+    float gray = dot(color, color);
+    FragColor = vec4(gray >= Threshold ? color : Black, 1);
 }
 
--- Hipass.FS
+-- Upsample.FS
+
+// 3x3 tent filter; the pyramid is accumulated with additive blending.
 
 in vec2 vTexCoord;
 layout(location = 0) out vec4 FragColor;
 uniform sampler2D Sampler;
-uniform float Threshold = 1.0;
-const vec3 Black = vec3(0, 0, 0);
+uniform vec2 TexelSize;
+uniform float Intensity = 1.0;
+
+vec3 Fetch(float x, float y)
+{
+    return texture(Sampler, vTexCoord + TexelSize * vec2(x, y)).rgb;
+}
 
 void main()
 {
-    vec3 c = texture(Sampler, vTexCoord).rgb;
-    float gray = dot(c,c);
-    FragColor = vec4(gray > Threshold ? c : Black, 1);
+    vec3 color = Fetch(0, 0) * 4.0;
+    color += (Fetch(-1, 0) + Fetch(+1, 0) + Fetch(0, -1) + Fetch(0, +1)) * 2.0;
+    color += Fetch(-1, -1) + Fetch(+1, -1) + Fetch(-1, +1) + Fetch(+1, +1);
+    FragColor = vec4(Intensity * color / 16.0, 1);
 }
@@ -0,0 +1,193 @@
+// Level of Detail OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License. 
+// http://creativecommons.org/licenses/by/3.0/
+//
+// Long rows of trefoil knots and tori, each drawn from a pez chain of levels
+// of detail.  Every frame, each object gets the finest level with at most one
+// triangle per eight pixels its bounding sphere covers, or a coarser one if
+// that one's error still stays under a pixel on screen.  Objects about to
+// switch levels cross-fade between the two with complementary screen-door
+// patterns.  The camera dollies along the rows; the triangles drawn per frame
+// are printed every couple of seconds, next to what full detail would cost.
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include "pez.h"
+#include "vmath.h"
+
+enum { Columns = 6, Rows = 96, ObjectCount = Columns * Rows };
+static const float Spacing = 2.5f;
+static const float PixelsPerTriangle = 8.0f;
+static const float MaxPixelError = 1.0f;
+static const float FadeBand = 0.2f;     // the last part of each level's range, where it fades out
+static const float ReportInterval = 2.0f;
+
+struct {
+    float Time;
+    GLuint LitProgram;
+    GLint FadeLocation;
+    PezLods Meshes[2];
+    Matrix4 Projection;
+    Matrix4 View;
+    Point3 Eye;
+    float PixelScale;
+    Matrix4 Models[ObjectCount];
+    PezTransforms Transforms[ObjectCount];
+    float SinceReport;
+    int Frames;
+    double TriangleSum;
+    double FullSum;
+} Globals;
+
+static GLuint LoadProgram(const char* vsKey, const char* fsKey);
+static void DrawObject(int object, PezUniforms transforms);
+
+PezConfig PezGetConfig()
+{
+    PezConfig config;
+    config.Title = __FILE__;
+    config.Width = 853;
+    config.Height = 480;
+    config.Multisampling = true;
+    config.VerticalSync = false;
+    return config;
+}
+
+void PezInitialize()
+{
+    const PezConfig cfg = PezGetConfig();
+
+    // Compile shaders
+    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.FS");
+    Globals.FadeLocation = glGetUniformLocation(Globals.LitProgram, "Fade");
+
+    // Set up viewport
+    float fovy = 30 * TwoPi / 360;
+    float aspect = (float) cfg.Width / cfg.Height;
+    float zNear = 0.1, zFar = 300;
+    Globals.Projection = M4MakePerspective(fovy, aspect, zNear, zFar);
+    Globals.PixelScale = cfg.Height / (2 * tan(fovy / 2));
+
+    // Create geometry, the finest levels much denser than the other demos':
+    Globals.Meshes[0] = pezGenTrefoil(512, 64, PEZ_MAX_LODS);
+    Globals.Meshes[1] = pezGenTorus(0.6f, 0.2f, 256, 64, PEZ_MAX_LODS);
+    for (int i = 0; i < ObjectCount; i++) {
+        int column = i % Columns, row = i / Columns;
+        Vector3 angles = {TwoPi * rand() / RAND_MAX, TwoPi * rand() / RAND_MAX, 0};
+        Globals.Models[i] = M4MakeRotationZYX(angles);
+        Globals.Models[i].col3 = (Vector4){(column - 0.5f * (Columns - 1)) * Spacing, 0, -row * Spacing, 1};
+    }
+
+    // Misc Initialization
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glClearColor(0.5f, 0.6f, 0.7f, 1.0f);
+}
+
+void PezUpdate(float seconds)
+{
+    Globals.Time += seconds;
+
+    // Dolly from the front of the rows to the middle and back:
+    float z = 8 - 0.25f * Rows * Spacing * (1 - cos(0.2f * Globals.Time));
+    Globals.Eye = (Point3){0, 2, z};
+    Point3 target = {0, 0, z - 10};
+    Vector3 up = {0, 1, 0};
+    Globals.View = M4MakeLookAt(Globals.Eye, target, up);
+    for (int i = 0; i < ObjectCount; i++) {
+        pezPackTransforms(&Globals.Transforms[i], (float*) &Globals.Projection,
+                          (float*) &Globals.View, (float*) &Globals.Models[i]);
+    }
+
+    Globals.SinceReport += seconds;
+    if (Globals.SinceReport >= ReportInterval && Globals.Frames) {
+        pezPrintString("%8.0f triangles per frame, %8.0f at full detail\n",
+                       Globals.TriangleSum / Globals.Frames, Globals.FullSum / Globals.Frames);
+        Globals.SinceReport = 0;
+        Globals.Frames = 0;
+        Globals.TriangleSum = Globals.FullSum = 0;
+    }
+}
+
+void PezRender()
+{
+    PezUniforms transforms[ObjectCount];
+    for (int i = 0; i < ObjectCount; i++) {
+        transforms[i] = pezWriteUniforms(&Globals.Transforms[i], sizeof(PezTransforms));
+    }
+    pezCommitUniforms();
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glUseProgram(Globals.LitProgram);
+    for (int i = 0; i < ObjectCount; i++) {
+        DrawObject(i, transforms[i]);
+    }
+    glUniform2f(Globals.FadeLocation, 0, 0);
+    Globals.Frames++;
+}
+
+void PezHandleMouse(int x, int y, int action)
+{
+}
+
+// Draws an object at the level picked for its distance.  Near the end of a
+// level's range, the next level fades in on the pixels that this one drops.
+static void DrawObject(int object, PezUniforms transforms)
+{
+    PezLods lods = Globals.Meshes[object % 2];
+    Vector4 center = Globals.Models[object].col3;
+    Vector3 offset = {center.x - Globals.Eye.x, center.y - Globals.Eye.y, center.z - Globals.Eye.z};
+    float distance = V3Length(offset) - pezGetLodRadius(lods);
+    float lod = pezSelectLod(lods, distance, Globals.PixelScale, PixelsPerTriangle, MaxPixelError);
+    int level = (int) lod;
+    float fade = (lod - level - (1 - FadeBand)) / FadeBand;
+
+    pezBindUniforms(0, transforms);
+    Globals.FullSum += pezGetLodTriangles(lods, 0);
+    if (fade <= 0 || level + 1 >= pezGetLodCount(lods)) {
+        glUniform2f(Globals.FadeLocation, 0, 0);
+        pezDrawLod(lods, level);
+        Globals.TriangleSum += pezGetLodTriangles(lods, level);
+        return;
+    }
+    glUniform2f(Globals.FadeLocation, fade, 0);
+    pezDrawLod(lods, level);
+    glUniform2f(Globals.FadeLocation, fade, 1);
+    pezDrawLod(lods, level + 1);
+    Globals.TriangleSum += pezGetLodTriangles(lods, level) + pezGetLodTriangles(lods, level + 1);
+}
+
+static GLuint LoadProgram(const char* vsKey, const char* fsKey)
+{
+    GLchar spew[256];
+    GLint compileSuccess;
+    GLuint programHandle = glCreateProgram();
+
+    const char* vsSource = pezGetShader(vsKey);
+    pezCheck(vsSource != 0, "Can't find vshader: %s\n", vsKey);
+    GLuint vsHandle = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vsHandle, 1, &vsSource, 0);
+    glCompileShader(vsHandle);
+    glGetShaderiv(vsHandle, GL_COMPILE_STATUS, &compileSuccess);
+    glGetShaderInfoLog(vsHandle, sizeof(spew), 0, spew);
+    pezCheck(compileSuccess, "Can't compile vshader:\n%s", spew);
+    glAttachShader(programHandle, vsHandle);
+
+    const char* fsSource = pezGetShader(fsKey);
+    pezCheck(fsSource != 0, "Can't find fshader: %s\n", fsKey);
+    GLuint fsHandle = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fsHandle, 1, &fsSource, 0);
+    glCompileShader(fsHandle);
+    glGetShaderiv(fsHandle, GL_COMPILE_STATUS, &compileSuccess);
+    glGetShaderInfoLog(fsHandle, sizeof(spew), 0, spew);
+    pezCheck(compileSuccess, "Can't compile fshader:\n%s", spew);
+    glAttachShader(programHandle, fsHandle);
+
+    glLinkProgram(programHandle);
+    GLint linkSuccess;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &linkSuccess);
+    glGetProgramInfoLog(programHandle, sizeof(spew), 0, spew);
+    pezCheck(linkSuccess, "Can't link shaders:\n%s", spew);
+    return programHandle;
+}
@@ -0,0 +1,305 @@
+// Meshlets OpenGL Demo by Philip Rideout
+// Licensed under the Creative Commons Attribution 3.0 Unported License. 
+// http://creativecommons.org/licenses/by/3.0/
+//
+// A densely tessellated trefoil knot, split into pez meshlets.  Each frame the
+// clusters that are outside the view frustum or face away from the eye are
+// culled on the CPU, and the rest go out in a single multi-draw.  The camera
+// swoops in close and back out while the demo alternates between culled and
+// whole draws every few seconds, printing the share of triangles submitted
+// and the average frame and culling times for each.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include "pez.h"
+#include "vmath.h"
+
+typedef struct {
+    int VertexCount;
+    int IndexCount;
+    GLuint Vao;
+    PezMeshlets Meshlets;
+} MeshPod;
+
+static const float StepSeconds = 4.0f;
+
+struct {
+    float Theta;
+    bool Culling;
+    GLuint LitProgram;
+    MeshPod TrefoilKnot;
+    Matrix4 Projection;
+    Matrix4 View;
+    Point3 Eye;
+    PezTransforms Transforms;
+    float StepTime;
+    int Frames;
+    double TriangleSum;
+    double CullSeconds;
+} Globals;
+
+typedef struct {
+    Vector3 Position;
+    Vector3 Normal;
+} Vertex;
+
+static GLuint LoadProgram(const char* vsKey, const char* fsKey);
+static MeshPod CreateTrefoil();
+static double GetSeconds();
+
+#define offset(x) ((const GLvoid*)x)
+
+PezConfig PezGetConfig()
+{
+    PezConfig config;
+    config.Title = __FILE__;
+    config.Width = 853;
+    config.Height = 480;
+    config.Multisampling = true;
+    config.VerticalSync = false;
+    return config;
+}
+
+void PezInitialize()
+{
+    const PezConfig cfg = PezGetConfig();
+
+    // Compile shaders
+    Globals.LitProgram = LoadProgram("Lit.VS", "Lit.FS");
+
+    // Set up viewport
+    float fovy = 30 * TwoPi / 360;
+    float aspect = (float) cfg.Width / cfg.Height;
+    float zNear = 0.01, zFar = 20;
+    Globals.Projection = M4MakePerspective(fovy, aspect, zNear, zFar);
+
+    // Create geometry
+    Globals.TrefoilKnot = CreateTrefoil();
+    pezPrintString("%d triangles in %d meshlets\n", Globals.TrefoilKnot.IndexCount / 3,
+                   pezGetMeshletCount(Globals.TrefoilKnot.Meshlets));
+
+    // Misc Initialization
+    Globals.Theta = 0;
+    Globals.Culling = true;
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glClearColor(0.5f, 0.6f, 0.7f, 1.0f);
+}
+
+void PezUpdate(float seconds)
+{
+    const float RadiansPerSecond = 0.4f;
+    Globals.Theta += seconds * RadiansPerSecond;
+
+    // Orbit the knot, swooping from well outside it to skimming its surface:
+    float distance = 2.2f + 1.6f * cos(0.7f * Globals.Theta);
+    Globals.Eye = (Point3){distance * sin(Globals.Theta), 0.3f * distance, distance * cos(Globals.Theta)};
+    Point3 target = {0, 0, 0};
+    Vector3 up = {0, 1, 0};
+    Globals.View = M4MakeLookAt(Globals.Eye, target, up);
+    Matrix4 identity = M4MakeIdentity();
+    pezPackTransforms(&Globals.Transforms, (float*) &Globals.Projection,
+                      (float*) &Globals.View, (float*) &identity);
+
+    Globals.StepTime += seconds;
+    if (Globals.StepTime >= StepSeconds && Globals.Frames) {
+        pezPrintString("%-8s %5.1f%% of triangles, frame %6.2f ms, cull %5.2f ms\n",
+                       Globals.Culling ? "culled:" : "whole:",
+                       100 * Globals.TriangleSum / Globals.Frames / (Globals.TrefoilKnot.IndexCount / 3),
+                       1000 * Globals.StepTime / Globals.Frames,
+                       1000 * Globals.CullSeconds / Globals.Frames);
+        Globals.Culling = !Globals.Culling;
+        Globals.StepTime = 0;
+        Globals.Frames = 0;
+        Globals.TriangleSum = 0;
+        Globals.CullSeconds = 0;
+    }
+}
+
+void PezRender()
+{
+    PezUniforms transforms = pezWriteUniforms(&Globals.Transforms, sizeof(PezTransforms));
+    pezCommitUniforms();
+
+    MeshPod* mesh = &Globals.TrefoilKnot;
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glUseProgram(Globals.LitProgram);
+    glBindVertexArray(mesh->Vao);
+    pezBindUniforms(0, transforms);
+
+    // The model matrix is the identity, so the eye is already in model space.
+    if (Globals.Culling) {
+        Matrix4 viewProjection = M4Mul(Globals.Projection, Globals.View);
+        float eye[3] = {Globals.Eye.x, Globals.Eye.y, Globals.Eye.z};
+        double start = GetSeconds();
+        Globals.TriangleSum += pezCullMeshlets(mesh->Meshlets, (float*) &viewProjection, eye);
+        Globals.CullSeconds += GetSeconds() - start;
+        pezDrawMeshlets(mesh->Meshlets);
+    } else {
+        Globals.TriangleSum += mesh->IndexCount / 3;
+        glDrawElements(GL_TRIANGLES, mesh->IndexCount, GL_UNSIGNED_INT, 0);
+    }
+    Globals.Frames++;
+}
+
+void PezHandleMouse(int x, int y, int action)
+{
+}
+
+static double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static GLuint LoadProgram(const char* vsKey, const char* fsKey)
+{
+    GLchar spew[256];
+    GLint compileSuccess;
+    GLuint programHandle = glCreateProgram();
+
+    const char* vsSource = pezGetShader(vsKey);
+    pezCheck(vsSource != 0, "Can't find vshader: %s\n", vsKey);
+    GLuint vsHandle = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vsHandle, 1, &vsSource, 0);
+    glCompileShader(vsHandle);
+    glGetShaderiv(vsHandle, GL_COMPILE_STATUS, &compileSuccess);
+    glGetShaderInfoLog(vsHandle, sizeof(spew), 0, spew);
+    pezCheck(compileSuccess, "Can't compile vshader:\n%s", spew);
+    glAttachShader(programHandle, vsHandle);
+
+    const char* fsSource = pezGetShader(fsKey);
+    pezCheck(fsSource != 0, "Can't find fshader: %s\n", fsKey);
+    GLuint fsHandle = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fsHandle, 1, &fsSource, 0);
+    glCompileShader(fsHandle);
+    glGetShaderiv(fsHandle, GL_COMPILE_STATUS, &compileSuccess);
+    glGetShaderInfoLog(fsHandle, sizeof(spew), 0, spew);
+    pezCheck(compileSuccess, "Can't compile fshader:\n%s", spew);
+    glAttachShader(programHandle, fsHandle);
+
+    glLinkProgram(programHandle);
+    GLint linkSuccess;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &linkSuccess);
+    glGetProgramInfoLog(programHandle, sizeof(spew), 0, spew);
+    pezCheck(linkSuccess, "Can't link shaders:\n%s", spew);
+    return programHandle;
+}
+
+static Vector3 EvaluateTrefoil(float s, float t)
+{
+    const float a = 0.5f;
+    const float b = 0.3f;
+    const float c = 0.5f;
+    const float d = 0.1f;
+    const float u = (1 - s) * 2 * TwoPi;
+    const float v = t * TwoPi;
+    const float r = a + b * cos(1.5f * u);
+    const float x = r * cos(u);
+    const float y = r * sin(u);
+    const float z = c * sin(1.5f * u);
+
+    Vector3 dv;
+    dv.x = -1.5f * b * sin(1.5f * u) * cos(u) - (a + b * cos(1.5f * u)) * sin(u);
+    dv.y = -1.5f * b * sin(1.5f * u) * sin(u) + (a + b * cos(1.5f * u)) * cos(u);
+    dv.z = 1.5f * c * cos(1.5f * u);
+
+    Vector3 q = V3Normalize(dv);
+    Vector3 qvn = V3Normalize((Vector3){q.y, -q.x, 0});
+    Vector3 ww = V3Cross(q, qvn);
+        
+    Vector3 range;
+    range.x = x + d * (qvn.x * cos(v) + ww.x * sin(v));
+    range.y = y + d * (qvn.y * cos(v) + ww.y * sin(v));
+    range.z = z + d * ww.z * sin(v);
+    return range;
+}
+
+static MeshPod CreateTrefoil()
+{
+    // Far denser than ToonShading's, so that there's vertex work to save:
+    const int Slices = 1024;
+    const int Stacks = 96;
+    const int VertexCount = Slices * Stacks;
+    const int IndexCount = VertexCount * 6;
+
+    MeshPod mesh;
+    glGenVertexArrays(1, &mesh.Vao);
+    glBindVertexArray(mesh.Vao);
+
+    // Too big for the stack, unlike the other demos' knots:
+    Vertex* verts = (Vertex*) malloc(VertexCount * sizeof(Vertex));
+    GLuint* inds = (GLuint*) malloc(IndexCount * sizeof(GLuint));
+    pezCheck(verts && inds, "Out of memory.");
+
+    // Create a buffer with interleaved positions and normals
+    if (1) {
+        Vertex* pVert = &verts[0];
+        for (int i = 0; i < Slices; i++) {
+            for (int j = 0; j < Stacks; j++) {
+                const float E = 0.01f;
+                float s = (float) i / Slices;
+                float t = (float) j / Stacks;
+                Vector3 p = EvaluateTrefoil(s, t);
+                Vector3 u = V3Sub(EvaluateTrefoil(s + E, t), p);
+                Vector3 v = V3Sub(EvaluateTrefoil(s, t + E), p);
+                Vector3 n = V3Normalize(V3Cross(u, v));
+                pVert->Position = p;
+                pVert->Normal = n;
+                ++pVert;
+            }
+        }
+
+        GLuint vbo;
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, VertexCount * sizeof(Vertex), verts, GL_STATIC_DRAW);
+    }
+
+    // Create a buffer of 32-bit indices, in meshlet order
+    if (1) {
+        GLuint* pIndex = &inds[0];
+        GLuint n = 0;
+        for (int i = 0; i < Slices; i++) {
+            for (int j = 0; j < Stacks; j++) {
+                *pIndex++ = (n + j + Stacks) % VertexCount;
+                *pIndex++ = n + (j + 1) % Stacks;
+                *pIndex++ = n + j;
+                
+                *pIndex++ = (n + (j + 1) % Stacks + Stacks) % VertexCount;
+                *pIndex++ = (n + (j + 1) % Stacks) % VertexCount;
+                *pIndex++ = (n + j + Stacks) % VertexCount;
+            }
+            n += Stacks;
+        }
+
+        pezCheck(n == VertexCount, "Tessellation error.");
+        pezCheck(pIndex - &inds[0] == IndexCount, "Tessellation error.");
+
+        mesh.Meshlets = pezBuildMeshlets(&verts[0].Position.x, sizeof(Vertex), VertexCount,
+                                         inds, GL_UNSIGNED_INT, IndexCount);
+
+        GLuint handle;
+        glGenBuffers(1, &handle);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, IndexCount * sizeof(GLuint), inds, GL_STATIC_DRAW);
+    }
+
+    free(verts);
+    free(inds);
+
+    mesh.VertexCount = VertexCount;
+    mesh.IndexCount = IndexCount;
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 24, 0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 24, offset(12));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    return mesh;
+}
@@ -2,6 +2,7 @@
 // Licensed under the Creative Commons Attribution 3.0 Unported License. 
 // http://creativecommons.org/licenses/by/3.0/
 
+#include <stdlib.h>
 #include "pez.h"
 #include "vmath.h"
 
@@ -10,6 +11,10 @@ static Point3 LightPosition = {1, 1, 2};
 static const float FieldOfView = 0.7f;
 static const int GridSize = 96;
 static const int ViewSamples = 96 * 2;
+static const int Downsample = 2;         // 1 = full resolution, 2 = half, 4 = quarter
+static const bool TemporalJitter = true; // jitter rays and accumulate them over several frames
+static const float HistoryWeight = 0.8f;
+static const float ReportInterval = 2.0f; // seconds between quality/speed reports
 
 PezConfig PezGetConfig()
 {
@@ -35,10 +40,31 @@ struct VolumesRec {
     Volume LightCache;
 } Volumes;
 
+// The raymarch writes color, and the distance to the first opaque sample along
+// each ray, which places each texel for reprojection and for upsampling.
+struct TargetsRec {
+    PezTarget* Trace;
+    PezTarget* History[2];
+    PezTarget* Reference;
+} Targets;
+
+static const GLfloat ClearValues[8] = {
+    0, 0, 0, 0,     // transparent
+    1000, 0, 0, 0,  // farthest
+};
+
+struct FrameRec {
+    unsigned int Index;
+    float ReportTimer;
+    bool Report;
+    GLuint Queries[2];
+} Frame;
+
 struct MatricesRec {
     Matrix4 Projection;
     Matrix4 Modelview;
     Matrix4 ModelviewProjection;
+    Matrix4 PreviousModelviewProjection;
 } Matrices;
 
 struct VbosRec {
@@ -48,10 +74,15 @@ struct VbosRec {
 
 struct ProgramsRec {
     GLuint Raycast;
+    GLuint Accumulate;
+    GLuint Upsample;
 } Programs;
 
 static GLuint LoadProgram(char* vs, char* gs, char* fs);
 static Volume CreateVolume(GLsizei w, GLsizei h, GLsizei d, int numComponents);
+static void RenderVolume(GLsizei width, GLsizei height, bool jitter);
+static void GetPixelOffset(bool jitter, float* offset);
+static void DrawQuad();
 static GLuint CurrentProgram();
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
@@ -60,8 +91,11 @@ static GLuint CurrentProgram();
 void PezInitialize()
 {
     PezGetConfig();
+    PezAsset smoke = pezLoadPixelsAsync("Smoke96.pbo");
 
     Programs.Raycast = LoadProgram("VS", "GS", "FS");
+    Programs.Accumulate = LoadProgram("Quad.VS", 0, "Accumulate.FS");
+    Programs.Upsample = LoadProgram("Quad.VS", 0, "Upsample.FS");
 
     GLuint vao;
     glGenVertexArrays(1, &vao);
@@ -80,13 +114,32 @@ void PezInitialize()
     Volumes.Density = CreateVolume(GridSize, GridSize, GridSize, 1);
     Volumes.LightCache = CreateVolume(GridSize, GridSize, GridSize, 1);
 
-    PezPixels pixels = pezLoadPixels("Smoke96.pbo");
+    PezPixels pixels = pezGetAssetPixels(smoke);
+    pezFreeAsset(smoke);
     glBindTexture(GL_TEXTURE_3D, Volumes.Density.TextureHandle);
     glTexImage3D(GL_TEXTURE_3D, 0, pixels.InternalFormat,
         pixels.Width, pixels.Height, pixels.Depth,
         0, pixels.Format, pixels.Type, pixels.Frames);
     pezFreePixels(pixels);
 
+    PezTargetDesc desc = {0};
+    desc.Divisor = Downsample;
+    desc.ColorFormats[0] = GL_RGBA16F;
+    desc.ColorFormats[1] = GL_R32F;
+    desc.Filter = GL_NEAREST;
+    Targets.Trace = pezAcquireTarget(desc);
+    desc.Filter = GL_LINEAR; // the history is resampled where it's reprojected
+    Targets.History[0] = pezAcquireTarget(desc);
+    Targets.History[1] = pezAcquireTarget(desc);
+    pezClearTarget(Targets.History[0], ClearValues);
+    pezClearTarget(Targets.History[1], ClearValues);
+    desc.Divisor = 1;
+    desc.ColorFormats[1] = GL_NONE;
+    desc.Filter = GL_NEAREST;
+    Targets.Reference = pezAcquireTarget(desc);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glGenQueries(2, Frame.Queries);
+
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -97,17 +150,101 @@ void PezInitialize()
 void PezRender()
 {
     PezConfig cfg = PezGetConfig();
-    Vector3 rayOrigin = V4GetXYZ(M4MulP3(M4Transpose(Matrices.Modelview), EyePosition));
-    GLfloat* mvp = &Matrices.ModelviewProjection.col0.x;
-    GLfloat* mv = &Matrices.Modelview.col0.x;
-    GLfloat* proj = &Matrices.Projection.col0.x;
+    Frame.Index++;
+
+    // Render the full-resolution image that the reduced path is compared against:
+    if (Frame.Report) {
+        glBeginQuery(GL_TIME_ELAPSED, Frame.Queries[0]);
+        pezClearTarget(Targets.Reference, ClearValues);
+        glEnable(GL_BLEND);
+        RenderVolume(Targets.Reference->Width, Targets.Reference->Height, false);
+        glEndQuery(GL_TIME_ELAPSED);
+        glBeginQuery(GL_TIME_ELAPSED, Frame.Queries[1]);
+    }
+
+    if (Downsample == 1) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glClearColor(0, 0, 0, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glEnable(GL_BLEND);
+        RenderVolume(cfg.Width, cfg.Height, TemporalJitter);
+        return;
+    }
+
+    // Raymarch into the low-resolution target:
+    PezTarget* trace = Targets.Trace;
+    pezClearTarget(trace, ClearValues);
+    glDisable(GL_BLEND);
+    RenderVolume(trace->Width, trace->Height, TemporalJitter);
+
+    // Blend the jittered samples with the previous frames, reprojecting them
+    // from where the last frame saw the same point:
+    if (TemporalJitter) {
+        PezTarget* src = Targets.History[Frame.Index % 2];
+        PezTarget* dst = Targets.History[(Frame.Index + 1) % 2];
+        Matrix4 reprojection = M4Mul(Matrices.PreviousModelviewProjection, M4Inverse(Matrices.Modelview));
+        float offset[2];
+        GetPixelOffset(true, offset);
+        glBindFramebuffer(GL_FRAMEBUFFER, dst->Fbo);
+        glUseProgram(Programs.Accumulate);
+        glUniform1f(u("HistoryWeight"), Frame.Index > 1 ? HistoryWeight : 0.0f);
+        glUniformMatrix4fv(u("Reprojection"), 1, 0, &reprojection.col0.x);
+        glUniform1f(u("FocalLength"), 1.0f / tanf(FieldOfView / 2));
+        glUniform2fv(u("PixelOffset"), 1, offset);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, trace->ColorTextures[0]);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, trace->ColorTextures[1]);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, src->ColorTextures[0]);
+        DrawQuad();
+        trace = dst;
+    }
 
-    // Perform raycasting:
+    // Upsample to the window, preserving edges where the depth changes abruptly:
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glViewport(0, 0, cfg.Width, cfg.Height);
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT);
     glEnable(GL_BLEND);
+    glUseProgram(Programs.Upsample);
+    glUniform1f(u("Downsample"), (float) Downsample);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, trace->ColorTextures[0]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, trace->ColorTextures[1]);
+    DrawQuad();
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Print the cost and error of the reduced path next to the full-resolution path:
+    if (Frame.Report) {
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 fullTime, reducedTime;
+        glGetQueryObjectui64v(Frame.Queries[0], GL_QUERY_RESULT, &fullTime);
+        glGetQueryObjectui64v(Frame.Queries[1], GL_QUERY_RESULT, &reducedTime);
+        pezPrintString("Full res: %.2f ms | 1/%d res: %.2f ms, PSNR %.1f dB\n",
+            fullTime / 1000000.0, Downsample, reducedTime / 1000000.0,
+            pezComputePsnr(Targets.Reference));
+        Frame.Report = false;
+    }
+}
+
+static void RenderVolume(GLsizei width, GLsizei height, bool jitter)
+{
+    Vector3 rayOrigin = V4GetXYZ(M4MulP3(M4Transpose(Matrices.Modelview), EyePosition));
+    GLfloat* mvp = &Matrices.ModelviewProjection.col0.x;
+    GLfloat* mv = &Matrices.Modelview.col0.x;
+    GLfloat* proj = &Matrices.Projection.col0.x;
+
+    float offset[2];
+    GetPixelOffset(jitter, offset);
+
+    glViewport(0, 0, width, height);
     glBindBuffer(GL_ARRAY_BUFFER, Vbos.CubeCenter);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
     glActiveTexture(GL_TEXTURE0);
@@ -124,19 +261,33 @@ void PezRender()
     glUniform1i(u("Density"), 0);
     glUniform3fv(u("RayOrigin"), 1, &rayOrigin.x);
     glUniform1f(u("FocalLength"), 1.0f / tanf(FieldOfView / 2));
-    glUniform2f(u("WindowSize"), (float) cfg.Width, (float) cfg.Height);
+    glUniform2f(u("WindowSize"), (float) width, (float) height);
     glUniform1f(u("StepSize"), sqrtf(3.0f) / ViewSamples); // should be sqrt(2)
+    glUniform1i(u("Jitter"), jitter);
+    glUniform1ui(u("FrameIndex"), Frame.Index);
+    glUniform2fv(u("PixelOffset"), 1, offset);
     glDrawArrays(GL_POINTS, 0, 1);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_3D, 0);
     glActiveTexture(GL_TEXTURE0);
 }
 
+// Cycles through the centers of the full-resolution pixels that each texel
+// of the raymarch covers, so that accumulated frames cover all of them.
+static void GetPixelOffset(bool jitter, float* offset)
+{
+    int sample = jitter ? Frame.Index % (Downsample * Downsample) : 0;
+    offset[0] = jitter ? (sample % Downsample + 0.5f) / Downsample - 0.5f : 0;
+    offset[1] = jitter ? (sample / Downsample + 0.5f) / Downsample - 0.5f : 0;
+}
+
 void PezUpdate(float dt)
 {
     static float theta = 0;
     theta += dt / 2.0f;
     
+    Matrices.PreviousModelviewProjection = Matrices.ModelviewProjection;
+
     Vector3 up = {1, 0, 0}; Point3 target = {0, 0, 0};
     Matrix4 view = M4MakeLookAt(EyePosition, target, up);
     Matrix4 spin = M4MakeRotationX(sin(theta) * Pi / 2);
@@ -153,6 +304,12 @@ void PezUpdate(float dt)
         0.0f, 1.0f);
 
     Matrices.ModelviewProjection = M4Mul(Matrices.Projection, Matrices.Modelview);
+
+    Frame.ReportTimer += dt;
+    if (Frame.ReportTimer > ReportInterval && Downsample > 1) {
+        Frame.ReportTimer = 0;
+        Frame.Report = true;
+    }
 }
 
 void PezHandleMouse(int x, int y, int action)
@@ -266,6 +423,13 @@ static Volume CreateVolume(GLsizei w, GLsizei h, GLsizei d, int numComponents)
     return volume;
 }
 
+static void DrawQuad()
+{
+    glBindBuffer(GL_ARRAY_BUFFER, Vbos.FullscreenQuad);
+    glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, 2 * sizeof(short), 0);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
 static GLuint CurrentProgram()
 {
     GLuint p;
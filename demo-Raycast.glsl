@@ -66,7 +66,8 @@ void main()
 
 -- FS
 
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out float FragDepth;
 
 uniform sampler3D Density;
 
@@ -80,8 +81,9 @@ uniform vec3 RayOrigin;
 uniform vec3 Ambient = vec3(0.15, 0.15, 0.20);
 uniform float StepSize;
 uniform int ViewSamples;
-
-const bool Jitter = false;
+uniform bool Jitter = false;
+uniform uint FrameIndex = 0u;
+uniform vec2 PixelOffset = vec2(0);
 
 float GetDensity(vec3 pos)
 {
@@ -125,7 +127,7 @@ float randhash(uint seed, float b)
 void main()
 {
     vec3 rayDirection;
-    rayDirection.xy = 2.0 * gl_FragCoord.xy / WindowSize - 1.0;
+    rayDirection.xy = 2.0 * (gl_FragCoord.xy + PixelOffset) / WindowSize - 1.0;
     rayDirection.x /= WindowSize.y / WindowSize.x;
     rayDirection.z = -FocalLength;
     rayDirection = (vec4(rayDirection, 0) * Modelview).xyz;
@@ -148,11 +150,14 @@ void main()
     vec3 Lo = Ambient;
 
     if (Jitter) {
-        uint seed = uint(gl_FragCoord.x) * uint(gl_FragCoord.y);
+        uint seed = uint(gl_FragCoord.x) * uint(gl_FragCoord.y) + FrameIndex;
         pos += viewDir * (-0.5 + randhash(seed, 1.0));
     }
 
     float remainingLength = distance(rayStop, rayStart);
+    vec3 eyeStart = 0.5 * (eye.Origin + 1.0);
+    float depth = distance(eyeStart, rayStop);
+    bool opaque = false;
 
     for (int i=0; i < ViewSamples && remainingLength > 0.0;
         ++i, pos += viewDir, remainingLength -= StepSize) {
@@ -167,6 +172,10 @@ void main()
         }
 
         T *= 1.0 - density * StepSize * Absorption;
+        if (T < 0.5 && !opaque) {
+            depth = distance(eyeStart, pos);
+            opaque = true;
+        }
         if (T <= 0.01)
             break;
 
@@ -178,4 +187,98 @@ void main()
 
     FragColor.rgb = Lo;
     FragColor.a = 1-T;
+    FragDepth = depth;
+}
+
+-- Quad.VS
+
+in vec4 Position;
+
+void main()
+{
+    gl_Position = Position;
+}
+
+-- Accumulate.FS
+
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out float FragDepth;
+
+layout(binding = 0) uniform sampler2D Color;
+layout(binding = 1) uniform sampler2D Depth;
+layout(binding = 2) uniform sampler2D History;
+uniform float HistoryWeight;
+uniform mat4 Reprojection; // from this frame's eye space to the last frame's clip space
+uniform float FocalLength;
+uniform vec2 PixelOffset;
+
+// Rebuilds the point that this texel's ray stopped at, finds it in the last
+// frame, and blends in the history from there.  The history is clamped to
+// the colors around this texel, which rejects it where the point was hidden
+// or has changed since.
+void main()
+{
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(Color, 0);
+    vec4 current = texelFetch(Color, coord, 0);
+    float depth = texelFetch(Depth, coord, 0).r;
+
+    // Depths are in texture space, where the volume is half its model size:
+    vec2 windowSize = vec2(size);
+    vec3 rayDirection;
+    rayDirection.xy = 2.0 * (gl_FragCoord.xy + PixelOffset) / windowSize - 1.0;
+    rayDirection.x /= windowSize.y / windowSize.x;
+    rayDirection.z = -FocalLength;
+    vec4 previous = Reprojection * vec4(normalize(rayDirection) * 2.0 * depth, 1);
+    vec2 uv = 0.5 * previous.xy / previous.w + 0.5;
+    bool onscreen = previous.w > 0.0 && all(greaterThanEqual(uv, vec2(0))) && all(lessThanEqual(uv, vec2(1)));
+
+    vec4 lo = current, hi = current;
+    for (int i = 0; i < 9; i++) {
+        ivec2 neighbor = clamp(coord + ivec2(i % 3 - 1, i / 3 - 1), ivec2(0), size - 1);
+        vec4 c = texelFetch(Color, neighbor, 0);
+        lo = min(lo, c);
+        hi = max(hi, c);
+    }
+    vec4 history = clamp(texture(History, uv), lo, hi);
+
+    FragColor = mix(current, history, onscreen ? HistoryWeight : 0.0);
+    FragDepth = depth;
+}
+
+-- Upsample.FS
+
+out vec4 FragColor;
+
+layout(binding = 0) uniform sampler2D Color;
+layout(binding = 1) uniform sampler2D Depth;
+uniform float Downsample;
+uniform float DepthTolerance = 0.02;
+
+// Bilinear upsample where each of the four low-res taps is down-weighted
+// when its depth differs from the depth of the texel covering this pixel.
+// This keeps the silhouette of the smoke and floor from bleeding outwards.
+void main()
+{
+    ivec2 maxCoord = textureSize(Color, 0) - 1;
+    vec2 p = gl_FragCoord.xy / Downsample - 0.5;
+    ivec2 base = ivec2(floor(p));
+    vec2 f = fract(p);
+
+    ivec2 nearest = clamp(ivec2(gl_FragCoord.xy / Downsample), ivec2(0), maxCoord);
+    float reference = texelFetch(Depth, nearest, 0).r;
+
+    vec4 sum = vec4(0);
+    float total = 0.0;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 coord = clamp(base + offset, ivec2(0), maxCoord);
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float delta = abs(texelFetch(Depth, coord, 0).r - reference);
+        float w = bilinear.x * bilinear.y / (DepthTolerance + delta);
+        sum += w * texelFetch(Color, coord, 0);
+        total += w;
+    }
+
+    FragColor = total > 0.0 ? sum / total : texelFetch(Color, nearest, 0);
 }
@@ -1,13 +1,16 @@
 -- Text.VS
 
-in int Character;
+layout(location = 0) in vec2 Origin;
+layout(location = 1) in uvec4 Glyph;
 out int vCharacter;
-out int vPosition;
+out vec2 vOrigin;
+out vec2 vCell;
 
 void main()
 {
-    vCharacter = Character;
-    vPosition = gl_VertexID;
+    vCharacter = int(Glyph.x);
+    vOrigin = Origin;
+    vCell = vec2(Glyph.yz);
     gl_Position = vec4(0, 0, 0, 1);
 }
 
@@ -18,39 +21,40 @@ layout(points) in;
 layout(triangle_strip, max_vertices = 4) out;
 
 in int vCharacter[1];
-in int vPosition[1];
+in vec2 vOrigin[1];
+in vec2 vCell[1];
 out vec2 gTexCoord;
-uniform sampler2D Sampler;
 
+uniform vec4 GlyphRects[MaxGlyphs];  // atlas texcoords: left, top, right, bottom
+uniform vec4 GlyphBounds[MaxGlyphs]; // font pixels: left, top, width, height
+uniform int FirstCharacter;
+uniform int GlyphCount;
 uniform vec2 CellSize;
-uniform vec2 CellOffset;
-uniform vec2 RenderSize;
-uniform vec2 RenderOrigin;
+uniform float Scale;
+uniform vec2 InverseViewport;
 
 void main()
 {
-    // Determine the final quad's position and size:
-    float x = RenderOrigin.x + float(vPosition[0]) * RenderSize.x * 2;
-    float y = RenderOrigin.y;
-    vec4 P = vec4(x, y, 0, 1);
-    vec4 U = vec4(1, 0, 0, 0) * RenderSize.x;
-    vec4 V = vec4(0, 1, 0, 0) * RenderSize.y;
-
-    // Determine the texture coordinates:
-    int letter = vCharacter[0];
-    letter = clamp(letter - 32, 0, 96);
-    int row = letter / 16 + 1;
-    int col = letter % 16;
-    float S0 = CellOffset.x + CellSize.x * col;
-    float T0 = CellOffset.y + 1 - CellSize.y * row;
-    float S1 = S0 + CellSize.x - CellOffset.x;
-    float T1 = T0 + CellSize.y;
+    int letter = clamp(vCharacter[0] - FirstCharacter, 0, GlyphCount - 1);
+    vec4 rect = GlyphRects[letter];
+    vec4 bounds = GlyphBounds[letter];
+    if (bounds.z == 0.0)
+        return;
+
+    // Place the glyph's quad in pixels (origin at the top left), then go
+    // to clip space:
+    vec2 topLeft = vOrigin[0] + Scale * (CellSize * vCell[0] + bounds.xy);
+    vec2 bottomRight = topLeft + Scale * bounds.zw;
+    vec2 P0 = topLeft * InverseViewport * 2.0 - 1.0;
+    vec2 P1 = bottomRight * InverseViewport * 2.0 - 1.0;
+    P0.y = -P0.y;
+    P1.y = -P1.y;
 
     // Output the quad's vertices:
-    gTexCoord = vec2(S0, T1); gl_Position = P - U - V; EmitVertex();
-    gTexCoord = vec2(S1, T1); gl_Position = P + U - V; EmitVertex();
-    gTexCoord = vec2(S0, T0); gl_Position = P - U + V; EmitVertex();
-    gTexCoord = vec2(S1, T0); gl_Position = P + U + V; EmitVertex();
+    gTexCoord = rect.xw; gl_Position = vec4(P0.x, P1.y, 0, 1); EmitVertex();
+    gTexCoord = rect.zw; gl_Position = vec4(P1.x, P1.y, 0, 1); EmitVertex();
+    gTexCoord = rect.xy; gl_Position = vec4(P0.x, P0.y, 0, 1); EmitVertex();
+    gTexCoord = rect.zy; gl_Position = vec4(P1.x, P0.y, 0, 1); EmitVertex();
     EndPrimitive();
 }
 
@@ -61,26 +65,37 @@ in vec2 gTexCoord;
 
 uniform sampler2D Sampler;
 uniform vec3 TextColor;
+uniform vec3 OutlineColor;
+uniform float OutlineWidth = 0.0;
 
+// The atlas stores signed distance with the glyph edge at 0.5, so a single
+// fetch gives both the fill and, further out, the outline.
 void main()
 {
-    float A = texture(Sampler, gTexCoord).r;
-    FragColor = vec4(TextColor, A);
+    float D = texture(Sampler, gTexCoord).r;
+    float width = fwidth(D);
+    float fill = smoothstep(0.5 - width, 0.5 + width, D);
+    float edge = 0.5 - OutlineWidth;
+    float A = smoothstep(edge - width, edge + width, D);
+    FragColor = vec4(mix(OutlineColor, TextColor, fill), A);
 }
 
 -- Lit.VS
 
-in vec4 Position;
-in vec3 Normal;
+layout(location = 0) in vec4 Position;
+layout(location = 1) in vec3 Normal;
 
 out vec3 vPosition;
 out vec3 vNormal;
 
-uniform mat4 Projection;
-uniform mat4 Modelview;
-uniform mat4 ViewMatrix;
-uniform mat4 ModelMatrix;
-uniform mat3 NormalMatrix;
+layout(std140, binding = 0) uniform Transforms
+{
+    mat4 Projection;
+    mat4 ViewMatrix;
+    mat4 ModelMatrix;
+    mat4 Modelview;
+    mat3 NormalMatrix;
+};
 
 void main()
 {
@@ -4,51 +4,65 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
 #include "pez.h"
 #include "vmath.h"
-#include "lodepng.h"
-
-typedef struct {
-    int VertexCount;
-    int IndexCount;
-    GLuint Vao;
-} MeshPod;
 
 typedef struct {
     Matrix4 Projection;
     Matrix4 Ortho;
-    Matrix4 Modelview;
     Matrix4 View;
     Matrix4 Model;
-    Matrix3 Normal;
-    GLfloat PackedNormal[9];
+    PezTransforms Packed;
 } TransformsPod;
 
+enum { AttributeBold = 1, AttributeUnderline = 2, AttributeInverse = 4 };
+
+// One record per cell, streamed to the GPU as a per-instance uvec4.
+// Colors are indices into a 16-entry palette.
+typedef struct {
+    GLubyte Glyph;
+    GLubyte Attributes;
+    GLubyte Foreground;
+    GLubyte Background;
+} CellPod;
+
+typedef struct {
+    int Columns;
+    int Rows;
+    CellPod* Cells;
+    bool* DirtyRows;
+    GLuint Buffer;
+    GLuint Vao;
+} TextGridPod;
+
+static const float GridScale = 0.5f; // window pixels per font pixel; 8 x 16.5 pixel cells with verasansmono
+
 struct {
     float Theta;
+    int Frame;
+    int UploadedRows;
     GLuint LitProgram;
     GLuint QuadProgram;
-    GLuint TextProgram;
-    GLuint SinglePointVao;
-    MeshPod TrefoilKnot;
+    GLuint GridProgram;
+    PezLods TrefoilKnot;
     TransformsPod Transforms;
     GLuint QuadVao;
-    GLuint TextVao;
+    TextGridPod Grid;
     GLuint FontMap;
-    char Message[256];
+    PezGlyphs Glyphs;
 } Globals;
 
-typedef struct {
-    Vector3 Position;
-    Vector3 Normal;
-} Vertex;
-
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
 static GLuint CurrentProgram();
-static MeshPod CreateTrefoil();
 static GLuint LoadTexture(const char* filename);
 static GLuint CreateQuad(int sourceWidth, int sourceHeight, int destWidth, int destHeight);
-static GLuint CreateText(const char* text);
+static void LoadGlyphs(const char* filename);
+static TextGridPod CreateGrid(int columns, int rows);
+static void PrintGrid(TextGridPod* grid, int column, int row, GLubyte foreground,
+                      GLubyte background, GLubyte attributes, const char* fmt, ...);
+static int UploadGrid(TextGridPod* grid);
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define a(x) glGetAttribLocation(CurrentProgram(), x)
@@ -59,8 +73,8 @@ PezConfig PezGetConfig()
 {
     PezConfig config;
     config.Title = __FILE__;
-    config.Width = 725;//853;
-    config.Height = 231;//480;
+    config.Width = 1200;
+    config.Height = 800;
     config.Multisampling = true;
     config.VerticalSync = true;
     return config;
@@ -70,13 +84,14 @@ void PezInitialize()
 {
     const PezConfig cfg = PezGetConfig();
     pezSwAddDirective("*", "#extension GL_ARB_explicit_attrib_location : enable");
-
-    strcpy(Globals.Message, "Hello, world.");
+    char maxGlyphs[32];
+    sprintf(maxGlyphs, "#define MaxGlyphs %d", PEZ_MAX_GLYPHS);
+    pezSwAddDirective("*", maxGlyphs);
 
     // Compile shaders
     Globals.QuadProgram = LoadProgram("Quad.VS", 0, "Quad.FS");
     Globals.LitProgram = LoadProgram("Lit.VS", 0, "Lit.FS");
-    Globals.TextProgram = LoadProgram("Text.VS", "Text.GS", "Text.Smooth.FS");
+    Globals.GridProgram = LoadProgram("Grid.VS", 0, "Grid.FS");
 
     // Set up viewport
     float fovy = 16 * TwoPi / 180;
@@ -88,14 +103,24 @@ void PezInitialize()
     // Create geometry
     glUseProgram(Globals.QuadProgram);
     Globals.QuadVao = CreateQuad(cfg.Width, -cfg.Height, cfg.Width, cfg.Height);
-    glUseProgram(Globals.TextProgram);
-    Globals.TextVao = CreateText(Globals.Message);
-    glUseProgram(Globals.LitProgram);
-    Globals.TrefoilKnot = CreateTrefoil();
-
-    // Load textures
-    Globals.FontMap = LoadTexture("FontMap.png");
-    //Globals.FontMap = LoadTexture("Mona-EDT-Small.png");
+    Globals.TrefoilKnot = pezGenTrefoil(256, 32, 1);    // one level, for the one fixed view
+
+    // Load the distance field atlas that BakeFont made from verasansmono.png
+    Globals.FontMap = LoadTexture("verasansmono.sdf.png");
+    glUseProgram(Globals.GridProgram);
+    LoadGlyphs("verasansmono.glyphs");
+
+    // Fill the window with as many cells as fit at a readable size
+    const PezGlyphs* glyphs = &Globals.Glyphs;
+    int columns = (int) (cfg.Width / (GridScale * glyphs->CellWidth));
+    int rows = (int) (cfg.Height / (GridScale * glyphs->CellHeight));
+    pezCheck(columns >= 24 && rows >= 2, "The window is too small for the text grid.");
+    Globals.Grid = CreateGrid(columns, rows);
+    glUniform1f(u("Scale"), GridScale);
+    glUniform1i(u("Columns"), columns);
+    glUniform2f(u("InverseViewport"), 1.0f / cfg.Width, 1.0f / cfg.Height);
+    PrintGrid(&Globals.Grid, 0, 0, 15, 1, AttributeBold,
+              "%d x %d grid, one instanced draw", columns, rows);
 
     // Misc Initialization
     Globals.Theta = 0;
@@ -108,6 +133,19 @@ void PezUpdate(float seconds)
 {
     const float RadiansPerSecond = 0.5f;
     Globals.Theta += seconds * RadiansPerSecond;
+
+    // Append a log line, wrapping around below the header row.  Only the
+    // touched rows get re-uploaded.
+    TextGridPod* grid = &Globals.Grid;
+    int row = 1 + Globals.Frame % (grid->Rows - 1);
+    GLubyte color = 9 + Globals.Frame % 6;
+    PrintGrid(grid, 0, row, color, 0, 0, "[%06d] theta = %8.3f  dt = %6.3f ms",
+              Globals.Frame, Globals.Theta, seconds * 1000);
+    PrintGrid(grid, 0, 1 + (row % (grid->Rows - 1)), 8, 0, AttributeUnderline,
+              "%*s", grid->Columns, "");
+    PrintGrid(grid, grid->Columns - 24, 0, 0, 7, AttributeInverse,
+              "rows uploaded: %-3d", Globals.UploadedRows);
+    Globals.Frame++;
     
     // Create the model-view matrix:
     Globals.Transforms.Model = M4MakeRotationY(Globals.Theta);
@@ -115,40 +153,32 @@ void PezUpdate(float seconds)
     Point3 target = {0, 0, 0};
     Vector3 up = {0, 1, 0};
     Globals.Transforms.View = M4MakeLookAt(eye, target, up);
-    Globals.Transforms.Modelview = M4Mul(Globals.Transforms.View, Globals.Transforms.Model);
-    Globals.Transforms.Normal = M4GetUpper3x3(Globals.Transforms.Modelview);
-    for (int i = 0; i < 9; ++i) {
-        Globals.Transforms.PackedNormal[i] = M3GetElem(Globals.Transforms.Normal, i/3, i%3);
-    }
+    pezPackTransforms(&Globals.Transforms.Packed, (float*) &Globals.Transforms.Projection,
+                      (float*) &Globals.Transforms.View, (float*) &Globals.Transforms.Model);
 }
 
 void PezRender()
 {
-    float* pModel = (float*) &Globals.Transforms.Model;
-    float* pView = (float*) &Globals.Transforms.View;
-    float* pModelview = (float*) &Globals.Transforms.Modelview;
-    float* pProjection = (float*) &Globals.Transforms.Projection;
-    float* pNormalMatrix = &Globals.Transforms.PackedNormal[0];
-    MeshPod* mesh = &Globals.TrefoilKnot;
+    PezUniforms transforms = pezWriteUniforms(&Globals.Transforms.Packed, sizeof(PezTransforms));
+    pezCommitUniforms();
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
 
     glUseProgram(Globals.LitProgram);
-    glBindVertexArray(mesh->Vao);
-    glUniformMatrix4fv(u("ViewMatrix"), 1, 0, pView);
-    glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pModel);
-    glUniformMatrix4fv(u("Modelview"), 1, 0, pModelview);
-    glUniformMatrix4fv(u("Projection"), 1, 0, pProjection);
-    glUniformMatrix3fv(u("NormalMatrix"), 1, 0, pNormalMatrix);
-    glDrawElements(GL_TRIANGLES, mesh->IndexCount, GL_UNSIGNED_SHORT, 0);
+    pezBindUniforms(0, transforms);
+    pezDrawLod(Globals.TrefoilKnot, 0);
     pezCheck(OpenGLError);
 
-    glUseProgram(Globals.TextProgram);
+    // Upload whatever changed, then draw every cell with one instanced quad:
+    TextGridPod* grid = &Globals.Grid;
+    Globals.UploadedRows = UploadGrid(grid);
+    glUseProgram(Globals.GridProgram);
     glEnable(GL_BLEND);
     glDisable(GL_DEPTH_TEST);
     glBindTexture(GL_TEXTURE_2D, Globals.FontMap);
-    glDrawArrays(GL_POINTS, 0, 1); // strlen(Globals.Message));
+    glBindVertexArray(grid->Vao);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, grid->Columns * grid->Rows);
     glBindTexture(GL_TEXTURE_2D, 0);
     glDisable(GL_BLEND);
 
@@ -215,156 +245,14 @@ static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKe
     return programHandle;
 }
 
-static Vector3 EvaluateTrefoil(float s, float t)
-{
-    const float a = 0.5f;
-    const float b = 0.3f;
-    const float c = 0.5f;
-    const float d = 0.1f;
-    const float u = (1 - s) * 2 * TwoPi;
-    const float v = t * TwoPi;
-    const float r = a + b * cos(1.5f * u);
-    const float x = r * cos(u);
-    const float y = r * sin(u);
-    const float z = c * sin(1.5f * u);
-
-    Vector3 dv;
-    dv.x = -1.5f * b * sin(1.5f * u) * cos(u) - (a + b * cos(1.5f * u)) * sin(u);
-    dv.y = -1.5f * b * sin(1.5f * u) * sin(u) + (a + b * cos(1.5f * u)) * cos(u);
-    dv.z = 1.5f * c * cos(1.5f * u);
-
-    Vector3 q = V3Normalize(dv);
-    Vector3 qvn = V3Normalize((Vector3){q.y, -q.x, 0});
-    Vector3 ww = V3Cross(q, qvn);
-        
-    Vector3 range;
-    range.x = x + d * (qvn.x * cos(v) + ww.x * sin(v));
-    range.y = y + d * (qvn.y * cos(v) + ww.y * sin(v));
-    range.z = z + d * ww.z * sin(v);
-    return range;
-}
-
-static MeshPod CreateTrefoil()
-{
-    const int Slices = 256;
-    const int Stacks = 32;
-    const int VertexCount = Slices * Stacks;
-    const int IndexCount = VertexCount * 6;
-
-    MeshPod mesh;
-    glGenVertexArrays(1, &mesh.Vao);
-    glBindVertexArray(mesh.Vao);
-
-    // Create a buffer with interleaved positions and normals
-    if (true) {
-        Vertex verts[VertexCount];
-        Vertex* pVert = &verts[0];
-        float ds = 1.0f / Slices;
-        float dt = 1.0f / Stacks;
-
-        // The upper bounds in these loops are tweaked to reduce the
-        // chance of precision error causing an incorrect # of iterations.
-        for (float s = 0; s < 1 - ds / 2; s += ds) {
-            for (float t = 0; t < 1 - dt / 2; t += dt) {
-                const float E = 0.01f;
-                Vector3 p = EvaluateTrefoil(s, t);
-                Vector3 u = V3Sub(EvaluateTrefoil(s + E, t), p);
-                Vector3 v = V3Sub(EvaluateTrefoil(s, t + E), p);
-                Vector3 n = V3Normalize(V3Cross(u, v));
-                pVert->Position = p;
-                pVert->Normal = n;
-                ++pVert;
-            }
-        }
-
-        pezCheck(pVert - &verts[0] == VertexCount, "Tessellation error.");
-
-        GLuint vbo;
-        GLsizeiptr size = sizeof(verts);
-        const GLvoid* data = &verts[0].Position.x;
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-    }
-
-    // Create a buffer of 16-bit indices
-    if (true) {
-        GLushort inds[IndexCount];
-        GLushort* pIndex = &inds[0];
-        GLushort n = 0;
-        for (GLushort i = 0; i < Slices; i++) {
-            for (GLushort j = 0; j < Stacks; j++) {
-                *pIndex++ = (n + j + Stacks) % VertexCount;
-                *pIndex++ = n + (j + 1) % Stacks;
-                *pIndex++ = n + j;
-                
-                *pIndex++ = (n + (j + 1) % Stacks + Stacks) % VertexCount;
-                *pIndex++ = (n + (j + 1) % Stacks) % VertexCount;
-                *pIndex++ = (n + j + Stacks) % VertexCount;
-            }
-            n += Stacks;
-        }
-
-        pezCheck(n == VertexCount, "Tessellation error.");
-        pezCheck(pIndex - &inds[0] == IndexCount, "Tessellation error.");
-
-        GLuint handle;
-        GLsizeiptr size = sizeof(inds);
-        const GLvoid* data = &inds[0];
-        GLenum usage = GL_STATIC_DRAW;
-        glGenBuffers(1, &handle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage);
-    }
-
-    mesh.VertexCount = VertexCount;
-    mesh.IndexCount = IndexCount;
-
-    glVertexAttribPointer(a("Position"), 3, GL_FLOAT, GL_FALSE, 24, 0);
-    glVertexAttribPointer(a("Normal"), 3, GL_FLOAT, GL_FALSE, 24, offset(12));
-    glEnableVertexAttribArray(a("Position"));
-    glEnableVertexAttribArray(a("Normal"));
-
-    pezCheck(OpenGLError);
-    return mesh;
-}
-
 static GLuint LoadTexture(const char* filename)
 {
-    unsigned char* buffer;
-    unsigned char* image;
-    size_t buffersize, imagesize;
-    LodePNG_Decoder decoder;
-    LodePNG_loadFile(&buffer, &buffersize, filename);
-    LodePNG_Decoder_init(&decoder);
-    decoder.infoRaw.color.colorType = 0;
-    decoder.infoRaw.color.bitDepth = 8;
-    LodePNG_Decoder_decode(&decoder, &image, &imagesize, buffer, buffersize);
-    pezCheck(!decoder.error, "error %u: %s\n", decoder.error, LodePNG_error_text(decoder.error));
-    int bpp = LodePNG_InfoColor_getBpp(&decoder.infoPng.color);
-    int bitDepth = decoder.infoPng.color.bitDepth;
-    int colorChannels = LodePNG_InfoColor_getChannels(&decoder.infoPng.color);
-    pezCheck(bpp == 8 && bitDepth == 8 && colorChannels == 1);
-    int w = decoder.infoPng.width;
-    int h = decoder.infoPng.height;
-    pezPrintString("Loaded %s (%d x %d) bufferSize = %d, imageSize = %d\n", filename, w, h, buffersize, imagesize);
-
-    GLuint handle;
-    glGenTextures(1, &handle);
-    glBindTexture(GL_TEXTURE_2D, handle);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    // The glyph table addresses the atlas from its top-left, so keep the PNG's row order.
+    GLuint handle = pezLoadTexture(filename, false);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, image);
-
-    free(buffer);
-    free(image);
-    LodePNG_Decoder_cleanup(&decoder);
-
     pezCheck(OpenGLError);
     return handle;
 }
@@ -469,16 +357,114 @@ static GLuint CreateQuad(int sourceWidth, int sourceHeight, int destWidth, int d
     return vao;
 }
 
-static GLuint CreateText(const char* text)
+static TextGridPod CreateGrid(int columns, int rows)
 {
-    GLuint vbo, vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, strlen(text), text, GL_STATIC_DRAW);
-    glVertexAttribPointer(a("Character"), 1, GL_UNSIGNED_BYTE, GL_FALSE, 8, 0);
-    glEnableVertexAttribArray(a("Character"));
+    TextGridPod grid;
+    grid.Columns = columns;
+    grid.Rows = rows;
+    grid.Cells = (CellPod*) calloc(columns * rows, sizeof(CellPod));
+    grid.DirtyRows = (bool*) calloc(rows, sizeof(bool));
+    for (int i = 0; i < columns * rows; i++) {
+        grid.Cells[i].Glyph = ' ';
+        grid.Cells[i].Foreground = 7;
+    }
+
+    glGenVertexArrays(1, &grid.Vao);
+    glBindVertexArray(grid.Vao);
+    glGenBuffers(1, &grid.Buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, grid.Buffer);
+    glBufferData(GL_ARRAY_BUFFER, columns * rows * sizeof(CellPod), grid.Cells, GL_DYNAMIC_DRAW);
+    glVertexAttribIPointer(0, 4, GL_UNSIGNED_BYTE, sizeof(CellPod), 0);
+    glVertexAttribDivisor(0, 1);
+    glEnableVertexAttribArray(0);
+    pezCheck(OpenGLError);
+    return grid;
+}
+
+// Writes a formatted string into the grid's shadow copy, clipped to the grid,
+// and marks the row dirty.
+static void PrintGrid(TextGridPod* grid, int column, int row, GLubyte foreground,
+                      GLubyte background, GLubyte attributes, const char* fmt, ...)
+{
+    char text[1024];
+    va_list a;
+    va_start(a, fmt);
+    vsnprintf(text, sizeof(text), fmt, a);
+    va_end(a);
+
+    const char* c = text;
+    while (*c && column < 0) {
+        c++, column++;
+    }
+    if (row < 0 || row >= grid->Rows || !*c || column >= grid->Columns) {
+        return;
+    }
+
+    CellPod* cell = grid->Cells + row * grid->Columns + column;
+    for (; *c && column < grid->Columns; c++, column++, cell++) {
+        cell->Glyph = *c;
+        cell->Attributes = attributes;
+        cell->Foreground = foreground;
+        cell->Background = background;
+    }
+    grid->DirtyRows[row] = true;
+}
+
+// Sends each run of consecutive dirty rows with a single glBufferSubData and
+// returns the number of rows that were sent.
+static int UploadGrid(TextGridPod* grid)
+{
+    GLsizeiptr rowSize = grid->Columns * sizeof(CellPod);
+    int uploaded = 0;
+    glBindBuffer(GL_ARRAY_BUFFER, grid->Buffer);
+    for (int row = 0; row < grid->Rows;) {
+        if (!grid->DirtyRows[row]) {
+            row++;
+            continue;
+        }
+        int first = row;
+        while (row < grid->Rows && grid->DirtyRows[row]) {
+            grid->DirtyRows[row++] = false;
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, first * rowSize, (row - first) * rowSize,
+                        grid->Cells + first * grid->Columns);
+        uploaded += row - first;
+    }
+    return uploaded;
+}
+
+// Uploads the glyph table to the current program as two vec4 arrays: where
+// each glyph lives in the atlas, and where its quad sits within a cell.
+static void LoadGlyphs(const char* filename)
+{
+    Globals.Glyphs = pezLoadGlyphs(filename);
+    const PezGlyphs* glyphs = &Globals.Glyphs;
+    const int count = glyphs->GlyphCount;
+    pezCheck(count > 0 && count <= PEZ_MAX_GLYPHS, "%s has %d glyphs; the text shaders hold 1 to %d.",
+             filename, count, PEZ_MAX_GLYPHS);
+    GLfloat* rects = (GLfloat*) malloc(sizeof(GLfloat) * 4 * count);
+    GLfloat* bounds = (GLfloat*) malloc(sizeof(GLfloat) * 4 * count);
+    const float s = 1.0f / glyphs->AtlasWidth, t = 1.0f / glyphs->AtlasHeight;
+    const float texelSize = 1.0f / glyphs->Resolution;
+    for (int i = 0; i < count; i++) {
+        const PezGlyph* glyph = glyphs->Glyphs + i;
+        rects[i*4+0] = glyph->X * s;
+        rects[i*4+1] = glyph->Y * t;
+        rects[i*4+2] = (glyph->X + glyph->Width) * s;
+        rects[i*4+3] = (glyph->Y + glyph->Height) * t;
+        bounds[i*4+0] = glyph->Left;
+        bounds[i*4+1] = glyph->Top;
+        bounds[i*4+2] = glyph->Width * texelSize;
+        bounds[i*4+3] = glyph->Height * texelSize;
+    }
+
+    glUniform4fv(u("GlyphRects"), count, rects);
+    glUniform4fv(u("GlyphBounds"), count, bounds);
+    glUniform2f(u("CellSize"), glyphs->CellWidth, glyphs->CellHeight);
+    glUniform1i(u("FirstCharacter"), glyphs->FirstCharacter);
+    glUniform1i(u("GlyphCount"), count);
+
+    free(rects);
+    free(bounds);
     pezCheck(OpenGLError);
-    return vao;
 }
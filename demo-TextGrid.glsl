@@ -1,138 +1,87 @@
--- Text.VS
-
-in uint Character;
-out uint vCharacter;
-uniform int GlyphWidth = 32;
-
-void main()
-{
-    vec2 p;
-    p.x = float(gl_VertexID) * GlyphWidth;
-    p.y = 0;
-    vCharacter = Character;
-    gl_Position = vec4(p, 0, 1);
-}
-
-
--- Text.GS
-
-layout(points) in;
-layout(triangle_strip, max_vertices = 4) out;
-
-in uint vCharacter[1];
-out vec2 gTexCoord;
-uniform sampler2D Sampler;
+-- Grid.VS
+
+// Each instance is one cell; its four vertices form the cell's quad.
+layout(location = 0) in uvec4 Cell; // glyph, attributes, foreground, background
+
+out vec2 vCellPosition;
+flat out vec4 vRect;
+flat out vec4 vBounds;
+flat out vec3 vForeground;
+flat out vec4 vBackground;
+flat out uint vAttributes;
+
+uniform vec4 GlyphRects[MaxGlyphs];  // atlas texcoords: left, top, right, bottom
+uniform vec4 GlyphBounds[MaxGlyphs]; // font pixels: left, top, width, height
+uniform int FirstCharacter;
+uniform int GlyphCount;
+uniform vec2 CellSize;
+uniform float Scale;
+uniform int Columns;
+uniform vec2 InverseViewport;
+uniform float BackgroundAlpha = 0.75;
+
+const uint Inverse = 4u;
+
+const vec3 Palette[16] = vec3[16](
+    vec3(0.00, 0.00, 0.00), vec3(0.00, 0.00, 0.67), vec3(0.00, 0.67, 0.00), vec3(0.00, 0.67, 0.67),
+    vec3(0.67, 0.00, 0.00), vec3(0.67, 0.00, 0.67), vec3(0.67, 0.33, 0.00), vec3(0.67, 0.67, 0.67),
+    vec3(0.33, 0.33, 0.33), vec3(0.33, 0.33, 1.00), vec3(0.33, 1.00, 0.33), vec3(0.33, 1.00, 1.00),
+    vec3(1.00, 0.33, 0.33), vec3(1.00, 0.33, 1.00), vec3(1.00, 1.00, 0.33), vec3(1.00, 1.00, 1.00));
 
 void main()
 {
-    /*
-    vec4 P = gl_in[0].gl_Position;
-    vec4 U = vec4(SpriteSize.x, 0, 0, 0) * InverseViewport.x;
-    vec4 V = vec4(0, SpriteSize.y, 0, 0) * InverseViewport.y;
-    */
-
-    vec4 P = vec4(0, 0, 0, 1);
-    vec4 U = vec4(1, 0, 0, 0);
-    vec4 V = vec4(0, 1, 0, 0);
-
-    // Letter 'H' is column 16, row 1.
-    // Letter 'h' is column 0, row 3.
-    // Columns and Rows increase Right-Down.
-    float column = 8;
-    float row = 3;
-
-    float ColumnCount = 24;
-    float RowCount = 4;
-
-    ivec2 size = textureSize(Sampler, 0);
-
-    ivec2 padding = ivec2(2, 16);
-    vec2 offset = vec2(6, 0);
-    int rowPadding = 2; // not yet used
-
-    float GlyphWidth = float(size.x - padding.x) / ColumnCount;
-    float GlyphHeight = float(size.y - padding.y) / RowCount;
-
-    float S0 = (offset.x + (column+0) * GlyphWidth) / float(size.x);
-    float S1 = (offset.x + (column+1) * GlyphWidth) / float(size.x);
-    float T0 = (offset.y + (row+0) * GlyphHeight) / float(size.y);
-    float T1 = (offset.y + (row+1) * GlyphHeight) / float(size.y);
-    S0 = 0.0;S1 = 1.0;T0 = 0.0;T1 = 1.0;
-
-    gTexCoord = vec2(S0, T1);
-    gl_Position = P - U - V;
-    EmitVertex();
-
-    gTexCoord = vec2(S1, T1);
-    gl_Position = P + U - V;
-    EmitVertex();
-
-    gTexCoord = vec2(S0, T0);
-    gl_Position = P - U + V;
-    EmitVertex();
-
-    gTexCoord = vec2(S1, T0);
-    gl_Position = P + U + V;
-    gl_Position.z += float(vCharacter[0]) * 0.00000000001;
-    EmitVertex();
-
-    EndPrimitive();
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 cell = vec2(gl_InstanceID % Columns, gl_InstanceID / Columns);
+    vec2 p = Scale * CellSize * (cell + corner) * InverseViewport * 2.0 - 1.0;
+    gl_Position = vec4(p.x, -p.y, 0, 1);
+    vCellPosition = CellSize * corner;
+
+    int letter = int(Cell.x) - FirstCharacter;
+    bool valid = letter >= 0 && letter < GlyphCount;
+    vRect = valid ? GlyphRects[letter] : vec4(0);
+    vBounds = valid ? GlyphBounds[letter] : vec4(0);
+
+    vec3 foreground = Palette[Cell.z & 15u];
+    vec3 background = Palette[Cell.w & 15u];
+    bool inverse = (Cell.y & Inverse) != 0u;
+    vForeground = inverse ? background : foreground;
+    vBackground = vec4(inverse ? foreground : background, BackgroundAlpha);
+    vAttributes = Cell.y;
 }
 
--- Text.Smooth.FS
+-- Grid.FS
 
 out vec4 FragColor;
-in vec2 gTexCoord;
+in vec2 vCellPosition;
+flat in vec4 vRect;
+flat in vec4 vBounds;
+flat in vec3 vForeground;
+flat in vec4 vBackground;
+flat in uint vAttributes;
 
 uniform sampler2D Sampler;
-//uniform vec3 TextColor = vec3(0.275, 0.510, 0.706); // SteelBlue
-uniform vec3 TextColor = vec3(0.686, 0.933, 0.933); // PaleTurquoise
+uniform vec2 CellSize;
+
+const uint Bold = 1u;
+const uint Underline = 2u;
 
+// The glyph's atlas rectangle is padded by the distance spread, so clamping
+// to its edge reads "far outside" for the rest of the cell.
 void main()
 {
-    float D = texture(Sampler, gTexCoord).r;
-    float width = fwidth(D);
-    float T = 0.5;
-    float A = 1.0 - smoothstep(T - width, T + width, D);
-
-    FragColor = vec4(TextColor, A);
-
-    int GlyphWidth = 29;
-    int OffsetFromLeft = 11;
-    int GlyphHeight = 52;
-    int OffsetFromBottom = 14;
-
-    if (int(gl_FragCoord.x - OffsetFromLeft) % GlyphWidth == 0) {
-        FragColor = vec4(0,0,0,1);
-    }
-
-    if (int(gl_FragCoord.y - OffsetFromBottom) % GlyphHeight == 0) {
-        FragColor = vec4(0,0,0,1);
+    float D = 0.0;
+    if (vBounds.z > 0.0) {
+        vec2 uv = clamp((vCellPosition - vBounds.xy) / vBounds.zw, 0.0, 1.0);
+        D = texture(Sampler, mix(vRect.xy, vRect.zw, uv)).r;
     }
-}
-
--- Text.Outline.FS
-
-out vec4 FragColor;
-in vec2 gTexCoord;
 
-uniform sampler2D Sampler;
-uniform float Thickness = 0.03;
-
-void main()
-{
-    float D = texture(Sampler, gTexCoord).x;
     float width = fwidth(D);
+    float edge = (vAttributes & Bold) != 0u ? 0.45 : 0.5;
+    float A = smoothstep(edge - width, edge + width, D);
+    if ((vAttributes & Underline) != 0u && vCellPosition.y > CellSize.y - 2.0)
+        A = 1.0;
 
-    if (D < 0.5 - Thickness) {
-        float A = 1.0 - smoothstep(0.5 - Thickness - width, 0.5 - Thickness, D);
-        FragColor = vec4(A, A, A, 1);
-    } else if (D < 0.5 + Thickness) {
-        FragColor = vec4(0, 0, 0, 1);
-    } else {
-        float A = 1.0 - smoothstep(0.5 + Thickness, 0.5 + Thickness + width, D);
-        FragColor = vec4(0, 0, 0, A);
-    }
+    FragColor = mix(vBackground, vec4(vForeground, 1), A);
 }
 
 ----------------------------------------------------------------
@@ -163,17 +112,20 @@ void main()
 
 -- Lit.VS
 
-in vec4 Position;
-in vec3 Normal;
+layout(location = 0) in vec4 Position;
+layout(location = 1) in vec3 Normal;
 
 out vec3 vPosition;
 out vec3 vNormal;
 
-uniform mat4 Projection;
-uniform mat4 Modelview;
-uniform mat4 ViewMatrix;
-uniform mat4 ModelMatrix;
-uniform mat3 NormalMatrix;
+layout(std140, binding = 0) uniform Transforms
+{
+    mat4 Projection;
+    mat4 ViewMatrix;
+    mat4 ModelMatrix;
+    mat4 Modelview;
+    mat3 NormalMatrix;
+};
 
 void main()
 {
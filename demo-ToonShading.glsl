@@ -1,17 +1,20 @@
 
 -- Lit.VS
 
-in vec4 Position;
-in vec3 Normal;
+layout(location = 0) in vec4 Position;
+layout(location = 1) in vec3 Normal;
 
 out vec3 vPosition;
 out vec3 vNormal;
 
-uniform mat4 Projection;
-uniform mat4 Modelview;
-uniform mat4 ViewMatrix;
-uniform mat4 ModelMatrix;
-uniform mat3 NormalMatrix;
+layout(std140, binding = 0) uniform Transforms
+{
+    mat4 Projection;
+    mat4 ViewMatrix;
+    mat4 ModelMatrix;
+    mat4 Modelview;
+    mat3 NormalMatrix;
+};
 
 void main()
 {
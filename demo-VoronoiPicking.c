@@ -1,13 +1,72 @@
 // Voronoi Picking OpenGL Demo by Philip Rideout
 // Licensed under the Creative Commons Attribution 3.0 Unported License. 
 // http://creativecommons.org/licenses/by/3.0/
+//
+// Dragging the mouse shows the cloud's sprites; each release moves on to the
+// next of these modes:
+//
+//   Voronoi:  opaque nailboards whose cone-shaped depth carves out the cells
+//   Unsorted: a denser cloud of translucent sprites, blended in vertex order
+//   Sorted:   the same, drawn back to front after a parallel radix sort
+//   Weighted: the same, through weighted blended order-independent
+//             transparency (McGuire and Bavoil): an accumulation and a
+//             revealage target, then a resolve pass
+//   Particles: a million particles that never leave the GPU, launched by a
+//             few emitters and pulled by gravity and an orbiting attractor;
+//             transform feedback ping-pongs their state between two buffers
+//
+// While dragging, or while the particles run, the CPU sort time and the GPU
+// time of the sprites are printed every couple of seconds.
+
+#define _POSIX_C_SOURCE 200112L
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
 #include "pez.h"
 #include "vmath.h"
 
+enum { VoronoiMode, UnsortedMode, SortedMode, WeightedMode, ParticleMode, ModeCount };
+static const char* ModeNames[ModeCount] = { "Voronoi", "Unsorted", "Sorted", "Weighted", "Particles" };
+enum { TranslucentCount = 16384, SortGrain = 2048, RadixSize = 256 };
+enum { ChunkCount = (TranslucentCount + SortGrain - 1) / SortGrain };
+static const float TranslucentSpriteSize = 24;
+static const float TranslucentOpacity = 0.5f;
+static const float ReportInterval = 2.0f;
+
+// Particle state, interleaved; Age is negative until the particle is born.
+// The update shader respawns particles at the emitters when Age passes Life.
+typedef struct {
+    float Position[3];
+    float Age;
+    float Velocity[3];
+    float Life;
+} Particle;
+
+enum { ParticleCount = 1 << 20, EmitterCount = 3 };
+static const float ParticleSpriteSize = 4;
+static const float ParticleOpacity = 0.05f;
+static const float ParticleDrag = 0.2f;
+static const float ParticleGravity = 3.0f;
+static const float AttractorStrength = 4.0f;
+static const float AttractorRadiansPerSecond = 0.8f;
+
+// Back-to-front order of the translucent cloud, by view-space depth.  Each
+// pass of the LSD radix sort histograms its chunks of the source in parallel,
+// then scatters them in parallel, each chunk to its own stable offsets.
+typedef struct {
+    const GLfloat* Positions;
+    Vector4 DepthRow;
+    unsigned* Keys[2];
+    unsigned* Indices[2];
+    int Source;
+    int Shift;
+    unsigned Histograms[ChunkCount][RadixSize];
+} DepthSort;
+
 struct {
+    int Mode;
     int VertexCount;
     bool IsDragging;
     float Theta;
@@ -24,15 +83,54 @@ struct {
     GLuint CloudVao;
     GLuint SinglePointVao;
     GLuint OffscreenFbo, ColorTexture, IdTexture;
+    GLuint BlendProgram;
+    GLuint WeightedProgram;
+    GLuint ResolveProgram;
+    GLuint TranslucentVao;
+    GLuint SortedIndices;
+    GLuint WeightedFbo, AccumTexture, RevealTexture;
+    GLuint UpdateProgram;
+    GLuint ParticleProgram;
+    GLuint ParticleBuffers[2];
+    GLuint UpdateVaos[2];
+    GLuint ParticleVaos[2];
+    int ParticleSource;
+    unsigned ParticleFrame;
+    float ParticleSeconds;
+    float DeltaSeconds;
+    bool ParticlesReset;
+    GLuint Queries[2];
+    int QueryCount;
+    int Frames;
+    int GpuFrames;
+    double SortSeconds;
+    double GpuSeconds;
+    float SinceReport;
 } Globals;
 
+static DepthSort Sort;
+
 static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKey);
+static GLuint LoadFeedbackProgram(const char* vsKey, const char** varyings, int varyingCount);
 static GLuint CurrentProgram();
 static GLuint CreateSinglePoint();
 static void ModifySinglePoint(GLuint vao, Vector3 v);
-static GLuint CreatePointCloud(float radius, int count);
+static GLfloat* CreatePositions(float radius, int count);
+static GLuint CreatePointCloud(const GLfloat* positions, int count);
 static GLuint CreateRenderTarget(GLuint* colorTexture, GLuint* idTexture);
+static GLuint CreateWeightedTarget(GLuint* accumTexture, GLuint* revealTexture);
 static GLuint CreateQuad(int sourceWidth, int sourceHeight, int destWidth, int destHeight);
+static void DrawTranslucentSprites(float w, float h);
+static void CreateParticles();
+static void UpdateParticles();
+static void DrawParticles(float w, float h);
+static void BeginTiming();
+static void EndTiming();
+static void SortByDepth();
+static void KeyJob(void* data, int begin, int end);
+static void HistogramJob(void* data, int begin, int end);
+static void ScatterJob(void* data, int begin, int end);
+static double GetSeconds();
 
 #define u(x) glGetUniformLocation(CurrentProgram(), x)
 #define a(x) glGetAttribLocation(CurrentProgram(), x)
@@ -58,6 +156,12 @@ void PezInitialize()
     // Compile shaders
     Globals.QuadProgram = LoadProgram("Quad.VS", 0, "Quad.FS");
     Globals.SpriteProgram = LoadProgram("VS", "Sprite.GS", "Sprite.FS");
+    Globals.BlendProgram = LoadProgram("VS", "Sprite.GS", "Sprite.Blend.FS");
+    Globals.WeightedProgram = LoadProgram("VS", "Sprite.GS", "Sprite.Weighted.FS");
+    Globals.ResolveProgram = LoadProgram("Quad.VS", 0, "Resolve.FS");
+    Globals.ParticleProgram = LoadProgram("Particle.VS", "Sprite.GS", "Sprite.Blend.FS");
+    const char* varyings[] = { "tfPosition", "tfAge", "tfVelocity", "tfLife" };
+    Globals.UpdateProgram = LoadFeedbackProgram("Particle.Update.VS", varyings, 4);
     Globals.PointProgram = LoadProgram("VS", 0, "Point.FS");
 
     // Set up viewport
@@ -70,8 +174,27 @@ void PezInitialize()
     // Create geometry
     Globals.SinglePointVao = CreateSinglePoint();
     Globals.QuadVao = CreateQuad(cfg.Width, cfg.Height, cfg.Width, cfg.Height);
-    Globals.CloudVao = CreatePointCloud(5.0f, 400);
+    GLfloat* positions = CreatePositions(5.0f, 400);
+    Globals.VertexCount = 400;
+    Globals.CloudVao = CreatePointCloud(positions, Globals.VertexCount);
+    free(positions);
     Globals.OffscreenFbo = CreateRenderTarget(&Globals.ColorTexture, &Globals.IdTexture);
+    Globals.WeightedFbo = CreateWeightedTarget(&Globals.AccumTexture, &Globals.RevealTexture);
+
+    // The translucent cloud keeps its positions for sorting, and gets an
+    // index buffer for the sorted order
+    Sort.Positions = CreatePositions(5.0f, TranslucentCount);
+    Globals.TranslucentVao = CreatePointCloud(Sort.Positions, TranslucentCount);
+    glGenBuffers(1, &Globals.SortedIndices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Globals.SortedIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * TranslucentCount, 0, GL_STREAM_DRAW);
+    for (int i = 0; i < 2; i++) {
+        Sort.Keys[i] = (unsigned*) malloc(sizeof(unsigned) * TranslucentCount);
+        Sort.Indices[i] = (unsigned*) malloc(sizeof(unsigned) * TranslucentCount);
+        pezCheck(Sort.Keys[i] && Sort.Indices[i], "Out of memory.");
+    }
+    glGenQueries(2, Globals.Queries);
+    CreateParticles();
 
     // Misc Initialization
     Globals.IsDragging = false;
@@ -93,6 +216,26 @@ void PezUpdate(float seconds)
     Vector3 up = {0, 1, 0};
     Globals.ViewMatrix = M4MakeLookAt(eye, target, up);
     Globals.Modelview = M4Mul(Globals.ViewMatrix, Globals.ModelMatrix);
+
+    if (Globals.Mode == ParticleMode) {
+        Globals.ParticleSeconds += seconds;
+        Globals.DeltaSeconds = seconds;
+    }
+
+    bool timing = Globals.IsDragging || Globals.Mode == ParticleMode;
+    Globals.SinceReport += seconds;
+    if (timing && Globals.SinceReport >= ReportInterval && Globals.Frames) {
+        double gpu = Globals.GpuFrames ? 1000 * Globals.GpuSeconds / Globals.GpuFrames : 0.0;
+        if (Globals.Mode == ParticleMode) {
+            pezPrintString("Particles: update and sprites %.2f ms\n", gpu);
+        } else {
+            pezPrintString("%s: sort %.2f ms, sprites %.2f ms\n", ModeNames[Globals.Mode],
+                           1000 * Globals.SortSeconds / Globals.Frames, gpu);
+        }
+        Globals.Frames = Globals.GpuFrames = 0;
+        Globals.SortSeconds = Globals.GpuSeconds = 0;
+        Globals.SinceReport = 0;
+    }
 }
 
 void PezRender()
@@ -102,23 +245,34 @@ void PezRender()
     float* pModelview = (float*) &Globals.Modelview;
     float* pProjection = (float*) &Globals.Projection;
 
-    glUseProgram(Globals.PointProgram);
-    glBindVertexArray(Globals.CloudVao);
-    glUniformMatrix4fv(u("ViewMatrix"), 1, 0, pView);
-    glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pModel);
-    glUniformMatrix4fv(u("Modelview"), 1, 0, pModelview);
-    glUniformMatrix4fv(u("Projection"), 1, 0, pProjection);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glEnable(GL_DEPTH_TEST);
-    glDrawArrays(GL_POINTS, 0, Globals.VertexCount);
+    bool translucent = Globals.Mode >= UnsortedMode && Globals.Mode <= WeightedMode;
+    bool particles = Globals.Mode == ParticleMode;
 
     const float w = PezGetConfig().Width;
     const float h = PezGetConfig().Height;
     const float s = 64;
 
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+
+    if (particles) {
+        UpdateParticles();
+        DrawParticles(w, h);
+    } else {
+        glUseProgram(Globals.PointProgram);
+        glBindVertexArray(translucent ? Globals.TranslucentVao : Globals.CloudVao);
+        glUniformMatrix4fv(u("ViewMatrix"), 1, 0, pView);
+        glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pModel);
+        glUniformMatrix4fv(u("Modelview"), 1, 0, pModelview);
+        glUniformMatrix4fv(u("Projection"), 1, 0, pProjection);
+        glDrawArrays(GL_POINTS, 0, translucent ? TranslucentCount : Globals.VertexCount);
+    }
+
     glClear(GL_DEPTH_BUFFER_BIT);
     
-    if (Globals.IsDragging) {
+    if (Globals.IsDragging && translucent) {
+        DrawTranslucentSprites(w, h);
+    } else if (Globals.IsDragging && !particles) {
         glUseProgram(Globals.SpriteProgram);
         glUniformMatrix4fv(u("ViewMatrix"), 1, 0, pView);
         glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pModel);
@@ -172,11 +326,310 @@ void PezHandleMouse(int x, int y, int action)
 
     if (action == PEZ_DOWN) {
         Globals.IsDragging = true;
+        Globals.QueryCount = 0;
+        Globals.Frames = Globals.GpuFrames = 0;
+        Globals.SortSeconds = Globals.GpuSeconds = 0;
+        Globals.SinceReport = 0;
+        pezPrintString("%s sprites\n", ModeNames[Globals.Mode]);
     } else if (action == PEZ_UP) {
         Globals.IsDragging = false;
+        Globals.Mode = (Globals.Mode + 1) % ModeCount;
+        Globals.QueryCount = 0;
+        Globals.Frames = Globals.GpuFrames = 0;
+        Globals.GpuSeconds = 0;
+        Globals.SinceReport = 0;
+        if (Globals.Mode == ParticleMode) {
+            Globals.ParticlesReset = true;
+            pezPrintString("%d particles\n", ParticleCount);
+        }
+    }
+}
+
+static void DrawTranslucentSprites(float w, float h)
+{
+    float* pView = (float*) &Globals.ViewMatrix;
+    float* pModel = (float*) &Globals.ModelMatrix;
+    float* pModelview = (float*) &Globals.Modelview;
+    float* pProjection = (float*) &Globals.Projection;
+
+    bool weighted = Globals.Mode == WeightedMode;
+    bool sorted = Globals.Mode == SortedMode;
+    if (sorted) {
+        double start = GetSeconds();
+        SortByDepth();
+        Globals.SortSeconds += GetSeconds() - start;
+    }
+    Globals.Frames++;
+
+    BeginTiming();
+    glBindVertexArray(Globals.TranslucentVao);
+    if (sorted) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Globals.SortedIndices);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(GLuint) * TranslucentCount,
+                        Sort.Indices[Sort.Source]);
+    }
+
+    glUseProgram(weighted ? Globals.WeightedProgram : Globals.BlendProgram);
+    glUniformMatrix4fv(u("ViewMatrix"), 1, 0, pView);
+    glUniformMatrix4fv(u("ModelMatrix"), 1, 0, pModel);
+    glUniformMatrix4fv(u("Modelview"), 1, 0, pModelview);
+    glUniformMatrix4fv(u("Projection"), 1, 0, pProjection);
+    glUniform2f(u("SpriteSize"), TranslucentSpriteSize, TranslucentSpriteSize);
+    if (!weighted) {
+        glUniform1f(u("Opacity"), TranslucentOpacity);
+    }
+    glUniform2f(u("HalfViewport"), w / 2.0f, h / 2.0f);
+    glUniform2f(u("InverseViewport"), 1.0f / w, 1.0f / h);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+
+    if (weighted) {
+        const GLfloat zero[4] = {0, 0, 0, 0};
+        const GLfloat one[4] = {1, 1, 1, 1};
+        const GLenum buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glBindFramebuffer(GL_FRAMEBUFFER, Globals.WeightedFbo);
+        glDrawBuffers(2, buffers);
+        glClearBufferfv(GL_COLOR, 0, zero);
+        glClearBufferfv(GL_COLOR, 1, one);
+        glBlendFunci(0, GL_ONE, GL_ONE);
+        glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+        glDrawArrays(GL_POINTS, 0, TranslucentCount);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        // Composite the average color over the frame:
+        glUseProgram(Globals.ResolveProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, Globals.AccumTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, Globals.RevealTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(u("Accumulation"), 0);
+        glUniform1i(u("Revealage"), 1);
+        glBindVertexArray(Globals.QuadVao);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    } else if (sorted) {
+        glDrawElements(GL_POINTS, TranslucentCount, GL_UNSIGNED_INT, 0);
+    } else {
+        glDrawArrays(GL_POINTS, 0, TranslucentCount);
+    }
+
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    EndTiming();
+}
+
+// Both particle buffers are filled on the GPU, by a reset pass of the update
+// shader before the first frame of the particle mode; after that, the only
+// traffic from the CPU is a handful of uniforms.
+static void CreateParticles()
+{
+    GLsizeiptr size = sizeof(Particle) * ParticleCount;
+    glGenBuffers(2, Globals.ParticleBuffers);
+    glGenVertexArrays(2, Globals.UpdateVaos);
+    glGenVertexArrays(2, Globals.ParticleVaos);
+
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_ARRAY_BUFFER, Globals.ParticleBuffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, size, 0, GL_DYNAMIC_COPY);
+        pezCheck(GL_NO_ERROR == glGetError(), "Unable to create particle buffer.");
+
+        glUseProgram(Globals.UpdateProgram);
+        glBindVertexArray(Globals.UpdateVaos[i]);
+        glVertexAttribPointer(a("Position"), 3, GL_FLOAT, GL_FALSE, sizeof(Particle), offset(0));
+        glVertexAttribPointer(a("Age"), 1, GL_FLOAT, GL_FALSE, sizeof(Particle), offset(12));
+        glVertexAttribPointer(a("Velocity"), 3, GL_FLOAT, GL_FALSE, sizeof(Particle), offset(16));
+        glVertexAttribPointer(a("Life"), 1, GL_FLOAT, GL_FALSE, sizeof(Particle), offset(28));
+        glEnableVertexAttribArray(a("Position"));
+        glEnableVertexAttribArray(a("Age"));
+        glEnableVertexAttribArray(a("Velocity"));
+        glEnableVertexAttribArray(a("Life"));
+
+        glUseProgram(Globals.ParticleProgram);
+        glBindVertexArray(Globals.ParticleVaos[i]);
+        glVertexAttribPointer(a("Position"), 3, GL_FLOAT, GL_FALSE, sizeof(Particle), offset(0));
+        glVertexAttribPointer(a("Age"), 1, GL_FLOAT, GL_FALSE, sizeof(Particle), offset(12));
+        glEnableVertexAttribArray(a("Position"));
+        glEnableVertexAttribArray(a("Age"));
+    }
+
+    Globals.ParticleSource = 0;
+    Globals.ParticlesReset = true;
+}
+
+// Advances the particles by one step, from the source buffer into the other
+// one, with rasterization off.
+static void UpdateParticles()
+{
+    const float EmitterRadius = 3;
+    const float EmitterHeight = -4;
+    const float LaunchSpeed = 5;
+
+    int source = Globals.ParticleSource;
+    int target = 1 - source;
+    float t = Globals.ParticleSeconds;
+
+    BeginTiming();
+    glUseProgram(Globals.UpdateProgram);
+    GLfloat emitters[EmitterCount][4];
+    for (int i = 0; i < EmitterCount; i++) {
+        float theta = TwoPi * i / EmitterCount;
+        emitters[i][0] = EmitterRadius * cos(theta);
+        emitters[i][1] = EmitterRadius * sin(theta);
+        emitters[i][2] = EmitterHeight;
+        emitters[i][3] = LaunchSpeed;
+    }
+    float phi = t * AttractorRadiansPerSecond;
+    glUniform4fv(u("Emitters"), EmitterCount, &emitters[0][0]);
+    glUniform3f(u("Gravity"), 0, 0, -ParticleGravity);
+    glUniform4f(u("Attractor"), 2 * cos(phi), 2 * sin(phi), 1, AttractorStrength);
+    glUniform1f(u("Drag"), ParticleDrag);
+    glUniform1f(u("DeltaTime"), Globals.ParticlesReset ? 0 : Globals.DeltaSeconds);
+    glUniform1ui(u("Frame"), Globals.ParticleFrame++);
+    glUniform1i(u("Reset"), Globals.ParticlesReset);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(Globals.UpdateVaos[source]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, Globals.ParticleBuffers[target]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, ParticleCount);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    Globals.ParticleSource = target;
+    Globals.ParticlesReset = false;
+}
+
+static void DrawParticles(float w, float h)
+{
+    float* pModelview = (float*) &Globals.Modelview;
+    float* pProjection = (float*) &Globals.Projection;
+
+    glUseProgram(Globals.ParticleProgram);
+    glUniformMatrix4fv(u("Modelview"), 1, 0, pModelview);
+    glUniformMatrix4fv(u("Projection"), 1, 0, pProjection);
+    glUniform2f(u("SpriteSize"), ParticleSpriteSize, ParticleSpriteSize);
+    glUniform2f(u("HalfViewport"), w / 2.0f, h / 2.0f);
+    glUniform2f(u("InverseViewport"), 1.0f / w, 1.0f / h);
+    glUniform1f(u("Opacity"), ParticleOpacity);
+
+    // Additive, so that no order is needed:
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    glBindVertexArray(Globals.ParticleVaos[Globals.ParticleSource]);
+    glDrawArrays(GL_POINTS, 0, ParticleCount);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+
+    EndTiming();
+    Globals.Frames++;
+}
+
+// Reads back the query from two frames ago, so as not to stall.
+static void BeginTiming()
+{
+    int query = Globals.QueryCount & 1;
+    if (Globals.QueryCount >= 2) {
+        GLuint64 elapsed;
+        glGetQueryObjectui64v(Globals.Queries[query], GL_QUERY_RESULT, &elapsed);
+        Globals.GpuSeconds += elapsed * 1e-9;
+        Globals.GpuFrames++;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, Globals.Queries[query]);
+}
+
+static void EndTiming()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    Globals.QueryCount++;
+}
+
+// Farthest first: view-space depths are negative, so the keys map floats to
+// unsigned integers in ascending order.
+static void SortByDepth()
+{
+    Matrix4 m = Globals.Modelview;
+    Sort.DepthRow = (Vector4){m.col0.z, m.col1.z, m.col2.z, m.col3.z};
+    Sort.Source = 0;
+    Sort.Shift = 0;
+    pezParallelFor(TranslucentCount, SortGrain, KeyJob, 0);
+
+    for (Sort.Shift = 0; Sort.Shift < 32; Sort.Shift += 8) {
+        if (Sort.Shift) {
+            pezParallelFor(TranslucentCount, SortGrain, HistogramJob, 0);
+        }
+
+        // Turn the counts into each chunk's first slot for each digit.  A pass
+        // where every key has the same digit leaves the order as it is.
+        unsigned offset = 0;
+        bool uniform = false;
+        for (int digit = 0; digit < RadixSize; digit++) {
+            unsigned total = 0;
+            for (int chunk = 0; chunk < ChunkCount; chunk++) {
+                unsigned count = Sort.Histograms[chunk][digit];
+                Sort.Histograms[chunk][digit] = offset + total;
+                total += count;
+            }
+            uniform = uniform || total == TranslucentCount;
+            offset += total;
+        }
+        if (!uniform) {
+            pezParallelFor(TranslucentCount, SortGrain, ScatterJob, 0);
+            Sort.Source = 1 - Sort.Source;
+        }
+    }
+}
+
+static void KeyJob(void* data, int begin, int end)
+{
+    const Vector4 row = Sort.DepthRow;
+    unsigned* keys = Sort.Keys[Sort.Source];
+    unsigned* indices = Sort.Indices[Sort.Source];
+    for (int i = begin; i < end; i++) {
+        const GLfloat* p = Sort.Positions + 3 * i;
+        float depth = row.x * p[0] + row.y * p[1] + row.z * p[2] + row.w;
+        unsigned bits;
+        memcpy(&bits, &depth, sizeof(bits));
+        keys[i] = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+        indices[i] = i;
+    }
+    HistogramJob(data, begin, end);
+}
+
+static void HistogramJob(void* data, int begin, int end)
+{
+    unsigned* histogram = Sort.Histograms[begin / SortGrain];
+    const unsigned* keys = Sort.Keys[Sort.Source];
+    memset(histogram, 0, sizeof(unsigned) * RadixSize);
+    for (int i = begin; i < end; i++) {
+        histogram[(keys[i] >> Sort.Shift) & (RadixSize - 1)]++;
+    }
+}
+
+static void ScatterJob(void* data, int begin, int end)
+{
+    unsigned* offsets = Sort.Histograms[begin / SortGrain];
+    const unsigned* keys = Sort.Keys[Sort.Source];
+    const unsigned* indices = Sort.Indices[Sort.Source];
+    unsigned* sortedKeys = Sort.Keys[1 - Sort.Source];
+    unsigned* sortedIndices = Sort.Indices[1 - Sort.Source];
+    for (int i = begin; i < end; i++) {
+        unsigned slot = offsets[(keys[i] >> Sort.Shift) & (RadixSize - 1)]++;
+        sortedKeys[slot] = keys[i];
+        sortedIndices[slot] = indices[i];
     }
 }
 
+static double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 static GLuint CurrentProgram()
 {
     GLuint p;
@@ -231,6 +684,32 @@ static GLuint LoadProgram(const char* vsKey, const char* gsKey, const char* fsKe
     return programHandle;
 }
 
+static GLuint LoadFeedbackProgram(const char* vsKey, const char** varyings, int varyingCount)
+{
+    GLchar spew[256];
+    GLint compileSuccess;
+    GLuint programHandle = glCreateProgram();
+
+    const char* vsSource = pezGetShader(vsKey);
+    pezCheck(vsSource != 0, "Can't find vshader: %s\n", vsKey);
+    GLuint vsHandle = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vsHandle, 1, &vsSource, 0);
+    glCompileShader(vsHandle);
+    glGetShaderiv(vsHandle, GL_COMPILE_STATUS, &compileSuccess);
+    glGetShaderInfoLog(vsHandle, sizeof(spew), 0, spew);
+    pezCheck(compileSuccess, "Can't compile vshader:\n%s", spew);
+    glAttachShader(programHandle, vsHandle);
+
+    glTransformFeedbackVaryings(programHandle, varyingCount, varyings, GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(programHandle);
+    GLint linkSuccess;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &linkSuccess);
+    glGetProgramInfoLog(programHandle, sizeof(spew), 0, spew);
+    pezCheck(linkSuccess, "Can't link shaders:\n%s", spew);
+    glUseProgram(programHandle);
+    return programHandle;
+}
+
 static GLuint CreateSinglePoint()
 {
     GLuint vao;
@@ -263,16 +742,10 @@ static void ModifySinglePoint(GLuint vao, Vector3 v)
     glBufferData(GL_ARRAY_BUFFER, size, &v.x, GL_STATIC_DRAW);
 }
 
-static GLuint CreatePointCloud(float r, int pointCount)
+static GLfloat* CreatePositions(float r, int pointCount)
 {
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    Globals.VertexCount = pointCount;
-    int vertexStride = sizeof(float) * 3;
-    GLsizeiptr size = Globals.VertexCount * vertexStride;
-    GLfloat* positions = (GLfloat*) malloc(size);
+    GLfloat* positions = (GLfloat*) malloc(sizeof(GLfloat) * 3 * pointCount);
+    pezCheck(positions != 0, "Out of memory.");
 
     GLfloat* position = positions;
     for (int slice = 0; slice < pointCount; slice++) {
@@ -287,6 +760,17 @@ static GLuint CreatePointCloud(float r, int pointCount)
         *position++ = y;
         *position++ = z;
     }
+    return positions;
+}
+
+static GLuint CreatePointCloud(const GLfloat* positions, int pointCount)
+{
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    int vertexStride = sizeof(float) * 3;
+    GLsizeiptr size = pointCount * vertexStride;
 
     GLuint handle;
     glGenBuffers(1, &handle);
@@ -296,7 +780,6 @@ static GLuint CreatePointCloud(float r, int pointCount)
     glVertexAttribPointer(a("Position"), 3, GL_FLOAT, GL_FALSE,
                           vertexStride, 0);
 
-    free(positions);
     return vao;
 }
 
@@ -339,6 +822,39 @@ static GLuint CreateRenderTarget(GLuint* colorTexture, GLuint* idTexture)
     return fboHandle;
 }
 
+static GLuint CreateWeightedTarget(GLuint* accumTexture, GLuint* revealTexture)
+{
+    PezConfig cfg = PezGetConfig();
+
+    glGenTextures(1, accumTexture);
+    glBindTexture(GL_TEXTURE_2D, *accumTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, cfg.Width, cfg.Height, 0, GL_RGBA, GL_HALF_FLOAT, 0);
+    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create accumulation texture.");
+
+    glGenTextures(1, revealTexture);
+    glBindTexture(GL_TEXTURE_2D, *revealTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, cfg.Width, cfg.Height, 0, GL_RED, GL_UNSIGNED_BYTE, 0);
+    pezCheck(GL_NO_ERROR == glGetError(), "Unable to create revealage texture.");
+
+    GLuint fboHandle;
+    glGenFramebuffers(1, &fboHandle);
+    glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *accumTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, *revealTexture, 0);
+
+    pezCheck(GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER), "Invalid FBO.");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return fboHandle;
+}
+
 static GLuint CreateQuad(int sourceWidth, int sourceHeight, int destWidth, int destHeight)
 {
     // Stretch to fit:
@@ -21,6 +21,24 @@ void main()
     FragColor = texture(Sampler, vTexCoord);
 }
 
+-- Resolve.FS
+
+// Weighted average of the translucent sprites, over the frame
+out vec4 FragColor;
+uniform sampler2D Accumulation;
+uniform sampler2D Revealage;
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    float revealage = texelFetch(Revealage, p, 0).r;
+    if (revealage == 1.0)
+        discard;
+    vec4 accumulation = texelFetch(Accumulation, p, 0);
+    vec3 average = accumulation.rgb / clamp(accumulation.a, 1e-4, 5e4);
+    FragColor = vec4(average, 1.0 - revealage);
+}
+
 -- VS
 
 in vec4 Position;
@@ -39,6 +57,110 @@ void main()
     gl_Position = Projection * Modelview * Position;
 }
 
+-- Particle.VS
+
+in vec3 Position;
+in float Age;
+out vec3 vPosition;
+out int vId;
+
+uniform mat4 Projection;
+uniform mat4 Modelview;
+
+void main()
+{
+    vPosition = Position;
+    vId = gl_VertexID;
+    gl_Position = Projection * Modelview * vec4(Position, 1);
+
+    // Sprite.GS flattens z, so move unborn particles off to the side:
+    if (Age < 0.0)
+        gl_Position = vec4(-4, -4, 0, 1);
+}
+
+-- Particle.Update.VS
+
+in vec3 Position;
+in float Age;
+in vec3 Velocity;
+in float Life;
+out vec3 tfPosition;
+out float tfAge;
+out vec3 tfVelocity;
+out float tfLife;
+
+const int EmitterCount = 3;
+const float MinLife = 2.0;
+const float MaxLife = 4.0;
+const float Spread = 0.35;
+
+uniform vec4 Emitters[EmitterCount];   // center and launch speed
+uniform vec3 Gravity;
+uniform vec4 Attractor;                // position and strength
+uniform float Drag;
+uniform float DeltaTime;
+uniform uint Frame;
+uniform bool Reset;
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float random(inout uint seed)
+{
+    seed = hash(seed);
+    return float(seed) / 4294967295.0;
+}
+
+void spawn(inout uint seed, float age)
+{
+    vec4 emitter = Emitters[gl_VertexID % EmitterCount];
+    vec3 jitter = vec3(random(seed), random(seed), random(seed)) - 0.5;
+    vec3 direction = vec3(Spread * 2.0 * (vec2(random(seed), random(seed)) - 0.5), 1);
+    tfPosition = emitter.xyz + 0.2 * jitter;
+    tfVelocity = normalize(direction) * emitter.w * mix(0.8, 1.2, random(seed));
+    tfAge = age;
+    tfLife = mix(MinLife, MaxLife, random(seed));
+}
+
+void main()
+{
+    uint seed = hash(uint(gl_VertexID) ^ hash(Frame));
+
+    // Stagger the births, so that the emitters run at a steady rate:
+    if (Reset) {
+        tfPosition = Emitters[gl_VertexID % EmitterCount].xyz;
+        tfVelocity = vec3(0);
+        tfAge = -MaxLife * random(seed);
+        tfLife = 0;
+        return;
+    }
+
+    float age = Age + DeltaTime;
+    if (Age < 0.0 && age < 0.0) {
+        tfPosition = Position;
+        tfVelocity = Velocity;
+        tfAge = age;
+        tfLife = Life;
+    } else if (Age < 0.0 || age >= Life) {
+        spawn(seed, 0.0);
+    } else {
+        vec3 d = Attractor.xyz - Position;
+        vec3 pull = Attractor.w * d / pow(dot(d, d) + 0.25, 1.5);
+        vec3 v = Velocity + (Gravity + pull - Drag * Velocity) * DeltaTime;
+        tfPosition = Position + v * DeltaTime;
+        tfVelocity = v;
+        tfAge = age;
+        tfLife = Life;
+    }
+}
+
 ------------------------
 
 ------------------------
@@ -70,6 +192,7 @@ uniform vec2 SpriteSize;
 in int vId[1];
 flat out int gId;
 out vec2 gCenterCoord;
+out float gDepth;
 uniform vec2 HalfViewport;
 uniform vec2 InverseViewport;
 
@@ -85,6 +208,7 @@ void main()
     vec4 V = vec4(0, SpriteSize.y, 0, 0) * InverseViewport.y;
     gId = vId[0];
     gCenterCoord = toFragCoord(P);
+    gDepth = 0.5 + 0.5 * P.z / P.w;
 
     P.z = 0;
     P.xy /= P.w;
@@ -145,3 +269,66 @@ void main()
         }
     }
 }
+
+-- Sprite.Blend.FS
+
+flat in int gId;
+out vec4 FragColor;
+in vec2 gCenterCoord;
+uniform vec2 SpriteSize;
+uniform float Opacity;
+
+vec3 colorFromIndex(int i)
+{
+    int r = i & 1;
+    int g = i & 2;
+    int b = i & 4;
+    float x = (r == 0) ? 1.0 : 0.0;
+    float y = (g == 0) ? 1.0 : 0.0;
+    float z = (b == 0) ? 1.0 : 0.0;
+    return vec3(x, y, z);
+}
+
+void main()
+{
+    float L = distance(gl_FragCoord.xy, gCenterCoord);
+    float D = 2.0 * L / SpriteSize.x;
+    if (D > 1.0)
+        discard;
+    FragColor = vec4(colorFromIndex(gId), Opacity * (1 - D * D));
+}
+
+-- Sprite.Weighted.FS
+
+flat in int gId;
+in vec2 gCenterCoord;
+in float gDepth;
+layout(location = 0) out vec4 Accumulation;
+layout(location = 1) out float Revealage;
+uniform vec2 SpriteSize;
+const float Opacity = 0.5;
+
+vec3 colorFromIndex(int i)
+{
+    int r = i & 1;
+    int g = i & 2;
+    int b = i & 4;
+    float x = (r == 0) ? 1.0 : 0.0;
+    float y = (g == 0) ? 1.0 : 0.0;
+    float z = (b == 0) ? 1.0 : 0.0;
+    return vec3(x, y, z);
+}
+
+void main()
+{
+    float L = distance(gl_FragCoord.xy, gCenterCoord);
+    float D = 2.0 * L / SpriteSize.x;
+    if (D > 1.0)
+        discard;
+    float A = Opacity * (1 - D * D);
+
+    // Nearer sprites weigh more, standing in for the order:
+    float weight = A * max(1e-2, 3e3 * pow(1.0 - gDepth, 3.0));
+    Accumulation = vec4(colorFromIndex(gId) * A, A) * weight;
+    Revealage = A;
+}
@@ -37,6 +37,21 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <fstream>
 #endif /*__cplusplus*/
 
+#if defined(LODEPNG_COMPILE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LODEPNG_SSE2
+#define LODEPNG_SSE2_TARGET __attribute__((target("sse2")))
+#include <emmintrin.h>
+
+static int supportsSSE2(void)
+{
+  return __builtin_cpu_supports("sse2");
+}
+#endif /*LODEPNG_SSE2*/
+
+#ifdef LODEPNG_COMPILE_THREADS
+#include <pthread.h>
+#endif /*LODEPNG_COMPILE_THREADS*/
+
 #define VERSION_STRING "20111210"
 
 /*
@@ -438,6 +453,39 @@ unsigned LodePNG_saveFile(const unsigned char* buffer, size_t buffersize, const
 
 #ifdef LODEPNG_COMPILE_ZLIB
 
+#ifdef LODEPNG_COMPILE_ENCODER
+/*
+Call job once for each of the count elements of the args array (of elements of
+argsize bytes). The first runs on the calling thread and, with
+LODEPNG_COMPILE_THREADS, the others each on a thread of their own. If a thread
+can't be started, its job runs on the calling thread instead.
+*/
+static void runJobs(void* (*job)(void*), void* args, size_t argsize, unsigned count)
+{
+  unsigned i;
+#ifdef LODEPNG_COMPILE_THREADS
+  pthread_t* threads = count > 1 ? (pthread_t*)malloc(sizeof(pthread_t) * count) : 0;
+  unsigned char* started = count > 1 ? (unsigned char*)malloc(count) : 0;
+  if(threads && started)
+  {
+    for(i = 1; i < count; i++) started[i] = !pthread_create(&threads[i], 0, job, (char*)args + i * argsize);
+    job(args);
+    for(i = 1; i < count; i++)
+    {
+      if(started[i]) pthread_join(threads[i], 0);
+      else job((char*)args + i * argsize);
+    }
+    free(threads);
+    free(started);
+    return;
+  }
+  free(threads);
+  free(started);
+#endif /*LODEPNG_COMPILE_THREADS*/
+  for(i = 0; i < count; i++) job((char*)args + i * argsize);
+}
+#endif /*LODEPNG_COMPILE_ENCODER*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Reading and writing single bits and bytes from/to stream for Deflate   / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -453,38 +501,111 @@ static void addBitToStream(size_t* bitpointer, ucvector* bitstream, unsigned cha
   (*bitpointer)++;
 }
 
+/*fills up the last byte and then whole new bytes, instead of going bit by bit*/
 static void addBitsToStream(size_t* bitpointer, ucvector* bitstream, unsigned value, size_t nbits)
 {
-  size_t i;
-  for(i = 0; i < nbits; i++) addBitToStream(bitpointer, bitstream, (unsigned char)((value >> i) & 1));
+  while(nbits > 0)
+  {
+    unsigned offset = (unsigned)((*bitpointer) & 0x7);
+    unsigned n = nbits < 8 - offset ? (unsigned)nbits : 8 - offset;
+    if(offset == 0) ucvector_push_back(bitstream, (unsigned char)0);
+    (bitstream->data[bitstream->size - 1]) |= (unsigned char)((value & ((1u << n) - 1u)) << offset);
+    value >>= n;
+    nbits -= n;
+    (*bitpointer) += n;
+  }
 }
 
 static void addBitsToStreamReversed(size_t* bitpointer, ucvector* bitstream, unsigned value, size_t nbits)
 {
+  unsigned reversed = 0;
   size_t i;
-  for(i = 0; i < nbits; i++) addBitToStream(bitpointer, bitstream, (unsigned char)((value >> (nbits - 1 - i)) & 1));
+  for(i = 0; i < nbits; i++) reversed |= ((value >> (nbits - 1 - i)) & 1u) << i;
+  addBitsToStream(bitpointer, bitstream, reversed, nbits);
 }
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-#define READBIT(bitpointer, bitstream) ((bitstream[bitpointer >> 3] >> (bitpointer & 0x7)) & (unsigned char)1)
+/*
+The inflator reads its input through a 64-bit bit buffer. The next bit to read is
+the lsb of the buffer; while at least 8 bytes of input remain, a refill loads
+them all at once, so a huffman symbol and its extra bits are usually taken out of
+the buffer without touching the input. Past the end of the input, zero bits are
+shifted in: callers compare BitReader_position with the input size to detect that.
+*/
+typedef struct BitReader
+{
+  const unsigned char* data;
+  size_t size; /*size of data in bytes*/
+  size_t next; /*the next byte of data that will go into the buffer*/
+  unsigned long long buffer; /*bits not yet consumed*/
+  unsigned count; /*how many bits of buffer are valid*/
+} BitReader;
 
-static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char* bitstream)
+static void BitReader_init(BitReader* reader, const unsigned char* data, size_t size)
 {
-  unsigned char result = (unsigned char)(READBIT(*bitpointer, bitstream));
-  (*bitpointer)++;
-  return result;
+  reader->data = data;
+  reader->size = size;
+  reader->next = 0;
+  reader->buffer = 0;
+  reader->count = 0;
 }
 
-static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
+/*continue reading at the given byte, dropping what is left in the buffer*/
+static void BitReader_seek(BitReader* reader, size_t bytepos)
 {
-  unsigned result = 0, i;
-  for(i = 0; i < nbits; i++)
+  reader->next = bytepos;
+  reader->buffer = 0;
+  reader->count = 0;
+}
+
+/*bit position of the next bit that will be read, counting from the start of data*/
+static size_t BitReader_position(const BitReader* reader)
+{
+  return reader->next * 8 - reader->count;
+}
+
+/*make sure there are at least 56 valid bits in the buffer*/
+static void BitReader_refill(BitReader* reader)
+{
+  if(reader->next + 8 <= reader->size)
   {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    (*bitpointer)++;
+    /*load 8 bytes, but only advance by the whole bytes that fit: the bits of a partial
+    byte at the top are loaded again, at the same place, by the next refill*/
+    const unsigned char* p = &reader->data[reader->next];
+    unsigned long long word = (unsigned long long)p[0]
+                            | ((unsigned long long)p[1] << 8)
+                            | ((unsigned long long)p[2] << 16)
+                            | ((unsigned long long)p[3] << 24)
+                            | ((unsigned long long)p[4] << 32)
+                            | ((unsigned long long)p[5] << 40)
+                            | ((unsigned long long)p[6] << 48)
+                            | ((unsigned long long)p[7] << 56);
+    reader->buffer |= word << reader->count;
+    reader->next += (63 - reader->count) >> 3;
+    reader->count |= 56;
   }
+  else
+  {
+    while(reader->count <= 56)
+    {
+      unsigned long long byte = reader->next < reader->size ? reader->data[reader->next] : 0;
+      reader->buffer |= byte << reader->count;
+      reader->next++;
+      reader->count += 8;
+    }
+  }
+}
+
+/*read nbits bits, nbits is at most 16. The first bit read is the lsb of the result*/
+static unsigned BitReader_readBits(BitReader* reader, unsigned nbits)
+{
+  unsigned result;
+  if(reader->count < nbits) BitReader_refill(reader);
+  result = (unsigned)reader->buffer & ((1u << nbits) - 1u);
+  reader->buffer >>= nbits;
+  reader->count -= nbits;
   return result;
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
@@ -534,7 +655,7 @@ Huffman tree struct, containing multiple representations of the tree
 */
 typedef struct HuffmanTree
 {
-  uivector tree2d;
+  uivector table; /*the lookup table used by the decoder, see HuffmanTree_makeTable*/
   uivector tree1d;
   uivector lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
@@ -556,77 +677,18 @@ static void HuffmanTree_draw(HuffmanTree* tree)
 
 static void HuffmanTree_init(HuffmanTree* tree)
 {
-  uivector_init(&tree->tree2d);
+  uivector_init(&tree->table);
   uivector_init(&tree->tree1d);
   uivector_init(&tree->lengths);
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
 {
-  uivector_cleanup(&tree->tree2d);
+  uivector_cleanup(&tree->table);
   uivector_cleanup(&tree->tree1d);
   uivector_cleanup(&tree->lengths);
 }
 
-/*the tree representation used by the decoder. return value is error*/
-static unsigned HuffmanTree_make2DTree(HuffmanTree* tree)
-{
-  unsigned nodefilled = 0; /*up to which node it is filled*/
-  unsigned treepos = 0; /*position in the tree (1 of the numcodes columns)*/
-  unsigned n, i;
-
-  if(!uivector_resize(&tree->tree2d, tree->numcodes * 2)) return 9901; /*alloc fail*/
-
-  /*
-  convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means
-  uninited, a value >= numcodes is an address to another bit, a value < numcodes
-  is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as
-  many columns as codes - 1.
-  A good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes.
-  Here, the internal nodes are stored (what their 0 and 1 option point to).
-  There is only memory for such good tree currently, if there are more nodes
-  (due to too long length codes), error 55 will happen
-  */
-  for(n = 0;  n < tree->numcodes * 2; n++)
-  {
-    tree->tree2d.data[n] = 32767; /*32767 here means the tree2d isn't filled there yet*/
-  }
-
-  for(n = 0; n < tree->numcodes; n++) /*the codes*/
-  {
-    for(i = 0; i < tree->lengths.data[n]; i++) /*the bits for this code*/
-    {
-      unsigned char bit = (unsigned char)((tree->tree1d.data[n] >> (tree->lengths.data[n] - i - 1)) & 1);
-      if(treepos > tree->numcodes - 2) return 55; /*oversubscribed, see comment in LodePNG_error_text*/
-      if(tree->tree2d.data[2 * treepos + bit] == 32767) /*not yet filled in*/
-      {
-        if(i + 1 == tree->lengths.data[n]) /*last bit*/
-        {
-          tree->tree2d.data[2 * treepos + bit] = n; /*put the current code in it*/
-          treepos = 0;
-        }
-        else
-        {
-          /*put address of the next step in here, first that address has to be found of course
-          (it's just nodefilled + 1)...*/
-          nodefilled++;
-          /*addresses encoded with numcodes added to it*/
-          tree->tree2d.data[2 * treepos + bit] = nodefilled + tree->numcodes;
-          treepos = nodefilled;
-        }
-      }
-      else treepos = tree->tree2d.data[2 * treepos + bit] - tree->numcodes;
-    }
-  }
-
-  for(n = 0;  n < tree->numcodes * 2; n++)
-  {
-    if(tree->tree2d.data[n] == 32767) tree->tree2d.data[n] = 0; /*remove possible remaining 32767's*/
-  }
-
-  return 0;
-}
-
 /*
 Second step for the ...makeFromLengths and ...makeFromFrequencies functions.
 numcodes, lengths and maxbitlen must already be filled in correctly. return
@@ -664,8 +726,7 @@ static unsigned HuffmanTree_makeFromLengths2(HuffmanTree* tree)
   uivector_cleanup(&blcount);
   uivector_cleanup(&nextcode);
 
-  if(!error) return HuffmanTree_make2DTree(tree);
-  else return error;
+  return error;
 }
 
 /*
@@ -915,29 +976,125 @@ static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 
 #ifdef LODEPNG_COMPILE_DECODER
 
+/*number of bits the primary decoding table is indexed with*/
+#define HUFFMAN_FIRSTBITS 9u
+
+static unsigned reverseBits(unsigned bits, unsigned num)
+{
+  unsigned i, result = 0;
+  for(i = 0; i < num; i++) result |= ((bits >> (num - i - 1)) & 1u) << i;
+  return result;
+}
+
 /*
-returns the code, or (unsigned)(-1) if error happened
-inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
+the tree representation used by the decoder, made from tree1d and lengths. return
+value is error.
+The first 2^HUFFMAN_FIRSTBITS entries of the table are indexed by the next
+HUFFMAN_FIRSTBITS bits of the stream (which has the codes bit-reversed) and
+contain symbol * 16 + code length for codes of up to HUFFMAN_FIRSTBITS bits. Codes
+that are longer share a secondary table per value of their first HUFFMAN_FIRSTBITS
+bits; the primary entry then contains the offset of that secondary table * 16 +
+HUFFMAN_FIRSTBITS + the number of bits the secondary table is indexed with. A code
+length of 0 marks bit patterns that no code starts with.
 */
-static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
-                                    const HuffmanTree* codetree, size_t inbitlength)
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
 {
-  unsigned treepos = 0, ct;
-  for(;;)
+  static const unsigned headsize = 1u << HUFFMAN_FIRSTBITS;
+  static const unsigned mask = (1u << HUFFMAN_FIRSTBITS) - 1u;
+  unsigned kraft = 0; /*sum of 2^(15 - length) over all codes*/
+  unsigned n, i, size;
+  uivector maxlens; /*the longest code starting with each primary index*/
+
+  /*with more codes than fit in the code space, it's not a prefix code*/
+  for(n = 0; n < tree->numcodes; n++)
   {
-    if(*bp > inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
+    if(tree->lengths.data[n]) kraft += 32768u >> tree->lengths.data[n];
+  }
+  if(kraft > 32768u) return 55; /*oversubscribed, see comment in LodePNG_error_text*/
 
-    /*
-    decode the symbol from the tree. The "readBitFromStream" code is inlined in
-    the expression below because this is the biggest bottleneck while decoding
-    */
-    ct = codetree->tree2d.data[(treepos << 1) + READBIT(*bp, in)];
-    (*bp)++;
-    if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
-    else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
+  uivector_init(&maxlens);
+  if(!uivector_resizev(&maxlens, headsize, 0)) return 9901; /*alloc fail*/
+  for(n = 0; n < tree->numcodes; n++)
+  {
+    unsigned l = tree->lengths.data[n];
+    if(l > HUFFMAN_FIRSTBITS)
+    {
+      i = reverseBits(tree->tree1d.data[n] >> (l - HUFFMAN_FIRSTBITS), HUFFMAN_FIRSTBITS);
+      if(maxlens.data[i] < l) maxlens.data[i] = l;
+    }
+  }
+
+  size = headsize;
+  for(i = 0; i < headsize; i++)
+  {
+    if(maxlens.data[i]) size += 1u << (maxlens.data[i] - HUFFMAN_FIRSTBITS);
+  }
+  if(!uivector_resizev(&tree->table, size, 0))
+  {
+    uivector_cleanup(&maxlens);
+    return 9901; /*alloc fail*/
+  }
 
-    if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
+  /*point the primary entries of long codes to their secondary table*/
+  size = headsize;
+  for(i = 0; i < headsize; i++)
+  {
+    if(maxlens.data[i])
+    {
+      tree->table.data[i] = (size << 4) | maxlens.data[i];
+      size += 1u << (maxlens.data[i] - HUFFMAN_FIRSTBITS);
+    }
+  }
+  uivector_cleanup(&maxlens);
+
+  /*fill in every entry whose bits start with a code, whatever the bits after it are*/
+  for(n = 0; n < tree->numcodes; n++)
+  {
+    unsigned l = tree->lengths.data[n], reverse, j;
+    if(!l) continue;
+    reverse = reverseBits(tree->tree1d.data[n], l);
+    if(l <= HUFFMAN_FIRSTBITS)
+    {
+      for(j = reverse; j < headsize; j += 1u << l) tree->table.data[j] = (n << 4) | l;
+    }
+    else
+    {
+      unsigned entry = tree->table.data[reverse & mask];
+      unsigned start = entry >> 4, subsize = 1u << ((entry & 15) - HUFFMAN_FIRSTBITS);
+      for(j = reverse >> HUFFMAN_FIRSTBITS; j < subsize; j += 1u << (l - HUFFMAN_FIRSTBITS))
+      {
+        tree->table.data[start + j] = (n << 4) | l;
+      }
+    }
   }
+
+  return 0;
+}
+
+/*
+returns the code, or (unsigned)(-1) if error happened: the bits don't form a code
+of the tree, or decoding the symbol went past the end of the input
+*/
+static unsigned huffmanDecodeSymbol(BitReader* reader, const HuffmanTree* codetree)
+{
+  unsigned entry, length;
+  /*no code is longer than 15 bits*/
+  if(reader->count < 15) BitReader_refill(reader);
+  entry = codetree->table.data[reader->buffer & ((1u << HUFFMAN_FIRSTBITS) - 1u)];
+  length = entry & 15;
+  if(length > HUFFMAN_FIRSTBITS)
+  {
+    /*a long code, the rest of its bits index the secondary table*/
+    unsigned index = (unsigned)(reader->buffer >> HUFFMAN_FIRSTBITS) & ((1u << (length - HUFFMAN_FIRSTBITS)) - 1u);
+    entry = codetree->table.data[(entry >> 4) + index];
+    length = entry & 15;
+  }
+  if(length == 0) return (unsigned)(-1); /*error: these bits aren't a code of the tree*/
+  reader->buffer >>= length;
+  reader->count -= length;
+  /*error: end of input memory reached without endcode*/
+  if(reader->next > reader->size && BitReader_position(reader) > reader->size * 8) return (unsigned)(-1);
+  return entry >> 4;
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -948,22 +1105,23 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
 /* ////////////////////////////////////////////////////////////////////////// */
 
 /*get the tree of a deflated block with fixed tree, as specified in the deflate specification*/
-static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
+static unsigned getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
 {
-  /*error checking not done, this is fixed stuff, it works, it doesn't depend on the image*/
-  /*TODO: out of memory errors could still happen...*/
-  generateFixedLitLenTree(tree_ll);
-  generateFixedDistanceTree(tree_d);
+  /*this is fixed stuff, it doesn't depend on the image, so the only errors are out of memory errors*/
+  unsigned error = generateFixedLitLenTree(tree_ll);
+  if(!error) error = HuffmanTree_makeTable(tree_ll);
+  if(!error) error = generateFixedDistanceTree(tree_d);
+  if(!error) error = HuffmanTree_makeTable(tree_d);
+  return error;
 }
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      const unsigned char* in, size_t* bp, size_t inlength)
+static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d, BitReader* reader)
 {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
   unsigned n, HLIT, HDIST, HCLEN, i;
-  size_t inbitlength = inlength * 8;
+  size_t inlength = reader->size;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
   uivector bitlen_ll; /*lit,len code lengths*/
@@ -972,14 +1130,14 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   uivector bitlen_cl;
   HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
 
-  if((*bp) >> 3 >= inlength - 2) return 49; /*the bit pointer is or will go past the memory*/
+  if(BitReader_position(reader) >> 3 >= inlength - 2) return 49; /*the bit pointer is or will go past the memory*/
 
   /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already*/
-  HLIT =  readBitsFromStream(bp, in, 5) + 257;
+  HLIT =  BitReader_readBits(reader, 5) + 257;
   /*number of distance codes. Unlike the spec, the value 1 is added to it here already*/
-  HDIST = readBitsFromStream(bp, in, 5) + 1;
+  HDIST = BitReader_readBits(reader, 5) + 1;
   /*number of code length codes. Unlike the spec, the value 4 is added to it here already*/
-  HCLEN = readBitsFromStream(bp, in, 4) + 4;
+  HCLEN = BitReader_readBits(reader, 4) + 4;
 
   HuffmanTree_init(&tree_cl);
   uivector_init(&bitlen_ll);
@@ -994,11 +1152,12 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
     for(i = 0; i < NUM_CODE_LENGTH_CODES; i++)
     {
-      if(i < HCLEN) bitlen_cl.data[CLCL_ORDER[i]] = readBitsFromStream(bp, in, 3);
+      if(i < HCLEN) bitlen_cl.data[CLCL_ORDER[i]] = BitReader_readBits(reader, 3);
       else bitlen_cl.data[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
     }
 
     error = HuffmanTree_makeFromLengths(&tree_cl, bitlen_cl.data, bitlen_cl.size, 7);
+    if(!error) error = HuffmanTree_makeTable(&tree_cl);
     if(error) break;
 
     /*now we can use this tree to read the lengths for the tree that this function will return*/
@@ -1010,7 +1169,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     /*i is the current symbol we're reading in the part that contains the code lengths of lit/len and dist codes*/
     while(i < HLIT + HDIST)
     {
-      unsigned code = huffmanDecodeSymbol(in, bp, &tree_cl, inbitlength);
+      unsigned code = huffmanDecodeSymbol(reader, &tree_cl);
       if(code <= 15) /*a length code*/
       {
         if(i < HLIT) bitlen_ll.data[i] = code;
@@ -1022,10 +1181,10 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
         unsigned replength = 3; /*read in the 2 bits that indicate repeat length (3-6)*/
         unsigned value; /*set value to the previous code*/
 
-        if((*bp) >> 3 >= inlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        if(BitReader_position(reader) >> 3 >= inlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
         if (i == 0) ERROR_BREAK(54); /*can't repeat previous if i is 0*/
 
-        replength += readBitsFromStream(bp, in, 2);
+        replength += BitReader_readBits(reader, 2);
 
         if(i < HLIT + 1) value = bitlen_ll.data[i - 1];
         else value = bitlen_d.data[i - HLIT - 1];
@@ -1041,9 +1200,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 17) /*repeat "0" 3-10 times*/
       {
         unsigned replength = 3; /*read in the bits that indicate repeat length*/
-        if((*bp) >> 3 >= inlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        if(BitReader_position(reader) >> 3 >= inlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
-        replength += readBitsFromStream(bp, in, 3);
+        replength += BitReader_readBits(reader, 3);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; n++)
@@ -1058,9 +1217,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 18) /*repeat "0" 11-138 times*/
       {
         unsigned replength = 11; /*read in the bits that indicate repeat length*/
-        if((*bp) >> 3 >= inlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        if(BitReader_position(reader) >> 3 >= inlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
-        replength += readBitsFromStream(bp, in, 7);
+        replength += BitReader_readBits(reader, 7);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; n++)
@@ -1078,7 +1237,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inlength * 8 ? 10 : 11;
+          error = BitReader_position(reader) > inlength * 8 ? 10 : 11;
         }
         else error = 16; /*unexisting code, this can never happen*/
         break;
@@ -1090,8 +1249,10 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
     /*now we've finally got HLIT and HDIST, so generate the code trees, and the function is done*/
     error = HuffmanTree_makeFromLengths(tree_ll, &bitlen_ll.data[0], bitlen_ll.size, 15);
+    if(!error) error = HuffmanTree_makeTable(tree_ll);
     if(error) break;
     error = HuffmanTree_makeFromLengths(tree_d, &bitlen_d.data[0], bitlen_d.size, 15);
+    if(!error) error = HuffmanTree_makeTable(tree_d);
 
     break; /*end of error-while*/
   }
@@ -1105,27 +1266,26 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 }
 
 /*inflate a block with dynamic of fixed Huffman tree*/
-static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
-                                    size_t* pos, size_t inlength, unsigned btype)
+static unsigned inflateHuffmanBlock(ucvector* out, BitReader* reader, size_t* pos, unsigned btype)
 {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  size_t inbitlength = inlength * 8;
+  size_t inlength = reader->size;
 
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
 
-  if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
+  if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
   else if(btype == 2)
   {
-    error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+    error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
   }
 
   while(!error) /*decode all symbols until end reached, breaks at end code*/
   {
     /*code_ll is literal, length or end code*/
-    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    unsigned code_ll = huffmanDecodeSymbol(reader, &tree_ll);
     if(code_ll <= 255) /*literal symbol*/
     {
       if((*pos) >= out->size)
@@ -1147,18 +1307,18 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 2: get extra bits and add the value of that to length*/
       numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if(((*bp) >> 3) >= inlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      length += readBitsFromStream(bp, in, numextrabits_l);
+      if((BitReader_position(reader) >> 3) >= inlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      length += BitReader_readBits(reader, numextrabits_l);
 
       /*part 3: get distance code*/
-      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+      code_d = huffmanDecodeSymbol(reader, &tree_d);
       if(code_d > 29)
       {
-        if(code_ll == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+        if(code_d == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inlength * 8 ? 10 : 11;
+          error = BitReader_position(reader) > inlength * 8 ? 10 : 11;
         }
         else error = 18; /*error: invalid distance code (30-31 are never used)*/
         break;
@@ -1167,12 +1327,13 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 4: get extra bits from distance*/
       numextrabits_d = DISTANCEEXTRA[code_d];
-      if(((*bp) >> 3) >= inlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      if((BitReader_position(reader) >> 3) >= inlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
 
-      distance += readBitsFromStream(bp, in, numextrabits_d);
+      distance += BitReader_readBits(reader, numextrabits_d);
 
       /*part 5: fill in all the out[n] values based on the length and dist*/
       start = (*pos);
+      if(distance > start) ERROR_BREAK(83); /*error: distance goes back before the start of the output*/
       backward = start - distance;
       if((*pos) + length >= out->size)
       {
@@ -1196,7 +1357,7 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
     {
       /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
       (10=no endcode, 11=wrong jump outside of tree)*/
-      error = (*bp) > inlength * 8 ? 10 : 11;
+      error = BitReader_position(reader) > inlength * 8 ? 10 : 11;
       break;
     }
   }
@@ -1207,13 +1368,13 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
   return error;
 }
 
-static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
+static unsigned inflateNoCompression(ucvector* out, BitReader* reader, size_t* pos)
 {
+  const unsigned char* in = reader->data;
+  size_t inlength = reader->size;
   /*go to first boundary of byte*/
-  size_t p;
+  size_t p = (BitReader_position(reader) + 7) / 8; /*byte position*/
   unsigned LEN, NLEN, n, error = 0;
-  while(((*bp) & 0x7) != 0) (*bp)++;
-  p = (*bp) / 8; /*byte position*/
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
   if(p >= inlength - 4) return 52; /*error, bit pointer will jump past memory*/
@@ -1232,7 +1393,7 @@ static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, siz
   if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
   for(n = 0; n < LEN; n++) out->data[(*pos)++] = in[p++];
 
-  (*bp) = p * 8;
+  BitReader_seek(reader, p);
 
   return error;
 }
@@ -1240,24 +1401,24 @@ static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, siz
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
 static unsigned LodePNG_inflate(ucvector* out, const unsigned char* in, size_t insize, size_t inpos)
 {
-  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
-  size_t bp = 0;
+  BitReader reader; /*the "in" data from inpos on, read through a bit buffer*/
   unsigned BFINAL = 0;
   size_t pos = 0; /*byte position in the out buffer*/
 
   unsigned error = 0;
 
+  BitReader_init(&reader, &in[inpos], insize - inpos);
+
   while(!BFINAL)
   {
     unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBitFromStream(&bp, &in[inpos]);
-    BTYPE = 1 * readBitFromStream(&bp, &in[inpos]);
-    BTYPE += 2 * readBitFromStream(&bp, &in[inpos]);
+    if(BitReader_position(&reader) + 2 >= reader.size * 8) return 52; /*error, bit pointer will jump past memory*/
+    BFINAL = BitReader_readBits(&reader, 1);
+    BTYPE = BitReader_readBits(&reader, 2);
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, &in[inpos], &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, &in[inpos], &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+    else if(BTYPE == 0) error = inflateNoCompression(out, &reader, &pos); /*no compression*/
+    else error = inflateHuffmanBlock(out, &reader, &pos, BTYPE); /*compression, BTYPE 01 or 10*/
 
     if(error) return error;
   }
@@ -1382,249 +1543,201 @@ static unsigned encodeLZ77_brute(uivector* out, const unsigned char* in, size_t
 }
 #endif
 
-static const unsigned HASH_NUM_VALUES = 65536;
-static const unsigned HASH_NUM_CHARACTERS = 3;
-static const unsigned HASH_SHIFT = 2;
+/*the hash of 3 bytes, the shortest match length, indexes a table of 2^HASH_BITS chain heads*/
+#define HASH_BITS 15
+#define HASH_NUM_VALUES (1u << HASH_BITS)
+/*a length 3 match further back than this costs more bits than 3 literals*/
+#define TOO_FAR_FOR_LENGTH_3 4096
+
+static unsigned getHash(const unsigned char* data)
+{
+  unsigned v = data[0] | (data[1] << 8) | (data[2] << 16);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
 /*
-The HASH_NUM_CHARACTERS value is used to make encoding faster by using longer
-sequences to generate a hash value from the stream bytes. Setting it to 3
-gives exactly the same compression as the brute force method, since deflate's
-run length encoding starts with lengths of 3. Setting it to higher values,
-like 6, can make the encoding faster (not always though!), but will cause the
-encoding to miss any length between 3 and this value, so that the compression
-may be worse (but this can vary too depending on the image, sometimes it is
-even a bit better instead).
-The HASH_NUM_VALUES is the amount of unique possible hash values that
-combinations of bytes can give, the higher it is the more memory is needed, but
-if it's too low the advantage of hashing is gone.
+Per compression level: how much effort the matcher spends. Like zlib:
+goodlength: when the lazy match is already this long, search only a quarter of the chain
+lazylength: don't look for a better match at the next byte when the match is this long;
+            for the greedy levels, don't put the bytes of a longer match in the hash chains
+nicelength: stop searching the chain when a match is this long
+maxchain: the most chain entries to look at for one match
 */
+typedef struct LZ77Config
+{
+  unsigned goodlength, lazylength, nicelength, maxchain, lazy;
+} LZ77Config;
 
-static unsigned getHash(const unsigned char* data, size_t size, size_t pos)
+static const LZ77Config LZ77_CONFIGS[10] =
 {
-  unsigned result = 0;
-  size_t amount, i;
-  if(pos >= size) return 0;
-  amount = HASH_NUM_CHARACTERS;
-  if(pos + amount >= size) amount = size - pos;
-  for(i = 0; i < amount; i++) result ^= (data[pos + i] << (i * HASH_SHIFT));
-  return result % HASH_NUM_VALUES;
+  {0, 0, 0, 0, 0},            /*0: unused, btype 0 is used for no compression*/
+  {4, 4, 8, 4, 0},            /*1: fastest, greedy*/
+  {4, 5, 16, 8, 0},
+  {4, 6, 32, 32, 0},
+  {4, 4, 16, 16, 1},          /*4: lazy matching from here on*/
+  {8, 16, 32, 32, 1},
+  {8, 16, 128, 128, 1},       /*6: the default*/
+  {8, 32, 128, 256, 1},
+  {32, 128, 258, 1024, 1},
+  {32, 258, 258, 4096, 1}     /*9: smallest*/
+};
+
+/*put pos in the chain of the hash of its 3 bytes*/
+static void updateHashChain(int* head, int* prev, const unsigned char* in, size_t pos, unsigned windowSize)
+{
+  unsigned hash = getHash(&in[pos]);
+  prev[pos % windowSize] = head[hash];
+  head[hash] = (int)pos;
 }
 
-static unsigned countZeros(const unsigned char* data, size_t size, size_t pos)
+/*
+find the longest match for pos in the hash chain of its first 3 bytes. Returns the
+length (0 if none of at least 3 bytes), and the distance in *distance
+*/
+static unsigned findMatch(unsigned* distance, const int* head, const int* prev, const unsigned char* in,
+                          size_t insize, size_t pos, unsigned windowSize, unsigned maxchain,
+                          unsigned nicelength, unsigned prevlength)
 {
-  size_t max_count = MAX_SUPPORTED_DEFLATE_LENGTH;
-  size_t i;
-  if(max_count > size - pos) max_count = size - pos;
-  for(i = 0; i < max_count; i++)
+  const unsigned char* current = &in[pos];
+  size_t maxlength = insize - pos < MAX_SUPPORTED_DEFLATE_LENGTH ? insize - pos : MAX_SUPPORTED_DEFLATE_LENGTH;
+  unsigned bestlength = prevlength < 2 ? 2 : prevlength; /*only a longer match than this is of use*/
+  int candidate = head[getHash(current)];
+  unsigned chain = maxchain;
+
+  *distance = 0;
+  if(nicelength > maxlength) nicelength = (unsigned)maxlength;
+  if(bestlength >= maxlength) return 0;
+
+  while(candidate >= 0 && pos - (size_t)candidate <= windowSize && chain-- > 0)
   {
-    if(data[pos + i] != 0)
-      return i;
+    const unsigned char* back = &in[candidate];
+    /*a match can only be longer if it agrees at the current best length, check that first*/
+    if(back[bestlength] == current[bestlength] && back[0] == current[0] && back[1] == current[1])
+    {
+      size_t length = 2;
+      while(length < maxlength && back[length] == current[length]) length++;
+      if(length > bestlength)
+      {
+        bestlength = (unsigned)length;
+        *distance = (unsigned)(pos - (size_t)candidate);
+        if(length >= nicelength) break;
+      }
+    }
+    candidate = prev[candidate % windowSize];
   }
-  return max_count;
-}
 
-void updateHashChain(unsigned short* hashchain, int* hashhead, int* hashval,
-                     size_t pos, int hash, unsigned windowSize)
-{
-  unsigned wpos = pos % windowSize;
-  hashval[wpos] = hash;
-  if(hashhead[hash] != -1) hashchain[wpos] = hashhead[hash];
-  hashhead[hash] = wpos;
+  if(!*distance) return 0;
+  if(bestlength == 3 && *distance > TOO_FAR_FOR_LENGTH_3) return 0;
+  return bestlength;
 }
 
-/*Enable to use lazy instead of greedy matching. It looks one byte further
-to see if that one gives a longer distance. This gives slightly better compression, at the cost
-of a speed loss.*/
-#define LAZY_MATCHING
-
 /*
-LZ77-encode the data. Return value is error code. The input are raw bytes, the output
-is in the form of unsigned integers with codes representing for example literal bytes, or
-length/distance pairs.
-It uses a hash table technique to let it encode faster. When doing LZ77 encoding, a
-sliding window (of windowSize) is used, and all past bytes in that window can be used as
-the "dictionary". A brute force search through all possible distances would be slow, and
-this hash technique is one out of several ways to speed this up.
+LZ77-encode the data from instart to insize. Return value is error code. The input are raw
+bytes, the output is in the form of unsigned integers with codes representing for example
+literal bytes, or length/distance pairs.
+All past bytes in the sliding window (of windowSize) can be used as the "dictionary",
+including the ones before instart, which were encoded elsewhere.
+To find matches in it fast, the positions are kept in chains per hash of the 3 bytes
+starting there, newest first, and the level limits how far down a chain is searched.
+The low levels take the first good match (greedy), the others first look if the next
+byte starts an even longer match (lazy matching).
 */
-static unsigned encodeLZ77(uivector* out, const unsigned char* in, size_t insize, unsigned windowSize)
+static unsigned encodeLZ77(uivector* out, const unsigned char* in, size_t instart, size_t insize,
+                           unsigned windowSize, unsigned level)
 {
-  int* hashhead = (int*)malloc(sizeof(int) * HASH_NUM_VALUES);
-  int* hashval = (int*)malloc(sizeof(int) * windowSize);
-  unsigned short* hashchain = (unsigned short*)malloc(sizeof(unsigned short) * windowSize);
-  unsigned short* hashzeros = (unsigned short*)malloc(sizeof(unsigned short) * windowSize);
-  unsigned short numzeros = 0;
-  unsigned numones = 0;
-
-  unsigned pos, i, error = 0;
+  const LZ77Config* config = &LZ77_CONFIGS[level]; /*1 to 9, checked by LodePNG_zlib_compress*/
+  int* head = (int*)malloc(sizeof(int) * HASH_NUM_VALUES);
+  int* prev = (int*)malloc(sizeof(int) * windowSize);
+  size_t pos, i;
+  unsigned error = 0;
 
-  if(!hashhead || !hashval || !hashchain || !hashzeros) error = 9918; /*alloc fail*/
+  if(!head || !prev) error = 9918; /*alloc fail*/
 
   if(!error)
   {
-    unsigned offset; /*the offset represents the distance in LZ77 terminology*/
-    unsigned length;
-#ifdef LAZY_MATCHING
-    unsigned lazy = 0;
-    unsigned lazylength = 0, lazyoffset = 0;
-#endif /*LAZY_MATCHING*/
-    unsigned hash;
-    unsigned current_offset, current_length;
-    const unsigned char *lastptr, *foreptr, *backptr;
-    unsigned short hashpos, prevpos;
-
-    /*initialize hash table*/
-    for(i = 0; i < HASH_NUM_VALUES; i++) hashhead[i] = -1;
-    for(i = 0; i < windowSize; i++) hashval[i] = -1;
-    for(i = 0; i < windowSize; i++) hashchain[i] = i; /*same value as index indicates uninitialized*/
-
-    for(pos = 0; pos < insize; pos++)
-    {
-      size_t wpos = pos % windowSize; /*position for in 'circular' hash buffers*/
-
-      hash = getHash(in, insize, pos);
-      updateHashChain(hashchain, hashhead, hashval, pos, hash, windowSize);
-      if(hash == 0)
-      {
-        numzeros = countZeros(in, insize, pos);
-        hashzeros[wpos] = numzeros;
-      }
-
-      length = 0, offset = 0; /*the length and offset found for the current position*/
+    /*the last 2 bytes can't start a match, their hash would read past the end*/
+    size_t hashend = insize < 2 ? 0 : insize - 2;
+    /*for lazy matching: the match found at the previous position, not yet output*/
+    unsigned prevlength = 0, prevdistance = 0, prevavailable = 0;
 
-      prevpos = hashhead[hash];
-      hashpos = hashchain[prevpos];
+    for(i = 0; i < HASH_NUM_VALUES; i++) head[i] = -1;
+    for(pos = instart < windowSize ? 0 : instart - windowSize; pos < instart && pos < hashend; pos++)
+    {
+      updateHashChain(head, prev, in, pos, windowSize);
+    }
 
-      lastptr = &in[insize < pos + MAX_SUPPORTED_DEFLATE_LENGTH ? insize : pos + MAX_SUPPORTED_DEFLATE_LENGTH];
+    for(pos = instart; pos < insize; pos++)
+    {
+      unsigned length = 0, distance = 0;
 
-      /*search for the longest string*/
-      if(hashval[wpos] == (int)hash)
+      if(pos < hashend)
       {
-        for(;;)
+        unsigned maxchain = config->maxchain;
+        if(config->lazy && prevlength >= config->goodlength) maxchain >>= 2;
+        if(!config->lazy || prevlength < config->lazylength)
         {
-          /*stop when went completely around the circular buffer*/
-          if(prevpos < wpos && hashpos > prevpos && hashpos <= wpos) break;
-          if(prevpos > wpos && (hashpos <= wpos || hashpos > prevpos)) break;
-
-          current_offset = hashpos <= wpos ? wpos - hashpos : wpos - hashpos + windowSize;
-
-          if(current_offset > 0) {
-            /*test the next characters*/
-            foreptr = &in[pos];
-            backptr = &in[pos - current_offset];
-            if(hash == 0 && hashval[hashpos] == 0 /*hashval[hashpos] may be out of date*/)
-            {
-              /*common case in PNGs is lots of zeros. Quickly skip over them as a speedup*/
-              unsigned skip = hashzeros[hashpos];
-              if(skip > numzeros) skip = numzeros;
-              if(skip > insize - pos) skip = insize - pos;
-              backptr += skip;
-              foreptr += skip;
-            }
-            while(foreptr != lastptr && *backptr == *foreptr) /*maximum supported length by deflate is max length*/
-            {
-              ++backptr;
-              ++foreptr;
-            }
-            current_length = (unsigned)(foreptr - &in[pos]);
-
-            if(current_length > length)
-            {
-              length = current_length; /*the longest length*/
-              offset = current_offset; /*the offset that is related to this longest length*/
-              /*jump out once a length of max length is found (speed gain)*/
-              if(current_length == MAX_SUPPORTED_DEFLATE_LENGTH) break;
-            }
-          }
-
-          if(hashpos == hashchain[hashpos]) break;
-
-          prevpos = hashpos;
-          hashpos = hashchain[hashpos];
+          length = findMatch(&distance, head, prev, in, insize, pos, windowSize, maxchain,
+                             config->nicelength, config->lazy ? prevlength : 0);
         }
+        updateHashChain(head, prev, in, pos, windowSize);
       }
 
-#ifdef LAZY_MATCHING
-      if(!lazy && length >= 3 && length < MAX_SUPPORTED_DEFLATE_LENGTH)
-      {
-        lazy = 1;
-        lazylength = length;
-        lazyoffset = offset;
-        continue;
-      }
-      if(lazy)
+      if(!config->lazy)
       {
-        lazy = 0;
-        if(pos == 0) ERROR_BREAK(81);
-        if(length > lazylength + 1)
+        if(length < 3)
         {
-          /*push the previous character as literal*/
-          if(!uivector_push_back(out, in[pos - 1])) ERROR_BREAK(9921 /*alloc fail*/);
+          if(!uivector_push_back(out, in[pos])) ERROR_BREAK(9921 /*alloc fail*/);
+          continue;
         }
-        else
+        addLengthDistance(out, length, distance);
+        if(length <= config->lazylength)
         {
-          length = lazylength;
-          offset = lazyoffset;
-          hashhead[hash] = -1; /*the same hashchain update will be done, this ensures no wrong alteration*/
-          pos--;
+          /*hash the other bytes of the match, long matches are skipped for speed*/
+          for(i = 1; i < length; i++)
+          {
+            if(pos + i < hashend) updateHashChain(head, prev, in, pos + i, windowSize);
+          }
         }
+        pos += length - 1;
+        continue;
       }
-#endif /*LAZY_MATCHING*/
 
-      /**encode it as length/distance pair or literal value**/
-      if(length < 3) /*only lengths of 3 or higher are supported as length/distance pair*/
+      if(prevavailable && prevlength >= 3 && length <= prevlength)
       {
-        if(!uivector_push_back(out, in[pos])) ERROR_BREAK(9921 /*alloc fail*/);
+        /*the match of the previous byte is at least as good: output it, the current byte is in it*/
+        addLengthDistance(out, prevlength, prevdistance);
+        for(i = 1; i + 1 < prevlength; i++)
+        {
+          if(pos + i < hashend) updateHashChain(head, prev, in, pos + i, windowSize);
+        }
+        pos += prevlength - 2;
+        prevavailable = 0;
+        prevlength = 0;
       }
       else
       {
-        if(length == 3 && offset > 2048)
-        {
-          /*compensate for the fact that longer offsets have more extra bits, a
-          length of only 3 may be not worth it then*/
-          if(!uivector_push_back(out, in[pos + 0])) ERROR_BREAK(9921 /*alloc fail*/);
-          if(!uivector_push_back(out, in[pos + 1])) ERROR_BREAK(9921 /*alloc fail*/);
-          if(!uivector_push_back(out, in[pos + 2])) ERROR_BREAK(9921 /*alloc fail*/);
-        }
-        else
-        {
-          addLengthDistance(out, length, offset);
-        }
-        for(i = 1; i < length; i++)
-        {
-          pos++;
-          hash = getHash(in, insize, pos);
-          updateHashChain(hashchain, hashhead, hashval, pos, hash, windowSize);
-          if(hash == 0)
-          {
-            hashzeros[pos % windowSize] = countZeros(in, insize, pos);
-          }
-          else if(hash == 1)
-          {
-            numones++;
-            /*
-            If many hash values are getting grouped together in hash value 1, 4, 16, 20, ...,
-            it indicates there are many near-zero values. This is not zero enough to benefit from a speed
-            increase from numzeros, and makes it very slow. For that case switch to a different
-            hash scheme which is way faster for this specific case but results in slightly worse compression.
-            */
-            if(numones == 8192 && numones > pos / 16) windowSize = windowSize < 256 ? windowSize : 256;
-          }
-        }
+        /*the previous byte goes out as literal, and the current one waits for the next*/
+        if(prevavailable && !uivector_push_back(out, in[pos - 1])) ERROR_BREAK(9921 /*alloc fail*/);
+        prevavailable = 1;
+        prevlength = length;
+        prevdistance = distance;
       }
-
     } /*end of the loop through each character of input*/
+
+    if(!error && prevavailable)
+    {
+      if(!uivector_push_back(out, in[insize - 1])) error = 9921; /*alloc fail*/
+    }
   } /*end of "if(!error)"*/
 
-  free(hashhead);
-  free(hashval);
-  free(hashchain);
-  free(hashzeros);
+  free(head);
+  free(prev);
   return error;
 }
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize, unsigned final)
 {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
@@ -1636,7 +1749,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     unsigned BFINAL, BTYPE, LEN, NLEN;
     unsigned char firstbyte;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = final && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     firstbyte = (unsigned char)(BFINAL + ((BTYPE & 1) << 1) + ((BTYPE & 2) << 1));
@@ -1694,9 +1807,25 @@ static void writeLZ77data(size_t* bp, ucvector* out, const uivector* lz77_encode
   }
 }
 
-/*Deflate for a block of type "dynamic", that is, with freely, optimally, created huffman trees*/
-static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t datasize,
-                               const LodePNG_CompressSettings* settings)
+/*
+End a block that isn't the final one with an empty uncompressed block, as zlib's sync flush
+does. That leaves the stream at a byte boundary, so that more blocks can be appended as bytes.
+*/
+static unsigned addSyncFlush(size_t* bp, ucvector* out)
+{
+  addBitsToStream(bp, out, 0, 3); /*BFINAL 0, BTYPE 00, then the rest of the byte is skipped*/
+  /*LEN 0 and NLEN 65535*/
+  if(!ucvector_push_back(out, 0) || !ucvector_push_back(out, 0)
+     || !ucvector_push_back(out, 255) || !ucvector_push_back(out, 255)) return 9922; /*alloc fail*/
+  return 0;
+}
+
+/*
+Deflate for a block of type "dynamic", that is, with freely, optimally, created huffman trees.
+Compresses data from datastart to datasize, the data before datastart is used as LZ77 dictionary.
+*/
+static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t datastart, size_t datasize,
+                               unsigned final, const LodePNG_CompressSettings* settings)
 {
   unsigned error = 0;
 
@@ -1733,7 +1862,7 @@ static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t
   bitlen_cl is to bitlen_lld_e what bitlen_lld is to lz77_encoded.
   */
 
-  unsigned BFINAL = 1; /*make only one block... the first and final one*/
+  unsigned BFINAL = final; /*make only one block... the first and final one, unless more data follows*/
   size_t numcodes_ll, numcodes_d, i;
   size_t bp = 0; /*the bit pointer*/
   unsigned HLIT, HDIST, HCLEN;
@@ -1755,13 +1884,14 @@ static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t
   {
     if(settings->useLZ77)
     {
-      error = encodeLZ77(&lz77_encoded, data, datasize, settings->windowSize); /*LZ77 encoded*/
+      error = encodeLZ77(&lz77_encoded, data, datastart, datasize, settings->windowSize, settings->level);
       if(error) break;
     }
     else
     {
-      if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(9923 /*alloc fail*/);
-      for(i = 0; i < datasize; i++) lz77_encoded.data[i] = data[i]; /*no LZ77, but still will be Huffman compressed*/
+      if(!uivector_resize(&lz77_encoded, datasize - datastart)) ERROR_BREAK(9923 /*alloc fail*/);
+      /*no LZ77, but still will be Huffman compressed*/
+      for(i = datastart; i < datasize; i++) lz77_encoded.data[i - datastart] = data[i];
     }
 
     if(!uivector_resizev(&frequencies_ll, 286, 0)) ERROR_BREAK(9924 /*alloc fail*/);
@@ -1915,6 +2045,7 @@ static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t
 
     /*write the end code*/
     addHuffmanSymbol(&bp, out, HuffmanTree_getCode(&tree_ll, 256), HuffmanTree_getLength(&tree_ll, 256));
+    if(!BFINAL) error = addSyncFlush(&bp, out);
 
     break; /*end of error-while*/
   }
@@ -1934,13 +2065,13 @@ static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t
   return error;
 }
 
-static unsigned deflateFixed(ucvector* out, const unsigned char* data,
-                             size_t datasize, const LodePNG_CompressSettings* settings)
+static unsigned deflateFixed(ucvector* out, const unsigned char* data, size_t datastart, size_t datasize,
+                             unsigned final, const LodePNG_CompressSettings* settings)
 {
   HuffmanTree tree_ll; /*tree for literal values and length codes*/
   HuffmanTree tree_d; /*tree for distance codes*/
 
-  unsigned BFINAL = 1; /*make only one block... the first and final one*/
+  unsigned BFINAL = final; /*make only one block... the first and final one, unless more data follows*/
   unsigned error = 0;
   size_t i, bp = 0; /*the bit pointer*/
 
@@ -1958,19 +2089,20 @@ static unsigned deflateFixed(ucvector* out, const unsigned char* data,
   {
     uivector lz77_encoded;
     uivector_init(&lz77_encoded);
-    error = encodeLZ77(&lz77_encoded, data, datasize, settings->windowSize);
+    error = encodeLZ77(&lz77_encoded, data, datastart, datasize, settings->windowSize, settings->level);
     if(!error) writeLZ77data(&bp, out, &lz77_encoded, &tree_ll, &tree_d);
     uivector_cleanup(&lz77_encoded);
   }
   else /*no LZ77, but still will be Huffman compressed*/
   {
-    for(i = 0; i < datasize; i++)
+    for(i = datastart; i < datasize; i++)
     {
       addHuffmanSymbol(&bp, out, HuffmanTree_getCode(&tree_ll, data[i]), HuffmanTree_getLength(&tree_ll, data[i]));
     }
   }
   /*add END code*/
   if(!error) addHuffmanSymbol(&bp, out, HuffmanTree_getCode(&tree_ll, 256), HuffmanTree_getLength(&tree_ll, 256));
+  if(!error && !BFINAL) error = addSyncFlush(&bp, out);
 
   /*cleanup*/
   HuffmanTree_cleanup(&tree_ll);
@@ -1979,13 +2111,17 @@ static unsigned deflateFixed(ucvector* out, const unsigned char* data,
   return error;
 }
 
-static unsigned LodePNG_deflate(ucvector* out, const unsigned char* data, size_t datasize,
-                                const LodePNG_CompressSettings* settings)
+/*
+Deflate data from datastart to datasize, with the data before it as dictionary. If final
+is 0, more deflated data will follow and the output ends at a byte boundary.
+*/
+static unsigned deflateRange(ucvector* out, const unsigned char* data, size_t datastart, size_t datasize,
+                             unsigned final, const LodePNG_CompressSettings* settings)
 {
   unsigned error = 0;
-  if(settings->btype == 0) error = deflateNoCompression(out, data, datasize);
-  else if(settings->btype == 1) error = deflateFixed(out, data, datasize, settings);
-  else if(settings->btype == 2) error = deflateDynamic(out, data, datasize, settings);
+  if(settings->btype == 0) error = deflateNoCompression(out, &data[datastart], datasize - datastart, final);
+  else if(settings->btype == 1) error = deflateFixed(out, data, datastart, datasize, final, settings);
+  else if(settings->btype == 2) error = deflateDynamic(out, data, datastart, datasize, final, settings);
   else error = 61;
   return error;
 }
@@ -1996,11 +2132,70 @@ static unsigned LodePNG_deflate(ucvector* out, const unsigned char* data, size_t
 /* / Adler32                                                                  */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+#ifdef LODEPNG_SSE2
+/*
+Adler32 of 16 bytes at a time: s1 gets the sum of the bytes (_mm_sad_epu8), s2 gets
+16 times the s1 of before the block plus the bytes weighted 16 down to 1. The sums
+of a run of blocks stay in 32-bit lanes and are reduced with 64-bit math after the run.
+*/
+LODEPNG_SSE2_TARGET
+static unsigned update_adler32_sse2(unsigned adler, const unsigned char* data, unsigned len)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i weightslo = _mm_set_epi16(9, 10, 11, 12, 13, 14, 15, 16);
+  const __m128i weightshi = _mm_set_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+
+  while(len >= 16)
+  {
+    unsigned blocks = len / 16 > 347 ? 347 : len / 16; /*keeps the lanes well below 2^32*/
+    __m128i vs1 = zero, vs2 = zero, vprefix = zero;
+    unsigned lanes[3][4];
+    unsigned long long sum1, prefix, sum2;
+    unsigned i;
+
+    len -= blocks * 16;
+    for(i = 0; i < blocks; i++)
+    {
+      __m128i block = _mm_loadu_si128((const __m128i*)data);
+      vprefix = _mm_add_epi32(vprefix, vs1);
+      vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(block, zero));
+      vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(block, zero), weightslo));
+      vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(block, zero), weightshi));
+      data += 16;
+    }
+
+    _mm_storeu_si128((__m128i*)lanes[0], vs1);
+    _mm_storeu_si128((__m128i*)lanes[1], vprefix);
+    _mm_storeu_si128((__m128i*)lanes[2], vs2);
+    sum1 = (unsigned long long)lanes[0][0] + lanes[0][1] + lanes[0][2] + lanes[0][3];
+    prefix = (unsigned long long)lanes[1][0] + lanes[1][1] + lanes[1][2] + lanes[1][3];
+    sum2 = (unsigned long long)lanes[2][0] + lanes[2][1] + lanes[2][2] + lanes[2][3];
+    s2 = (unsigned)((s2 + 16ull * blocks * s1 + 16ull * prefix + sum2) % 65521);
+    s1 = (unsigned)((s1 + sum1) % 65521);
+  }
+
+  while(len > 0)
+  {
+    s1 = (s1 + *data++);
+    s2 = (s2 + s1);
+    len--;
+  }
+
+  return ((s2 % 65521) << 16) | (s1 % 65521);
+}
+#endif /*LODEPNG_SSE2*/
+
 static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
 {
    unsigned s1 = adler & 0xffff;
    unsigned s2 = (adler >> 16) & 0xffff;
 
+#ifdef LODEPNG_SSE2
+  if(len >= 64 && supportsSSE2()) return update_adler32_sse2(adler, data, len);
+#endif /*LODEPNG_SSE2*/
+
   while(len > 0)
   {
     /*at least 5550 sums can be done before the sums overflow, saving a lot of module divisions*/
@@ -2025,6 +2220,22 @@ static unsigned adler32(const unsigned char* data, unsigned len)
   return update_adler32(1L, data, len);
 }
 
+#ifdef LODEPNG_COMPILE_ENCODER
+/*Return the adler32 of two pieces of data one after the other, from their adler32s and the length of the second*/
+static unsigned adler32_combine(unsigned adler1, unsigned adler2, size_t len2)
+{
+  unsigned rem = (unsigned)(len2 % 65521);
+  unsigned s1 = adler1 & 0xffff;
+  unsigned s2 = (rem * s1) % 65521;
+  /*s1 = s1_1 + s1_2 - 1, s2 = s2_1 + s2_2 + len2 * (s1_1 - 1), modulo 65521*/
+  s1 += (adler2 & 0xffff) + 65521 - 1;
+  s2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + 65521 - rem;
+  s1 %= 65521;
+  s2 %= 65521;
+  return (s2 << 16) | s1;
+}
+#endif /*LODEPNG_COMPILE_ENCODER*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -2085,6 +2296,73 @@ unsigned LodePNG_zlib_decompress(unsigned char** out, size_t* outsize, const uns
 
 #ifdef LODEPNG_COMPILE_ENCODER
 
+/*bands smaller than this aren't worth a thread, and cost compression at their boundaries*/
+#define MIN_BAND_SIZE 65536
+
+typedef struct DeflateBand
+{
+  const unsigned char* data;
+  size_t start, end; /*the band is data[start..end-1], the data before it is its dictionary*/
+  unsigned final;
+  const LodePNG_CompressSettings* settings;
+  ucvector out;
+  unsigned adler;
+  unsigned error;
+} DeflateBand;
+
+static void* deflateBandJob(void* arg)
+{
+  DeflateBand* band = (DeflateBand*)arg;
+  band->error = deflateRange(&band->out, band->data, band->start, band->end, band->final, band->settings);
+  band->adler = adler32(&band->data[band->start], (unsigned)(band->end - band->start));
+  return 0;
+}
+
+/*
+Deflate the data, and give the adler32 of it. With settings->threads above 1, the data is
+split in that many bands that are deflated at the same time, each ending in a sync flush so
+that the deflated bands can simply be appended, and their adler32s are combined.
+*/
+static unsigned deflateBands(ucvector* out, unsigned* adler, const unsigned char* data, size_t datasize,
+                             const LodePNG_CompressSettings* settings)
+{
+  unsigned numbands = settings->threads;
+  unsigned i, error = 0;
+  DeflateBand* bands;
+
+  if(numbands > datasize / MIN_BAND_SIZE) numbands = (unsigned)(datasize / MIN_BAND_SIZE);
+  if(numbands < 1) numbands = 1;
+
+  bands = (DeflateBand*)malloc(sizeof(DeflateBand) * numbands);
+  if(!bands) return 9954; /*alloc fail*/
+  for(i = 0; i < numbands; i++)
+  {
+    bands[i].data = data;
+    bands[i].start = datasize / numbands * i;
+    bands[i].end = i + 1 == numbands ? datasize : datasize / numbands * (i + 1);
+    bands[i].final = i + 1 == numbands;
+    bands[i].settings = settings;
+    ucvector_init(&bands[i].out);
+  }
+
+  runJobs(deflateBandJob, bands, sizeof(DeflateBand), numbands);
+
+  *adler = 1;
+  for(i = 0; i < numbands; i++)
+  {
+    if(!error) error = bands[i].error;
+    if(!error && !ucvector_resize(out, out->size + bands[i].out.size)) error = 9955; /*alloc fail*/
+    if(!error)
+    {
+      if(bands[i].out.size) memcpy(&out->data[out->size - bands[i].out.size], bands[i].out.data, bands[i].out.size);
+      *adler = adler32_combine(*adler, bands[i].adler, bands[i].end - bands[i].start);
+    }
+    ucvector_cleanup(&bands[i].out);
+  }
+  free(bands);
+  return error;
+}
+
 unsigned LodePNG_zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
                                size_t insize, const LodePNG_CompressSettings* settings)
 {
@@ -2103,6 +2381,8 @@ unsigned LodePNG_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   unsigned FCHECK = 31 - CMFFLG % 31;
   CMFFLG += FCHECK;
 
+  if(settings->level < 1 || settings->level > 9) return 84; /*error: unexisting compression level*/
+
   /*ucvector-controlled version of the output buffer, for dynamic array*/
   ucvector_init_buffer(&outv, *out, *outsize);
 
@@ -2110,15 +2390,14 @@ unsigned LodePNG_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   ucvector_push_back(&outv, (unsigned char)(CMFFLG % 256));
 
   ucvector_init(&deflatedata);
-  error = LodePNG_deflate(&deflatedata, in, insize, settings);
+  error = deflateBands(&deflatedata, &ADLER32, in, insize, settings);
 
   if(!error)
   {
-    ADLER32 = adler32(in, (unsigned)insize);
     for(i = 0; i < deflatedata.size; i++) ucvector_push_back(&outv, deflatedata.data[i]);
-    ucvector_cleanup(&deflatedata);
     LodePNG_add32bitInt(&outv, ADLER32);
   }
+  ucvector_cleanup(&deflatedata);
 
   *out = outv.data;
   *outsize = outv.size;
@@ -2163,6 +2442,7 @@ static unsigned LodePNG_zlib_compress(unsigned char** out, size_t* outsize, cons
 
 /*this is a good tradeoff between speed and compression ratio*/
 #define DEFAULT_WINDOWSIZE 2048
+#define DEFAULT_LEVEL 6
 
 void LodePNG_CompressSettings_init(LodePNG_CompressSettings* settings)
 {
@@ -2170,9 +2450,11 @@ void LodePNG_CompressSettings_init(LodePNG_CompressSettings* settings)
   settings->btype = 2;
   settings->useLZ77 = 1;
   settings->windowSize = DEFAULT_WINDOWSIZE;
+  settings->level = DEFAULT_LEVEL;
+  settings->threads = 1;
 }
 
-const LodePNG_CompressSettings LodePNG_defaultCompressSettings = {2, 1, DEFAULT_WINDOWSIZE};
+const LodePNG_CompressSettings LodePNG_defaultCompressSettings = {2, 1, DEFAULT_WINDOWSIZE, DEFAULT_LEVEL, 1};
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
@@ -2199,25 +2481,372 @@ const LodePNG_DecompressSettings LodePNG_defaultDecompressSettings = {0};
 /* / CRC32                                                                  / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-static unsigned Crc32_crc_table_computed = 0;
-static unsigned Crc32_crc_table[256];
-
-/*Make the table for a fast CRC.*/
-static void Crc32_make_crc_table(void)
-{
-  unsigned c, k, n;
-  for(n = 0; n < 256; n++)
-  {
-    c = n;
-    for(k = 0; k < 8; k++)
-    {
-      if(c & 1) c = 0xedb88320L ^ (c >> 1);
-      else c = c >> 1;
-    }
-    Crc32_crc_table[n] = c;
-  }
-  Crc32_crc_table_computed = 1;
-}
+/*Crc32_crc_table[0] is the usual byte table, Crc32_crc_table[k] is the CRC of a
+byte followed by k zero bytes, used to do 8 bytes per step ("slicing-by-8").
+The tables are constant data rather than built on first use, so that images
+can be decoded on several threads at once.*/
+static const unsigned Crc32_crc_table[8][256] = {
+  {
+    0x00000000u, 0x77073096u, 0xee0e612cu, 0x990951bau, 0x076dc419u, 0x706af48fu,
+    0xe963a535u, 0x9e6495a3u, 0x0edb8832u, 0x79dcb8a4u, 0xe0d5e91eu, 0x97d2d988u,
+    0x09b64c2bu, 0x7eb17cbdu, 0xe7b82d07u, 0x90bf1d91u, 0x1db71064u, 0x6ab020f2u,
+    0xf3b97148u, 0x84be41deu, 0x1adad47du, 0x6ddde4ebu, 0xf4d4b551u, 0x83d385c7u,
+    0x136c9856u, 0x646ba8c0u, 0xfd62f97au, 0x8a65c9ecu, 0x14015c4fu, 0x63066cd9u,
+    0xfa0f3d63u, 0x8d080df5u, 0x3b6e20c8u, 0x4c69105eu, 0xd56041e4u, 0xa2677172u,
+    0x3c03e4d1u, 0x4b04d447u, 0xd20d85fdu, 0xa50ab56bu, 0x35b5a8fau, 0x42b2986cu,
+    0xdbbbc9d6u, 0xacbcf940u, 0x32d86ce3u, 0x45df5c75u, 0xdcd60dcfu, 0xabd13d59u,
+    0x26d930acu, 0x51de003au, 0xc8d75180u, 0xbfd06116u, 0x21b4f4b5u, 0x56b3c423u,
+    0xcfba9599u, 0xb8bda50fu, 0x2802b89eu, 0x5f058808u, 0xc60cd9b2u, 0xb10be924u,
+    0x2f6f7c87u, 0x58684c11u, 0xc1611dabu, 0xb6662d3du, 0x76dc4190u, 0x01db7106u,
+    0x98d220bcu, 0xefd5102au, 0x71b18589u, 0x06b6b51fu, 0x9fbfe4a5u, 0xe8b8d433u,
+    0x7807c9a2u, 0x0f00f934u, 0x9609a88eu, 0xe10e9818u, 0x7f6a0dbbu, 0x086d3d2du,
+    0x91646c97u, 0xe6635c01u, 0x6b6b51f4u, 0x1c6c6162u, 0x856530d8u, 0xf262004eu,
+    0x6c0695edu, 0x1b01a57bu, 0x8208f4c1u, 0xf50fc457u, 0x65b0d9c6u, 0x12b7e950u,
+    0x8bbeb8eau, 0xfcb9887cu, 0x62dd1ddfu, 0x15da2d49u, 0x8cd37cf3u, 0xfbd44c65u,
+    0x4db26158u, 0x3ab551ceu, 0xa3bc0074u, 0xd4bb30e2u, 0x4adfa541u, 0x3dd895d7u,
+    0xa4d1c46du, 0xd3d6f4fbu, 0x4369e96au, 0x346ed9fcu, 0xad678846u, 0xda60b8d0u,
+    0x44042d73u, 0x33031de5u, 0xaa0a4c5fu, 0xdd0d7cc9u, 0x5005713cu, 0x270241aau,
+    0xbe0b1010u, 0xc90c2086u, 0x5768b525u, 0x206f85b3u, 0xb966d409u, 0xce61e49fu,
+    0x5edef90eu, 0x29d9c998u, 0xb0d09822u, 0xc7d7a8b4u, 0x59b33d17u, 0x2eb40d81u,
+    0xb7bd5c3bu, 0xc0ba6cadu, 0xedb88320u, 0x9abfb3b6u, 0x03b6e20cu, 0x74b1d29au,
+    0xead54739u, 0x9dd277afu, 0x04db2615u, 0x73dc1683u, 0xe3630b12u, 0x94643b84u,
+    0x0d6d6a3eu, 0x7a6a5aa8u, 0xe40ecf0bu, 0x9309ff9du, 0x0a00ae27u, 0x7d079eb1u,
+    0xf00f9344u, 0x8708a3d2u, 0x1e01f268u, 0x6906c2feu, 0xf762575du, 0x806567cbu,
+    0x196c3671u, 0x6e6b06e7u, 0xfed41b76u, 0x89d32be0u, 0x10da7a5au, 0x67dd4accu,
+    0xf9b9df6fu, 0x8ebeeff9u, 0x17b7be43u, 0x60b08ed5u, 0xd6d6a3e8u, 0xa1d1937eu,
+    0x38d8c2c4u, 0x4fdff252u, 0xd1bb67f1u, 0xa6bc5767u, 0x3fb506ddu, 0x48b2364bu,
+    0xd80d2bdau, 0xaf0a1b4cu, 0x36034af6u, 0x41047a60u, 0xdf60efc3u, 0xa867df55u,
+    0x316e8eefu, 0x4669be79u, 0xcb61b38cu, 0xbc66831au, 0x256fd2a0u, 0x5268e236u,
+    0xcc0c7795u, 0xbb0b4703u, 0x220216b9u, 0x5505262fu, 0xc5ba3bbeu, 0xb2bd0b28u,
+    0x2bb45a92u, 0x5cb36a04u, 0xc2d7ffa7u, 0xb5d0cf31u, 0x2cd99e8bu, 0x5bdeae1du,
+    0x9b64c2b0u, 0xec63f226u, 0x756aa39cu, 0x026d930au, 0x9c0906a9u, 0xeb0e363fu,
+    0x72076785u, 0x05005713u, 0x95bf4a82u, 0xe2b87a14u, 0x7bb12baeu, 0x0cb61b38u,
+    0x92d28e9bu, 0xe5d5be0du, 0x7cdcefb7u, 0x0bdbdf21u, 0x86d3d2d4u, 0xf1d4e242u,
+    0x68ddb3f8u, 0x1fda836eu, 0x81be16cdu, 0xf6b9265bu, 0x6fb077e1u, 0x18b74777u,
+    0x88085ae6u, 0xff0f6a70u, 0x66063bcau, 0x11010b5cu, 0x8f659effu, 0xf862ae69u,
+    0x616bffd3u, 0x166ccf45u, 0xa00ae278u, 0xd70dd2eeu, 0x4e048354u, 0x3903b3c2u,
+    0xa7672661u, 0xd06016f7u, 0x4969474du, 0x3e6e77dbu, 0xaed16a4au, 0xd9d65adcu,
+    0x40df0b66u, 0x37d83bf0u, 0xa9bcae53u, 0xdebb9ec5u, 0x47b2cf7fu, 0x30b5ffe9u,
+    0xbdbdf21cu, 0xcabac28au, 0x53b39330u, 0x24b4a3a6u, 0xbad03605u, 0xcdd70693u,
+    0x54de5729u, 0x23d967bfu, 0xb3667a2eu, 0xc4614ab8u, 0x5d681b02u, 0x2a6f2b94u,
+    0xb40bbe37u, 0xc30c8ea1u, 0x5a05df1bu, 0x2d02ef8du
+  },
+  {
+    0x00000000u, 0x191b3141u, 0x32366282u, 0x2b2d53c3u, 0x646cc504u, 0x7d77f445u,
+    0x565aa786u, 0x4f4196c7u, 0xc8d98a08u, 0xd1c2bb49u, 0xfaefe88au, 0xe3f4d9cbu,
+    0xacb54f0cu, 0xb5ae7e4du, 0x9e832d8eu, 0x87981ccfu, 0x4ac21251u, 0x53d92310u,
+    0x78f470d3u, 0x61ef4192u, 0x2eaed755u, 0x37b5e614u, 0x1c98b5d7u, 0x05838496u,
+    0x821b9859u, 0x9b00a918u, 0xb02dfadbu, 0xa936cb9au, 0xe6775d5du, 0xff6c6c1cu,
+    0xd4413fdfu, 0xcd5a0e9eu, 0x958424a2u, 0x8c9f15e3u, 0xa7b24620u, 0xbea97761u,
+    0xf1e8e1a6u, 0xe8f3d0e7u, 0xc3de8324u, 0xdac5b265u, 0x5d5daeaau, 0x44469febu,
+    0x6f6bcc28u, 0x7670fd69u, 0x39316baeu, 0x202a5aefu, 0x0b07092cu, 0x121c386du,
+    0xdf4636f3u, 0xc65d07b2u, 0xed705471u, 0xf46b6530u, 0xbb2af3f7u, 0xa231c2b6u,
+    0x891c9175u, 0x9007a034u, 0x179fbcfbu, 0x0e848dbau, 0x25a9de79u, 0x3cb2ef38u,
+    0x73f379ffu, 0x6ae848beu, 0x41c51b7du, 0x58de2a3cu, 0xf0794f05u, 0xe9627e44u,
+    0xc24f2d87u, 0xdb541cc6u, 0x94158a01u, 0x8d0ebb40u, 0xa623e883u, 0xbf38d9c2u,
+    0x38a0c50du, 0x21bbf44cu, 0x0a96a78fu, 0x138d96ceu, 0x5ccc0009u, 0x45d73148u,
+    0x6efa628bu, 0x77e153cau, 0xbabb5d54u, 0xa3a06c15u, 0x888d3fd6u, 0x91960e97u,
+    0xded79850u, 0xc7cca911u, 0xece1fad2u, 0xf5facb93u, 0x7262d75cu, 0x6b79e61du,
+    0x4054b5deu, 0x594f849fu, 0x160e1258u, 0x0f152319u, 0x243870dau, 0x3d23419bu,
+    0x65fd6ba7u, 0x7ce65ae6u, 0x57cb0925u, 0x4ed03864u, 0x0191aea3u, 0x188a9fe2u,
+    0x33a7cc21u, 0x2abcfd60u, 0xad24e1afu, 0xb43fd0eeu, 0x9f12832du, 0x8609b26cu,
+    0xc94824abu, 0xd05315eau, 0xfb7e4629u, 0xe2657768u, 0x2f3f79f6u, 0x362448b7u,
+    0x1d091b74u, 0x04122a35u, 0x4b53bcf2u, 0x52488db3u, 0x7965de70u, 0x607eef31u,
+    0xe7e6f3feu, 0xfefdc2bfu, 0xd5d0917cu, 0xcccba03du, 0x838a36fau, 0x9a9107bbu,
+    0xb1bc5478u, 0xa8a76539u, 0x3b83984bu, 0x2298a90au, 0x09b5fac9u, 0x10aecb88u,
+    0x5fef5d4fu, 0x46f46c0eu, 0x6dd93fcdu, 0x74c20e8cu, 0xf35a1243u, 0xea412302u,
+    0xc16c70c1u, 0xd8774180u, 0x9736d747u, 0x8e2de606u, 0xa500b5c5u, 0xbc1b8484u,
+    0x71418a1au, 0x685abb5bu, 0x4377e898u, 0x5a6cd9d9u, 0x152d4f1eu, 0x0c367e5fu,
+    0x271b2d9cu, 0x3e001cddu, 0xb9980012u, 0xa0833153u, 0x8bae6290u, 0x92b553d1u,
+    0xddf4c516u, 0xc4eff457u, 0xefc2a794u, 0xf6d996d5u, 0xae07bce9u, 0xb71c8da8u,
+    0x9c31de6bu, 0x852aef2au, 0xca6b79edu, 0xd37048acu, 0xf85d1b6fu, 0xe1462a2eu,
+    0x66de36e1u, 0x7fc507a0u, 0x54e85463u, 0x4df36522u, 0x02b2f3e5u, 0x1ba9c2a4u,
+    0x30849167u, 0x299fa026u, 0xe4c5aeb8u, 0xfdde9ff9u, 0xd6f3cc3au, 0xcfe8fd7bu,
+    0x80a96bbcu, 0x99b25afdu, 0xb29f093eu, 0xab84387fu, 0x2c1c24b0u, 0x350715f1u,
+    0x1e2a4632u, 0x07317773u, 0x4870e1b4u, 0x516bd0f5u, 0x7a468336u, 0x635db277u,
+    0xcbfad74eu, 0xd2e1e60fu, 0xf9ccb5ccu, 0xe0d7848du, 0xaf96124au, 0xb68d230bu,
+    0x9da070c8u, 0x84bb4189u, 0x03235d46u, 0x1a386c07u, 0x31153fc4u, 0x280e0e85u,
+    0x674f9842u, 0x7e54a903u, 0x5579fac0u, 0x4c62cb81u, 0x8138c51fu, 0x9823f45eu,
+    0xb30ea79du, 0xaa1596dcu, 0xe554001bu, 0xfc4f315au, 0xd7626299u, 0xce7953d8u,
+    0x49e14f17u, 0x50fa7e56u, 0x7bd72d95u, 0x62cc1cd4u, 0x2d8d8a13u, 0x3496bb52u,
+    0x1fbbe891u, 0x06a0d9d0u, 0x5e7ef3ecu, 0x4765c2adu, 0x6c48916eu, 0x7553a02fu,
+    0x3a1236e8u, 0x230907a9u, 0x0824546au, 0x113f652bu, 0x96a779e4u, 0x8fbc48a5u,
+    0xa4911b66u, 0xbd8a2a27u, 0xf2cbbce0u, 0xebd08da1u, 0xc0fdde62u, 0xd9e6ef23u,
+    0x14bce1bdu, 0x0da7d0fcu, 0x268a833fu, 0x3f91b27eu, 0x70d024b9u, 0x69cb15f8u,
+    0x42e6463bu, 0x5bfd777au, 0xdc656bb5u, 0xc57e5af4u, 0xee530937u, 0xf7483876u,
+    0xb809aeb1u, 0xa1129ff0u, 0x8a3fcc33u, 0x9324fd72u
+  },
+  {
+    0x00000000u, 0x01c26a37u, 0x0384d46eu, 0x0246be59u, 0x0709a8dcu, 0x06cbc2ebu,
+    0x048d7cb2u, 0x054f1685u, 0x0e1351b8u, 0x0fd13b8fu, 0x0d9785d6u, 0x0c55efe1u,
+    0x091af964u, 0x08d89353u, 0x0a9e2d0au, 0x0b5c473du, 0x1c26a370u, 0x1de4c947u,
+    0x1fa2771eu, 0x1e601d29u, 0x1b2f0bacu, 0x1aed619bu, 0x18abdfc2u, 0x1969b5f5u,
+    0x1235f2c8u, 0x13f798ffu, 0x11b126a6u, 0x10734c91u, 0x153c5a14u, 0x14fe3023u,
+    0x16b88e7au, 0x177ae44du, 0x384d46e0u, 0x398f2cd7u, 0x3bc9928eu, 0x3a0bf8b9u,
+    0x3f44ee3cu, 0x3e86840bu, 0x3cc03a52u, 0x3d025065u, 0x365e1758u, 0x379c7d6fu,
+    0x35dac336u, 0x3418a901u, 0x3157bf84u, 0x3095d5b3u, 0x32d36beau, 0x331101ddu,
+    0x246be590u, 0x25a98fa7u, 0x27ef31feu, 0x262d5bc9u, 0x23624d4cu, 0x22a0277bu,
+    0x20e69922u, 0x2124f315u, 0x2a78b428u, 0x2bbade1fu, 0x29fc6046u, 0x283e0a71u,
+    0x2d711cf4u, 0x2cb376c3u, 0x2ef5c89au, 0x2f37a2adu, 0x709a8dc0u, 0x7158e7f7u,
+    0x731e59aeu, 0x72dc3399u, 0x7793251cu, 0x76514f2bu, 0x7417f172u, 0x75d59b45u,
+    0x7e89dc78u, 0x7f4bb64fu, 0x7d0d0816u, 0x7ccf6221u, 0x798074a4u, 0x78421e93u,
+    0x7a04a0cau, 0x7bc6cafdu, 0x6cbc2eb0u, 0x6d7e4487u, 0x6f38fadeu, 0x6efa90e9u,
+    0x6bb5866cu, 0x6a77ec5bu, 0x68315202u, 0x69f33835u, 0x62af7f08u, 0x636d153fu,
+    0x612bab66u, 0x60e9c151u, 0x65a6d7d4u, 0x6464bde3u, 0x662203bau, 0x67e0698du,
+    0x48d7cb20u, 0x4915a117u, 0x4b531f4eu, 0x4a917579u, 0x4fde63fcu, 0x4e1c09cbu,
+    0x4c5ab792u, 0x4d98dda5u, 0x46c49a98u, 0x4706f0afu, 0x45404ef6u, 0x448224c1u,
+    0x41cd3244u, 0x400f5873u, 0x4249e62au, 0x438b8c1du, 0x54f16850u, 0x55330267u,
+    0x5775bc3eu, 0x56b7d609u, 0x53f8c08cu, 0x523aaabbu, 0x507c14e2u, 0x51be7ed5u,
+    0x5ae239e8u, 0x5b2053dfu, 0x5966ed86u, 0x58a487b1u, 0x5deb9134u, 0x5c29fb03u,
+    0x5e6f455au, 0x5fad2f6du, 0xe1351b80u, 0xe0f771b7u, 0xe2b1cfeeu, 0xe373a5d9u,
+    0xe63cb35cu, 0xe7fed96bu, 0xe5b86732u, 0xe47a0d05u, 0xef264a38u, 0xeee4200fu,
+    0xeca29e56u, 0xed60f461u, 0xe82fe2e4u, 0xe9ed88d3u, 0xebab368au, 0xea695cbdu,
+    0xfd13b8f0u, 0xfcd1d2c7u, 0xfe976c9eu, 0xff5506a9u, 0xfa1a102cu, 0xfbd87a1bu,
+    0xf99ec442u, 0xf85cae75u, 0xf300e948u, 0xf2c2837fu, 0xf0843d26u, 0xf1465711u,
+    0xf4094194u, 0xf5cb2ba3u, 0xf78d95fau, 0xf64fffcdu, 0xd9785d60u, 0xd8ba3757u,
+    0xdafc890eu, 0xdb3ee339u, 0xde71f5bcu, 0xdfb39f8bu, 0xddf521d2u, 0xdc374be5u,
+    0xd76b0cd8u, 0xd6a966efu, 0xd4efd8b6u, 0xd52db281u, 0xd062a404u, 0xd1a0ce33u,
+    0xd3e6706au, 0xd2241a5du, 0xc55efe10u, 0xc49c9427u, 0xc6da2a7eu, 0xc7184049u,
+    0xc25756ccu, 0xc3953cfbu, 0xc1d382a2u, 0xc011e895u, 0xcb4dafa8u, 0xca8fc59fu,
+    0xc8c97bc6u, 0xc90b11f1u, 0xcc440774u, 0xcd866d43u, 0xcfc0d31au, 0xce02b92du,
+    0x91af9640u, 0x906dfc77u, 0x922b422eu, 0x93e92819u, 0x96a63e9cu, 0x976454abu,
+    0x9522eaf2u, 0x94e080c5u, 0x9fbcc7f8u, 0x9e7eadcfu, 0x9c381396u, 0x9dfa79a1u,
+    0x98b56f24u, 0x99770513u, 0x9b31bb4au, 0x9af3d17du, 0x8d893530u, 0x8c4b5f07u,
+    0x8e0de15eu, 0x8fcf8b69u, 0x8a809decu, 0x8b42f7dbu, 0x89044982u, 0x88c623b5u,
+    0x839a6488u, 0x82580ebfu, 0x801eb0e6u, 0x81dcdad1u, 0x8493cc54u, 0x8551a663u,
+    0x8717183au, 0x86d5720du, 0xa9e2d0a0u, 0xa820ba97u, 0xaa6604ceu, 0xaba46ef9u,
+    0xaeeb787cu, 0xaf29124bu, 0xad6fac12u, 0xacadc625u, 0xa7f18118u, 0xa633eb2fu,
+    0xa4755576u, 0xa5b73f41u, 0xa0f829c4u, 0xa13a43f3u, 0xa37cfdaau, 0xa2be979du,
+    0xb5c473d0u, 0xb40619e7u, 0xb640a7beu, 0xb782cd89u, 0xb2cddb0cu, 0xb30fb13bu,
+    0xb1490f62u, 0xb08b6555u, 0xbbd72268u, 0xba15485fu, 0xb853f606u, 0xb9919c31u,
+    0xbcde8ab4u, 0xbd1ce083u, 0xbf5a5edau, 0xbe9834edu
+  },
+  {
+    0x00000000u, 0xb8bc6765u, 0xaa09c88bu, 0x12b5afeeu, 0x8f629757u, 0x37def032u,
+    0x256b5fdcu, 0x9dd738b9u, 0xc5b428efu, 0x7d084f8au, 0x6fbde064u, 0xd7018701u,
+    0x4ad6bfb8u, 0xf26ad8ddu, 0xe0df7733u, 0x58631056u, 0x5019579fu, 0xe8a530fau,
+    0xfa109f14u, 0x42acf871u, 0xdf7bc0c8u, 0x67c7a7adu, 0x75720843u, 0xcdce6f26u,
+    0x95ad7f70u, 0x2d111815u, 0x3fa4b7fbu, 0x8718d09eu, 0x1acfe827u, 0xa2738f42u,
+    0xb0c620acu, 0x087a47c9u, 0xa032af3eu, 0x188ec85bu, 0x0a3b67b5u, 0xb28700d0u,
+    0x2f503869u, 0x97ec5f0cu, 0x8559f0e2u, 0x3de59787u, 0x658687d1u, 0xdd3ae0b4u,
+    0xcf8f4f5au, 0x7733283fu, 0xeae41086u, 0x525877e3u, 0x40edd80du, 0xf851bf68u,
+    0xf02bf8a1u, 0x48979fc4u, 0x5a22302au, 0xe29e574fu, 0x7f496ff6u, 0xc7f50893u,
+    0xd540a77du, 0x6dfcc018u, 0x359fd04eu, 0x8d23b72bu, 0x9f9618c5u, 0x272a7fa0u,
+    0xbafd4719u, 0x0241207cu, 0x10f48f92u, 0xa848e8f7u, 0x9b14583du, 0x23a83f58u,
+    0x311d90b6u, 0x89a1f7d3u, 0x1476cf6au, 0xaccaa80fu, 0xbe7f07e1u, 0x06c36084u,
+    0x5ea070d2u, 0xe61c17b7u, 0xf4a9b859u, 0x4c15df3cu, 0xd1c2e785u, 0x697e80e0u,
+    0x7bcb2f0eu, 0xc377486bu, 0xcb0d0fa2u, 0x73b168c7u, 0x6104c729u, 0xd9b8a04cu,
+    0x446f98f5u, 0xfcd3ff90u, 0xee66507eu, 0x56da371bu, 0x0eb9274du, 0xb6054028u,
+    0xa4b0efc6u, 0x1c0c88a3u, 0x81dbb01au, 0x3967d77fu, 0x2bd27891u, 0x936e1ff4u,
+    0x3b26f703u, 0x839a9066u, 0x912f3f88u, 0x299358edu, 0xb4446054u, 0x0cf80731u,
+    0x1e4da8dfu, 0xa6f1cfbau, 0xfe92dfecu, 0x462eb889u, 0x549b1767u, 0xec277002u,
+    0x71f048bbu, 0xc94c2fdeu, 0xdbf98030u, 0x6345e755u, 0x6b3fa09cu, 0xd383c7f9u,
+    0xc1366817u, 0x798a0f72u, 0xe45d37cbu, 0x5ce150aeu, 0x4e54ff40u, 0xf6e89825u,
+    0xae8b8873u, 0x1637ef16u, 0x048240f8u, 0xbc3e279du, 0x21e91f24u, 0x99557841u,
+    0x8be0d7afu, 0x335cb0cau, 0xed59b63bu, 0x55e5d15eu, 0x47507eb0u, 0xffec19d5u,
+    0x623b216cu, 0xda874609u, 0xc832e9e7u, 0x708e8e82u, 0x28ed9ed4u, 0x9051f9b1u,
+    0x82e4565fu, 0x3a58313au, 0xa78f0983u, 0x1f336ee6u, 0x0d86c108u, 0xb53aa66du,
+    0xbd40e1a4u, 0x05fc86c1u, 0x1749292fu, 0xaff54e4au, 0x322276f3u, 0x8a9e1196u,
+    0x982bbe78u, 0x2097d91du, 0x78f4c94bu, 0xc048ae2eu, 0xd2fd01c0u, 0x6a4166a5u,
+    0xf7965e1cu, 0x4f2a3979u, 0x5d9f9697u, 0xe523f1f2u, 0x4d6b1905u, 0xf5d77e60u,
+    0xe762d18eu, 0x5fdeb6ebu, 0xc2098e52u, 0x7ab5e937u, 0x680046d9u, 0xd0bc21bcu,
+    0x88df31eau, 0x3063568fu, 0x22d6f961u, 0x9a6a9e04u, 0x07bda6bdu, 0xbf01c1d8u,
+    0xadb46e36u, 0x15080953u, 0x1d724e9au, 0xa5ce29ffu, 0xb77b8611u, 0x0fc7e174u,
+    0x9210d9cdu, 0x2aacbea8u, 0x38191146u, 0x80a57623u, 0xd8c66675u, 0x607a0110u,
+    0x72cfaefeu, 0xca73c99bu, 0x57a4f122u, 0xef189647u, 0xfdad39a9u, 0x45115eccu,
+    0x764dee06u, 0xcef18963u, 0xdc44268du, 0x64f841e8u, 0xf92f7951u, 0x41931e34u,
+    0x5326b1dau, 0xeb9ad6bfu, 0xb3f9c6e9u, 0x0b45a18cu, 0x19f00e62u, 0xa14c6907u,
+    0x3c9b51beu, 0x842736dbu, 0x96929935u, 0x2e2efe50u, 0x2654b999u, 0x9ee8defcu,
+    0x8c5d7112u, 0x34e11677u, 0xa9362eceu, 0x118a49abu, 0x033fe645u, 0xbb838120u,
+    0xe3e09176u, 0x5b5cf613u, 0x49e959fdu, 0xf1553e98u, 0x6c820621u, 0xd43e6144u,
+    0xc68bceaau, 0x7e37a9cfu, 0xd67f4138u, 0x6ec3265du, 0x7c7689b3u, 0xc4caeed6u,
+    0x591dd66fu, 0xe1a1b10au, 0xf3141ee4u, 0x4ba87981u, 0x13cb69d7u, 0xab770eb2u,
+    0xb9c2a15cu, 0x017ec639u, 0x9ca9fe80u, 0x241599e5u, 0x36a0360bu, 0x8e1c516eu,
+    0x866616a7u, 0x3eda71c2u, 0x2c6fde2cu, 0x94d3b949u, 0x090481f0u, 0xb1b8e695u,
+    0xa30d497bu, 0x1bb12e1eu, 0x43d23e48u, 0xfb6e592du, 0xe9dbf6c3u, 0x516791a6u,
+    0xccb0a91fu, 0x740cce7au, 0x66b96194u, 0xde0506f1u
+  },
+  {
+    0x00000000u, 0x3d6029b0u, 0x7ac05360u, 0x47a07ad0u, 0xf580a6c0u, 0xc8e08f70u,
+    0x8f40f5a0u, 0xb220dc10u, 0x30704bc1u, 0x0d106271u, 0x4ab018a1u, 0x77d03111u,
+    0xc5f0ed01u, 0xf890c4b1u, 0xbf30be61u, 0x825097d1u, 0x60e09782u, 0x5d80be32u,
+    0x1a20c4e2u, 0x2740ed52u, 0x95603142u, 0xa80018f2u, 0xefa06222u, 0xd2c04b92u,
+    0x5090dc43u, 0x6df0f5f3u, 0x2a508f23u, 0x1730a693u, 0xa5107a83u, 0x98705333u,
+    0xdfd029e3u, 0xe2b00053u, 0xc1c12f04u, 0xfca106b4u, 0xbb017c64u, 0x866155d4u,
+    0x344189c4u, 0x0921a074u, 0x4e81daa4u, 0x73e1f314u, 0xf1b164c5u, 0xccd14d75u,
+    0x8b7137a5u, 0xb6111e15u, 0x0431c205u, 0x3951ebb5u, 0x7ef19165u, 0x4391b8d5u,
+    0xa121b886u, 0x9c419136u, 0xdbe1ebe6u, 0xe681c256u, 0x54a11e46u, 0x69c137f6u,
+    0x2e614d26u, 0x13016496u, 0x9151f347u, 0xac31daf7u, 0xeb91a027u, 0xd6f18997u,
+    0x64d15587u, 0x59b17c37u, 0x1e1106e7u, 0x23712f57u, 0x58f35849u, 0x659371f9u,
+    0x22330b29u, 0x1f532299u, 0xad73fe89u, 0x9013d739u, 0xd7b3ade9u, 0xead38459u,
+    0x68831388u, 0x55e33a38u, 0x124340e8u, 0x2f236958u, 0x9d03b548u, 0xa0639cf8u,
+    0xe7c3e628u, 0xdaa3cf98u, 0x3813cfcbu, 0x0573e67bu, 0x42d39cabu, 0x7fb3b51bu,
+    0xcd93690bu, 0xf0f340bbu, 0xb7533a6bu, 0x8a3313dbu, 0x0863840au, 0x3503adbau,
+    0x72a3d76au, 0x4fc3fedau, 0xfde322cau, 0xc0830b7au, 0x872371aau, 0xba43581au,
+    0x9932774du, 0xa4525efdu, 0xe3f2242du, 0xde920d9du, 0x6cb2d18du, 0x51d2f83du,
+    0x167282edu, 0x2b12ab5du, 0xa9423c8cu, 0x9422153cu, 0xd3826fecu, 0xeee2465cu,
+    0x5cc29a4cu, 0x61a2b3fcu, 0x2602c92cu, 0x1b62e09cu, 0xf9d2e0cfu, 0xc4b2c97fu,
+    0x8312b3afu, 0xbe729a1fu, 0x0c52460fu, 0x31326fbfu, 0x7692156fu, 0x4bf23cdfu,
+    0xc9a2ab0eu, 0xf4c282beu, 0xb362f86eu, 0x8e02d1deu, 0x3c220dceu, 0x0142247eu,
+    0x46e25eaeu, 0x7b82771eu, 0xb1e6b092u, 0x8c869922u, 0xcb26e3f2u, 0xf646ca42u,
+    0x44661652u, 0x79063fe2u, 0x3ea64532u, 0x03c66c82u, 0x8196fb53u, 0xbcf6d2e3u,
+    0xfb56a833u, 0xc6368183u, 0x74165d93u, 0x49767423u, 0x0ed60ef3u, 0x33b62743u,
+    0xd1062710u, 0xec660ea0u, 0xabc67470u, 0x96a65dc0u, 0x248681d0u, 0x19e6a860u,
+    0x5e46d2b0u, 0x6326fb00u, 0xe1766cd1u, 0xdc164561u, 0x9bb63fb1u, 0xa6d61601u,
+    0x14f6ca11u, 0x2996e3a1u, 0x6e369971u, 0x5356b0c1u, 0x70279f96u, 0x4d47b626u,
+    0x0ae7ccf6u, 0x3787e546u, 0x85a73956u, 0xb8c710e6u, 0xff676a36u, 0xc2074386u,
+    0x4057d457u, 0x7d37fde7u, 0x3a978737u, 0x07f7ae87u, 0xb5d77297u, 0x88b75b27u,
+    0xcf1721f7u, 0xf2770847u, 0x10c70814u, 0x2da721a4u, 0x6a075b74u, 0x576772c4u,
+    0xe547aed4u, 0xd8278764u, 0x9f87fdb4u, 0xa2e7d404u, 0x20b743d5u, 0x1dd76a65u,
+    0x5a7710b5u, 0x67173905u, 0xd537e515u, 0xe857cca5u, 0xaff7b675u, 0x92979fc5u,
+    0xe915e8dbu, 0xd475c16bu, 0x93d5bbbbu, 0xaeb5920bu, 0x1c954e1bu, 0x21f567abu,
+    0x66551d7bu, 0x5b3534cbu, 0xd965a31au, 0xe4058aaau, 0xa3a5f07au, 0x9ec5d9cau,
+    0x2ce505dau, 0x11852c6au, 0x562556bau, 0x6b457f0au, 0x89f57f59u, 0xb49556e9u,
+    0xf3352c39u, 0xce550589u, 0x7c75d999u, 0x4115f029u, 0x06b58af9u, 0x3bd5a349u,
+    0xb9853498u, 0x84e51d28u, 0xc34567f8u, 0xfe254e48u, 0x4c059258u, 0x7165bbe8u,
+    0x36c5c138u, 0x0ba5e888u, 0x28d4c7dfu, 0x15b4ee6fu, 0x521494bfu, 0x6f74bd0fu,
+    0xdd54611fu, 0xe03448afu, 0xa794327fu, 0x9af41bcfu, 0x18a48c1eu, 0x25c4a5aeu,
+    0x6264df7eu, 0x5f04f6ceu, 0xed242adeu, 0xd044036eu, 0x97e479beu, 0xaa84500eu,
+    0x4834505du, 0x755479edu, 0x32f4033du, 0x0f942a8du, 0xbdb4f69du, 0x80d4df2du,
+    0xc774a5fdu, 0xfa148c4du, 0x78441b9cu, 0x4524322cu, 0x028448fcu, 0x3fe4614cu,
+    0x8dc4bd5cu, 0xb0a494ecu, 0xf704ee3cu, 0xca64c78cu
+  },
+  {
+    0x00000000u, 0xcb5cd3a5u, 0x4dc8a10bu, 0x869472aeu, 0x9b914216u, 0x50cd91b3u,
+    0xd659e31du, 0x1d0530b8u, 0xec53826du, 0x270f51c8u, 0xa19b2366u, 0x6ac7f0c3u,
+    0x77c2c07bu, 0xbc9e13deu, 0x3a0a6170u, 0xf156b2d5u, 0x03d6029bu, 0xc88ad13eu,
+    0x4e1ea390u, 0x85427035u, 0x9847408du, 0x531b9328u, 0xd58fe186u, 0x1ed33223u,
+    0xef8580f6u, 0x24d95353u, 0xa24d21fdu, 0x6911f258u, 0x7414c2e0u, 0xbf481145u,
+    0x39dc63ebu, 0xf280b04eu, 0x07ac0536u, 0xccf0d693u, 0x4a64a43du, 0x81387798u,
+    0x9c3d4720u, 0x57619485u, 0xd1f5e62bu, 0x1aa9358eu, 0xebff875bu, 0x20a354feu,
+    0xa6372650u, 0x6d6bf5f5u, 0x706ec54du, 0xbb3216e8u, 0x3da66446u, 0xf6fab7e3u,
+    0x047a07adu, 0xcf26d408u, 0x49b2a6a6u, 0x82ee7503u, 0x9feb45bbu, 0x54b7961eu,
+    0xd223e4b0u, 0x197f3715u, 0xe82985c0u, 0x23755665u, 0xa5e124cbu, 0x6ebdf76eu,
+    0x73b8c7d6u, 0xb8e41473u, 0x3e7066ddu, 0xf52cb578u, 0x0f580a6cu, 0xc404d9c9u,
+    0x4290ab67u, 0x89cc78c2u, 0x94c9487au, 0x5f959bdfu, 0xd901e971u, 0x125d3ad4u,
+    0xe30b8801u, 0x28575ba4u, 0xaec3290au, 0x659ffaafu, 0x789aca17u, 0xb3c619b2u,
+    0x35526b1cu, 0xfe0eb8b9u, 0x0c8e08f7u, 0xc7d2db52u, 0x4146a9fcu, 0x8a1a7a59u,
+    0x971f4ae1u, 0x5c439944u, 0xdad7ebeau, 0x118b384fu, 0xe0dd8a9au, 0x2b81593fu,
+    0xad152b91u, 0x6649f834u, 0x7b4cc88cu, 0xb0101b29u, 0x36846987u, 0xfdd8ba22u,
+    0x08f40f5au, 0xc3a8dcffu, 0x453cae51u, 0x8e607df4u, 0x93654d4cu, 0x58399ee9u,
+    0xdeadec47u, 0x15f13fe2u, 0xe4a78d37u, 0x2ffb5e92u, 0xa96f2c3cu, 0x6233ff99u,
+    0x7f36cf21u, 0xb46a1c84u, 0x32fe6e2au, 0xf9a2bd8fu, 0x0b220dc1u, 0xc07ede64u,
+    0x46eaaccau, 0x8db67f6fu, 0x90b34fd7u, 0x5bef9c72u, 0xdd7beedcu, 0x16273d79u,
+    0xe7718facu, 0x2c2d5c09u, 0xaab92ea7u, 0x61e5fd02u, 0x7ce0cdbau, 0xb7bc1e1fu,
+    0x31286cb1u, 0xfa74bf14u, 0x1eb014d8u, 0xd5ecc77du, 0x5378b5d3u, 0x98246676u,
+    0x852156ceu, 0x4e7d856bu, 0xc8e9f7c5u, 0x03b52460u, 0xf2e396b5u, 0x39bf4510u,
+    0xbf2b37beu, 0x7477e41bu, 0x6972d4a3u, 0xa22e0706u, 0x24ba75a8u, 0xefe6a60du,
+    0x1d661643u, 0xd63ac5e6u, 0x50aeb748u, 0x9bf264edu, 0x86f75455u, 0x4dab87f0u,
+    0xcb3ff55eu, 0x006326fbu, 0xf135942eu, 0x3a69478bu, 0xbcfd3525u, 0x77a1e680u,
+    0x6aa4d638u, 0xa1f8059du, 0x276c7733u, 0xec30a496u, 0x191c11eeu, 0xd240c24bu,
+    0x54d4b0e5u, 0x9f886340u, 0x828d53f8u, 0x49d1805du, 0xcf45f2f3u, 0x04192156u,
+    0xf54f9383u, 0x3e134026u, 0xb8873288u, 0x73dbe12du, 0x6eded195u, 0xa5820230u,
+    0x2316709eu, 0xe84aa33bu, 0x1aca1375u, 0xd196c0d0u, 0x5702b27eu, 0x9c5e61dbu,
+    0x815b5163u, 0x4a0782c6u, 0xcc93f068u, 0x07cf23cdu, 0xf6999118u, 0x3dc542bdu,
+    0xbb513013u, 0x700de3b6u, 0x6d08d30eu, 0xa65400abu, 0x20c07205u, 0xeb9ca1a0u,
+    0x11e81eb4u, 0xdab4cd11u, 0x5c20bfbfu, 0x977c6c1au, 0x8a795ca2u, 0x41258f07u,
+    0xc7b1fda9u, 0x0ced2e0cu, 0xfdbb9cd9u, 0x36e74f7cu, 0xb0733dd2u, 0x7b2fee77u,
+    0x662adecfu, 0xad760d6au, 0x2be27fc4u, 0xe0beac61u, 0x123e1c2fu, 0xd962cf8au,
+    0x5ff6bd24u, 0x94aa6e81u, 0x89af5e39u, 0x42f38d9cu, 0xc467ff32u, 0x0f3b2c97u,
+    0xfe6d9e42u, 0x35314de7u, 0xb3a53f49u, 0x78f9ececu, 0x65fcdc54u, 0xaea00ff1u,
+    0x28347d5fu, 0xe368aefau, 0x16441b82u, 0xdd18c827u, 0x5b8cba89u, 0x90d0692cu,
+    0x8dd55994u, 0x46898a31u, 0xc01df89fu, 0x0b412b3au, 0xfa1799efu, 0x314b4a4au,
+    0xb7df38e4u, 0x7c83eb41u, 0x6186dbf9u, 0xaada085cu, 0x2c4e7af2u, 0xe712a957u,
+    0x15921919u, 0xdececabcu, 0x585ab812u, 0x93066bb7u, 0x8e035b0fu, 0x455f88aau,
+    0xc3cbfa04u, 0x089729a1u, 0xf9c19b74u, 0x329d48d1u, 0xb4093a7fu, 0x7f55e9dau,
+    0x6250d962u, 0xa90c0ac7u, 0x2f987869u, 0xe4c4abccu
+  },
+  {
+    0x00000000u, 0xa6770bb4u, 0x979f1129u, 0x31e81a9du, 0xf44f2413u, 0x52382fa7u,
+    0x63d0353au, 0xc5a73e8eu, 0x33ef4e67u, 0x959845d3u, 0xa4705f4eu, 0x020754fau,
+    0xc7a06a74u, 0x61d761c0u, 0x503f7b5du, 0xf64870e9u, 0x67de9cceu, 0xc1a9977au,
+    0xf0418de7u, 0x56368653u, 0x9391b8ddu, 0x35e6b369u, 0x040ea9f4u, 0xa279a240u,
+    0x5431d2a9u, 0xf246d91du, 0xc3aec380u, 0x65d9c834u, 0xa07ef6bau, 0x0609fd0eu,
+    0x37e1e793u, 0x9196ec27u, 0xcfbd399cu, 0x69ca3228u, 0x582228b5u, 0xfe552301u,
+    0x3bf21d8fu, 0x9d85163bu, 0xac6d0ca6u, 0x0a1a0712u, 0xfc5277fbu, 0x5a257c4fu,
+    0x6bcd66d2u, 0xcdba6d66u, 0x081d53e8u, 0xae6a585cu, 0x9f8242c1u, 0x39f54975u,
+    0xa863a552u, 0x0e14aee6u, 0x3ffcb47bu, 0x998bbfcfu, 0x5c2c8141u, 0xfa5b8af5u,
+    0xcbb39068u, 0x6dc49bdcu, 0x9b8ceb35u, 0x3dfbe081u, 0x0c13fa1cu, 0xaa64f1a8u,
+    0x6fc3cf26u, 0xc9b4c492u, 0xf85cde0fu, 0x5e2bd5bbu, 0x440b7579u, 0xe27c7ecdu,
+    0xd3946450u, 0x75e36fe4u, 0xb044516au, 0x16335adeu, 0x27db4043u, 0x81ac4bf7u,
+    0x77e43b1eu, 0xd19330aau, 0xe07b2a37u, 0x460c2183u, 0x83ab1f0du, 0x25dc14b9u,
+    0x14340e24u, 0xb2430590u, 0x23d5e9b7u, 0x85a2e203u, 0xb44af89eu, 0x123df32au,
+    0xd79acda4u, 0x71edc610u, 0x4005dc8du, 0xe672d739u, 0x103aa7d0u, 0xb64dac64u,
+    0x87a5b6f9u, 0x21d2bd4du, 0xe47583c3u, 0x42028877u, 0x73ea92eau, 0xd59d995eu,
+    0x8bb64ce5u, 0x2dc14751u, 0x1c295dccu, 0xba5e5678u, 0x7ff968f6u, 0xd98e6342u,
+    0xe86679dfu, 0x4e11726bu, 0xb8590282u, 0x1e2e0936u, 0x2fc613abu, 0x89b1181fu,
+    0x4c162691u, 0xea612d25u, 0xdb8937b8u, 0x7dfe3c0cu, 0xec68d02bu, 0x4a1fdb9fu,
+    0x7bf7c102u, 0xdd80cab6u, 0x1827f438u, 0xbe50ff8cu, 0x8fb8e511u, 0x29cfeea5u,
+    0xdf879e4cu, 0x79f095f8u, 0x48188f65u, 0xee6f84d1u, 0x2bc8ba5fu, 0x8dbfb1ebu,
+    0xbc57ab76u, 0x1a20a0c2u, 0x8816eaf2u, 0x2e61e146u, 0x1f89fbdbu, 0xb9fef06fu,
+    0x7c59cee1u, 0xda2ec555u, 0xebc6dfc8u, 0x4db1d47cu, 0xbbf9a495u, 0x1d8eaf21u,
+    0x2c66b5bcu, 0x8a11be08u, 0x4fb68086u, 0xe9c18b32u, 0xd82991afu, 0x7e5e9a1bu,
+    0xefc8763cu, 0x49bf7d88u, 0x78576715u, 0xde206ca1u, 0x1b87522fu, 0xbdf0599bu,
+    0x8c184306u, 0x2a6f48b2u, 0xdc27385bu, 0x7a5033efu, 0x4bb82972u, 0xedcf22c6u,
+    0x28681c48u, 0x8e1f17fcu, 0xbff70d61u, 0x198006d5u, 0x47abd36eu, 0xe1dcd8dau,
+    0xd034c247u, 0x7643c9f3u, 0xb3e4f77du, 0x1593fcc9u, 0x247be654u, 0x820cede0u,
+    0x74449d09u, 0xd23396bdu, 0xe3db8c20u, 0x45ac8794u, 0x800bb91au, 0x267cb2aeu,
+    0x1794a833u, 0xb1e3a387u, 0x20754fa0u, 0x86024414u, 0xb7ea5e89u, 0x119d553du,
+    0xd43a6bb3u, 0x724d6007u, 0x43a57a9au, 0xe5d2712eu, 0x139a01c7u, 0xb5ed0a73u,
+    0x840510eeu, 0x22721b5au, 0xe7d525d4u, 0x41a22e60u, 0x704a34fdu, 0xd63d3f49u,
+    0xcc1d9f8bu, 0x6a6a943fu, 0x5b828ea2u, 0xfdf58516u, 0x3852bb98u, 0x9e25b02cu,
+    0xafcdaab1u, 0x09baa105u, 0xfff2d1ecu, 0x5985da58u, 0x686dc0c5u, 0xce1acb71u,
+    0x0bbdf5ffu, 0xadcafe4bu, 0x9c22e4d6u, 0x3a55ef62u, 0xabc30345u, 0x0db408f1u,
+    0x3c5c126cu, 0x9a2b19d8u, 0x5f8c2756u, 0xf9fb2ce2u, 0xc813367fu, 0x6e643dcbu,
+    0x982c4d22u, 0x3e5b4696u, 0x0fb35c0bu, 0xa9c457bfu, 0x6c636931u, 0xca146285u,
+    0xfbfc7818u, 0x5d8b73acu, 0x03a0a617u, 0xa5d7ada3u, 0x943fb73eu, 0x3248bc8au,
+    0xf7ef8204u, 0x519889b0u, 0x6070932du, 0xc6079899u, 0x304fe870u, 0x9638e3c4u,
+    0xa7d0f959u, 0x01a7f2edu, 0xc400cc63u, 0x6277c7d7u, 0x539fdd4au, 0xf5e8d6feu,
+    0x647e3ad9u, 0xc209316du, 0xf3e12bf0u, 0x55962044u, 0x90311ecau, 0x3646157eu,
+    0x07ae0fe3u, 0xa1d90457u, 0x579174beu, 0xf1e67f0au, 0xc00e6597u, 0x66796e23u,
+    0xa3de50adu, 0x05a95b19u, 0x34414184u, 0x92364a30u
+  },
+  {
+    0x00000000u, 0xccaa009eu, 0x4225077du, 0x8e8f07e3u, 0x844a0efau, 0x48e00e64u,
+    0xc66f0987u, 0x0ac50919u, 0xd3e51bb5u, 0x1f4f1b2bu, 0x91c01cc8u, 0x5d6a1c56u,
+    0x57af154fu, 0x9b0515d1u, 0x158a1232u, 0xd92012acu, 0x7cbb312bu, 0xb01131b5u,
+    0x3e9e3656u, 0xf23436c8u, 0xf8f13fd1u, 0x345b3f4fu, 0xbad438acu, 0x767e3832u,
+    0xaf5e2a9eu, 0x63f42a00u, 0xed7b2de3u, 0x21d12d7du, 0x2b142464u, 0xe7be24fau,
+    0x69312319u, 0xa59b2387u, 0xf9766256u, 0x35dc62c8u, 0xbb53652bu, 0x77f965b5u,
+    0x7d3c6cacu, 0xb1966c32u, 0x3f196bd1u, 0xf3b36b4fu, 0x2a9379e3u, 0xe639797du,
+    0x68b67e9eu, 0xa41c7e00u, 0xaed97719u, 0x62737787u, 0xecfc7064u, 0x205670fau,
+    0x85cd537du, 0x496753e3u, 0xc7e85400u, 0x0b42549eu, 0x01875d87u, 0xcd2d5d19u,
+    0x43a25afau, 0x8f085a64u, 0x562848c8u, 0x9a824856u, 0x140d4fb5u, 0xd8a74f2bu,
+    0xd2624632u, 0x1ec846acu, 0x9047414fu, 0x5ced41d1u, 0x299dc2edu, 0xe537c273u,
+    0x6bb8c590u, 0xa712c50eu, 0xadd7cc17u, 0x617dcc89u, 0xeff2cb6au, 0x2358cbf4u,
+    0xfa78d958u, 0x36d2d9c6u, 0xb85dde25u, 0x74f7debbu, 0x7e32d7a2u, 0xb298d73cu,
+    0x3c17d0dfu, 0xf0bdd041u, 0x5526f3c6u, 0x998cf358u, 0x1703f4bbu, 0xdba9f425u,
+    0xd16cfd3cu, 0x1dc6fda2u, 0x9349fa41u, 0x5fe3fadfu, 0x86c3e873u, 0x4a69e8edu,
+    0xc4e6ef0eu, 0x084cef90u, 0x0289e689u, 0xce23e617u, 0x40ace1f4u, 0x8c06e16au,
+    0xd0eba0bbu, 0x1c41a025u, 0x92cea7c6u, 0x5e64a758u, 0x54a1ae41u, 0x980baedfu,
+    0x1684a93cu, 0xda2ea9a2u, 0x030ebb0eu, 0xcfa4bb90u, 0x412bbc73u, 0x8d81bcedu,
+    0x8744b5f4u, 0x4beeb56au, 0xc561b289u, 0x09cbb217u, 0xac509190u, 0x60fa910eu,
+    0xee7596edu, 0x22df9673u, 0x281a9f6au, 0xe4b09ff4u, 0x6a3f9817u, 0xa6959889u,
+    0x7fb58a25u, 0xb31f8abbu, 0x3d908d58u, 0xf13a8dc6u, 0xfbff84dfu, 0x37558441u,
+    0xb9da83a2u, 0x7570833cu, 0x533b85dau, 0x9f918544u, 0x111e82a7u, 0xddb48239u,
+    0xd7718b20u, 0x1bdb8bbeu, 0x95548c5du, 0x59fe8cc3u, 0x80de9e6fu, 0x4c749ef1u,
+    0xc2fb9912u, 0x0e51998cu, 0x04949095u, 0xc83e900bu, 0x46b197e8u, 0x8a1b9776u,
+    0x2f80b4f1u, 0xe32ab46fu, 0x6da5b38cu, 0xa10fb312u, 0xabcaba0bu, 0x6760ba95u,
+    0xe9efbd76u, 0x2545bde8u, 0xfc65af44u, 0x30cfafdau, 0xbe40a839u, 0x72eaa8a7u,
+    0x782fa1beu, 0xb485a120u, 0x3a0aa6c3u, 0xf6a0a65du, 0xaa4de78cu, 0x66e7e712u,
+    0xe868e0f1u, 0x24c2e06fu, 0x2e07e976u, 0xe2ade9e8u, 0x6c22ee0bu, 0xa088ee95u,
+    0x79a8fc39u, 0xb502fca7u, 0x3b8dfb44u, 0xf727fbdau, 0xfde2f2c3u, 0x3148f25du,
+    0xbfc7f5beu, 0x736df520u, 0xd6f6d6a7u, 0x1a5cd639u, 0x94d3d1dau, 0x5879d144u,
+    0x52bcd85du, 0x9e16d8c3u, 0x1099df20u, 0xdc33dfbeu, 0x0513cd12u, 0xc9b9cd8cu,
+    0x4736ca6fu, 0x8b9ccaf1u, 0x8159c3e8u, 0x4df3c376u, 0xc37cc495u, 0x0fd6c40bu,
+    0x7aa64737u, 0xb60c47a9u, 0x3883404au, 0xf42940d4u, 0xfeec49cdu, 0x32464953u,
+    0xbcc94eb0u, 0x70634e2eu, 0xa9435c82u, 0x65e95c1cu, 0xeb665bffu, 0x27cc5b61u,
+    0x2d095278u, 0xe1a352e6u, 0x6f2c5505u, 0xa386559bu, 0x061d761cu, 0xcab77682u,
+    0x44387161u, 0x889271ffu, 0x825778e6u, 0x4efd7878u, 0xc0727f9bu, 0x0cd87f05u,
+    0xd5f86da9u, 0x19526d37u, 0x97dd6ad4u, 0x5b776a4au, 0x51b26353u, 0x9d1863cdu,
+    0x1397642eu, 0xdf3d64b0u, 0x83d02561u, 0x4f7a25ffu, 0xc1f5221cu, 0x0d5f2282u,
+    0x079a2b9bu, 0xcb302b05u, 0x45bf2ce6u, 0x89152c78u, 0x50353ed4u, 0x9c9f3e4au,
+    0x121039a9u, 0xdeba3937u, 0xd47f302eu, 0x18d530b0u, 0x965a3753u, 0x5af037cdu,
+    0xff6b144au, 0x33c114d4u, 0xbd4e1337u, 0x71e413a9u, 0x7b211ab0u, 0xb78b1a2eu,
+    0x39041dcdu, 0xf5ae1d53u, 0x2c8e0fffu, 0xe0240f61u, 0x6eab0882u, 0xa201081cu,
+    0xa8c40105u, 0x646e019bu, 0xeae10678u, 0x264b06e6u
+  }
+};
 
 /*Update a running CRC with the bytes buf[0..len-1]--the CRC should be
 initialized to all 1's, and the transmitted value is the 1's complement of the
@@ -2227,10 +2856,17 @@ static unsigned Crc32_update_crc(const unsigned char* buf, unsigned crc, size_t
   unsigned c = crc;
   size_t n;
 
-  if(!Crc32_crc_table_computed) Crc32_make_crc_table();
-  for(n = 0; n < len; n++)
+  for(n = 0; n + 8 <= len; n += 8)
+  {
+    c ^= buf[n] | (buf[n + 1] << 8) | (buf[n + 2] << 16) | ((unsigned)buf[n + 3] << 24);
+    c = Crc32_crc_table[7][c & 0xff] ^ Crc32_crc_table[6][(c >> 8) & 0xff]
+      ^ Crc32_crc_table[5][(c >> 16) & 0xff] ^ Crc32_crc_table[4][c >> 24]
+      ^ Crc32_crc_table[3][buf[n + 4]] ^ Crc32_crc_table[2][buf[n + 5]]
+      ^ Crc32_crc_table[1][buf[n + 6]] ^ Crc32_crc_table[0][buf[n + 7]];
+  }
+  for(; n < len; n++)
   {
-    c = Crc32_crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
+    c = Crc32_crc_table[0][(c ^ buf[n]) & 0xff] ^ (c >> 8);
   }
   return c;
 }
@@ -3710,9 +4346,112 @@ void LodePNG_Decoder_inspect(LodePNG_Decoder* decoder, const unsigned char* in,
   decoder->error = checkColorValidity(decoder->infoPng.color.colorType, decoder->infoPng.color.bitDepth);
 }
 
+#ifdef LODEPNG_SSE2
+/*
+SSE2 versions of the Sub, Average and Paeth filters for 3 and 4 bytes per pixel.
+Each pixel depends on the one before it, so a pixel is done at a time, with its
+channels in the lanes of a register. The pixel is moved in and out through an int,
+so that a 3 byte pixel doesn't touch memory past the end of the scanline.
+*/
+
+LODEPNG_SSE2_TARGET
+static __m128i loadPixelSSE2(const unsigned char* p, size_t bytewidth)
+{
+  unsigned v = p[0] | (p[1] << 8) | (p[2] << 16);
+  if(bytewidth == 4) v |= (unsigned)p[3] << 24;
+  return _mm_cvtsi32_si128((int)v);
+}
+
+LODEPNG_SSE2_TARGET
+static void storePixelSSE2(unsigned char* p, __m128i pixel, size_t bytewidth)
+{
+  unsigned v = (unsigned)_mm_cvtsi128_si32(pixel);
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+  p[2] = (unsigned char)(v >> 16);
+  if(bytewidth == 4) p[3] = (unsigned char)(v >> 24);
+}
+
+/*mask ? x : y per bit*/
+LODEPNG_SSE2_TARGET
+static __m128i selectSSE2(__m128i mask, __m128i x, __m128i y)
+{
+  return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+LODEPNG_SSE2_TARGET
+static __m128i absSSE2(__m128i x)
+{
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+/*same as the scalar version, but for filter types 1, 3 and 4 only; precon must not be 0 for 3 and 4*/
+LODEPNG_SSE2_TARGET
+static void unfilterScanlineSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                 size_t bytewidth, unsigned char filterType, size_t length)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero; /*the pixel to the left, unfiltered*/
+  size_t i;
+
+  if(filterType == 1)
+  {
+    for(i = 0; i < length; i += bytewidth)
+    {
+      a = _mm_add_epi8(a, loadPixelSSE2(&scanline[i], bytewidth));
+      storePixelSSE2(&recon[i], a, bytewidth);
+    }
+  }
+  else if(filterType == 3)
+  {
+    const __m128i one = _mm_set1_epi8(1);
+    for(i = 0; i < length; i += bytewidth)
+    {
+      __m128i b = loadPixelSSE2(&precon[i], bytewidth);
+      /*_mm_avg_epu8 rounds up, the filter rounds down*/
+      __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+      a = _mm_add_epi8(average, loadPixelSSE2(&scanline[i], bytewidth));
+      storePixelSSE2(&recon[i], a, bytewidth);
+    }
+  }
+  else /*filterType == 4*/
+  {
+    /*a, b and c as in paethPredictor, in 16-bit lanes*/
+    __m128i c = zero;
+    for(i = 0; i < length; i += bytewidth)
+    {
+      __m128i b = _mm_unpacklo_epi8(loadPixelSSE2(&precon[i], bytewidth), zero);
+      __m128i pa = _mm_sub_epi16(b, c);
+      __m128i pb = _mm_sub_epi16(a, c);
+      __m128i pc = absSSE2(_mm_add_epi16(pa, pb));
+      __m128i smallest, predictor;
+      pa = absSSE2(pa);
+      pb = absSSE2(pb);
+      smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+      predictor = selectSSE2(_mm_cmpeq_epi16(pa, smallest), a,
+                             selectSSE2(_mm_cmpeq_epi16(pb, smallest), b, c));
+      predictor = _mm_add_epi8(_mm_packus_epi16(predictor, predictor), loadPixelSSE2(&scanline[i], bytewidth));
+      storePixelSSE2(&recon[i], predictor, bytewidth);
+      a = _mm_unpacklo_epi8(predictor, zero);
+      c = b;
+    }
+  }
+}
+
+#endif /*LODEPNG_SSE2*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
                                  size_t bytewidth, unsigned char filterType, size_t length)
 {
+#ifdef LODEPNG_SSE2
+  if((bytewidth == 3 || bytewidth == 4) && length % bytewidth == 0
+  && (filterType == 1 || ((filterType == 3 || filterType == 4) && precon)) && supportsSSE2())
+  {
+    unfilterScanlineSSE2(recon, scanline, precon, bytewidth, filterType, length);
+    return 0;
+  }
+#endif /*LODEPNG_SSE2*/
+
   /*
   For PNG filter method 0
   unfilter a PNG image scanline by scanline. when the pixels are smaller than 1 byte,
@@ -3784,7 +4523,8 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   return 0;
 }
 
-static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp,
+                         unsigned flip)
 {
   /*
   For PNG filter method 0
@@ -3792,6 +4532,7 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
   out must have enough bytes allocated already, in must have the scanlines + 1 filtertype byte per scanline
   w and h are image dimensions or dimensions of reduced image, bpp is bits per pixel
   in and out are allowed to be the same memory address (but aren't the same size since in has the extra filter bytes)
+  if flip is true, the rows are stored bottom-up in out, then in and out must be different buffers
   */
 
   unsigned y;
@@ -3803,7 +4544,7 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
 
   for(y = 0; y < h; y++)
   {
-    size_t outindex = linebytes * y;
+    size_t outindex = linebytes * (flip ? h - 1 - y : y);
     size_t inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
     unsigned char filterType = in[inindex];
 
@@ -3897,10 +4638,37 @@ static void removePaddingBits(unsigned char* out, const unsigned char* in,
   }
 }
 
+/*whether the rows can be flipped for free while unfiltering: only when unfilter writes straight into the image*/
+static unsigned flipsWhileUnfiltering(const LodePNG_InfoPng* infoPng)
+{
+  unsigned bpp = LodePNG_InfoColor_getBpp(&infoPng->color);
+  return infoPng->interlaceMethod == 0 && (infoPng->width * bpp) % 8 == 0;
+}
+
+/*reverse the order of the h rows of linebytes bytes in data*/
+static void flipRows(unsigned char* data, size_t linebytes, unsigned h)
+{
+  unsigned y;
+  size_t x;
+  for(y = 0; y < h / 2; y++)
+  {
+    unsigned char* a = &data[linebytes * y];
+    unsigned char* b = &data[linebytes * (h - 1 - y)];
+    for(x = 0; x < linebytes; x++)
+    {
+      unsigned char c = a[x];
+      a[x] = b[x];
+      b[x] = c;
+    }
+  }
+}
+
 /*out must be buffer big enough to contain full image, and in must contain the full decompressed data from
 the IDAT chunks (with filter index bytes and possible padding bits)
+flip stores the rows bottom-up, it may only be true if flipsWhileUnfiltering
 return value is error*/
-static unsigned postProcessScanlines(unsigned char* out, unsigned char* in, const LodePNG_InfoPng* infoPng)
+static unsigned postProcessScanlines(unsigned char* out, unsigned char* in, const LodePNG_InfoPng* infoPng,
+                                     unsigned flip)
 {
   /*
   This function converts the filtered-padded-interlaced data into pure 2D image buffer with the PNG's colortype.
@@ -3919,11 +4687,11 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in, cons
   {
     if(bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8)
     {
-      error = unfilter(in, in, w, h, bpp);
+      error = unfilter(in, in, w, h, bpp, 0);
       if(error) return error;
       removePaddingBits(out, in, w * bpp, ((w * bpp + 7) / 8) * 8, h);
     }
-    else error = unfilter(out, in, w, h, bpp); /*we can immediatly filter into the out buffer, no other steps needed*/
+    else error = unfilter(out, in, w, h, bpp, flip); /*we can immediatly filter into the out buffer, no other steps needed*/
   }
   else /*interlaceMethod is 1 (Adam7)*/
   {
@@ -3934,7 +4702,7 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in, cons
 
     for(i = 0; i < 7; i++)
     {
-      error = unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp);
+      error = unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp, 0);
       if(error) return error;
       /*TODO: possible efficiency improvement: if in this reduced image the bits fit nicely in 1 scanline,
       move bytes instead of bits or move not at all*/
@@ -4349,7 +5117,11 @@ static void decodeGeneric(LodePNG_Decoder* decoder, unsigned char** out, size_t*
       ucvector_init(&outv);
       if(!ucvector_resizev(&outv, (decoder->infoPng.height * decoder->infoPng.width
          * LodePNG_InfoColor_getBpp(&decoder->infoPng.color) + 7) / 8, 0)) decoder->error = 9946; /*alloc fail*/
-      if(!decoder->error) decoder->error = postProcessScanlines(outv.data, scanlines.data, &decoder->infoPng);
+      if(!decoder->error)
+      {
+        unsigned flip = decoder->settings.flipRows && flipsWhileUnfiltering(&decoder->infoPng);
+        decoder->error = postProcessScanlines(outv.data, scanlines.data, &decoder->infoPng, flip);
+      }
       *out = outv.data;
       *outsize = outv.size;
     }
@@ -4402,6 +5174,18 @@ void LodePNG_Decoder_decode(LodePNG_Decoder* decoder, unsigned char** out, size_
     else decoder->error = LodePNG_convert(*out, data, &decoder->infoRaw.color, &decoder->infoPng.color,
                                           decoder->infoPng.width, decoder->infoPng.height);
     free(data);
+    if(decoder->error) return;
+  }
+  if(decoder->settings.flipRows && !flipsWhileUnfiltering(&decoder->infoPng))
+  {
+    /*interlaced or bit-packed rows, flip the finished image instead, if its rows are whole bytes*/
+    unsigned bpp = LodePNG_InfoColor_getBpp(&decoder->infoRaw.color);
+    if((decoder->infoPng.width * bpp) % 8 != 0)
+    {
+      decoder->error = 86; /*error: can't flip rows that don't end at a byte boundary*/
+      return;
+    }
+    flipRows(*out, decoder->infoPng.width * bpp / 8, decoder->infoPng.height);
   }
 }
 
@@ -4463,6 +5247,7 @@ void LodePNG_DecodeSettings_init(LodePNG_DecodeSettings* settings)
   settings->readTextChunks = 1;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
   settings->ignoreCrc = 0;
+  settings->flipRows = 0;
 #ifdef LODEPNG_COMPILE_UNKNOWN_CHUNKS
   settings->rememberUnknownChunks = 0;
 #endif /*LODEPNG_COMPILE_UNKNOWN_CHUNKS*/
@@ -4832,6 +5617,82 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
   }
 }
 
+typedef struct FilterBand
+{
+  unsigned char* out;
+  const unsigned char* in;
+  size_t linebytes, bytewidth;
+  unsigned ystart, yend; /*the rows this band filters*/
+  unsigned error;
+} FilterBand;
+
+/*filter the rows of a band with the minimum sum of absolute differences heuristic*/
+static void* filterAdaptiveJob(void* arg)
+{
+  FilterBand* band = (FilterBand*)arg;
+  unsigned char* out = band->out;
+  const unsigned char* in = band->in;
+  size_t linebytes = band->linebytes, bytewidth = band->bytewidth;
+  const unsigned char* prevline = band->ystart ? &in[(band->ystart - 1) * linebytes] : 0;
+  size_t sum[5];
+  ucvector attempt[5]; /*five filtering attempts, one for each filter type*/
+  size_t smallest = 0;
+  unsigned type, bestType = 0;
+  unsigned x, y;
+  unsigned error = 0;
+
+  for(type = 0; type < 5; type++) ucvector_init(&attempt[type]);
+  for(type = 0; type < 5; type++)
+  {
+    if(!ucvector_resize(&attempt[type], linebytes)) ERROR_BREAK(9949 /*alloc fail*/);
+  }
+
+  if(!error)
+  {
+    for(y = band->ystart; y < band->yend; y++)
+    {
+      /*try the 5 filter types*/
+      for(type = 0; type < 5; type++)
+      {
+        filterScanline(attempt[type].data, &in[y * linebytes], prevline, linebytes, bytewidth, type);
+
+        /*calculate the sum of the result*/
+        sum[type] = 0;
+        /*note that not all pixels are checked to speed this up while still having probably the best choice*/
+        for(x = 0; x < attempt[type].size; x+=3)
+        {
+          /*For differences, each byte should be treated as signed, values above 127 are negative
+          (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
+          This means filtertype 0 is almost never chosen, but that is justified.*/
+          if(type == 0) sum[type] += (unsigned char)(attempt[type].data[x]);
+          else
+          {
+            signed char s = (signed char)(attempt[type].data[x]);
+            sum[type] += s < 0 ? -s : s;
+          }
+        }
+
+        /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
+        if(type == 0 || sum[type] < smallest)
+        {
+          bestType = type;
+          smallest = sum[type];
+        }
+      }
+
+      prevline = &in[y * linebytes];
+
+      /*now fill the out values*/
+      out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
+      for(x = 0; x < linebytes; x++) out[y * (linebytes + 1) + 1 + x] = attempt[bestType].data[x];
+    }
+  }
+
+  for(type = 0; type < 5; type++) ucvector_cleanup(&attempt[type]);
+  band->error = error;
+  return 0;
+}
+
 static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
                        const LodePNG_InfoColor* info, const LodePNG_EncodeSettings* settings)
 {
@@ -4876,59 +5737,26 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     }
     else /*adaptive filtering*/
     {
-      size_t sum[5];
-      ucvector attempt[5]; /*five filtering attempts, one for each filter type*/
-      size_t smallest = 0;
-      unsigned type, bestType = 0;
-
-      for(type = 0; type < 5; type++) ucvector_init(&attempt[type]);
-      for(type = 0; type < 5; type++)
+      /*the rows are filtered in bands, one per thread, since each row only depends on the unfiltered input*/
+      unsigned numbands = settings->zlibsettings.threads;
+      unsigned i;
+      FilterBand* bands;
+      if(numbands > h) numbands = h;
+      if(numbands < 1) numbands = 1;
+      bands = (FilterBand*)malloc(sizeof(FilterBand) * numbands);
+      if(!bands) return 9949; /*alloc fail*/
+      for(i = 0; i < numbands; i++)
       {
-        if(!ucvector_resize(&attempt[type], linebytes)) ERROR_BREAK(9949 /*alloc fail*/);
+        bands[i].out = out;
+        bands[i].in = in;
+        bands[i].linebytes = linebytes;
+        bands[i].bytewidth = bytewidth;
+        bands[i].ystart = (unsigned)((size_t)h * i / numbands);
+        bands[i].yend = (unsigned)((size_t)h * (i + 1) / numbands);
       }
-
-      if(!error)
-      {
-        for(y = 0; y < h; y++)
-        {
-          /*try the 5 filter types*/
-          for(type = 0; type < 5; type++)
-          {
-            filterScanline(attempt[type].data, &in[y * linebytes], prevline, linebytes, bytewidth, type);
-
-            /*calculate the sum of the result*/
-            sum[type] = 0;
-            /*note that not all pixels are checked to speed this up while still having probably the best choice*/
-            for(x = 0; x < attempt[type].size; x+=3)
-            {
-              /*For differences, each byte should be treated as signed, values above 127 are negative
-              (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
-              This means filtertype 0 is almost never chosen, but that is justified.*/
-              if(type == 0) sum[type] += (unsigned char)(attempt[type].data[x]);
-              else
-              {
-                signed char s = (signed char)(attempt[type].data[x]);
-                sum[type] += s < 0 ? -s : s;
-              }
-            }
-
-            /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-            if(type == 0 || sum[type] < smallest)
-            {
-              bestType = type;
-              smallest = sum[type];
-            }
-          }
-
-          prevline = &in[y * linebytes];
-
-          /*now fill the out values*/
-          out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-          for(x = 0; x < linebytes; x++) out[y * (linebytes + 1) + 1 + x] = attempt[bestType].data[x];
-        }
-      }
-
-      for(type = 0; type < 5; type++) ucvector_cleanup(&attempt[type]);
+      runJobs(filterAdaptiveJob, bands, sizeof(FilterBand), numbands);
+      for(i = 0; i < numbands; i++) if(!error) error = bands[i].error;
+      free(bands);
     }
   }
   else
@@ -5901,6 +6729,16 @@ void LodePNG_Encoder_encode(LodePNG_Encoder* encoder, unsigned char** out, size_
     encoder->error = 61; /*error: unexisting btype*/
     return;
   }
+  if(encoder->settings.zlibsettings.level < 1 || encoder->settings.zlibsettings.level > 9)
+  {
+    encoder->error = 84; /*error: unexisting compression level*/
+    return;
+  }
+  if(encoder->settings.zlibsettings.threads < 1)
+  {
+    encoder->error = 85; /*error: no threads to encode on*/
+    return;
+  }
   if(encoder->infoPng.interlaceMethod > 1)
   {
     encoder->error = 71; /*error: unexisting interlace mode*/
@@ -6253,8 +7091,11 @@ const char* LodePNG_error_text(unsigned code)
     case 78: return "failed to open file for reading"; /*file doesn't exist or couldn't be opened for reading*/
     case 79: return "failed to open file for writing";
     case 80: return "tried creating a tree of 0 symbols";
-    case 81: return "lazy matching at pos 0 is impossible";
     case 82: return "color conversion to palette requested while a color isn't in palette";
+    case 83: return "invalid backward distance in deflate stream, goes before the start of the data";
+    case 84: return "invalid compression level given in the settings of the encoder (only 1 to 9 are allowed)";
+    case 85: return "invalid number of threads given in the settings of the encoder (must be at least 1)";
+    case 86: return "can't flip the rows of an image whose rows don't end at a byte boundary";
     default: ; /*nothing to do here, checks for other error values are below*/
   }
 
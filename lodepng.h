@@ -61,6 +61,12 @@ source file.*/
 #define LODEPNG_COMPILE_UNKNOWN_CHUNKS
 /*ability to convert error numerical codes to English text string*/
 #define LODEPNG_COMPILE_ERROR_TEXT
+/*SSE2 unfiltering of 3 and 4 byte per pixel images, used when the CPU supports it*/
+#define LODEPNG_COMPILE_SIMD
+/*encoding on several threads (see LodePNG_CompressSettings threads). This uses pthreads,
+so every program linking LodePNG then needs -pthread (or -lpthread); disable it if that's
+not wanted, the threads setting still works but encodes the bands one after the other*/
+#define LODEPNG_COMPILE_THREADS
 
 /* ////////////////////////////////////////////////////////////////////////// */
 /* Simple Functions                                                           */
@@ -296,7 +302,9 @@ PNG files. Typically you won't need these directly.
 #ifdef LODEPNG_COMPILE_DECODER
 typedef struct LodePNG_DecompressSettings
 {
-  unsigned ignoreAdler32; /*if 1, continue and don't give an error message if the Adler32 checksum is corrupted*/
+  /*if 1, continue and don't give an error message if the Adler32 checksum is corrupted;
+  it isn't computed at all then, for trusted input*/
+  unsigned ignoreAdler32;
 } LodePNG_DecompressSettings;
 
 extern const LodePNG_DecompressSettings LodePNG_defaultDecompressSettings;
@@ -314,6 +322,9 @@ typedef struct LodePNG_CompressSettings /*deflate = compress*/
   unsigned btype; /*the block type for LZ (0, 1, 2 or 3, see zlib standard). Should be 2 for proper compression.*/
   unsigned useLZ77; /*whether or not to use LZ77. Should be 1 for proper compression.*/
   unsigned windowSize; /*the maximum is 32768, higher gives more compression but is slower. Typical value: 2048.*/
+  unsigned level; /*LZ77 effort, 1 (fastest, greedy matching) to 9 (smallest, lazy matching). Default: 6.*/
+  /*threads to filter and compress on, in bands of rows. More than 1 costs a little compression. Default: 1.*/
+  unsigned threads;
 } LodePNG_CompressSettings;
 
 extern const LodePNG_CompressSettings LodePNG_defaultCompressSettings;
@@ -628,8 +639,9 @@ typedef struct LodePNG_DecodeSettings
 {
   LodePNG_DecompressSettings zlibsettings; /*in here is the setting to ignore Adler32 checksums*/
 
-  unsigned ignoreCrc; /*ignore CRC checksums*/
+  unsigned ignoreCrc; /*ignore CRC checksums; they aren't computed at all then, for trusted input*/
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
+  unsigned flipRows; /*store the rows bottom-up, as OpenGL expects them. Default: no*/
 
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned readTextChunks; /*if false but rememberUnknownChunks is true, they're stored in the unknown chunks*/
@@ -1270,6 +1282,12 @@ is done, the resulting data will be as it was in the PNG (after decompression)
 and you'll have to puzzle the colors of the pixels together yourself using the
 color type information in the LodePNG_InfoPng.
 
+The setting flipRows, false by default, gives the rows bottom-up, the way
+glTexImage2D expects them. For non-interlaced images whose rows are whole bytes
+this costs nothing, the rows are written in that order while unfiltering.
+Otherwise the finished image is flipped, which fails with an error if its rows
+aren't whole bytes, for example 1-bit greyscale of an odd width without color
+conversion.
 
 5. Encoding
 -----------
@@ -1345,6 +1363,16 @@ the RGB information of fully transparent pixels.
    0 = uncompressed, 1 = fixed huffman tree, 2 = dynamic huffman tree (best compression)
 *) useLZ77: whether or not to use LZ77 for compressed block types
 *) windowSize: the window size used by the LZ77 encoder (1 - 32768)
+*) level: how hard the LZ77 encoder searches for matches, 1 - 9. 1 to 3 take the
+   first good match, 4 to 9 check whether the next byte starts a longer one, and
+   search longer hash chains the higher the level is. Default 6. Other values
+   give error 84.
+*) threads: how many threads to encode on, default 1. The scanlines are filtered
+   in that many bands of rows, and the filtered data deflated in as many bands
+   (of at least 64KB each), at the same time. Each deflated band ends at a sync
+   flush so that together they are one zlib stream, and has its own huffman trees.
+   Needs LODEPNG_COMPILE_THREADS to actually run in parallel, otherwise the bands
+   are encoded one after the other.
 *) force_palette: if colorType is 2 or 6, you can make the encoder write a PLTE
    chunk if force_palette is true. This can used as suggested palette to convert
    to by viewers that don't support more than 256 colors (if those still exist)
@@ -1643,6 +1671,8 @@ LodePNG is developed in gcc so this compiler is natively supported. It gives no
 warnings with compiler options "-Wall -Wextra -pedantic -ansi", with gcc and g++
 version 4.5.1 on Linux.
 
+With LODEPNG_COMPILE_THREADS, which is defined by default, link with -pthread.
+
 *) Mingw and Bloodshed DevC++
 
 The Mingw compiler (a port of gcc) used by Bloodshed DevC++ for Windows is fully
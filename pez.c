@@ -997,3 +997,2091 @@ void pezSaveVerts(PezVerts verts, const char* filename)
     free(compressed);
     fclose(file);
 }
+
+PezGlyphs pezLoadGlyphs(const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    size_t size, glyphsSize;
+    long length;
+    GLint header[7];
+    PezGlyphs glyphs;
+
+    pezCheckPointer(file, "Can't open %s", filename);
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    // Check the header before reading from it, and bound the glyph count
+    // before computing the size it implies:
+    pezCheck(length >= PEZ_GLYPHS_HEADER_SIZE, "%s is truncated.", filename);
+    size = (size_t) length;
+
+    glyphs.RawHeader = (void*) malloc(size);
+    pezCheckPointer(glyphs.RawHeader, "Out of memory loading %s", filename);
+    pezCheck(fread(glyphs.RawHeader, 1, size, file) == size, "Can't read %s", filename);
+    fclose(file);
+
+    memcpy(header, glyphs.RawHeader, sizeof(header));
+    memcpy(&glyphs.Spread, (char*) glyphs.RawHeader + sizeof(header), sizeof(GLfloat));
+    glyphs.GlyphCount = header[0];
+    glyphs.FirstCharacter = header[1];
+    glyphs.CellWidth = header[2];
+    glyphs.CellHeight = header[3];
+    glyphs.AtlasWidth = header[4];
+    glyphs.AtlasHeight = header[5];
+    glyphs.Resolution = header[6];
+    glyphs.Glyphs = (PezGlyph*) ((char*) glyphs.RawHeader + PEZ_GLYPHS_HEADER_SIZE);
+    glyphsSize = size - PEZ_GLYPHS_HEADER_SIZE;
+    pezCheck(glyphs.GlyphCount >= 0 && (size_t) glyphs.GlyphCount <= glyphsSize / sizeof(PezGlyph),
+             "%s is truncated.", filename);
+    pezCheck(glyphsSize == glyphs.GlyphCount * sizeof(PezGlyph), "%s is truncated.", filename);
+
+    return glyphs;
+}
+
+void pezFreeGlyphs(PezGlyphs glyphs)
+{
+    free(glyphs.RawHeader);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RENDER TARGET POOL
+//
+// Targets are keyed by their description.  A released target goes back to the
+// pool and can be handed to a later pass in the same frame; targets that stay
+// idle for a few frames are deleted.  Window-relative targets that are still
+// held when the window is resized are reallocated in place, so their texture
+// and FBO names stay valid.
+
+#include <math.h>
+
+#define PEZ_MAX_TARGETS 64
+#define PEZ_TARGET_LIFETIME 4
+
+typedef struct pezTargetSlotRec
+{
+    PezTarget Target;
+    bool Allocated;
+    bool InUse;
+    unsigned int LastFrame;
+} pezTargetSlot;
+
+static pezTargetSlot __pez__Targets[PEZ_MAX_TARGETS];
+static unsigned int __pez__TargetFrame = 0;
+static int __pez__WindowWidth = 0;
+static int __pez__WindowHeight = 0;
+
+static void __pez__PixelFormat(GLenum internalFormat, GLenum* format, GLenum* type, int* bytesPerPixel)
+{
+    switch (internalFormat)
+    {
+        case GL_R8:             *format = GL_RED;  *type = GL_UNSIGNED_BYTE; *bytesPerPixel = 1; break;
+        case GL_RG8:            *format = GL_RG;   *type = GL_UNSIGNED_BYTE; *bytesPerPixel = 2; break;
+        case GL_RGB:
+        case GL_RGB8:           *format = GL_RGB;  *type = GL_UNSIGNED_BYTE; *bytesPerPixel = 3; break;
+        case GL_RGBA:
+        case GL_RGBA8:          *format = GL_RGBA; *type = GL_UNSIGNED_BYTE; *bytesPerPixel = 4; break;
+        case GL_R16F:           *format = GL_RED;  *type = GL_HALF_FLOAT;    *bytesPerPixel = 2; break;
+        case GL_RG16F:          *format = GL_RG;   *type = GL_HALF_FLOAT;    *bytesPerPixel = 4; break;
+        case GL_RGB16F:         *format = GL_RGB;  *type = GL_HALF_FLOAT;    *bytesPerPixel = 6; break;
+        case GL_RGBA16F:        *format = GL_RGBA; *type = GL_HALF_FLOAT;    *bytesPerPixel = 8; break;
+        case GL_R32F:           *format = GL_RED;  *type = GL_FLOAT;         *bytesPerPixel = 4; break;
+        case GL_RG32F:          *format = GL_RG;   *type = GL_FLOAT;         *bytesPerPixel = 8; break;
+        case GL_RGBA32F:        *format = GL_RGBA; *type = GL_FLOAT;         *bytesPerPixel = 16; break;
+        case GL_R11F_G11F_B10F: *format = GL_RGB;  *type = GL_FLOAT;         *bytesPerPixel = 4; break;
+        default:
+            *format = *type = 0; *bytesPerPixel = 0;
+            pezFatal("Unsupported render target format: 0x%x", internalFormat);
+    }
+}
+
+static int __pez__SameDesc(const PezTargetDesc* a, const PezTargetDesc* b)
+{
+    int i;
+    if (a->Width != b->Width || a->Height != b->Height || a->Divisor != b->Divisor ||
+        a->DepthFormat != b->DepthFormat || a->Filter != b->Filter)
+    {
+        return 0;
+    }
+    for (i = 0; i < PEZ_MAX_ATTACHMENTS; i++)
+    {
+        if (a->ColorFormats[i] != b->ColorFormats[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void __pez__AllocateStorage(PezTarget* target)
+{
+    const PezTargetDesc* desc = &target->Desc;
+    int divisor = desc->Divisor > 0 ? desc->Divisor : 1;
+    int i;
+
+    target->Width = desc->Width ? desc->Width : __pez__WindowWidth / divisor;
+    target->Height = desc->Height ? desc->Height : __pez__WindowHeight / divisor;
+    if (target->Width < 1) target->Width = 1;
+    if (target->Height < 1) target->Height = 1;
+
+    for (i = 0; i < PEZ_MAX_ATTACHMENTS && desc->ColorFormats[i]; i++)
+    {
+        GLenum format, type;
+        int bytesPerPixel;
+        __pez__PixelFormat(desc->ColorFormats[i], &format, &type, &bytesPerPixel);
+        glBindTexture(GL_TEXTURE_2D, target->ColorTextures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, desc->ColorFormats[i], target->Width, target->Height, 0, format, type, 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (desc->DepthFormat)
+    {
+        glBindRenderbuffer(GL_RENDERBUFFER, target->DepthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, desc->DepthFormat, target->Width, target->Height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    }
+
+    pezCheck(GL_NO_ERROR == glGetError(), "Unable to allocate render target storage.");
+}
+
+static void __pez__CreateTarget(PezTarget* target, PezTargetDesc desc)
+{
+    GLenum filter = desc.Filter ? desc.Filter : GL_LINEAR;
+    GLenum drawBuffers[PEZ_MAX_ATTACHMENTS];
+    int count = 0;
+    int i;
+
+    memset(target, 0, sizeof(PezTarget));
+    target->Desc = desc;
+
+    for (i = 0; i < PEZ_MAX_ATTACHMENTS && desc.ColorFormats[i]; i++)
+    {
+        glGenTextures(1, &target->ColorTextures[i]);
+        glBindTexture(GL_TEXTURE_2D, target->ColorTextures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        count++;
+    }
+    if (desc.DepthFormat)
+    {
+        glGenRenderbuffers(1, &target->DepthBuffer);
+    }
+
+    __pez__AllocateStorage(target);
+
+    glGenFramebuffers(1, &target->Fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->Fbo);
+    for (i = 0; i < count; i++)
+    {
+        drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[i], GL_TEXTURE_2D, target->ColorTextures[i], 0);
+    }
+    if (desc.DepthFormat)
+    {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target->DepthBuffer);
+    }
+    glDrawBuffers(count, drawBuffers);
+
+    pezCheck(GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER), "Invalid FBO.");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static void __pez__DestroyTarget(pezTargetSlot* slot)
+{
+    PezTarget* target = &slot->Target;
+    int i;
+
+    for (i = 0; i < PEZ_MAX_ATTACHMENTS && target->ColorTextures[i]; i++)
+    {
+        glDeleteTextures(1, &target->ColorTextures[i]);
+    }
+    if (target->DepthBuffer)
+    {
+        glDeleteRenderbuffers(1, &target->DepthBuffer);
+    }
+    glDeleteFramebuffers(1, &target->Fbo);
+    memset(slot, 0, sizeof(pezTargetSlot));
+}
+
+PezTarget* pezAcquireTarget(PezTargetDesc desc)
+{
+    pezTargetSlot* empty = 0;
+    int i;
+
+    for (i = 0; i < PEZ_MAX_TARGETS; i++)
+    {
+        pezTargetSlot* slot = &__pez__Targets[i];
+        if (!slot->Allocated)
+        {
+            if (!empty) empty = slot;
+            continue;
+        }
+        if (!slot->InUse && __pez__SameDesc(&slot->Target.Desc, &desc))
+        {
+            slot->InUse = true;
+            slot->LastFrame = __pez__TargetFrame;
+            return &slot->Target;
+        }
+    }
+
+    pezCheckPointer(empty, "Render target pool is full.");
+    __pez__CreateTarget(&empty->Target, desc);
+    empty->Allocated = true;
+    empty->InUse = true;
+    empty->LastFrame = __pez__TargetFrame;
+    return &empty->Target;
+}
+
+void pezReleaseTarget(PezTarget* target)
+{
+    pezTargetSlot* slot = (pezTargetSlot*) target;
+    slot->InUse = false;
+    slot->LastFrame = __pez__TargetFrame;
+}
+
+void pezResizeTargets(int windowWidth, int windowHeight)
+{
+    int i;
+
+    if (windowWidth == __pez__WindowWidth && windowHeight == __pez__WindowHeight)
+    {
+        return;
+    }
+
+    __pez__WindowWidth = windowWidth;
+    __pez__WindowHeight = windowHeight;
+
+    for (i = 0; i < PEZ_MAX_TARGETS; i++)
+    {
+        pezTargetSlot* slot = &__pez__Targets[i];
+        if (!slot->Allocated || (slot->Target.Desc.Width && slot->Target.Desc.Height))
+        {
+            continue;
+        }
+        if (slot->InUse)
+        {
+            __pez__AllocateStorage(&slot->Target);
+        }
+        else
+        {
+            __pez__DestroyTarget(slot);
+        }
+    }
+}
+
+void pezCollectTargets()
+{
+    int i;
+
+    for (i = 0; i < PEZ_MAX_TARGETS; i++)
+    {
+        pezTargetSlot* slot = &__pez__Targets[i];
+        if (slot->Allocated && !slot->InUse &&
+            __pez__TargetFrame - slot->LastFrame > PEZ_TARGET_LIFETIME)
+        {
+            __pez__DestroyTarget(slot);
+        }
+    }
+
+    __pez__TargetFrame++;
+}
+
+GLsizeiptr pezGetTargetMemory()
+{
+    GLsizeiptr total = 0;
+    int i, j;
+
+    for (i = 0; i < PEZ_MAX_TARGETS; i++)
+    {
+        const PezTarget* target = &__pez__Targets[i].Target;
+        GLsizeiptr pixelCount = (GLsizeiptr) target->Width * target->Height;
+        if (!__pez__Targets[i].Allocated)
+        {
+            continue;
+        }
+        for (j = 0; j < PEZ_MAX_ATTACHMENTS && target->Desc.ColorFormats[j]; j++)
+        {
+            GLenum format, type;
+            int bytesPerPixel;
+            __pez__PixelFormat(target->Desc.ColorFormats[j], &format, &type, &bytesPerPixel);
+            total += pixelCount * bytesPerPixel;
+        }
+        if (target->Desc.DepthFormat)
+        {
+            total += pixelCount * 4;
+        }
+    }
+
+    return total;
+}
+
+void pezClearTarget(PezTarget* target, const GLfloat* values)
+{
+    int i;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target->Fbo);
+    for (i = 0; i < PEZ_MAX_ATTACHMENTS && target->Desc.ColorFormats[i]; i++)
+    {
+        glClearBufferfv(GL_COLOR, i, values + 4 * i);
+    }
+}
+
+float pezComputePsnr(const PezTarget* reference)
+{
+    GLsizei count = reference->Width * reference->Height * 3;
+    GLfloat* expected = (GLfloat*) malloc(count * sizeof(GLfloat));
+    GLfloat* actual = (GLfloat*) malloc(count * sizeof(GLfloat));
+    double squaredError = 0;
+    double mse;
+    GLsizei i;
+
+    pezCheckPointer(expected, "Out of memory.");
+    pezCheckPointer(actual, "Out of memory.");
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, reference->Fbo);
+    glReadPixels(0, 0, reference->Width, reference->Height, GL_RGB, GL_FLOAT, expected);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glReadPixels(0, 0, reference->Width, reference->Height, GL_RGB, GL_FLOAT, actual);
+
+    for (i = 0; i < count; i++)
+    {
+        float e = expected[i] < 1 ? expected[i] : 1;
+        float a = actual[i] < 1 ? actual[i] : 1;
+        squaredError += (e - a) * (e - a);
+    }
+    free(expected);
+    free(actual);
+
+    mse = squaredError / count;
+    return mse > 0 ? (float) (10.0 * log10(1.0 / mse)) : 99.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// STREAMING TEXT
+//
+// Glyphs are written straight into a vertex buffer that is split into
+// PEZ_TEXT_FRAMES segments.  Each flush maps its own segment unsynchronized
+// and fences it after the draw, so the CPU only waits if it laps the GPU.
+// A segment that fills up is flushed early, and the text carries on in the
+// next one.  The caller's vertex array and array buffer bindings are put
+// back after every GL call.
+
+#include <stdarg.h>
+
+#define PEZ_TEXT_FRAMES 3
+#define PEZ_TEXT_CAPACITY 4096
+#define PEZ_FENCE_TIMEOUT 1000000000    // nanoseconds
+
+// Blocks in the driver until the GPU has passed a fence, then deletes it.
+static void __pez__WaitFence(GLsync* fence)
+{
+    GLenum status;
+
+    if (*fence)
+    {
+        status = glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, PEZ_FENCE_TIMEOUT);
+        pezCheck(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED,
+                 "Timed out waiting for the GPU.");
+        glDeleteSync(*fence);
+        *fence = 0;
+    }
+}
+
+typedef struct pezTextVertexRec
+{
+    GLfloat X;
+    GLfloat Y;
+    GLubyte Character;
+    GLubyte Column;
+    GLubyte Row;
+    GLubyte Unused;
+} pezTextVertex;
+
+typedef struct pezTextRingRec
+{
+    GLuint Buffer;
+    GLuint Vao;
+    GLsync Fences[PEZ_TEXT_FRAMES];
+    int Segment;
+    int GlyphCount;
+    pezTextVertex* Mapped;
+} pezTextRing;
+
+static pezTextRing __pez__Text;
+
+static void __pez__BeginText()
+{
+    pezTextRing* ring = &__pez__Text;
+    GLsizeiptr segmentSize = PEZ_TEXT_CAPACITY * sizeof(pezTextVertex);
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+    GLint vao, buffer;
+
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &buffer);
+
+    if (!ring->Buffer)
+    {
+        glGenVertexArrays(1, &ring->Vao);
+        glBindVertexArray(ring->Vao);
+        glGenBuffers(1, &ring->Buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, ring->Buffer);
+        glBufferData(GL_ARRAY_BUFFER, segmentSize * PEZ_TEXT_FRAMES, 0, GL_STREAM_DRAW);
+        glVertexAttribPointer(PEZ_TEXT_ORIGIN, 2, GL_FLOAT, GL_FALSE, sizeof(pezTextVertex), 0);
+        glVertexAttribIPointer(PEZ_TEXT_GLYPH, 4, GL_UNSIGNED_BYTE, sizeof(pezTextVertex), (const GLvoid*) (2 * sizeof(GLfloat)));
+        glEnableVertexAttribArray(PEZ_TEXT_ORIGIN);
+        glEnableVertexAttribArray(PEZ_TEXT_GLYPH);
+        glBindVertexArray(vao);
+    }
+
+    __pez__WaitFence(&ring->Fences[ring->Segment]);
+
+    glBindBuffer(GL_ARRAY_BUFFER, ring->Buffer);
+    ring->Mapped = (pezTextVertex*) glMapBufferRange(GL_ARRAY_BUFFER, ring->Segment * segmentSize, segmentSize, access);
+    pezCheckPointer(ring->Mapped, "Unable to map text buffer.");
+    ring->GlyphCount = 0;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+}
+
+void pezDrawText(float x, float y, const char* fmt, ...)
+{
+    pezTextRing* ring = &__pez__Text;
+    char msg[1024];
+    int column = 0, row = 0;
+    const char* c;
+    va_list a;
+
+    va_start(a, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, a);
+    va_end(a);
+
+    if (!ring->Mapped)
+    {
+        __pez__BeginText();
+    }
+
+    for (c = msg; *c; c++)
+    {
+        pezTextVertex* glyph;
+        if (ring->GlyphCount == PEZ_TEXT_CAPACITY)
+        {
+            pezFlushText();
+            __pez__BeginText();
+        }
+        if (*c == '\n')
+        {
+            column = 0;
+            row++;
+            continue;
+        }
+        if (*c == ' ' || column > 255 || row > 255)
+        {
+            column++;
+            continue;
+        }
+        glyph = ring->Mapped + ring->GlyphCount++;
+        glyph->X = x;
+        glyph->Y = y;
+        glyph->Character = (GLubyte) *c;
+        glyph->Column = (GLubyte) column++;
+        glyph->Row = (GLubyte) row;
+        glyph->Unused = 0;
+    }
+}
+
+void pezFlushText()
+{
+    pezTextRing* ring = &__pez__Text;
+    GLint vao, buffer;
+
+    if (!ring->Mapped)
+    {
+        return;
+    }
+
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &buffer);
+
+    glBindBuffer(GL_ARRAY_BUFFER, ring->Buffer);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    ring->Mapped = 0;
+
+    if (ring->GlyphCount)
+    {
+        glBindVertexArray(ring->Vao);
+        glDrawArrays(GL_POINTS, ring->Segment * PEZ_TEXT_CAPACITY, ring->GlyphCount);
+        glBindVertexArray(vao);
+    }
+
+    ring->Fences[ring->Segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring->Segment = (ring->Segment + 1) % PEZ_TEXT_FRAMES;
+    ring->GlyphCount = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// TEXTURE LOADING
+//
+// PNG files are read into a scratch buffer that is kept between loads, and
+// decoded with lodepng straight into the row order GL wants.  The pixels are
+// handed to GL through a pixel-unpack buffer, which is orphaned on every load
+// so the upload never waits for the previous one.  Decoding touches no GL
+// state, so the asset loader below runs it as a job.
+
+#include "lodepng.h"
+
+typedef struct pezTextureScratchRec
+{
+    unsigned char* File;
+    size_t FileCapacity;
+} pezTextureScratch;
+
+typedef struct pezDecodedTextureRec
+{
+    unsigned char* Pixels;
+    size_t Size;
+    GLsizei Width;
+    GLsizei Height;
+    int Channels;
+    int BitDepth;
+} pezDecodedTexture;
+
+static pezTextureScratch __pez__TextureScratch[PEZ_MAX_THREADS];   // one per job thread
+static GLuint __pez__TexturePbo;
+
+static size_t __pez__ReadFile(pezTextureScratch* scratch, const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    size_t size;
+
+    pezCheck(file != 0, "Can't find %s", filename);
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (size > scratch->FileCapacity)
+    {
+        free(scratch->File);
+        scratch->File = (unsigned char*) malloc(size);
+        pezCheckPointer(scratch->File, "Out of memory reading %s", filename);
+        scratch->FileCapacity = size;
+    }
+    pezCheck(fread(scratch->File, 1, size, file) == size, "Can't read %s", filename);
+    fclose(file);
+    return size;
+}
+
+static void __pez__DecodeTexture(pezTextureScratch* scratch, const char* filename, bool flipRows,
+                                 pezDecodedTexture* decoded)
+{
+    size_t fileSize = __pez__ReadFile(scratch, filename);
+    LodePNG_Decoder decoder;
+
+    // The demos only load their own assets, so skip the checksums.
+    LodePNG_Decoder_init(&decoder);
+    decoder.settings.ignoreCrc = 1;
+    decoder.settings.zlibsettings.ignoreAdler32 = 1;
+    decoder.settings.flipRows = flipRows;
+    LodePNG_Decoder_inspect(&decoder, scratch->File, fileSize);
+    pezCheck(!decoder.error, "%s: error %u: %s", filename, decoder.error, LodePNG_error_text(decoder.error));
+
+    // Palettes become RGBA and greyscale below 8 bits becomes 8 bits;
+    // everything else is uploaded as it is stored.
+    const LodePNG_InfoColor* color = &decoder.infoPng.color;
+    if (color->colorType == 3) {
+        decoder.infoRaw.color.colorType = 6;
+        decoder.infoRaw.color.bitDepth = 8;
+    } else if (color->bitDepth < 8) {
+        decoder.infoRaw.color.colorType = 0;
+        decoder.infoRaw.color.bitDepth = 8;
+    } else {
+        decoder.settings.color_convert = 0;
+    }
+    LodePNG_Decoder_decode(&decoder, &decoded->Pixels, &decoded->Size, scratch->File, fileSize);
+    pezCheck(!decoder.error, "%s: error %u: %s", filename, decoder.error, LodePNG_error_text(decoder.error));
+
+    decoded->Channels = LodePNG_InfoColor_getChannels(&decoder.infoRaw.color);
+    decoded->BitDepth = decoder.infoRaw.color.bitDepth;
+    decoded->Width = decoder.infoPng.width;
+    decoded->Height = decoder.infoPng.height;
+    LodePNG_Decoder_cleanup(&decoder);
+}
+
+// Creates the texture and frees the decoded pixels.  Main thread only.
+static GLuint __pez__UploadTexture(const char* filename, pezDecodedTexture* decoded)
+{
+    static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    static const GLenum internalFormats8[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+    static const GLenum internalFormats16[] = { GL_R16, GL_RG16, GL_RGB16, GL_RGBA16 };
+    const int channels = decoded->Channels, bitDepth = decoded->BitDepth;
+
+    if (!__pez__TexturePbo) {
+        glGenBuffers(1, &__pez__TexturePbo);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, __pez__TexturePbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, decoded->Size, 0, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, decoded->Size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    pezCheckPointer(mapped, "Unable to map pixel unpack buffer.");
+    memcpy(mapped, decoded->Pixels, decoded->Size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    free(decoded->Pixels);
+    decoded->Pixels = 0;
+
+    // PNG rows are tightly packed, and 16-bit samples are big-endian.
+    const GLushort one = 1;
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_SWAP_BYTES, bitDepth == 16 && *(const GLubyte*) &one);
+
+    GLuint handle;
+    glGenTextures(1, &handle);
+    glBindTexture(GL_TEXTURE_2D, handle);
+    glTexImage2D(GL_TEXTURE_2D, 0,
+                 bitDepth == 16 ? internalFormats16[channels - 1] : internalFormats8[channels - 1],
+                 decoded->Width, decoded->Height, 0,
+                 formats[channels - 1], bitDepth == 16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, 0);
+
+    glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    pezPrintString("Loaded %s (%d x %d, %d channels, %d bits)\n", filename,
+                   decoded->Width, decoded->Height, channels, bitDepth);
+    pezCheck(GL_NO_ERROR == glGetError(), "Unable to upload %s", filename);
+    return handle;
+}
+
+GLuint pezLoadTexture(const char* filename, bool flipRows)
+{
+    pezDecodedTexture decoded;
+    __pez__DecodeTexture(&__pez__TextureScratch[pezGetJobThreadIndex()], filename, flipRows, &decoded);
+    return __pez__UploadTexture(filename, &decoded);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ASYNCHRONOUS ASSETS
+//
+// Each load is a job that reads and decodes the file on the job threads, with
+// the scratch buffer of whichever thread runs it.  A texture's decode job then
+// queues a main-thread job to upload it; raw pixel loads need no upload.  The
+// asset's counter stays raised until both are done.
+
+enum { PEZ_ASSET_TEXTURE, PEZ_ASSET_PIXELS };
+
+struct PezAssetRec
+{
+    int Kind;
+    char* Filename;
+    bool FlipRows;
+    pezDecodedTexture Decoded;
+    GLuint Texture;
+    PezPixels Pixels;
+    PezCounter Done;
+};
+
+static void __pez__UploadAssetJob(void* data, int begin, int end)
+{
+    PezAsset asset = (PezAsset) data;
+    asset->Texture = __pez__UploadTexture(asset->Filename, &asset->Decoded);
+}
+
+static void __pez__DecodeAssetJob(void* data, int begin, int end)
+{
+    PezAsset asset = (PezAsset) data;
+    if (asset->Kind == PEZ_ASSET_TEXTURE) {
+        pezTextureScratch* scratch = &__pez__TextureScratch[pezGetJobThreadIndex()];
+        __pez__DecodeTexture(scratch, asset->Filename, asset->FlipRows, &asset->Decoded);
+        pezRunMainThreadJob(__pez__UploadAssetJob, asset, &asset->Done);
+    } else {
+        asset->Pixels = pezLoadPixels(asset->Filename);
+    }
+}
+
+static PezAsset __pez__QueueAsset(int kind, const char* filename, bool flipRows)
+{
+    PezAsset asset = (PezAsset) calloc(1, sizeof(struct PezAssetRec));
+    pezCheckPointer(asset, "Out of memory loading %s", filename);
+    asset->Kind = kind;
+    asset->FlipRows = flipRows;
+    asset->Filename = (char*) malloc(strlen(filename) + 1);
+    strcpy(asset->Filename, filename);
+    pezRunJob(__pez__DecodeAssetJob, asset, &asset->Done);
+    return asset;
+}
+
+PezAsset pezLoadTextureAsync(const char* filename, bool flipRows)
+{
+    return __pez__QueueAsset(PEZ_ASSET_TEXTURE, filename, flipRows);
+}
+
+PezAsset pezLoadPixelsAsync(const char* filename)
+{
+    return __pez__QueueAsset(PEZ_ASSET_PIXELS, filename, false);
+}
+
+bool pezIsAssetReady(PezAsset asset)
+{
+    return pezIsCounterDone(&asset->Done);
+}
+
+void pezWaitAsset(PezAsset asset)
+{
+    pezWaitCounter(&asset->Done);
+}
+
+GLuint pezGetAssetTexture(PezAsset asset)
+{
+    pezWaitAsset(asset);
+    return asset->Texture;
+}
+
+PezPixels pezGetAssetPixels(PezAsset asset)
+{
+    pezWaitAsset(asset);
+    return asset->Pixels;
+}
+
+void pezFreeAsset(PezAsset asset)
+{
+    pezWaitAsset(asset);
+    free(asset->Filename);
+    free(asset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DOUBLE-BUFFERED FRAME STATE
+//
+// Each registered struct has a snapshot that the platform layer refreshes at
+// the start of every frame, before it sets PezUpdate off on a job thread.
+// PezRender reads the snapshot while PezUpdate writes the struct itself.
+
+#define PEZ_MAX_FRAME_STATES 8
+
+typedef struct pezFrameStateRec
+{
+    void* Live;
+    void* Snapshot;
+    size_t Size;
+} pezFrameState;
+
+static pezFrameState __pez__FrameStates[PEZ_MAX_FRAME_STATES];
+static int __pez__FrameStateCount = 0;
+
+void pezDoubleBuffer(void* state, size_t size)
+{
+    pezCheck(__pez__FrameStateCount < PEZ_MAX_FRAME_STATES, "Too many double-buffered structs.");
+    pezFrameState* frameState = &__pez__FrameStates[__pez__FrameStateCount++];
+    frameState->Live = state;
+    frameState->Snapshot = malloc(size);
+    pezCheckPointer(frameState->Snapshot, "Out of memory double-buffering frame state.");
+    frameState->Size = size;
+    memcpy(frameState->Snapshot, state, size);
+}
+
+const void* pezGetRenderState(const void* state)
+{
+    for (int i = 0; i < __pez__FrameStateCount; i++) {
+        if (__pez__FrameStates[i].Live == state) {
+            return __pez__FrameStates[i].Snapshot;
+        }
+    }
+    return state;
+}
+
+bool pezIsUpdateThreaded()
+{
+    return __pez__FrameStateCount > 0;
+}
+
+void pezSnapshotFrameState()
+{
+    for (int i = 0; i < __pez__FrameStateCount; i++) {
+        pezFrameState* frameState = &__pez__FrameStates[i];
+        memcpy(frameState->Snapshot, frameState->Live, frameState->Size);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// UNIFORM RING
+//
+// Uniform blocks live in one buffer split into PEZ_UNIFORM_FRAMES segments,
+// like the streaming text.  The first write after a commit fences the segment
+// that was drawn from, moves on to the next one and maps it unsynchronized,
+// so the CPU only waits if it laps the GPU.  Commit flushes only what was
+// written.  A segment grows, by reallocating the whole buffer once the GPU is
+// done with it, when a frame's first write doesn't fit.
+
+#define PEZ_UNIFORM_FRAMES 3
+#define PEZ_UNIFORM_DEFAULT_SIZE (64 * 1024)
+
+typedef struct pezUniformRingRec
+{
+    GLuint Buffer;
+    GLsizeiptr SegmentSize;
+    GLsizeiptr Used;
+    GLint Alignment;
+    GLsync Fences[PEZ_UNIFORM_FRAMES];
+    int Segment;
+    unsigned char* Mapped;
+} pezUniformRing;
+
+static pezUniformRing __pez__Uniforms;
+
+static void __pez__AllocateUniforms(GLsizeiptr segmentSize)
+{
+    pezUniformRing* ring = &__pez__Uniforms;
+
+    if (!ring->Buffer)
+    {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ring->Alignment);
+        if (ring->Alignment < 1) ring->Alignment = 256;
+        glGenBuffers(1, &ring->Buffer);
+    }
+    for (int i = 0; i < PEZ_UNIFORM_FRAMES; i++)
+    {
+        __pez__WaitFence(&ring->Fences[i]);
+    }
+    ring->SegmentSize = (segmentSize + ring->Alignment - 1) / ring->Alignment * ring->Alignment;
+    glBindBuffer(GL_UNIFORM_BUFFER, ring->Buffer);
+    glBufferData(GL_UNIFORM_BUFFER, ring->SegmentSize * PEZ_UNIFORM_FRAMES, 0, GL_STREAM_DRAW);
+}
+
+void pezReserveUniforms(GLsizeiptr bytesPerFrame)
+{
+    pezUniformRing* ring = &__pez__Uniforms;
+    pezCheck(!ring->Mapped, "Uniforms can't be reserved between a write and its commit.");
+    if (bytesPerFrame > ring->SegmentSize)
+    {
+        __pez__AllocateUniforms(bytesPerFrame);
+    }
+}
+
+void* pezMapUniforms(GLsizeiptr size, PezUniforms* range)
+{
+    pezUniformRing* ring = &__pez__Uniforms;
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+
+    if (!ring->Mapped)
+    {
+        if (!ring->Buffer || size > ring->SegmentSize)
+        {
+            GLsizeiptr segmentSize = ring->SegmentSize ? ring->SegmentSize : PEZ_UNIFORM_DEFAULT_SIZE;
+            while (segmentSize < size) segmentSize *= 2;
+            __pez__AllocateUniforms(segmentSize);
+        }
+        else if (ring->Used)
+        {
+            ring->Fences[ring->Segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            ring->Segment = (ring->Segment + 1) % PEZ_UNIFORM_FRAMES;
+            __pez__WaitFence(&ring->Fences[ring->Segment]);
+        }
+        ring->Used = 0;
+        glBindBuffer(GL_UNIFORM_BUFFER, ring->Buffer);
+        ring->Mapped = (unsigned char*) glMapBufferRange(GL_UNIFORM_BUFFER, ring->Segment * ring->SegmentSize, ring->SegmentSize, access);
+        pezCheckPointer(ring->Mapped, "Can't map the uniform ring.");
+    }
+
+    pezCheck(ring->Used + size <= ring->SegmentSize,
+             "Out of uniform space; reserve at least %d bytes per frame.", (int) (ring->Used + size));
+    range->Offset = ring->Segment * ring->SegmentSize + ring->Used;
+    range->Size = size;
+    void* data = ring->Mapped + ring->Used;
+    ring->Used = (ring->Used + size + ring->Alignment - 1) / ring->Alignment * ring->Alignment;
+    return data;
+}
+
+PezUniforms pezWriteUniforms(const void* data, GLsizeiptr size)
+{
+    PezUniforms range;
+    memcpy(pezMapUniforms(size, &range), data, size);
+    return range;
+}
+
+void pezCommitUniforms()
+{
+    pezUniformRing* ring = &__pez__Uniforms;
+
+    if (!ring->Mapped)
+    {
+        return;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, ring->Buffer);
+    glFlushMappedBufferRange(GL_UNIFORM_BUFFER, 0, ring->Used);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    ring->Mapped = 0;
+}
+
+void pezBindUniforms(GLuint binding, PezUniforms range)
+{
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, __pez__Uniforms.Buffer, range.Offset, range.Size);
+}
+
+// Column-major 4x4 product, a * b.
+static void __pez__MultiplyMatrices(GLfloat* result, const GLfloat* a, const GLfloat* b)
+{
+    for (int column = 0; column < 4; column++)
+    {
+        for (int row = 0; row < 4; row++)
+        {
+            GLfloat sum = 0;
+            for (int k = 0; k < 4; k++)
+            {
+                sum += a[k * 4 + row] * b[column * 4 + k];
+            }
+            result[column * 4 + row] = sum;
+        }
+    }
+}
+
+void pezPackTransforms(PezTransforms* transforms, const float* projection, const float* view, const float* model)
+{
+    memcpy(transforms->Projection, projection, sizeof(transforms->Projection));
+    memcpy(transforms->ViewMatrix, view, sizeof(transforms->ViewMatrix));
+    memcpy(transforms->ModelMatrix, model, sizeof(transforms->ModelMatrix));
+    __pez__MultiplyMatrices(transforms->Modelview, view, model);
+    for (int column = 0; column < 3; column++)
+    {
+        for (int row = 0; row < 3; row++)
+        {
+            transforms->NormalMatrix[column * 4 + row] = transforms->Modelview[column * 4 + row];
+        }
+        transforms->NormalMatrix[column * 4 + 3] = 0;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// COMMAND BUFFERS
+//
+// Every job thread records into its own buffer, so recording takes no locks.
+// A draw is a fixed-size packet that captures the recording state; uniform
+// blocks are copied into the buffer's arena, aligned for glBindBufferRange,
+// when they are set, so draws that share a block share its copy.  Submitting
+// radix-sorts pointers to the packets of all buffers by a key made from the
+// program and vertex array, copies all arenas into the uniform ring, and
+// replays the packets while skipping binds that wouldn't change anything.
+
+#define PEZ_MAX_COMMAND_BLOCKS 4    // uniform block bindings a draw can use
+
+typedef struct pezUniformRangeRec
+{
+    GLuint Offset;                  // within the arena until submitted
+    GLuint Size;                    // zero if the binding is unused
+} pezUniformRange;
+
+typedef struct pezDrawPacketRec
+{
+    GLuint Program;
+    GLuint Vao;
+    GLenum Mode;
+    GLenum Type;                    // zero for glDrawArrays
+    GLsizei Count;
+    GLuint First;                   // byte offset of the indices for glDrawElements
+    pezUniformRange Blocks[PEZ_MAX_COMMAND_BLOCKS];
+} pezDrawPacket;
+
+struct PezCommandBufferRec
+{
+    pezDrawPacket State;
+    pezDrawPacket* Packets;
+    int PacketCount;
+    int PacketCapacity;
+    unsigned char* Uniforms;
+    GLuint UniformSize;
+    GLuint UniformCapacity;
+    GLuint Alignment;
+    char Padding[64];               // keep neighbouring buffers off each other's cache lines
+};
+
+typedef struct pezSortItemRec
+{
+    unsigned int Key;
+    const pezDrawPacket* Packet;
+} pezSortItem;
+
+struct PezCommandListRec
+{
+    PezCommandBuffer Buffers[PEZ_MAX_THREADS];
+    pezSortItem* Items;
+    pezSortItem* Scratch;
+    int ItemCapacity;
+};
+
+PezCommandList pezCreateCommandList()
+{
+    PezCommandList list = (PezCommandList) calloc(1, sizeof(struct PezCommandListRec));
+    GLint alignment;
+
+    pezCheckPointer(list, "Out of memory creating a command list.");
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    for (int i = 0; i < PEZ_MAX_THREADS; i++) {
+        list->Buffers[i].Alignment = alignment > 0 ? alignment : 256;
+    }
+    return list;
+}
+
+void pezDestroyCommandList(PezCommandList list)
+{
+    for (int i = 0; i < PEZ_MAX_THREADS; i++) {
+        free(list->Buffers[i].Packets);
+        free(list->Buffers[i].Uniforms);
+    }
+    free(list->Items);
+    free(list->Scratch);
+    free(list);
+}
+
+PezCommandBuffer* pezBeginCommands(PezCommandList list)
+{
+    PezCommandBuffer* buffer = &list->Buffers[pezGetJobThreadIndex()];
+    memset(&buffer->State, 0, sizeof(buffer->State));
+    return buffer;
+}
+
+void pezCmdBindProgram(PezCommandBuffer* buffer, GLuint program)
+{
+    buffer->State.Program = program;
+}
+
+void pezCmdBindVertexArray(PezCommandBuffer* buffer, GLuint vao)
+{
+    buffer->State.Vao = vao;
+}
+
+void pezCmdSetUniforms(PezCommandBuffer* buffer, GLuint binding, const void* data, GLsizeiptr size)
+{
+    GLuint offset = buffer->UniformSize;
+    GLuint end = offset + (GLuint) size;
+
+    pezCheck(binding < PEZ_MAX_COMMAND_BLOCKS, "Uniform block binding %d is out of range.", binding);
+    if (end > buffer->UniformCapacity) {
+        buffer->UniformCapacity = end > 2 * buffer->UniformCapacity ? end : 2 * buffer->UniformCapacity;
+        buffer->Uniforms = (unsigned char*) realloc(buffer->Uniforms, buffer->UniformCapacity);
+        pezCheckPointer(buffer->Uniforms, "Out of memory recording commands.");
+    }
+    memcpy(buffer->Uniforms + offset, data, size);
+    buffer->UniformSize = (end + buffer->Alignment - 1) / buffer->Alignment * buffer->Alignment;
+    buffer->State.Blocks[binding].Offset = offset;
+    buffer->State.Blocks[binding].Size = (GLuint) size;
+}
+
+static void __pez__RecordDraw(PezCommandBuffer* buffer)
+{
+    if (buffer->PacketCount == buffer->PacketCapacity) {
+        buffer->PacketCapacity = buffer->PacketCapacity ? 2 * buffer->PacketCapacity : 1024;
+        buffer->Packets = (pezDrawPacket*) realloc(buffer->Packets, buffer->PacketCapacity * sizeof(pezDrawPacket));
+        pezCheckPointer(buffer->Packets, "Out of memory recording commands.");
+    }
+    buffer->Packets[buffer->PacketCount++] = buffer->State;
+}
+
+void pezCmdDrawElements(PezCommandBuffer* buffer, GLenum mode, GLsizei count, GLenum type, GLsizeiptr offset)
+{
+    buffer->State.Mode = mode;
+    buffer->State.Type = type;
+    buffer->State.Count = count;
+    buffer->State.First = (GLuint) offset;
+    __pez__RecordDraw(buffer);
+}
+
+void pezCmdDrawArrays(PezCommandBuffer* buffer, GLenum mode, GLint first, GLsizei count)
+{
+    buffer->State.Mode = mode;
+    buffer->State.Type = 0;
+    buffer->State.Count = count;
+    buffer->State.First = (GLuint) first;
+    __pez__RecordDraw(buffer);
+}
+
+// Stable LSD radix sort, a byte at a time; bytes that all keys share are skipped.
+static pezSortItem* __pez__SortItems(pezSortItem* items, pezSortItem* scratch, int count)
+{
+    for (int shift = 0; shift < 32; shift += 8) {
+        int offsets[256] = { 0 };
+        for (int i = 0; i < count; i++) {
+            offsets[(items[i].Key >> shift) & 0xff]++;
+        }
+        if (offsets[(items[0].Key >> shift) & 0xff] == count) {
+            continue;
+        }
+        for (int i = 0, sum = 0; i < 256; i++) {
+            int n = offsets[i];
+            offsets[i] = sum;
+            sum += n;
+        }
+        for (int i = 0; i < count; i++) {
+            scratch[offsets[(items[i].Key >> shift) & 0xff]++] = items[i];
+        }
+        pezSortItem* swap = items;
+        items = scratch;
+        scratch = swap;
+    }
+    return items;
+}
+
+int pezSubmitCommands(PezCommandList list)
+{
+    GLuint bases[PEZ_MAX_THREADS];
+    GLuint uniformSize = 0;
+    int count = 0;
+
+    for (int i = 0; i < PEZ_MAX_THREADS; i++) {
+        bases[i] = uniformSize;
+        uniformSize += list->Buffers[i].UniformSize;
+        count += list->Buffers[i].PacketCount;
+    }
+    if (!count) {
+        return 0;
+    }
+
+    if (count > list->ItemCapacity) {
+        list->ItemCapacity = count;
+        free(list->Items);
+        free(list->Scratch);
+        list->Items = (pezSortItem*) malloc(count * sizeof(pezSortItem));
+        list->Scratch = (pezSortItem*) malloc(count * sizeof(pezSortItem));
+        pezCheckPointer(list->Items, "Out of memory submitting commands.");
+        pezCheckPointer(list->Scratch, "Out of memory submitting commands.");
+    }
+
+    // Gather the packets, moving their uniform offsets into the ring.
+    PezUniforms uniforms = { 0, 0 };
+    unsigned char* mapped = uniformSize ? (unsigned char*) pezMapUniforms(uniformSize, &uniforms) : 0;
+    pezSortItem* item = list->Items;
+    for (int i = 0; i < PEZ_MAX_THREADS; i++) {
+        PezCommandBuffer* buffer = &list->Buffers[i];
+        GLuint base = (GLuint) uniforms.Offset + bases[i];
+        if (buffer->UniformSize) {
+            memcpy(mapped + bases[i], buffer->Uniforms, buffer->UniformSize);
+        }
+        for (int p = 0; p < buffer->PacketCount; p++) {
+            pezDrawPacket* packet = &buffer->Packets[p];
+            for (int b = 0; b < PEZ_MAX_COMMAND_BLOCKS; b++) {
+                packet->Blocks[b].Offset += base;
+            }
+            item->Key = (packet->Program & 0xffff) << 16 | (packet->Vao & 0xffff);
+            item->Packet = packet;
+            item++;
+        }
+    }
+    pezCommitUniforms();
+    pezSortItem* sorted = __pez__SortItems(list->Items, list->Scratch, count);
+
+    // Keys only group draws; the binds compare the real names.
+    GLuint program = 0, vao = 0;
+    pezUniformRange bound[PEZ_MAX_COMMAND_BLOCKS];
+    memset(bound, 0, sizeof(bound));
+    glUseProgram(0);
+    glBindVertexArray(0);
+    for (int i = 0; i < count; i++) {
+        const pezDrawPacket* packet = sorted[i].Packet;
+        if (packet->Program != program) {
+            program = packet->Program;
+            glUseProgram(program);
+        }
+        if (packet->Vao != vao) {
+            vao = packet->Vao;
+            glBindVertexArray(vao);
+        }
+        for (int b = 0; b < PEZ_MAX_COMMAND_BLOCKS; b++) {
+            const pezUniformRange* range = &packet->Blocks[b];
+            if (range->Size && (range->Offset != bound[b].Offset || range->Size != bound[b].Size)) {
+                PezUniforms block = { range->Offset, range->Size };
+                bound[b] = *range;
+                pezBindUniforms(b, block);
+            }
+        }
+        if (packet->Type) {
+            glDrawElements(packet->Mode, packet->Count, packet->Type, (const GLvoid*) (size_t) packet->First);
+        } else {
+            glDrawArrays(packet->Mode, packet->First, packet->Count);
+        }
+    }
+
+    for (int i = 0; i < PEZ_MAX_THREADS; i++) {
+        list->Buffers[i].PacketCount = 0;
+        list->Buffers[i].UniformSize = 0;
+    }
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// INSTANCING
+//
+// Culling is two parallel-fors over chunks of PEZ_INSTANCE_GRAIN instances.
+// The first tests bounding spheres with pezCullSphereRange and lists the
+// visible instances of each chunk in place; the second, once the chunks'
+// offsets are known, copies their transforms into the mapped segment of a
+// streaming buffer, packed.  Segments are fenced and reused like those of the
+// uniform ring.  Draws pick their segment with a base instance, so the vertex
+// arrays are set up only once.
+
+#include <math.h>
+
+#define PEZ_INSTANCE_FRAMES 3
+#define PEZ_INSTANCE_GRAIN 2048
+#define PEZ_INSTANCE_BLOCK 256      // a multiple of PEZ_CULL_BATCH
+
+struct PezInstancesRec
+{
+    int Capacity;
+    int Count;
+    float Radius;
+    GLfloat* Transforms;
+    int* Visible;                   // per chunk, from the chunk's first slot
+    int* ChunkCounts;
+    int* ChunkOffsets;
+    int VisibleCount;
+    PezFrustum Frustum;
+    GLfloat* Mapped;
+    GLuint Buffer;
+    GLsync Fences[PEZ_INSTANCE_FRAMES];
+    int Segment;
+    bool Drawn;
+};
+
+PezInstances pezCreateInstances(int capacity, float radius)
+{
+    PezInstances instances = (PezInstances) calloc(1, sizeof(struct PezInstancesRec));
+    int chunkCount = (capacity + PEZ_INSTANCE_GRAIN - 1) / PEZ_INSTANCE_GRAIN;
+
+    pezCheckPointer(instances, "Out of memory creating instances.");
+    instances->Capacity = capacity;
+    instances->Radius = radius;
+    instances->Transforms = (GLfloat*) calloc(capacity, 16 * sizeof(GLfloat));
+    instances->Visible = (int*) malloc(capacity * sizeof(int));
+    instances->ChunkCounts = (int*) malloc(chunkCount * sizeof(int));
+    instances->ChunkOffsets = (int*) malloc(chunkCount * sizeof(int));
+    pezCheck(instances->Transforms && instances->Visible && instances->ChunkCounts && instances->ChunkOffsets,
+             "Out of memory creating %d instances.", capacity);
+
+    glGenBuffers(1, &instances->Buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instances->Buffer);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) capacity * 16 * sizeof(GLfloat) * PEZ_INSTANCE_FRAMES, 0, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return instances;
+}
+
+void pezDestroyInstances(PezInstances instances)
+{
+    for (int i = 0; i < PEZ_INSTANCE_FRAMES; i++)
+    {
+        if (instances->Fences[i])
+        {
+            glDeleteSync(instances->Fences[i]);
+        }
+    }
+    glDeleteBuffers(1, &instances->Buffer);
+    free(instances->Transforms);
+    free(instances->Visible);
+    free(instances->ChunkCounts);
+    free(instances->ChunkOffsets);
+    free(instances);
+}
+
+GLfloat* pezGetInstanceTransforms(PezInstances instances)
+{
+    return instances->Transforms;
+}
+
+void pezSetInstanceCount(PezInstances instances, int count)
+{
+    pezCheck(count >= 0 && count <= instances->Capacity, "Instance count %d exceeds the capacity.", count);
+    instances->Count = count;
+}
+
+void pezAttachInstances(PezInstances instances, GLuint vao, GLuint location)
+{
+    GLsizei stride = 16 * sizeof(GLfloat);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, instances->Buffer);
+    for (GLuint column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(location + column, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid*) (column * 4 * sizeof(GLfloat)));
+        glVertexAttribDivisor(location + column, 1);
+        glEnableVertexAttribArray(location + column);
+    }
+    glBindVertexArray(0);
+}
+
+// Instances are gathered a block at a time into bounding spheres for the
+// culling library, which lists the visible ones relative to the block.
+static void __pez__CullJob(void* data, int begin, int end)
+{
+    PezInstances instances = (PezInstances) data;
+    float x[PEZ_INSTANCE_BLOCK], y[PEZ_INSTANCE_BLOCK], z[PEZ_INSTANCE_BLOCK], radius[PEZ_INSTANCE_BLOCK];
+    PezSpheres spheres = { PEZ_INSTANCE_BLOCK, x, y, z, radius };
+    int* visible = instances->Visible + begin;
+    int count = 0;
+
+    for (int block = begin; block < end; block += PEZ_INSTANCE_BLOCK)
+    {
+        int n = end - block < PEZ_INSTANCE_BLOCK ? end - block : PEZ_INSTANCE_BLOCK;
+        int found;
+
+        for (int k = 0; k < n; k++)
+        {
+            const GLfloat* m = instances->Transforms + 16 * (block + k);
+            float scale = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+            float sy = m[4] * m[4] + m[5] * m[5] + m[6] * m[6];
+            float sz = m[8] * m[8] + m[9] * m[9] + m[10] * m[10];
+
+            scale = sy > scale ? sy : scale;
+            scale = sz > scale ? sz : scale;
+            x[k] = m[12];
+            y[k] = m[13];
+            z[k] = m[14];
+            radius[k] = instances->Radius * sqrtf(scale);
+        }
+        found = pezCullSphereRange(&instances->Frustum, spheres, 0, n, visible + count);
+        for (int k = 0; k < found; k++)
+        {
+            visible[count + k] += block;
+        }
+        count += found;
+    }
+    instances->ChunkCounts[begin / PEZ_INSTANCE_GRAIN] = count;
+}
+
+static void __pez__PackJob(void* data, int begin, int end)
+{
+    PezInstances instances = (PezInstances) data;
+    int chunk = begin / PEZ_INSTANCE_GRAIN;
+    const int* visible = instances->Visible + begin;
+    GLfloat* dest = instances->Mapped + 16 * instances->ChunkOffsets[chunk];
+
+    for (int i = 0; i < instances->ChunkCounts[chunk]; i++)
+    {
+        memcpy(dest + 16 * i, instances->Transforms + 16 * visible[i], 16 * sizeof(GLfloat));
+    }
+}
+
+int pezCullInstances(PezInstances instances, const float* viewProjection)
+{
+    GLsizeiptr segmentSize = (GLsizeiptr) instances->Capacity * 16 * sizeof(GLfloat);
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+    int chunkCount = (instances->Count + PEZ_INSTANCE_GRAIN - 1) / PEZ_INSTANCE_GRAIN;
+
+    if (instances->Drawn)
+    {
+        instances->Fences[instances->Segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        instances->Segment = (instances->Segment + 1) % PEZ_INSTANCE_FRAMES;
+        instances->Drawn = false;
+    }
+    __pez__WaitFence(&instances->Fences[instances->Segment]);
+
+    pezExtractFrustum(&instances->Frustum, viewProjection);
+    pezParallelFor(instances->Count, PEZ_INSTANCE_GRAIN, __pez__CullJob, instances);
+    instances->VisibleCount = 0;
+    for (int chunk = 0; chunk < chunkCount; chunk++)
+    {
+        instances->ChunkOffsets[chunk] = instances->VisibleCount;
+        instances->VisibleCount += instances->ChunkCounts[chunk];
+    }
+
+    if (instances->VisibleCount)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, instances->Buffer);
+        instances->Mapped = (GLfloat*) glMapBufferRange(GL_ARRAY_BUFFER, instances->Segment * segmentSize, segmentSize, access);
+        pezCheckPointer(instances->Mapped, "Can't map the instance buffer.");
+        pezParallelFor(instances->Count, PEZ_INSTANCE_GRAIN, __pez__PackJob, instances);
+        glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, (GLsizeiptr) instances->VisibleCount * 16 * sizeof(GLfloat));
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        instances->Mapped = 0;
+    }
+    return instances->VisibleCount;
+}
+
+void pezDrawInstances(PezInstances instances, GLenum mode, GLsizei count, GLenum type, GLsizeiptr offset)
+{
+    if (instances->VisibleCount)
+    {
+        GLuint baseInstance = instances->Segment * instances->Capacity;
+        glDrawElementsInstancedBaseInstance(mode, count, type, (const GLvoid*) offset, instances->VisibleCount, baseInstance);
+        instances->Drawn = true;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MESHLETS
+//
+// Clusters are grown greedily.  Each starts from an unused triangle next to
+// the previous cluster, or the first unused one, then repeatedly takes the
+// unused triangle around its vertices that adds the fewest new vertices and
+// bends its normal cone the least, until nothing more fits.  The bounds
+// follow meshoptimizer: a sphere around the box of the cluster's vertices,
+// and a cone whose apex lies behind every triangle's plane, so that the eye
+// sees all the triangles from behind exactly when it's inside the cone.
+
+#define PEZ_MESHLET_CONE_WEIGHT 0.5f    // new vertices that one unit of bending is worth
+#define PEZ_MESHLET_MIN_SPREAD 0.1f     // clusters whose normals spread further never face away
+
+struct PezMeshletsRec
+{
+    int Count;
+    GLenum IndexType;
+    GLsizei* IndexCounts;
+    GLsizeiptr* IndexOffsets;           // in bytes
+    PezSpheres Spheres;
+    PezCones Cones;
+    int* Visible;
+    int* FrontFacing;
+    int VisibleCount;
+    GLsizei* DrawCounts;
+    const GLvoid** DrawOffsets;
+};
+
+static unsigned int __pez__GetIndex(const GLvoid* indices, GLenum type, int i)
+{
+    return type == GL_UNSIGNED_INT ? ((const GLuint*) indices)[i] : ((const GLushort*) indices)[i];
+}
+
+static const GLfloat* __pez__GetPosition(const GLfloat* positions, GLsizei stride, unsigned int vertex)
+{
+    return (const GLfloat*) ((const char*) positions + (size_t) stride * vertex);
+}
+
+// Fills in the sphere and cone of a cluster from its vertices and triangles.
+static void __pez__BoundMeshlet(PezMeshlets meshlets, int index, const GLfloat* positions, GLsizei stride,
+                                const unsigned int* vertices, int vertexCount,
+                                const GLvoid* indices, GLenum type, const int* triangles, int triangleCount,
+                                const float* normals)
+{
+    float lower[3], upper[3], center[3], axis[3] = { 0, 0, 0 };
+    float radius = 0, spread = 1, apex = 0, length;
+
+    for (int k = 0; k < 3; k++)
+    {
+        lower[k] = upper[k] = __pez__GetPosition(positions, stride, vertices[0])[k];
+    }
+    for (int v = 1; v < vertexCount; v++)
+    {
+        const GLfloat* p = __pez__GetPosition(positions, stride, vertices[v]);
+        for (int k = 0; k < 3; k++)
+        {
+            lower[k] = p[k] < lower[k] ? p[k] : lower[k];
+            upper[k] = p[k] > upper[k] ? p[k] : upper[k];
+        }
+    }
+    for (int k = 0; k < 3; k++)
+    {
+        center[k] = 0.5f * (lower[k] + upper[k]);
+    }
+    for (int v = 0; v < vertexCount; v++)
+    {
+        const GLfloat* p = __pez__GetPosition(positions, stride, vertices[v]);
+        float dx = p[0] - center[0], dy = p[1] - center[1], dz = p[2] - center[2];
+        float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+        radius = distance > radius ? distance : radius;
+    }
+
+    for (int t = 0; t < triangleCount; t++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            axis[k] += normals[3 * triangles[t] + k];
+        }
+    }
+    length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    for (int k = 0; k < 3; k++)
+    {
+        axis[k] = length > 0 ? axis[k] / length : 0;
+    }
+    for (int t = 0; t < triangleCount; t++)
+    {
+        const float* n = normals + 3 * triangles[t];
+        float dot = n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2];
+        spread = dot < spread ? dot : spread;
+    }
+
+    meshlets->Spheres.X[index] = center[0];
+    meshlets->Spheres.Y[index] = center[1];
+    meshlets->Spheres.Z[index] = center[2];
+    meshlets->Spheres.Radius[index] = radius;
+    meshlets->Cones.AxisX[index] = axis[0];
+    meshlets->Cones.AxisY[index] = axis[1];
+    meshlets->Cones.AxisZ[index] = axis[2];
+
+    // A cutoff above one never culls.
+    if (spread < PEZ_MESHLET_MIN_SPREAD)
+    {
+        meshlets->Cones.X[index] = center[0];
+        meshlets->Cones.Y[index] = center[1];
+        meshlets->Cones.Z[index] = center[2];
+        meshlets->Cones.Cutoff[index] = 2;
+        return;
+    }
+
+    // Move the apex back along the axis until it's behind every triangle.
+    for (int t = 0; t < triangleCount; t++)
+    {
+        const float* n = normals + 3 * triangles[t];
+        const GLfloat* p = __pez__GetPosition(positions, stride, __pez__GetIndex(indices, type, 3 * triangles[t]));
+        float offset = (center[0] - p[0]) * n[0] + (center[1] - p[1]) * n[1] + (center[2] - p[2]) * n[2];
+        float facing = axis[0] * n[0] + axis[1] * n[1] + axis[2] * n[2];
+        float distance = offset / facing;
+        apex = distance > apex ? distance : apex;
+    }
+    meshlets->Cones.X[index] = center[0] - axis[0] * apex;
+    meshlets->Cones.Y[index] = center[1] - axis[1] * apex;
+    meshlets->Cones.Z[index] = center[2] - axis[2] * apex;
+    meshlets->Cones.Cutoff[index] = sqrtf(1 - spread * spread);
+}
+
+PezMeshlets pezBuildMeshlets(const GLfloat* positions, GLsizei stride, int vertexCount,
+                             GLvoid* indices, GLenum indexType, int indexCount)
+{
+    int triangleCount = indexCount / 3;
+    size_t indexSize = indexType == GL_UNSIGNED_INT ? sizeof(GLuint) : sizeof(GLushort);
+    PezMeshlets meshlets = (PezMeshlets) calloc(1, sizeof(struct PezMeshletsRec));
+    float* normals = (float*) malloc(3 * sizeof(float) * triangleCount);
+    int* adjacencyStarts = (int*) calloc(vertexCount + 1, sizeof(int));
+    int* adjacency = (int*) malloc(3 * sizeof(int) * triangleCount);
+    int* vertexStamps = (int*) malloc(sizeof(int) * vertexCount);
+    int* order = (int*) malloc(sizeof(int) * triangleCount);
+    char* used = (char*) calloc(triangleCount, 1);
+    unsigned int vertices[PEZ_MESHLET_VERTICES];
+    unsigned int previous[PEZ_MESHLET_VERTICES];
+    int previousCount = 0;
+    int usedCount = 0;
+    int cursor = 0;
+    char* reordered;
+
+    pezCheck(indexType == GL_UNSIGNED_SHORT || indexType == GL_UNSIGNED_INT, "Meshlets need 16- or 32-bit indices.");
+    pezCheck(meshlets && normals && adjacencyStarts && adjacency && vertexStamps && order && used,
+             "Out of memory building meshlets.");
+    meshlets->IndexType = indexType;
+    meshlets->IndexCounts = (GLsizei*) malloc(sizeof(GLsizei) * triangleCount);
+    meshlets->IndexOffsets = (GLsizeiptr*) malloc(sizeof(GLsizeiptr) * triangleCount);
+    pezCheck(meshlets->IndexCounts && meshlets->IndexOffsets, "Out of memory building meshlets.");
+
+    // Unit normals of the triangles, and the triangles around each vertex:
+    for (int t = 0; t < triangleCount; t++)
+    {
+        const GLfloat* p0 = __pez__GetPosition(positions, stride, __pez__GetIndex(indices, indexType, 3 * t));
+        const GLfloat* p1 = __pez__GetPosition(positions, stride, __pez__GetIndex(indices, indexType, 3 * t + 1));
+        const GLfloat* p2 = __pez__GetPosition(positions, stride, __pez__GetIndex(indices, indexType, 3 * t + 2));
+        float u[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float v[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float* n = normals + 3 * t;
+        float length;
+
+        n[0] = u[1] * v[2] - u[2] * v[1];
+        n[1] = u[2] * v[0] - u[0] * v[2];
+        n[2] = u[0] * v[1] - u[1] * v[0];
+        length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int k = 0; k < 3; k++)
+        {
+            n[k] = length > 0 ? n[k] / length : 0;
+            adjacencyStarts[__pez__GetIndex(indices, indexType, 3 * t + k) + 1]++;
+        }
+    }
+    for (int v = 0; v < vertexCount; v++)
+    {
+        adjacencyStarts[v + 1] += adjacencyStarts[v];
+        vertexStamps[v] = -1;
+    }
+    for (int t = 0; t < triangleCount; t++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            adjacency[adjacencyStarts[__pez__GetIndex(indices, indexType, 3 * t + k)]++] = t;
+        }
+    }
+    for (int v = vertexCount; v > 0; v--)
+    {
+        adjacencyStarts[v] = adjacencyStarts[v - 1];
+    }
+    adjacencyStarts[0] = 0;
+
+    while (usedCount < triangleCount)
+    {
+        int index = meshlets->Count;
+        int first = usedCount;
+        int clusterVertices = 0;
+        int seed = -1;
+        float axis[3] = { 0, 0, 0 };
+
+        // Start next to the previous cluster if possible, to keep them in order.
+        for (int v = 0; v < previousCount && seed < 0; v++)
+        {
+            for (int a = adjacencyStarts[previous[v]]; a < adjacencyStarts[previous[v] + 1]; a++)
+            {
+                if (!used[adjacency[a]])
+                {
+                    seed = adjacency[a];
+                    break;
+                }
+            }
+        }
+        while (seed < 0)
+        {
+            seed = used[cursor] ? -1 : cursor;
+            cursor++;
+        }
+
+        for (int t = seed; t >= 0 && usedCount - first < PEZ_MESHLET_TRIANGLES; )
+        {
+            float length = 0, bestScore = 0;
+            int best = -1;
+
+            used[t] = 1;
+            order[usedCount++] = t;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int vertex = __pez__GetIndex(indices, indexType, 3 * t + k);
+                if (vertexStamps[vertex] != index)
+                {
+                    vertexStamps[vertex] = index;
+                    vertices[clusterVertices++] = vertex;
+                }
+                axis[k] += normals[3 * t + k];
+                length += axis[k] * axis[k];
+            }
+            length = length > 0 ? 1 / sqrtf(length) : 0;
+
+            // Pick the next triangle from those around the cluster's vertices.
+            for (int v = 0; v < clusterVertices; v++)
+            {
+                for (int a = adjacencyStarts[vertices[v]]; a < adjacencyStarts[vertices[v] + 1]; a++)
+                {
+                    int candidate = adjacency[a];
+                    const float* n = normals + 3 * candidate;
+                    int added = 0;
+                    float score;
+
+                    if (used[candidate])
+                    {
+                        continue;
+                    }
+                    for (int k = 0; k < 3; k++)
+                    {
+                        added += vertexStamps[__pez__GetIndex(indices, indexType, 3 * candidate + k)] != index;
+                    }
+                    if (clusterVertices + added > PEZ_MESHLET_VERTICES)
+                    {
+                        continue;
+                    }
+                    score = added + PEZ_MESHLET_CONE_WEIGHT * (1 - (n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2]) * length);
+                    if (best < 0 || score < bestScore)
+                    {
+                        best = candidate;
+                        bestScore = score;
+                    }
+                }
+            }
+            t = best;
+        }
+
+        meshlets->IndexCounts[index] = 3 * (usedCount - first);
+        meshlets->IndexOffsets[index] = (GLsizeiptr) (indexSize * 3 * first);
+        meshlets->Count++;
+        memcpy(previous, vertices, sizeof(unsigned int) * clusterVertices);
+        previousCount = clusterVertices;
+    }
+
+    meshlets->Spheres = pezCreateSpheres(meshlets->Count);
+    meshlets->Cones = pezCreateCones(meshlets->Count);
+    meshlets->Visible = (int*) malloc(sizeof(int) * meshlets->Count);
+    meshlets->FrontFacing = (int*) malloc(sizeof(int) * meshlets->Count);
+    meshlets->DrawCounts = (GLsizei*) malloc(sizeof(GLsizei) * meshlets->Count);
+    meshlets->DrawOffsets = (const GLvoid**) malloc(sizeof(GLvoid*) * meshlets->Count);
+    pezCheck(meshlets->Spheres.Count == meshlets->Count && meshlets->Cones.Count == meshlets->Count &&
+             meshlets->Visible && meshlets->FrontFacing && meshlets->DrawCounts && meshlets->DrawOffsets,
+             "Out of memory building meshlets.");
+
+    // The clusters' vertices are gathered again for their bounds, with stamps
+    // that can't match those of the first pass.
+    for (int m = 0; m < meshlets->Count; m++)
+    {
+        int first = (int) (meshlets->IndexOffsets[m] / indexSize / 3);
+        int count = meshlets->IndexCounts[m] / 3;
+        int clusterVertices = 0;
+
+        for (int t = first; t < first + count; t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int vertex = __pez__GetIndex(indices, indexType, 3 * order[t] + k);
+                if (vertexStamps[vertex] != meshlets->Count + m)
+                {
+                    vertexStamps[vertex] = meshlets->Count + m;
+                    vertices[clusterVertices++] = vertex;
+                }
+            }
+        }
+        __pez__BoundMeshlet(meshlets, m, positions, stride, vertices, clusterVertices,
+                            indices, indexType, order + first, count, normals);
+    }
+
+    reordered = (char*) malloc(indexSize * 3 * triangleCount);
+    pezCheckPointer(reordered, "Out of memory building meshlets.");
+    for (int t = 0; t < triangleCount; t++)
+    {
+        memcpy(reordered + indexSize * 3 * t, (const char*) indices + indexSize * 3 * order[t], indexSize * 3);
+    }
+    memcpy(indices, reordered, indexSize * 3 * triangleCount);
+
+    free(normals);
+    free(adjacencyStarts);
+    free(adjacency);
+    free(vertexStamps);
+    free(order);
+    free(used);
+    free(reordered);
+    return meshlets;
+}
+
+void pezDestroyMeshlets(PezMeshlets meshlets)
+{
+    free(meshlets->IndexCounts);
+    free(meshlets->IndexOffsets);
+    pezFreeSpheres(meshlets->Spheres);
+    pezFreeCones(meshlets->Cones);
+    free(meshlets->Visible);
+    free(meshlets->FrontFacing);
+    free(meshlets->DrawCounts);
+    free(meshlets->DrawOffsets);
+    free(meshlets);
+}
+
+int pezGetMeshletCount(PezMeshlets meshlets)
+{
+    return meshlets->Count;
+}
+
+int pezCullMeshlets(PezMeshlets meshlets, const float* modelViewProjection, const float* eye)
+{
+    PezFrustum frustum;
+    int triangleCount = 0;
+
+    pezExtractFrustum(&frustum, modelViewProjection);
+    meshlets->VisibleCount = pezCullSpheres(&frustum, meshlets->Spheres, meshlets->Visible);
+
+    // Both lists are in order, so their intersection can be taken in place.
+    if (eye)
+    {
+        int frontCount = pezCullCones(eye, meshlets->Cones, meshlets->FrontFacing);
+        int kept = 0;
+        for (int i = 0, j = 0; i < meshlets->VisibleCount && j < frontCount; )
+        {
+            if (meshlets->Visible[i] < meshlets->FrontFacing[j])
+            {
+                i++;
+            }
+            else if (meshlets->Visible[i] > meshlets->FrontFacing[j])
+            {
+                j++;
+            }
+            else
+            {
+                meshlets->Visible[kept++] = meshlets->Visible[i];
+                i++;
+                j++;
+            }
+        }
+        meshlets->VisibleCount = kept;
+    }
+
+    for (int i = 0; i < meshlets->VisibleCount; i++)
+    {
+        int m = meshlets->Visible[i];
+        meshlets->DrawCounts[i] = meshlets->IndexCounts[m];
+        meshlets->DrawOffsets[i] = (const GLvoid*) meshlets->IndexOffsets[m];
+        triangleCount += meshlets->IndexCounts[m] / 3;
+    }
+    return triangleCount;
+}
+
+void pezDrawMeshlets(PezMeshlets meshlets)
+{
+    if (meshlets->VisibleCount)
+    {
+        glMultiDrawElements(GL_TRIANGLES, meshlets->DrawCounts, meshlets->IndexType,
+                            meshlets->DrawOffsets, meshlets->VisibleCount);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LEVELS OF DETAIL
+//
+// All levels share a vertex buffer and an index buffer, each level drawn from
+// its own range with a base vertex.  Normals come from finite differences of
+// the surface.  A level's error is measured at the middle of each quad, where
+// the surface is furthest from the diagonal that splits it.
+
+#define PEZ_LOD_MIN_DIVISIONS 3
+#define PEZ_LOD_EPSILON 0.001f
+
+struct PezLodsRec
+{
+    int LevelCount;
+    GLuint Vao;
+    GLuint Buffers[2];
+    GLint BaseVertices[PEZ_MAX_LODS];
+    GLsizeiptr IndexOffsets[PEZ_MAX_LODS];      // in bytes
+    GLsizei IndexCounts[PEZ_MAX_LODS];
+    float Errors[PEZ_MAX_LODS];
+    float Radius;
+};
+
+typedef struct pezTorusRec
+{
+    float Major;
+    float Minor;
+} pezTorus;
+
+PezLods pezGenSurface(PezSurfaceFunction surface, const void* context, int slices, int stacks, int levelCount)
+{
+    PezLods lods = (PezLods) calloc(1, sizeof(struct PezLodsRec));
+    int vertexCount = 0, indexCount = 0;
+    GLfloat* vertices;
+    GLuint* indices;
+
+    pezCheckPointer(lods, "Out of memory creating levels of detail.");
+    levelCount = levelCount > PEZ_MAX_LODS ? PEZ_MAX_LODS : levelCount;
+    for (int level = 0; level < levelCount; level++)
+    {
+        int s = slices >> level, t = stacks >> level;
+        if (level && s < PEZ_LOD_MIN_DIVISIONS && t < PEZ_LOD_MIN_DIVISIONS)
+        {
+            break;
+        }
+        s = s < PEZ_LOD_MIN_DIVISIONS ? PEZ_LOD_MIN_DIVISIONS : s;
+        t = t < PEZ_LOD_MIN_DIVISIONS ? PEZ_LOD_MIN_DIVISIONS : t;
+        lods->BaseVertices[level] = vertexCount;
+        lods->IndexOffsets[level] = indexCount * sizeof(GLuint);
+        lods->IndexCounts[level] = s * t * 6;
+        lods->LevelCount++;
+        vertexCount += s * t;
+        indexCount += s * t * 6;
+    }
+
+    vertices = (GLfloat*) malloc(vertexCount * 6 * sizeof(GLfloat));
+    indices = (GLuint*) malloc(indexCount * sizeof(GLuint));
+    pezCheck(vertices && indices, "Out of memory creating levels of detail.");
+
+    for (int level = 0; level < lods->LevelCount; level++)
+    {
+        int s = slices >> level, t = stacks >> level;
+        GLfloat* vertex = vertices + 6 * lods->BaseVertices[level];
+        GLuint* index = indices + lods->IndexOffsets[level] / sizeof(GLuint);
+        float error = 0;
+
+        s = s < PEZ_LOD_MIN_DIVISIONS ? PEZ_LOD_MIN_DIVISIONS : s;
+        t = t < PEZ_LOD_MIN_DIVISIONS ? PEZ_LOD_MIN_DIVISIONS : t;
+        for (int i = 0; i < s; i++)
+        {
+            for (int j = 0; j < t; j++)
+            {
+                float u[3], v[3], length, next[3], across[3], middle[3];
+
+                surface(context, (float) i / s, (float) j / t, vertex);
+                surface(context, (float) i / s + PEZ_LOD_EPSILON, (float) j / t, u);
+                surface(context, (float) i / s, (float) j / t + PEZ_LOD_EPSILON, v);
+                for (int k = 0; k < 3; k++)
+                {
+                    u[k] -= vertex[k];
+                    v[k] -= vertex[k];
+                }
+                vertex[3] = u[1] * v[2] - u[2] * v[1];
+                vertex[4] = u[2] * v[0] - u[0] * v[2];
+                vertex[5] = u[0] * v[1] - u[1] * v[0];
+                length = sqrtf(vertex[3] * vertex[3] + vertex[4] * vertex[4] + vertex[5] * vertex[5]);
+                for (int k = 3; k < 6; k++)
+                {
+                    vertex[k] = length > 0 ? vertex[k] / length : 0;
+                }
+                if (level == 0)
+                {
+                    length = sqrtf(vertex[0] * vertex[0] + vertex[1] * vertex[1] + vertex[2] * vertex[2]);
+                    lods->Radius = length > lods->Radius ? length : lods->Radius;
+                }
+                vertex += 6;
+
+                // The quad's diagonal runs from (i + 1, j) to (i, j + 1).
+                surface(context, (float) (i + 1) / s, (float) j / t, next);
+                surface(context, (float) i / s, (float) (j + 1) / t, across);
+                surface(context, (i + 0.5f) / s, (j + 0.5f) / t, middle);
+                for (int k = 0; k < 3; k++)
+                {
+                    middle[k] -= 0.5f * (next[k] + across[k]);
+                }
+                length = sqrtf(middle[0] * middle[0] + middle[1] * middle[1] + middle[2] * middle[2]);
+                error = length > error ? length : error;
+
+                {
+                    GLuint corner = i * t + j;
+                    GLuint right = (corner + t) % (s * t);
+                    GLuint up = i * t + (j + 1) % t;
+                    GLuint diagonal = (up + t) % (s * t);
+                    *index++ = right;
+                    *index++ = up;
+                    *index++ = corner;
+                    *index++ = diagonal;
+                    *index++ = up;
+                    *index++ = right;
+                }
+            }
+        }
+        lods->Errors[level] = error;
+    }
+
+    glGenVertexArrays(1, &lods->Vao);
+    glBindVertexArray(lods->Vao);
+    glGenBuffers(2, lods->Buffers);
+    glBindBuffer(GL_ARRAY_BUFFER, lods->Buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * 6 * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lods->Buffers[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLuint), indices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), 0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const GLvoid*) (3 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+
+    free(vertices);
+    free(indices);
+    return lods;
+}
+
+static void __pez__EvaluateTorus(const void* context, float s, float t, float* position)
+{
+    const pezTorus* torus = (const pezTorus*) context;
+    float theta = s * 2 * Pi;
+    float phi = t * 2 * Pi;
+    float beta = torus->Major + torus->Minor * cosf(phi);
+
+    position[0] = cosf(theta) * beta;
+    position[1] = sinf(theta) * beta;
+    position[2] = sinf(phi) * torus->Minor;
+}
+
+// The knot as the demos draw it: a tube swept along a (3, 2) torus knot.
+static void __pez__EvaluateTrefoil(const void* context, float s, float t, float* position)
+{
+    const float a = 0.5f;
+    const float b = 0.3f;
+    const float c = 0.5f;
+    const float d = 0.1f;
+    const float u = (1 - s) * 2 * TwoPi;
+    const float v = t * TwoPi;
+    const float r = a + b * cosf(1.5f * u);
+    float tangent[3], side[3], normal[3], length;
+
+    tangent[0] = -1.5f * b * sinf(1.5f * u) * cosf(u) - r * sinf(u);
+    tangent[1] = -1.5f * b * sinf(1.5f * u) * sinf(u) + r * cosf(u);
+    tangent[2] = 1.5f * c * cosf(1.5f * u);
+    length = sqrtf(tangent[0] * tangent[0] + tangent[1] * tangent[1] + tangent[2] * tangent[2]);
+    for (int k = 0; k < 3; k++)
+    {
+        tangent[k] /= length;
+    }
+    length = sqrtf(tangent[0] * tangent[0] + tangent[1] * tangent[1]);
+    side[0] = tangent[1] / length;
+    side[1] = -tangent[0] / length;
+    side[2] = 0;
+    normal[0] = tangent[1] * side[2] - tangent[2] * side[1];
+    normal[1] = tangent[2] * side[0] - tangent[0] * side[2];
+    normal[2] = tangent[0] * side[1] - tangent[1] * side[0];
+
+    position[0] = r * cosf(u) + d * (side[0] * cosf(v) + normal[0] * sinf(v));
+    position[1] = r * sinf(u) + d * (side[1] * cosf(v) + normal[1] * sinf(v));
+    position[2] = c * sinf(1.5f * u) + d * normal[2] * sinf(v);
+}
+
+PezLods pezGenTorus(float major, float minor, int slices, int stacks, int levelCount)
+{
+    pezTorus torus = { major, minor };
+    return pezGenSurface(__pez__EvaluateTorus, &torus, slices, stacks, levelCount);
+}
+
+PezLods pezGenTrefoil(int slices, int stacks, int levelCount)
+{
+    return pezGenSurface(__pez__EvaluateTrefoil, 0, slices, stacks, levelCount);
+}
+
+void pezDestroyLods(PezLods lods)
+{
+    glDeleteBuffers(2, lods->Buffers);
+    glDeleteVertexArrays(1, &lods->Vao);
+    free(lods);
+}
+
+int pezGetLodCount(PezLods lods)
+{
+    return lods->LevelCount;
+}
+
+int pezGetLodTriangles(PezLods lods, int level)
+{
+    return lods->IndexCounts[level] / 3;
+}
+
+float pezGetLodError(PezLods lods, int level)
+{
+    return lods->Errors[level];
+}
+
+float pezGetLodRadius(PezLods lods)
+{
+    return lods->Radius;
+}
+
+// Triangle counts and errors both change by a roughly constant factor from
+// one level to the next, so fractions are taken in log space, where they move
+// evenly with distance.  The covered area is that of the bounding sphere.
+float pezSelectLod(PezLods lods, float distance, float pixelScale, float pixelsPerTriangle, float maxPixelError)
+{
+    float d = distance > 0 ? distance : 0;
+    float radius = lods->Radius * pixelScale / d;
+    float triangles = Pi * radius * radius / pixelsPerTriangle;
+    float budget = maxPixelError * d / pixelScale;
+    float byDensity, byError;
+    int last = lods->LevelCount - 1;
+    int level = 0;
+
+    if (last == 0)
+    {
+        return 0;
+    }
+
+    // The finest level within the triangle budget, which is fading in while
+    // the budget falls from the next finer level's count to its own.  Level
+    // zero fades in from a count extrapolated one level finer.
+    while (level < last && lods->IndexCounts[level] / 3 > triangles)
+    {
+        level++;
+    }
+    {
+        float count = (float) (lods->IndexCounts[level] / 3);
+        float finer = level > 0 ? (float) (lods->IndexCounts[level - 1] / 3) :
+            count * lods->IndexCounts[0] / lods->IndexCounts[1];
+        byDensity = level - 1 + logf(finer / triangles) / logf(finer / count);
+        byDensity = byDensity < 0 ? 0 : byDensity > last ? last : byDensity;
+    }
+
+    // The coarsest level whose error stays within budget:
+    level = 0;
+    while (level < last && lods->Errors[level + 1] <= budget)
+    {
+        level++;
+    }
+    byError = (float) level;
+    if (level < last && budget > lods->Errors[level] && lods->Errors[level] > 0)
+    {
+        byError += logf(budget / lods->Errors[level]) / logf(lods->Errors[level + 1] / lods->Errors[level]);
+    }
+
+    return byDensity > byError ? byDensity : byError;
+}
+
+void pezDrawLod(PezLods lods, int level)
+{
+    glBindVertexArray(lods->Vao);
+    glDrawElementsBaseVertex(GL_TRIANGLES, lods->IndexCounts[level], GL_UNSIGNED_INT,
+                             (const GLvoid*) lods->IndexOffsets[level], lods->BaseVertices[level]);
+}
@@ -0,0 +1,288 @@
+// Pez was developed by Philip Rideout and released under the MIT License.
+//
+// Frustum and normal cone culling.  Each batch loads PEZ_CULL_BATCH bounds
+// from the structure-of-arrays into GCC vectors of four lanes, which compile
+// to SSE or NEON without any intrinsics, and tests them against all the
+// planes without branching.  The lanes that pass are then appended to the visible
+// list with a branch-free store, so the list comes out compact and in order.
+// The parallel versions cull chunks of PEZ_CULL_GRAIN bounds into their own
+// part of the list, then slide the chunks' lists down to close the gaps.
+//
+// This file has no dependencies beyond the job scheduler so tools can link it.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "pez.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define PEZ_CULL_GRAIN 4096     // a multiple of PEZ_CULL_BATCH
+#define PEZ_CULL_ALIGN 32
+#define PEZ_CULL_LANES 4        // as wide as SSE and NEON go
+#define PEZ_CULL_VECTORS (PEZ_CULL_BATCH / PEZ_CULL_LANES)
+
+typedef float pezFloats __attribute__((vector_size(PEZ_CULL_LANES * sizeof(float))));
+typedef int pezMask __attribute__((vector_size(PEZ_CULL_LANES * sizeof(int))));
+
+typedef int (*pezCullFunction)(const void* test, const void* bounds, int begin, int end, int* visible);
+
+typedef struct pezCullTaskRec
+{
+    pezCullFunction Function;
+    const void* Test;
+    const void* Bounds;
+    int* Visible;
+    int* ChunkCounts;
+} pezCullTask;
+
+// Loads n lanes of a batch, zeroing the rest.
+static inline void __pez__Load(pezFloats lanes[PEZ_CULL_VECTORS], const float* source, int n)
+{
+    if (n == PEZ_CULL_BATCH) {
+        memcpy(lanes, source, PEZ_CULL_BATCH * sizeof(float));
+    } else {
+        memset(lanes, 0, PEZ_CULL_BATCH * sizeof(float));
+        memcpy(lanes, source, n * sizeof(float));
+    }
+}
+
+// Appends base + k for each of the first n lanes that pass; passing lanes are
+// all ones, so subtracting them counts up.
+static inline int __pez__Emit(const pezMask pass[PEZ_CULL_VECTORS], int base, int n, int* visible)
+{
+    int count = 0;
+    for (int k = 0; k < n; k++) {
+        visible[count] = base + k;
+        count -= pass[k / PEZ_CULL_LANES][k % PEZ_CULL_LANES];
+    }
+    return count;
+}
+
+// Gribb and Hartmann: each plane is the fourth row of the matrix plus or
+// minus one of the others, normalized so that the plane test gives distances.
+void pezExtractFrustum(PezFrustum* frustum, const float* m)
+{
+    for (int i = 0; i < 6; i++) {
+        float* plane = frustum->Planes[i];
+        int row = i / 2;
+        float sign = (i & 1) ? -1.0f : 1.0f;
+        for (int k = 0; k < 4; k++) {
+            plane[k] = m[k * 4 + 3] + sign * m[k * 4 + row];
+        }
+        float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        for (int k = 0; k < 4; k++) {
+            plane[k] /= length;
+        }
+    }
+}
+
+// Allocates the given number of zeroed arrays in one block, each padded to
+// whole batches; the first array is the block, for freeing.  Returns the
+// count, or zero with null arrays when out of memory.
+static int __pez__AllocateArrays(int count, int arrayCount, float** arrays[])
+{
+    size_t stride = (size_t) (count + PEZ_CULL_BATCH - 1) / PEZ_CULL_BATCH * PEZ_CULL_BATCH;
+    void* block = 0;
+    if (posix_memalign(&block, PEZ_CULL_ALIGN, stride * arrayCount * sizeof(float))) {
+        block = 0;
+        count = 0;
+    } else {
+        memset(block, 0, stride * arrayCount * sizeof(float));
+    }
+    for (int i = 0; i < arrayCount; i++) {
+        *arrays[i] = block ? (float*) block + i * stride : 0;
+    }
+    return count;
+}
+
+PezSpheres pezCreateSpheres(int count)
+{
+    PezSpheres spheres;
+    float** arrays[] = { &spheres.X, &spheres.Y, &spheres.Z, &spheres.Radius };
+    spheres.Count = __pez__AllocateArrays(count, countof(arrays), arrays);
+    return spheres;
+}
+
+PezBoxes pezCreateBoxes(int count)
+{
+    PezBoxes boxes;
+    float** arrays[] = { &boxes.X, &boxes.Y, &boxes.Z, &boxes.ExtentX, &boxes.ExtentY, &boxes.ExtentZ };
+    boxes.Count = __pez__AllocateArrays(count, countof(arrays), arrays);
+    return boxes;
+}
+
+PezCones pezCreateCones(int count)
+{
+    PezCones cones;
+    float** arrays[] = { &cones.X, &cones.Y, &cones.Z, &cones.AxisX, &cones.AxisY, &cones.AxisZ, &cones.Cutoff };
+    cones.Count = __pez__AllocateArrays(count, countof(arrays), arrays);
+    return cones;
+}
+
+void pezFreeSpheres(PezSpheres spheres)
+{
+    free(spheres.X);
+}
+
+void pezFreeBoxes(PezBoxes boxes)
+{
+    free(boxes.X);
+}
+
+void pezFreeCones(PezCones cones)
+{
+    free(cones.X);
+}
+
+int pezCullSphereRange(const PezFrustum* frustum, PezSpheres spheres, int begin, int end, int* visible)
+{
+    int count = 0;
+    for (int i = begin; i < end; i += PEZ_CULL_BATCH) {
+        int n = end - i < PEZ_CULL_BATCH ? end - i : PEZ_CULL_BATCH;
+        pezFloats x[PEZ_CULL_VECTORS], y[PEZ_CULL_VECTORS], z[PEZ_CULL_VECTORS], radius[PEZ_CULL_VECTORS];
+        pezMask pass[PEZ_CULL_VECTORS];
+        __pez__Load(x, spheres.X + i, n);
+        __pez__Load(y, spheres.Y + i, n);
+        __pez__Load(z, spheres.Z + i, n);
+        __pez__Load(radius, spheres.Radius + i, n);
+        for (int v = 0; v < PEZ_CULL_VECTORS; v++) {
+            pass[v] = ~(pezMask) { 0 };
+            for (int p = 0; p < 6; p++) {
+                const float* plane = frustum->Planes[p];
+                pezFloats distance = x[v] * plane[0] + y[v] * plane[1] + z[v] * plane[2] + plane[3];
+                pass[v] &= distance > -radius[v];
+            }
+        }
+        count += __pez__Emit(pass, i, n, visible + count);
+    }
+    return count;
+}
+
+// A box touches a plane's inner side when its center is closer to the outside
+// than the extent projected onto the plane's normal.
+int pezCullBoxRange(const PezFrustum* frustum, PezBoxes boxes, int begin, int end, int* visible)
+{
+    int count = 0;
+    for (int i = begin; i < end; i += PEZ_CULL_BATCH) {
+        int n = end - i < PEZ_CULL_BATCH ? end - i : PEZ_CULL_BATCH;
+        pezFloats x[PEZ_CULL_VECTORS], y[PEZ_CULL_VECTORS], z[PEZ_CULL_VECTORS];
+        pezFloats ex[PEZ_CULL_VECTORS], ey[PEZ_CULL_VECTORS], ez[PEZ_CULL_VECTORS];
+        pezMask pass[PEZ_CULL_VECTORS];
+        __pez__Load(x, boxes.X + i, n);
+        __pez__Load(y, boxes.Y + i, n);
+        __pez__Load(z, boxes.Z + i, n);
+        __pez__Load(ex, boxes.ExtentX + i, n);
+        __pez__Load(ey, boxes.ExtentY + i, n);
+        __pez__Load(ez, boxes.ExtentZ + i, n);
+        for (int v = 0; v < PEZ_CULL_VECTORS; v++) {
+            pass[v] = ~(pezMask) { 0 };
+            for (int p = 0; p < 6; p++) {
+                const float* plane = frustum->Planes[p];
+                pezFloats distance = x[v] * plane[0] + y[v] * plane[1] + z[v] * plane[2] + plane[3];
+                pezFloats reach = ex[v] * fabsf(plane[0]) + ey[v] * fabsf(plane[1]) + ez[v] * fabsf(plane[2]);
+                pass[v] &= distance > -reach;
+            }
+        }
+        count += __pez__Emit(pass, i, n, visible + count);
+    }
+    return count;
+}
+
+// A cluster faces away when the direction from the eye to the apex lies
+// within the cutoff of the axis: dot(normalize(apex - eye), axis) >= cutoff.
+int pezCullConeRange(const float* eye, PezCones cones, int begin, int end, int* visible)
+{
+    int count = 0;
+    for (int i = begin; i < end; i += PEZ_CULL_BATCH) {
+        int n = end - i < PEZ_CULL_BATCH ? end - i : PEZ_CULL_BATCH;
+        pezFloats x[PEZ_CULL_VECTORS], y[PEZ_CULL_VECTORS], z[PEZ_CULL_VECTORS];
+        pezFloats ax[PEZ_CULL_VECTORS], ay[PEZ_CULL_VECTORS], az[PEZ_CULL_VECTORS], cutoff[PEZ_CULL_VECTORS];
+        pezMask pass[PEZ_CULL_VECTORS];
+        __pez__Load(x, cones.X + i, n);
+        __pez__Load(y, cones.Y + i, n);
+        __pez__Load(z, cones.Z + i, n);
+        __pez__Load(ax, cones.AxisX + i, n);
+        __pez__Load(ay, cones.AxisY + i, n);
+        __pez__Load(az, cones.AxisZ + i, n);
+        __pez__Load(cutoff, cones.Cutoff + i, n);
+        for (int v = 0; v < PEZ_CULL_VECTORS; v++) {
+            pezFloats dx = x[v] - eye[0], dy = y[v] - eye[1], dz = z[v] - eye[2];
+            pezFloats length = dx * dx + dy * dy + dz * dz;
+            for (int k = 0; k < PEZ_CULL_LANES; k++) {
+                length[k] = sqrtf(length[k]);
+            }
+            pass[v] = dx * ax[v] + dy * ay[v] + dz * az[v] < cutoff[v] * length;
+        }
+        count += __pez__Emit(pass, i, n, visible + count);
+    }
+    return count;
+}
+
+static int __pez__CullSpheres(const void* test, const void* bounds, int begin, int end, int* visible)
+{
+    return pezCullSphereRange((const PezFrustum*) test, *(const PezSpheres*) bounds, begin, end, visible);
+}
+
+static int __pez__CullBoxes(const void* test, const void* bounds, int begin, int end, int* visible)
+{
+    return pezCullBoxRange((const PezFrustum*) test, *(const PezBoxes*) bounds, begin, end, visible);
+}
+
+static int __pez__CullCones(const void* test, const void* bounds, int begin, int end, int* visible)
+{
+    return pezCullConeRange((const float*) test, *(const PezCones*) bounds, begin, end, visible);
+}
+
+static void __pez__CullJob(void* data, int begin, int end)
+{
+    pezCullTask* task = (pezCullTask*) data;
+    task->ChunkCounts[begin / PEZ_CULL_GRAIN] = task->Function(task->Test, task->Bounds, begin, end, task->Visible + begin);
+}
+
+static int __pez__Cull(pezCullFunction function, const void* test, const void* bounds, int count, int* visible)
+{
+    int chunkCount = (count + PEZ_CULL_GRAIN - 1) / PEZ_CULL_GRAIN;
+    int localCounts[64];
+    int visibleCount = 0;
+
+    if (chunkCount <= 1) {
+        return function(test, bounds, 0, count, visible);
+    }
+
+    pezCullTask task = { function, test, bounds, visible, localCounts };
+    if (chunkCount > countof(localCounts)) {
+        task.ChunkCounts = (int*) malloc(chunkCount * sizeof(int));
+        if (!task.ChunkCounts) {
+            return function(test, bounds, 0, count, visible);
+        }
+    }
+    pezParallelFor(count, PEZ_CULL_GRAIN, __pez__CullJob, &task);
+
+    // Each chunk's list starts at or after the end of the packed ones, so
+    // moving them in order never overwrites a list that's still to move.
+    for (int chunk = 0; chunk < chunkCount; chunk++) {
+        memmove(visible + visibleCount, visible + chunk * PEZ_CULL_GRAIN, task.ChunkCounts[chunk] * sizeof(int));
+        visibleCount += task.ChunkCounts[chunk];
+    }
+
+    if (task.ChunkCounts != localCounts) {
+        free(task.ChunkCounts);
+    }
+    return visibleCount;
+}
+
+int pezCullSpheres(const PezFrustum* frustum, PezSpheres spheres, int* visible)
+{
+    return __pez__Cull(__pez__CullSpheres, frustum, &spheres, spheres.Count, visible);
+}
+
+int pezCullBoxes(const PezFrustum* frustum, PezBoxes boxes, int* visible)
+{
+    return __pez__Cull(__pez__CullBoxes, frustum, &boxes, boxes.Count, visible);
+}
+
+int pezCullCones(const float* eye, PezCones cones, int* visible)
+{
+    return __pez__Cull(__pez__CullCones, eye, &cones, cones.Count, visible);
+}
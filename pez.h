@@ -101,6 +101,371 @@ void pezSavePixels(PezPixels pixels, const char* filename);
 void pezRenderText(PezPixels pixels, const char* message);
 PezPixels pezGenNoise(PezPixels desc, float alpha, float beta, int n);
 
+// Loads a PNG into a new GL_TEXTURE_2D and leaves it bound, with the bottom row
+// first if flipRows is set.  Grey, grey-alpha, RGB and RGBA images keep their 8
+// or 16 bits per channel; palettes become RGBA and lower bit depths 8 bits.
+// Filtering, wrapping and mipmaps are left to the caller.
+GLuint pezLoadTexture(const char* filename, bool flipRows);
+
+// Asynchronous versions of pezLoadTexture and pezLoadPixels.  Files are read
+// and decoded by jobs; textures are then created by a main-thread job, which
+// pez runs between frames.  Poll a handle with pezIsAssetReady, or get its
+// result with pezGetAssetTexture or pezGetAssetPixels, which wait for it
+// (running jobs meanwhile).  pezFreeAsset frees the handle but not the
+// texture or pixels it loaded.
+typedef struct PezAssetRec* PezAsset;
+
+PezAsset pezLoadTextureAsync(const char* filename, bool flipRows);
+PezAsset pezLoadPixelsAsync(const char* filename);
+bool pezIsAssetReady(PezAsset asset);
+void pezWaitAsset(PezAsset asset);
+GLuint pezGetAssetTexture(PezAsset asset);
+PezPixels pezGetAssetPixels(PezAsset asset);
+void pezFreeAsset(PezAsset asset);
+
+#define PEZ_MAX_ATTACHMENTS 4
+
+typedef struct PezTargetDescRec {
+    GLsizei Width;   // zero means the window width divided by Divisor
+    GLsizei Height;  // zero means the window height divided by Divisor
+    int Divisor;
+    GLenum ColorFormats[PEZ_MAX_ATTACHMENTS]; // GL_NONE terminates the list
+    GLenum DepthFormat;
+    GLenum Filter;
+} PezTargetDesc;
+
+typedef struct PezTargetRec {
+    PezTargetDesc Desc;
+    GLsizei Width;
+    GLsizei Height;
+    GLuint Fbo;
+    GLuint ColorTextures[PEZ_MAX_ATTACHMENTS];
+    GLuint DepthBuffer;
+} PezTarget;
+
+PezTarget* pezAcquireTarget(PezTargetDesc desc);
+void pezReleaseTarget(PezTarget* target);
+void pezResizeTargets(int windowWidth, int windowHeight);
+void pezCollectTargets();
+GLsizeiptr pezGetTargetMemory();
+
+// pezClearTarget binds a target's framebuffer and clears each of its color
+// attachments to the next four values.  pezComputePsnr compares a target's
+// first attachment with the same-sized corner of the window, each clamped
+// to [0, 1], and returns the peak signal-to-noise ratio in decibels, or 99
+// if they match.
+void pezClearTarget(PezTarget* target, const GLfloat* values);
+float pezComputePsnr(const PezTarget* reference);
+
+// Glyph tables are written by BakeFont alongside a signed-distance atlas.
+// The file starts with the first eight fields of PezGlyphs, 32 bits each and
+// in order, and the glyphs follow.  Text shaders that hold the glyph table in
+// uniform arrays size them for PEZ_MAX_GLYPHS glyphs.
+#define PEZ_GLYPHS_HEADER_SIZE 32
+#define PEZ_MAX_GLYPHS 96
+
+typedef struct PezGlyphRec {
+    GLushort X, Y;          // top-left of the glyph in the atlas, in texels
+    GLushort Width, Height; // size in the atlas, in texels; zero for blank glyphs
+    GLshort Left, Top;      // offset from the top-left of the cell, in font pixels
+} PezGlyph;
+
+typedef struct PezGlyphsRec {
+    int GlyphCount;
+    int FirstCharacter;
+    GLsizei CellWidth;      // in font pixels
+    GLsizei CellHeight;
+    GLsizei AtlasWidth;
+    GLsizei AtlasHeight;
+    int Resolution;         // atlas texels per font pixel
+    float Spread;           // distance in font pixels that spans 0.5 in the atlas
+    PezGlyph* Glyphs;
+    void* RawHeader;
+} PezGlyphs;
+
+PezGlyphs pezLoadGlyphs(const char* filename);
+void pezFreeGlyphs(PezGlyphs glyphs);
+
+// Text drawn with pezDrawText is batched into a streaming vertex buffer and
+// submitted with a single GL_POINTS draw by pezFlushText, using whatever
+// program is current.  Each point carries the label origin in pixels at
+// attribute 0 (vec2) and (character, column, row, 0) at attribute 1 (uvec4).
+// A batch that outgrows the buffer is flushed early by pezDrawText, so the
+// text program should be current while drawing text, too.  Neither function
+// changes the vertex array or array buffer that is bound.
+#define PEZ_TEXT_ORIGIN 0
+#define PEZ_TEXT_GLYPH 1
+
+void pezDrawText(float x, float y, const char* fmt, ...);
+void pezFlushText();
+
+// Jobs run on a work-stealing pool of one thread per core, counting the main
+// thread, which is started by the first job or by pezStartJobs.  A job gets
+// the range [begin, end) it should process; single jobs get [0, 1).  Each
+// thread queues up to 4096 jobs and runs any more right away, as it submits
+// them.
+//
+// Jobs may only be submitted, and counters waited on, from the main thread
+// and from jobs.  Any other thread would share the main thread's queue, which
+// only one thread may push to, so the main thread is the only submitter from
+// outside the pool.  Other threads can hand work over with
+// pezRunMainThreadJob, which is safe from any thread.
+//
+// A counter, zero-initialized, is raised by each job submitted with it and
+// lowered when the job finishes.  pezWaitCounter runs other jobs until it
+// drops to zero, and pezRunJobAfter holds a job back until it does.  Jobs
+// that need the GL context go to pezRunMainThreadJob; they run from
+// pezRunMainThreadJobs, which pez calls between frames, and from
+// pezWaitCounter on the main thread.
+#define PEZ_MAX_THREADS 16
+
+typedef void (*PezJobFunction)(void* data, int begin, int end);
+
+typedef struct PezCounterRec {
+    int Value;
+    int Releasing;
+    void* Parked;
+} PezCounter;
+
+void pezStartJobs(int threadCount);     // zero means one per core
+void pezStopJobs();
+int pezGetJobThreadCount();
+int pezGetJobThreadIndex();             // zero on the main thread
+void pezRunJob(PezJobFunction function, void* data, PezCounter* counter);
+void pezRunJobAfter(PezCounter* dependency, PezJobFunction function, void* data, PezCounter* counter);
+void pezParallelFor(int count, int grain, PezJobFunction function, void* data);
+void pezRunMainThreadJob(PezJobFunction function, void* data, PezCounter* counter);
+void pezRunMainThreadJobs();
+void pezWaitCounter(PezCounter* counter);
+bool pezIsCounterDone(PezCounter* counter);
+
+// A demo can have PezUpdate for the next frame run on a job thread while
+// PezRender draws the current one.  To opt in, register every struct that
+// PezUpdate writes and PezRender reads with pezDoubleBuffer at the end of
+// PezInitialize, and have PezRender read them through pezGetRenderState,
+// which gives a snapshot taken before PezUpdate was started.  PezUpdate then
+// must not make GL calls, and PezRender must not write the registered state.
+// pez calls PezUpdate once more before the first frame, so that the first
+// snapshot isn't the state PezInitialize left.  The update is a pool job: with
+// a single core there is no worker to take it, and it runs on the main thread
+// at the start of the next frame, when pez waits for it, so it doesn't
+// overlap PezRender.
+void pezDoubleBuffer(void* state, size_t size);
+const void* pezGetRenderState(const void* state);
+
+// For the platform layer, to support pezDoubleBuffer:
+bool pezIsUpdateThreaded();
+void pezSnapshotFrameState();
+
+// Uniform blocks for a frame go into a ring buffer: pezWriteUniforms copies a
+// block in, or pezMapUniforms returns space to fill, along with the range to
+// bind it from.  Once the frame's blocks are written, pezCommitUniforms makes
+// them visible, and each draw binds its ranges with pezBindUniforms, one call
+// per block.  Blocks can't be written between the commit and the frame's last
+// draw.  The ring grows by itself when the first block of a frame doesn't fit;
+// pezReserveUniforms sizes it up front for frames that write many blocks.
+typedef struct PezUniformsRec {
+    GLintptr Offset;
+    GLsizeiptr Size;
+} PezUniforms;
+
+void pezReserveUniforms(GLsizeiptr bytesPerFrame);
+void* pezMapUniforms(GLsizeiptr size, PezUniforms* range);
+PezUniforms pezWriteUniforms(const void* data, GLsizeiptr size);
+void pezCommitUniforms();
+void pezBindUniforms(GLuint binding, PezUniforms range);
+
+// The std140 layout of the transforms block that the lit demos share:
+//
+//     layout(std140, binding = 0) uniform Transforms
+//     {
+//         mat4 Projection;
+//         mat4 ViewMatrix;
+//         mat4 ModelMatrix;
+//         mat4 Modelview;
+//         mat3 NormalMatrix;
+//     };
+//
+// pezPackTransforms fills it from column-major matrices, deriving Modelview
+// and, from its upper 3x3, NormalMatrix.
+typedef struct PezTransformsRec {
+    GLfloat Projection[16];
+    GLfloat ViewMatrix[16];
+    GLfloat ModelMatrix[16];
+    GLfloat Modelview[16];
+    GLfloat NormalMatrix[12];   // each column padded to a vec4
+} PezTransforms;
+
+void pezPackTransforms(PezTransforms* transforms, const float* projection, const float* view, const float* model);
+
+// Command lists let jobs record draws without the GL context.  Each job thread
+// records into its own buffer, which pezBeginCommands hands out with nothing
+// bound; the program, vertex array and uniform blocks set on it stick until
+// changed, and every draw captures them.  Uniform data is copied when it's
+// set.  pezSubmitCommands, on the main thread once recording is done, sorts
+// the draws of all threads by program and vertex array, copies their uniform
+// blocks into the uniform ring and commits it, replays the draws, and returns
+// how many there were; draws of the same state keep the order that each
+// thread recorded them in.  It leaves the last program and vertex array bound.
+typedef struct PezCommandListRec* PezCommandList;
+typedef struct PezCommandBufferRec PezCommandBuffer;
+
+PezCommandList pezCreateCommandList();
+void pezDestroyCommandList(PezCommandList list);
+PezCommandBuffer* pezBeginCommands(PezCommandList list);
+void pezCmdBindProgram(PezCommandBuffer* buffer, GLuint program);
+void pezCmdBindVertexArray(PezCommandBuffer* buffer, GLuint vao);
+void pezCmdSetUniforms(PezCommandBuffer* buffer, GLuint binding, const void* data, GLsizeiptr size);  // binding < 4
+void pezCmdDrawElements(PezCommandBuffer* buffer, GLenum mode, GLsizei count, GLenum type, GLsizeiptr offset);
+void pezCmdDrawArrays(PezCommandBuffer* buffer, GLenum mode, GLint first, GLsizei count);
+int pezSubmitCommands(PezCommandList list);
+
+// Culling tests bounds against a frustum, PEZ_CULL_BATCH at a time, and
+// writes the indices of those that pass to a compact list, in increasing
+// order, returning how many there are.  The list is written without
+// branching, storing each tested index whether it passes or not, so it needs
+// room for every tested index, not just the visible ones: Count entries for
+// the pezCull* functions, and end - begin for the pezCull*Range functions,
+// which write from visible[0].
+// pezExtractFrustum takes the planes from a column-major view-projection
+// matrix, such as vmath's projection times modelview cast to float*; bounds
+// must then be in the space that matrix transforms from.  Spheres and boxes
+// pass when they touch the frustum.  Normal cones, which bound the facing of
+// a cluster of triangles, pass unless every triangle faces away from the eye;
+// cutoff is the cosine of the cone's half-angle plus 90 degrees.  Bounds are
+// stored structure-of-arrays, either in caller-owned arrays or allocated by
+// the pezCreate* functions, which round up to whole batches and align them,
+// and give a count of zero when out of memory.
+// The pezCull* functions split the test over the job threads; the
+// pezCull*Range functions test [begin, end) on the calling thread, for jobs.
+#define PEZ_CULL_BATCH 8
+
+typedef struct PezFrustumRec {
+    float Planes[6][4];         // (a, b, c, d), pointing inwards, normalized
+} PezFrustum;
+
+typedef struct PezSpheresRec {
+    int Count;
+    float* X;
+    float* Y;
+    float* Z;
+    float* Radius;
+} PezSpheres;
+
+typedef struct PezBoxesRec {
+    int Count;
+    float* X;                   // centers
+    float* Y;
+    float* Z;
+    float* ExtentX;             // half sizes
+    float* ExtentY;
+    float* ExtentZ;
+} PezBoxes;
+
+typedef struct PezConesRec {
+    int Count;
+    float* X;                   // apexes
+    float* Y;
+    float* Z;
+    float* AxisX;
+    float* AxisY;
+    float* AxisZ;
+    float* Cutoff;
+} PezCones;
+
+void pezExtractFrustum(PezFrustum* frustum, const float* viewProjection);
+PezSpheres pezCreateSpheres(int count);
+PezBoxes pezCreateBoxes(int count);
+PezCones pezCreateCones(int count);
+void pezFreeSpheres(PezSpheres spheres);
+void pezFreeBoxes(PezBoxes boxes);
+void pezFreeCones(PezCones cones);
+int pezCullSpheres(const PezFrustum* frustum, PezSpheres spheres, int* visible);
+int pezCullBoxes(const PezFrustum* frustum, PezBoxes boxes, int* visible);
+int pezCullCones(const float* eye, PezCones cones, int* visible);
+int pezCullSphereRange(const PezFrustum* frustum, PezSpheres spheres, int begin, int end, int* visible);
+int pezCullBoxRange(const PezFrustum* frustum, PezBoxes boxes, int begin, int end, int* visible);
+int pezCullConeRange(const float* eye, PezCones cones, int begin, int end, int* visible);
+
+// Instance sets draw many copies of a mesh with one instanced draw.  Fill in
+// the transforms, column-major like vmath's Matrix4, of the first count
+// instances; the set's radius, scaled by the longest axis of each transform,
+// bounds every copy, so transforms must be translate-rotate-scale.
+// pezCullInstances tests the bounding spheres against the frustum of a
+// view-projection matrix on the job threads, packs the transforms of the
+// visible instances into a streaming buffer, and returns how many there are.
+// pezDrawInstances then draws that many copies with the vertex array that is
+// bound, which pezAttachInstances has set up to read the transform as a mat4
+// at four attribute locations, starting at location.
+typedef struct PezInstancesRec* PezInstances;
+
+PezInstances pezCreateInstances(int capacity, float radius);
+void pezDestroyInstances(PezInstances instances);
+GLfloat* pezGetInstanceTransforms(PezInstances instances);     // 16 floats per instance
+void pezSetInstanceCount(PezInstances instances, int count);
+void pezAttachInstances(PezInstances instances, GLuint vao, GLuint location);
+int pezCullInstances(PezInstances instances, const float* viewProjection);
+void pezDrawInstances(PezInstances instances, GLenum mode, GLsizei count, GLenum type, GLsizeiptr offset);
+
+// Meshlets split an indexed triangle list into clusters of at most
+// PEZ_MESHLET_VERTICES vertices and PEZ_MESHLET_TRIANGLES triangles, grown
+// from neighbouring triangles that face alike.  pezBuildMeshlets reorders
+// the indices in place so that each cluster's triangles are contiguous;
+// upload them afterwards.  Positions are three floats at the given stride in
+// bytes; for PezVerts, pass attribute 0 and the verts' indices.  Triangles
+// must wind counter-clockwise seen from the front.  pezCullMeshlets tests
+// each cluster's bounding sphere against the frustum of a model-view-
+// projection matrix and, if eye is not null, its normal cone against the eye
+// position in model space, then returns how many triangles are left.
+// pezDrawMeshlets draws those with one multi-draw, from the element array
+// buffer of the vertex array that is bound.
+#define PEZ_MESHLET_VERTICES 64
+#define PEZ_MESHLET_TRIANGLES 124
+
+typedef struct PezMeshletsRec* PezMeshlets;
+
+PezMeshlets pezBuildMeshlets(const GLfloat* positions, GLsizei stride, int vertexCount,
+                             GLvoid* indices, GLenum indexType, int indexCount);
+void pezDestroyMeshlets(PezMeshlets meshlets);
+int pezGetMeshletCount(PezMeshlets meshlets);
+int pezCullMeshlets(PezMeshlets meshlets, const float* modelViewProjection, const float* eye);
+void pezDrawMeshlets(PezMeshlets meshlets);
+
+// Parametric surfaces are tessellated into chains of levels of detail, each
+// with half the slices and stacks of the one before, down to three of each.
+// The surface function maps (s, t) in [0, 1) x [0, 1) to a position, and must
+// wrap in both directions, like a torus.  Every level goes into one vertex
+// array, with the position at attribute 0 and the normal at attribute 1
+// (three floats each), and counter-clockwise front faces where the normal
+// follows the derivatives in s and t.  Each level records its error, the
+// furthest its flat triangles stray from the surface, in model units.
+//
+// pezSelectLod picks a level for an object at the given distance from the
+// eye, given pixelScale, the viewport height over twice the tangent of half
+// the vertical field of view.  It takes the finest level with at most one
+// triangle per pixelsPerTriangle of the pixels the object's bounding sphere
+// covers, which holds triangles per covered pixel constant with distance,
+// unless a coarser level's error still projects to at most maxPixelError
+// pixels.  It returns the level plus how far the next, coarser level has come
+// towards being picked, from zero to one, which can drive a cross-fade.
+// pezDrawLod binds the chain's vertex array and draws a level.
+#define PEZ_MAX_LODS 8
+
+typedef void (*PezSurfaceFunction)(const void* context, float s, float t, float* position);
+typedef struct PezLodsRec* PezLods;
+
+PezLods pezGenSurface(PezSurfaceFunction surface, const void* context, int slices, int stacks, int levelCount);
+PezLods pezGenTorus(float major, float minor, int slices, int stacks, int levelCount);
+PezLods pezGenTrefoil(int slices, int stacks, int levelCount);
+void pezDestroyLods(PezLods lods);
+int pezGetLodCount(PezLods lods);
+int pezGetLodTriangles(PezLods lods, int level);
+float pezGetLodError(PezLods lods, int level);
+float pezGetLodRadius(PezLods lods);            // of a sphere around the origin
+float pezSelectLod(PezLods lods, float distance, float pixelScale, float pixelsPerTriangle,
+                   float maxPixelError);
+void pezDrawLod(PezLods lods, int level);
+
 // For internal use, to support pezGetShader:
 int pezSwInit(const char* keyPrefix);
 int pezSwShutdown();
@@ -0,0 +1,382 @@
+// Pez was developed by Philip Rideout and released under the MIT License.
+//
+// Work-stealing job scheduler.  The main thread and every worker own a
+// Chase-Lev deque: a thread pushes and pops jobs at the bottom of its own
+// deque and, when that runs dry, steals from the top of someone else's.
+// Counters track completion: every job submitted with a counter increments
+// it, and decrements it after running.  Jobs that wait on a counter are
+// parked on it and pushed when it drops to zero.  Jobs that need the GL
+// context go on a separate queue that only the main thread drains.
+//
+// Threads outside the pool have index zero, like the main thread, and would
+// push to its deque, so only the main thread may submit from outside.
+//
+// This file has no dependencies beyond pthreads so tools can link it alone.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "pez.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define PEZ_DEQUE_SIZE 4096     // power of two; a thread with a full deque runs new jobs itself
+#define PEZ_IDLE_SPINS 64       // failed steals before a worker goes to sleep
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+#define RELAXED_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define RELAXED_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+typedef struct pezJobRec
+{
+    PezJobFunction Function;
+    void* Data;
+    int Begin;
+    int End;
+    PezCounter* Counter;
+} pezJob;
+
+typedef struct pezParkedJobRec
+{
+    pezJob Job;
+    struct pezParkedJobRec* Next;
+} pezParkedJob;
+
+typedef struct pezDequeRec
+{
+    long Top;                   // thieves take from here
+    char Padding[64];           // keep the owner's end on another cache line
+    long Bottom;                // the owner pushes and pops here
+    pezJob Jobs[PEZ_DEQUE_SIZE];
+} pezDeque;
+
+typedef struct pezSchedulerRec
+{
+    int ThreadCount;            // including the main thread; zero until started
+    int Queued;                 // jobs sitting in deques
+    int Sleeping;               // workers waiting for Wake
+    int Quit;
+    pthread_mutex_t Lock;       // for sleeping and for the main-thread queue
+    pthread_cond_t Wake;
+    pezParkedJob* MainHead;
+    pezParkedJob* MainTail;
+    pthread_t Threads[PEZ_MAX_THREADS];
+    pezDeque Deques[PEZ_MAX_THREADS];
+} pezScheduler;
+
+static pezScheduler __pez__Scheduler = { 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+static __thread int __pez__ThreadIndex;     // zero on the main thread
+
+// Thieves may read a slot while the owner is writing it; they then fail to
+// claim it and drop what they read.  Going through relaxed atomics keeps that
+// race well-defined.
+static void __pez__StoreJob(pezJob* slot, const pezJob* job)
+{
+    RELAXED_STORE(slot->Function, job->Function);
+    RELAXED_STORE(slot->Data, job->Data);
+    RELAXED_STORE(slot->Begin, job->Begin);
+    RELAXED_STORE(slot->End, job->End);
+    RELAXED_STORE(slot->Counter, job->Counter);
+}
+
+static void __pez__LoadJob(pezJob* job, pezJob* slot)
+{
+    job->Function = RELAXED_LOAD(slot->Function);
+    job->Data = RELAXED_LOAD(slot->Data);
+    job->Begin = RELAXED_LOAD(slot->Begin);
+    job->End = RELAXED_LOAD(slot->End);
+    job->Counter = RELAXED_LOAD(slot->Counter);
+}
+
+static int __pez__DequePush(pezDeque* deque, const pezJob* job)
+{
+    long bottom = RELAXED_LOAD(deque->Bottom);
+    long top = __atomic_load_n(&deque->Top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= PEZ_DEQUE_SIZE) {
+        return 0;
+    }
+    __pez__StoreJob(&deque->Jobs[bottom & (PEZ_DEQUE_SIZE - 1)], job);
+    __atomic_store_n(&deque->Bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int __pez__DequePop(pezDeque* deque, pezJob* job)
+{
+    long bottom = RELAXED_LOAD(deque->Bottom) - 1;
+    RELAXED_STORE(deque->Bottom, bottom);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = RELAXED_LOAD(deque->Top);
+    if (top > bottom) {
+        RELAXED_STORE(deque->Bottom, bottom + 1);
+        return 0;
+    }
+    __pez__LoadJob(job, &deque->Jobs[bottom & (PEZ_DEQUE_SIZE - 1)]);
+    if (top == bottom) {
+        // Last job: race the thieves for it.
+        int won = __atomic_compare_exchange_n(&deque->Top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        RELAXED_STORE(deque->Bottom, bottom + 1);
+        return won;
+    }
+    return 1;
+}
+
+static int __pez__DequeSteal(pezDeque* deque, pezJob* job)
+{
+    long top = __atomic_load_n(&deque->Top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&deque->Bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return 0;
+    }
+    __pez__LoadJob(job, &deque->Jobs[top & (PEZ_DEQUE_SIZE - 1)]);
+    return __atomic_compare_exchange_n(&deque->Top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static void __pez__Execute(const pezJob* job);
+
+static void __pez__Push(const pezJob* job)
+{
+    pezScheduler* scheduler = &__pez__Scheduler;
+    if (!__pez__DequePush(&scheduler->Deques[__pez__ThreadIndex], job)) {
+        __pez__Execute(job);
+        return;
+    }
+    __atomic_add_fetch(&scheduler->Queued, 1, __ATOMIC_SEQ_CST);
+    if (LOAD(scheduler->Sleeping)) {
+        pthread_mutex_lock(&scheduler->Lock);
+        pthread_cond_signal(&scheduler->Wake);
+        pthread_mutex_unlock(&scheduler->Lock);
+    }
+}
+
+static int __pez__FindJob(pezJob* job)
+{
+    pezScheduler* scheduler = &__pez__Scheduler;
+    int self = __pez__ThreadIndex, count = LOAD(scheduler->ThreadCount);
+    int found = __pez__DequePop(&scheduler->Deques[self], job);
+    for (int i = 1; !found && i < count; i++) {
+        found = __pez__DequeSteal(&scheduler->Deques[(self + i) % count], job);
+    }
+    if (found) {
+        __atomic_sub_fetch(&scheduler->Queued, 1, __ATOMIC_SEQ_CST);
+    }
+    return found;
+}
+
+// Releasing stays raised until the counter is no longer touched, so that a
+// waiter doesn't return, and free the counter, while parked jobs are pushed.
+static void __pez__Release(PezCounter* counter)
+{
+    __atomic_add_fetch(&counter->Releasing, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_sub_fetch(&counter->Value, 1, __ATOMIC_SEQ_CST)) {
+        pezParkedJob* parked = (pezParkedJob*) __atomic_exchange_n(&counter->Parked, 0, __ATOMIC_SEQ_CST);
+        while (parked) {
+            pezParkedJob* next = parked->Next;
+            __pez__Push(&parked->Job);
+            free(parked);
+            parked = next;
+        }
+    }
+    __atomic_sub_fetch(&counter->Releasing, 1, __ATOMIC_SEQ_CST);
+}
+
+static void __pez__Execute(const pezJob* job)
+{
+    job->Function(job->Data, job->Begin, job->End);
+    if (job->Counter) {
+        __pez__Release(job->Counter);
+    }
+}
+
+static void* __pez__WorkerThread(void* index)
+{
+    pezScheduler* scheduler = &__pez__Scheduler;
+    int spins = 0;
+    pezJob job;
+
+    __pez__ThreadIndex = (int) (size_t) index;
+    while (!LOAD(scheduler->Quit)) {
+        if (__pez__FindJob(&job)) {
+            __pez__Execute(&job);
+            spins = 0;
+        } else if (++spins < PEZ_IDLE_SPINS) {
+            sched_yield();
+        } else {
+            pthread_mutex_lock(&scheduler->Lock);
+            __atomic_add_fetch(&scheduler->Sleeping, 1, __ATOMIC_SEQ_CST);
+            while (!LOAD(scheduler->Quit) && !LOAD(scheduler->Queued)) {
+                pthread_cond_wait(&scheduler->Wake, &scheduler->Lock);
+            }
+            __atomic_sub_fetch(&scheduler->Sleeping, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&scheduler->Lock);
+            spins = 0;
+        }
+    }
+    return 0;
+}
+
+void pezStartJobs(int threadCount)
+{
+    pezScheduler* scheduler = &__pez__Scheduler;
+    if (LOAD(scheduler->ThreadCount)) {
+        return;
+    }
+    if (threadCount <= 0) {
+        threadCount = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    threadCount = threadCount < 1 ? 1 : (threadCount > PEZ_MAX_THREADS ? PEZ_MAX_THREADS : threadCount);
+
+    // Workers read the count as soon as they start, so set it first and
+    // lower it if some thread can't be created.
+    STORE(scheduler->Quit, 0);
+    STORE(scheduler->ThreadCount, threadCount);
+    for (int i = 1; i < threadCount; i++) {
+        if (pthread_create(&scheduler->Threads[i], 0, __pez__WorkerThread, (void*) (size_t) i)) {
+            STORE(scheduler->ThreadCount, i);
+            break;
+        }
+    }
+}
+
+void pezStopJobs()
+{
+    pezScheduler* scheduler = &__pez__Scheduler;
+    pthread_mutex_lock(&scheduler->Lock);
+    STORE(scheduler->Quit, 1);
+    pthread_cond_broadcast(&scheduler->Wake);
+    pthread_mutex_unlock(&scheduler->Lock);
+    for (int i = 1; i < scheduler->ThreadCount; i++) {
+        pthread_join(scheduler->Threads[i], 0);
+    }
+    STORE(scheduler->ThreadCount, 0);
+}
+
+int pezGetJobThreadCount()
+{
+    pezStartJobs(0);
+    return LOAD(__pez__Scheduler.ThreadCount);
+}
+
+int pezGetJobThreadIndex()
+{
+    return __pez__ThreadIndex;
+}
+
+void pezRunJob(PezJobFunction function, void* data, PezCounter* counter)
+{
+    pezJob job = { function, data, 0, 1, counter };
+    pezStartJobs(0);
+    if (counter) {
+        __atomic_add_fetch(&counter->Value, 1, __ATOMIC_SEQ_CST);
+    }
+    __pez__Push(&job);
+}
+
+void pezRunJobAfter(PezCounter* dependency, PezJobFunction function, void* data, PezCounter* counter)
+{
+    pezParkedJob* parked = (pezParkedJob*) malloc(sizeof(pezParkedJob));
+    pezJob job = { function, data, 0, 1, counter };
+    pezStartJobs(0);
+    if (counter) {
+        __atomic_add_fetch(&counter->Value, 1, __ATOMIC_SEQ_CST);
+    }
+    if (!parked) {
+        pezWaitCounter(dependency);
+        __pez__Push(&job);
+        return;
+    }
+
+    // Hold the dependency open while parking on it, so that whoever drops it
+    // to zero, possibly this thread, sees the parked job.
+    __atomic_add_fetch(&dependency->Value, 1, __ATOMIC_SEQ_CST);
+    parked->Job = job;
+    parked->Next = (pezParkedJob*) LOAD(dependency->Parked);
+    while (!__atomic_compare_exchange_n(&dependency->Parked, (void**) &parked->Next, (void*) parked, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    }
+    __pez__Release(dependency);
+}
+
+void pezParallelFor(int count, int grain, PezJobFunction function, void* data)
+{
+    PezCounter counter = { 0, 0, 0 };
+    pezStartJobs(0);
+    grain = grain < 1 ? 1 : grain;
+    __atomic_add_fetch(&counter.Value, (count + grain - 1) / grain, __ATOMIC_SEQ_CST);
+    for (int begin = 0; begin < count; begin += grain) {
+        pezJob job = { function, data, begin, begin + grain < count ? begin + grain : count, &counter };
+        __pez__Push(&job);
+    }
+    pezWaitCounter(&counter);
+}
+
+void pezRunMainThreadJob(PezJobFunction function, void* data, PezCounter* counter)
+{
+    pezScheduler* scheduler = &__pez__Scheduler;
+    pezParkedJob* parked = (pezParkedJob*) malloc(sizeof(pezParkedJob));
+    pezJob job = { function, data, 0, 1, counter };
+    if (!parked) {
+        abort();
+    }
+    if (counter) {
+        __atomic_add_fetch(&counter->Value, 1, __ATOMIC_SEQ_CST);
+    }
+    parked->Job = job;
+    parked->Next = 0;
+    pthread_mutex_lock(&scheduler->Lock);
+    if (scheduler->MainTail) {
+        scheduler->MainTail->Next = parked;
+    } else {
+        scheduler->MainHead = parked;
+    }
+    scheduler->MainTail = parked;
+    pthread_mutex_unlock(&scheduler->Lock);
+}
+
+static int __pez__RunMainThreadJob()
+{
+    pezScheduler* scheduler = &__pez__Scheduler;
+    pthread_mutex_lock(&scheduler->Lock);
+    pezParkedJob* parked = scheduler->MainHead;
+    if (parked) {
+        scheduler->MainHead = parked->Next;
+        if (!scheduler->MainHead) {
+            scheduler->MainTail = 0;
+        }
+    }
+    pthread_mutex_unlock(&scheduler->Lock);
+    if (!parked) {
+        return 0;
+    }
+    __pez__Execute(&parked->Job);
+    free(parked);
+    return 1;
+}
+
+void pezRunMainThreadJobs()
+{
+    while (__pez__RunMainThreadJob()) {
+    }
+}
+
+void pezWaitCounter(PezCounter* counter)
+{
+    pezJob job;
+    while (!pezIsCounterDone(counter)) {
+        if (__pez__ThreadIndex == 0 && __pez__RunMainThreadJob()) {
+            continue;
+        }
+        if (__pez__FindJob(&job)) {
+            __pez__Execute(&job);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+bool pezIsCounterDone(PezCounter* counter)
+{
+    return LOAD(counter->Value) == 0 && LOAD(counter->Releasing) == 0;
+}
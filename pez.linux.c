@@ -32,6 +32,11 @@ typedef struct PlatformContextRec
     Window MainWindow;
 } PlatformContext;
 
+static void UpdateJob(void* seconds, int begin, int end)
+{
+    PezUpdate(*(float*) seconds);
+}
+
 unsigned int GetMicroseconds()
 {
     struct timeval tp;
@@ -195,6 +200,7 @@ int main(int argc, char** argv)
 
     // Perform user-specified intialization
     pezPrintString("OpenGL Version: %s\n", glGetString(GL_VERSION));
+    pezResizeTargets(PezGetConfig().Width, PezGetConfig().Height);
     PezInitialize();
     bstring windowTitle = bmidstr(name, 5, blength(name) - 7);
     XStoreName(context.MainDisplay, context.MainWindow, bdata(windowTitle));
@@ -205,10 +211,22 @@ int main(int argc, char** argv)
     // Start the Game Loop
     // -------------------
 
+    // The first frame renders a snapshot too, so give it an updated one.
+    if (pezIsUpdateThreaded()) {
+        PezUpdate(0);
+        pezSnapshotFrameState();
+    }
+
     unsigned int previousTime = GetMicroseconds();
     int done = 0;
+    PezCounter update = { 0, 0, 0 };
+    float updateSeconds = 0;
     while (!done) {
-        
+
+        // With double-buffered state, the previous PezUpdate may still be
+        // running, and the event handlers may touch the same state.
+        pezWaitCounter(&update);
+
         if (glGetError() != GL_NO_ERROR)
             pezFatal("OpenGL error.\n");
 
@@ -223,7 +241,8 @@ int main(int argc, char** argv)
                     break;
                 
                 case ConfigureNotify:
-                    //resize(event.xconfigure.width, event.xconfigure.height);
+                    glViewport(0, 0, event.xconfigure.width, event.xconfigure.height);
+                    pezResizeTargets(event.xconfigure.width, event.xconfigure.height);
                     break;
                 
 #ifdef PEZ_MOUSE_HANDLER
@@ -262,12 +281,21 @@ int main(int argc, char** argv)
         unsigned int deltaTime = currentTime - previousTime;
         previousTime = currentTime;
         
-        PezUpdate((float) deltaTime / 1000000.0f);
+        pezRunMainThreadJobs();
+        updateSeconds = (float) deltaTime / 1000000.0f;
+        if (pezIsUpdateThreaded()) {
+            pezSnapshotFrameState();
+            pezRunJob(UpdateJob, &updateSeconds, &update);
+        } else {
+            PezUpdate(updateSeconds);
+        }
 
         PezRender(0);
         glXSwapBuffers(context.MainDisplay, context.MainWindow);
+        pezCollectTargets();
     }
 
+    pezWaitCounter(&update);
     pezSwShutdown();
 
     return 0;
@@ -0,0 +1,375 @@
+// Signed Distance Font Baker
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+//
+// Converts a grid-layout coverage font map (one printable ASCII glyph per
+// cell, starting at the space character) into a packed signed-distance atlas
+// plus a glyph table that pezLoadGlyphs can read:
+//
+//     ./BakeFont -b verasansmono.png 16 6 0 56 256 200
+//
+// writes verasansmono.sdf.png and verasansmono.glyphs.  The optional last
+// four arguments give the region covered by the grid and default to the
+// whole image; -b means the first row of glyphs is at the bottom.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pez.h"
+#include "lodepng.h"
+
+static const int FirstCharacter = 32;
+static const int Spread = 4;         // in source pixels; maps to the full 0..1 range
+static const int Resolution = 1;     // atlas texels per source pixel
+static const int Supersample = 4;    // distance samples per atlas texel, per axis
+static const int AtlasWidth = 256;
+static const int Padding = 1;        // texels between packed glyphs
+static const float Far = 1e20f;
+
+typedef struct {
+    int Left, Top, Right, Bottom;    // cell bounds in the source
+    int InkLeft, InkTop;             // top-left of the cell's ink
+    int InkWidth, InkHeight;         // zero for blank cells
+} GlyphJob;
+
+struct {
+    unsigned char* Source;
+    unsigned SourceWidth;
+    unsigned SourceHeight;
+    unsigned char* Atlas;
+    PezGlyphs Table;
+    GlyphJob* Jobs;
+    int ThreadCount;
+} Globals;
+
+static void FindInk(GlyphJob* job);
+static void PackGlyphs();
+static void* BakeThread(void* arg);
+static void BakeGlyph(int index, float* grid, float* f, float* d, int* v, float* z);
+static void DistanceTransform(float* grid, int width, int height, float* f, float* d, int* v, float* z);
+static void WriteGlyphs(const char* filename);
+
+int main(int argc, char** argv)
+{
+    bool bottomUp = argc > 1 && !strcmp(argv[1], "-b");
+    if (bottomUp) {
+        argc--;
+        argv++;
+    }
+    if (argc != 4 && argc != 8) {
+        fprintf(stderr, "Usage: BakeFont [-b] fontmap.png columns rows [left top width height]\n");
+        return 1;
+    }
+
+    const char* filename = argv[1];
+    int columns = atoi(argv[2]);
+    int rows = atoi(argv[3]);
+
+    unsigned error = LodePNG_decode_file(&Globals.Source, &Globals.SourceWidth,
+                                         &Globals.SourceHeight, filename, 0, 8);
+    if (error) {
+        fprintf(stderr, "error %u: %s\n", error, LodePNG_error_text(error));
+        return 1;
+    }
+
+    int gridLeft = argc == 8 ? atoi(argv[4]) : 0;
+    int gridTop = argc == 8 ? atoi(argv[5]) : 0;
+    int gridWidth = argc == 8 ? atoi(argv[6]) : (int) Globals.SourceWidth;
+    int gridHeight = argc == 8 ? atoi(argv[7]) : (int) Globals.SourceHeight;
+
+    // Find the ink in every cell:
+    PezGlyphs* table = &Globals.Table;
+    table->GlyphCount = columns * rows;
+    table->FirstCharacter = FirstCharacter;
+    table->CellWidth = gridWidth / columns;
+    table->CellHeight = gridHeight / rows;
+    table->Resolution = Resolution;
+    table->Spread = Spread;
+    table->Glyphs = (PezGlyph*) calloc(table->GlyphCount, sizeof(PezGlyph));
+    Globals.Jobs = (GlyphJob*) calloc(table->GlyphCount, sizeof(GlyphJob));
+    for (int i = 0; i < table->GlyphCount; i++) {
+        GlyphJob* job = Globals.Jobs + i;
+        int column = i % columns, row = i / columns;
+        if (bottomUp) {
+            row = rows - 1 - row;
+        }
+        job->Left = gridLeft + column * gridWidth / columns;
+        job->Right = gridLeft + (column + 1) * gridWidth / columns;
+        job->Top = gridTop + row * gridHeight / rows;
+        job->Bottom = gridTop + (row + 1) * gridHeight / rows;
+        FindInk(job);
+    }
+
+    PackGlyphs();
+
+    // Each thread takes every Nth glyph; glyphs are independent so they
+    // write to disjoint parts of the atlas.
+    Globals.ThreadCount = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (Globals.ThreadCount < 1) {
+        Globals.ThreadCount = 1;
+    }
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * Globals.ThreadCount);
+    long* indices = (long*) malloc(sizeof(long) * Globals.ThreadCount);
+    for (int t = 0; t < Globals.ThreadCount; t++) {
+        indices[t] = t;
+        if (pthread_create(&threads[t], 0, BakeThread, &indices[t])) {
+            fprintf(stderr, "Can't start baking thread %d\n", t);
+            exit(1);
+        }
+    }
+    for (int t = 0; t < Globals.ThreadCount; t++) {
+        pthread_join(threads[t], 0);
+    }
+    free(threads);
+    free(indices);
+
+    // Write the atlas and the glyph table next to the source:
+    size_t stem = strlen(filename);
+    if (stem > 4 && !strcmp(filename + stem - 4, ".png")) {
+        stem -= 4;
+    }
+    char* outname = (char*) malloc(stem + 16);
+    sprintf(outname, "%.*s.sdf.png", (int) stem, filename);
+    error = LodePNG_encode_file(outname, Globals.Atlas, table->AtlasWidth, table->AtlasHeight, 0, 8);
+    if (error) {
+        fprintf(stderr, "error %u: %s\n", error, LodePNG_error_text(error));
+        return 1;
+    }
+    printf("Wrote %s (%d x %d) with %d threads\n", outname,
+           table->AtlasWidth, table->AtlasHeight, Globals.ThreadCount);
+    sprintf(outname, "%.*s.glyphs", (int) stem, filename);
+    WriteGlyphs(outname);
+
+    free(outname);
+    free(Globals.Jobs);
+    free(table->Glyphs);
+    free(Globals.Atlas);
+    free(Globals.Source);
+    return 0;
+}
+
+static void FindInk(GlyphJob* job)
+{
+    int left = job->Right, top = job->Bottom, right = job->Left, bottom = job->Top;
+    for (int y = job->Top; y < job->Bottom; y++) {
+        for (int x = job->Left; x < job->Right; x++) {
+            if (Globals.Source[y * Globals.SourceWidth + x] >= 128) {
+                if (x < left) left = x;
+                if (x >= right) right = x + 1;
+                if (y < top) top = y;
+                if (y >= bottom) bottom = y + 1;
+            }
+        }
+    }
+    job->InkLeft = left;
+    job->InkTop = top;
+    job->InkWidth = right > left ? right - left : 0;
+    job->InkHeight = bottom > top ? bottom - top : 0;
+}
+
+// Shelf packing in cell order; the glyphs are all roughly the same height.
+static void PackGlyphs()
+{
+    PezGlyphs* table = &Globals.Table;
+    int x = 0, y = 0, shelfHeight = 0;
+    for (int i = 0; i < table->GlyphCount; i++) {
+        GlyphJob* job = Globals.Jobs + i;
+        PezGlyph* glyph = table->Glyphs + i;
+        if (!job->InkWidth) {
+            continue;
+        }
+        glyph->Width = (job->InkWidth + 2 * Spread) * Resolution;
+        glyph->Height = (job->InkHeight + 2 * Spread) * Resolution;
+        glyph->Left = job->InkLeft - Spread - job->Left;
+        glyph->Top = job->InkTop - Spread - job->Top;
+        if (x + glyph->Width > AtlasWidth) {
+            x = 0;
+            y += shelfHeight + Padding;
+            shelfHeight = 0;
+        }
+        glyph->X = x;
+        glyph->Y = y;
+        x += glyph->Width + Padding;
+        if (glyph->Height > shelfHeight) {
+            shelfHeight = glyph->Height;
+        }
+    }
+
+    table->AtlasWidth = AtlasWidth;
+    table->AtlasHeight = (y + shelfHeight + 3) & ~3;
+    Globals.Atlas = (unsigned char*) calloc(table->AtlasWidth * table->AtlasHeight, 1);
+}
+
+static void* BakeThread(void* arg)
+{
+    int first = (int) *(long*) arg;
+    int maxWidth = 0, maxHeight = 0;
+    for (int i = first; i < Globals.Table.GlyphCount; i += Globals.ThreadCount) {
+        PezGlyph* glyph = Globals.Table.Glyphs + i;
+        if (glyph->Width > maxWidth) maxWidth = glyph->Width;
+        if (glyph->Height > maxHeight) maxHeight = glyph->Height;
+    }
+
+    int width = maxWidth * Supersample, height = maxHeight * Supersample;
+    int longest = width > height ? width : height;
+    float* grid = (float*) malloc(sizeof(float) * width * height * 2);
+    float* f = (float*) malloc(sizeof(float) * longest);
+    float* d = (float*) malloc(sizeof(float) * longest);
+    float* z = (float*) malloc(sizeof(float) * (longest + 1));
+    int* v = (int*) malloc(sizeof(int) * longest);
+
+    for (int i = first; i < Globals.Table.GlyphCount; i += Globals.ThreadCount) {
+        if (Globals.Table.Glyphs[i].Width) {
+            BakeGlyph(i, grid, f, d, v, z);
+        }
+    }
+
+    free(grid);
+    free(f);
+    free(d);
+    free(z);
+    free(v);
+    return 0;
+}
+
+// Bilinear coverage lookup that ignores ink outside the glyph's own cell.
+static float Coverage(const GlyphJob* job, float x, float y)
+{
+    int x0 = (int) floorf(x), y0 = (int) floorf(y);
+    float fx = x - x0, fy = y - y0;
+    float sum = 0;
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 2; i++) {
+            int sx = x0 + i, sy = y0 + j;
+            if (sx < job->Left || sx >= job->Right || sy < job->Top || sy >= job->Bottom) {
+                continue;
+            }
+            float w = (i ? fx : 1 - fx) * (j ? fy : 1 - fy);
+            sum += w * Globals.Source[sy * Globals.SourceWidth + sx];
+        }
+    }
+    return sum / 255.0f;
+}
+
+static void BakeGlyph(int index, float* grid, float* f, float* d, int* v, float* z)
+{
+    const GlyphJob* job = Globals.Jobs + index;
+    const PezGlyph* glyph = Globals.Table.Glyphs + index;
+    const int samplesPerPixel = Resolution * Supersample;
+    const int width = glyph->Width * Supersample;
+    const int height = glyph->Height * Supersample;
+    float* outside = grid;
+    float* inside = grid + width * height;
+
+    // Threshold the upsampled coverage.  The outside grid is zero on ink and
+    // the inside grid is zero off ink, so transforming each one gives the
+    // squared distance to the nearest sample of the opposite kind.
+    float left = job->InkLeft - Spread, top = job->InkTop - Spread;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float sx = left + (x + 0.5f) / samplesPerPixel - 0.5f;
+            float sy = top + (y + 0.5f) / samplesPerPixel - 0.5f;
+            int ink = Coverage(job, sx, sy) >= 0.5f;
+            outside[y * width + x] = ink ? 0 : Far;
+            inside[y * width + x] = ink ? Far : 0;
+        }
+    }
+
+    DistanceTransform(outside, width, height, f, d, v, z);
+    DistanceTransform(inside, width, height, f, d, v, z);
+
+    // Average the signed distance over each atlas texel and encode it so that
+    // 0.5 is the edge and values above 0.5 are inside the glyph.
+    float scale = 1.0f / (Supersample * Supersample);
+    for (int y = 0; y < glyph->Height; y++) {
+        for (int x = 0; x < glyph->Width; x++) {
+            float sum = 0;
+            for (int j = 0; j < Supersample; j++) {
+                for (int i = 0; i < Supersample; i++) {
+                    int s = (y * Supersample + j) * width + x * Supersample + i;
+                    sum += sqrtf(outside[s]) - sqrtf(inside[s]);
+                }
+            }
+            float distance = sum * scale / samplesPerPixel;
+            float value = 0.5f - 0.5f * distance / Spread;
+            value = value < 0 ? 0 : (value > 1 ? 1 : value);
+            int atlasX = glyph->X + x, atlasY = glyph->Y + y;
+            Globals.Atlas[atlasY * Globals.Table.AtlasWidth + atlasX] = (unsigned char) (value * 255 + 0.5f);
+        }
+    }
+}
+
+// Exact squared Euclidean distance transform of a sampled function, from
+// "Distance Transforms of Sampled Functions" (Felzenszwalb and Huttenlocher).
+static void Transform1D(const float* f, float* d, int* v, float* z, int n)
+{
+    int k = 0;
+    v[0] = 0;
+    z[0] = -Far;
+    z[1] = Far;
+    for (int q = 1; q < n; q++) {
+        float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+        while (s <= z[k]) {
+            k--;
+            s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = Far;
+    }
+    k = 0;
+    for (int q = 0; q < n; q++) {
+        while (z[k + 1] < q) {
+            k++;
+        }
+        d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+}
+
+static void DistanceTransform(float* grid, int width, int height, float* f, float* d, int* v, float* z)
+{
+    for (int x = 0; x < width; x++) {
+        for (int y = 0; y < height; y++) {
+            f[y] = grid[y * width + x];
+        }
+        Transform1D(f, d, v, z, height);
+        for (int y = 0; y < height; y++) {
+            grid[y * width + x] = d[y];
+        }
+    }
+    for (int y = 0; y < height; y++) {
+        float* row = grid + y * width;
+        memcpy(f, row, sizeof(float) * width);
+        Transform1D(f, row, v, z, width);
+    }
+}
+
+// Same layout as pezLoadGlyphs expects: the eight header fields, 32 bits
+// each, followed by the glyph array.
+static void WriteGlyphs(const char* filename)
+{
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        fprintf(stderr, "Can't write %s\n", filename);
+        exit(1);
+    }
+    const PezGlyphs* table = &Globals.Table;
+    GLint header[7] = {
+        table->GlyphCount, table->FirstCharacter,
+        table->CellWidth, table->CellHeight,
+        table->AtlasWidth, table->AtlasHeight,
+        table->Resolution };
+    GLfloat spread = table->Spread;
+    fwrite(header, sizeof(GLint), 7, file);
+    fwrite(&spread, sizeof(GLfloat), 1, file);
+    fwrite(Globals.Table.Glyphs, sizeof(PezGlyph), Globals.Table.GlyphCount, file);
+    fclose(file);
+    printf("Wrote %s (%d glyphs)\n", filename, Globals.Table.GlyphCount);
+}
@@ -0,0 +1,152 @@
+// Culling Benchmark
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+//
+// Measures the pez culling library for every thread count from 1 to N
+// (default: the number of cores), on a million bounding spheres, boxes and
+// normal cones scattered around a camera:
+//
+//     ./BenchCull [N]
+//
+// Throughput is in millions of objects per second, in total and per thread.
+// Before the table, the spheres are culled once more by a plain loop that
+// tests one sphere at a time, for comparison; both must find the same ones.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "pez.h"
+#include "vmath.h"
+
+static const int ObjectCount = 1 << 20;
+static const float FieldSize = 200;
+static const double MinimumSeconds = 0.5;   // per measurement
+
+static double GetSeconds();
+static float Random(float low, float high);
+static int CullScalar(const PezFrustum* frustum, PezSpheres spheres, int* visible);
+
+int main(int argc, char** argv)
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    maxThreads = maxThreads < 1 ? 1 : maxThreads;
+
+    PezSpheres spheres = pezCreateSpheres(ObjectCount);
+    PezBoxes boxes = pezCreateBoxes(ObjectCount);
+    PezCones cones = pezCreateCones(ObjectCount);
+    int* visible = (int*) malloc(sizeof(int) * ObjectCount);
+    if (spheres.Count != ObjectCount || boxes.Count != ObjectCount || cones.Count != ObjectCount || !visible) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    srand(1);
+    for (int i = 0; i < ObjectCount; i++) {
+        spheres.X[i] = boxes.X[i] = cones.X[i] = Random(-FieldSize, FieldSize);
+        spheres.Y[i] = boxes.Y[i] = cones.Y[i] = Random(-FieldSize, FieldSize);
+        spheres.Z[i] = boxes.Z[i] = cones.Z[i] = Random(-FieldSize, FieldSize);
+        spheres.Radius[i] = Random(0.5f, 2);
+        boxes.ExtentX[i] = Random(0.5f, 2);
+        boxes.ExtentY[i] = Random(0.5f, 2);
+        boxes.ExtentZ[i] = Random(0.5f, 2);
+        Vector3 axis = V3Normalize((Vector3){Random(-1, 1), Random(-1, 1), Random(-1, 1)});
+        cones.AxisX[i] = axis.x;
+        cones.AxisY[i] = axis.y;
+        cones.AxisZ[i] = axis.z;
+        cones.Cutoff[i] = Random(-1, 0.5f);
+    }
+
+    Point3 eye = {0, 20, 150};
+    Point3 target = {0, 0, 0};
+    Vector3 up = {0, 1, 0};
+    Matrix4 projection = M4MakePerspective(60 * TwoPi / 360, 16.0f / 9.0f, 1, 500);
+    Matrix4 viewProjection = M4Mul(projection, M4MakeLookAt(eye, target, up));
+    PezFrustum frustum;
+    pezExtractFrustum(&frustum, (const float*) &viewProjection);
+    float eyePosition[3] = {eye.x, eye.y, eye.z};
+
+    // One sphere at a time, as a reference:
+    int scalarCount = 0, runs = 0;
+    double start = GetSeconds(), elapsed;
+    do {
+        scalarCount = CullScalar(&frustum, spheres, visible);
+        runs++;
+        elapsed = GetSeconds() - start;
+    } while (elapsed < MinimumSeconds);
+    printf("%d objects, %.1f%% of the spheres visible; one at a time: %.1f M/s\n\n", ObjectCount,
+           100.0 * scalarCount / ObjectCount, runs * (double) ObjectCount / elapsed / 1e6);
+
+    printf("%8s %14s %14s %14s %14s %14s %14s\n", "threads", "spheres M/s", "per thread",
+           "boxes M/s", "per thread", "cones M/s", "per thread");
+
+    for (int threads = 1; threads <= maxThreads; threads++) {
+        pezStartJobs(threads);
+        if (pezGetJobThreadCount() != threads) {
+            fprintf(stderr, "Only %d threads could be started.\n", pezGetJobThreadCount());
+            return 1;
+        }
+
+        double rates[3];
+        for (int test = 0; test < 3; test++) {
+            int count = 0;
+            runs = 0;
+            start = GetSeconds();
+            do {
+                if (test == 0)
+                    count = pezCullSpheres(&frustum, spheres, visible);
+                else if (test == 1)
+                    count = pezCullBoxes(&frustum, boxes, visible);
+                else
+                    count = pezCullCones(eyePosition, cones, visible);
+                runs++;
+                elapsed = GetSeconds() - start;
+            } while (elapsed < MinimumSeconds);
+            rates[test] = runs * (double) ObjectCount / elapsed / 1e6;
+            if (test == 0 && count != scalarCount) {
+                fprintf(stderr, "%d spheres visible, but %d one at a time.\n", count, scalarCount);
+                return 1;
+            }
+        }
+
+        printf("%8d %14.1f %14.1f %14.1f %14.1f %14.1f %14.1f\n", threads, rates[0], rates[0] / threads,
+               rates[1], rates[1] / threads, rates[2], rates[2] / threads);
+        pezStopJobs();
+    }
+
+    pezFreeSpheres(spheres);
+    pezFreeBoxes(boxes);
+    pezFreeCones(cones);
+    free(visible);
+    return 0;
+}
+
+static double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float Random(float low, float high)
+{
+    return low + (high - low) * rand() / (float) RAND_MAX;
+}
+
+static int CullScalar(const PezFrustum* frustum, PezSpheres spheres, int* visible)
+{
+    int count = 0;
+    for (int i = 0; i < spheres.Count; i++) {
+        int inside = 1;
+        for (int p = 0; p < 6 && inside; p++) {
+            const float* plane = frustum->Planes[p];
+            inside = plane[0] * spheres.X[i] + plane[1] * spheres.Y[i] + plane[2] * spheres.Z[i] + plane[3] > -spheres.Radius[i];
+        }
+        if (inside)
+            visible[count++] = i;
+    }
+    return count;
+}
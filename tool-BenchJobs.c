@@ -0,0 +1,114 @@
+// Job System Benchmark
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+//
+// Measures the pez job scheduler for every thread count from 1 to N (default:
+// the number of cores), first its overhead per job, with jobs that do nothing,
+// then its scaling, with a parallel-for over a CPU-bound loop:
+//
+//     ./BenchJobs [N]
+//
+// "submit" pushes single jobs from the main thread and waits for all of them;
+// "parallel-for" splits the same number of empty iterations at grain 1.  The
+// speedup of the CPU-bound loop is relative to one thread.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "pez.h"
+
+static const int EmptyJobs = 1 << 11;       // fits a thread's job queue, so none run at submission
+static const int WorkItems = 1 << 12;
+static const int WorkGrain = 16;
+static const int WorkPerItem = 2000;
+static const double MinimumSeconds = 0.5;   // per measurement
+
+static double GetSeconds();
+static void EmptyJob(void* data, int begin, int end);
+static void WorkJob(void* data, int begin, int end);
+
+int main(int argc, char** argv)
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    maxThreads = maxThreads < 1 ? 1 : maxThreads;
+    float* results = (float*) malloc(sizeof(float) * WorkItems);
+    double baseline = 0;
+
+    printf("%8s %16s %22s %14s %9s\n", "threads", "submit ns/job", "parallel-for ns/job", "work ms", "speedup");
+
+    for (int threads = 1; threads <= maxThreads; threads++) {
+        pezStartJobs(threads);
+        if (pezGetJobThreadCount() != threads) {
+            fprintf(stderr, "Only %d threads could be started.\n", pezGetJobThreadCount());
+            return 1;
+        }
+
+        // Submitting single empty jobs:
+        int runs = 0;
+        double start = GetSeconds(), elapsed;
+        do {
+            PezCounter counter = { 0, 0, 0 };
+            for (int i = 0; i < EmptyJobs; i++)
+                pezRunJob(EmptyJob, 0, &counter);
+            pezWaitCounter(&counter);
+            runs++;
+            elapsed = GetSeconds() - start;
+        } while (elapsed < MinimumSeconds);
+        double submitCost = elapsed / runs / EmptyJobs * 1e9;
+
+        // Parallel-for over empty iterations:
+        runs = 0;
+        start = GetSeconds();
+        do {
+            pezParallelFor(EmptyJobs, 1, EmptyJob, 0);
+            runs++;
+            elapsed = GetSeconds() - start;
+        } while (elapsed < MinimumSeconds);
+        double forCost = elapsed / runs / EmptyJobs * 1e9;
+
+        // Parallel-for over real work:
+        runs = 0;
+        start = GetSeconds();
+        do {
+            pezParallelFor(WorkItems, WorkGrain, WorkJob, results);
+            runs++;
+            elapsed = GetSeconds() - start;
+        } while (elapsed < MinimumSeconds);
+        double workTime = elapsed / runs * 1e3;
+        if (threads == 1)
+            baseline = workTime;
+
+        printf("%8d %16.1f %22.1f %14.2f %9.2f\n", threads, submitCost, forCost, workTime, baseline / workTime);
+        pezStopJobs();
+    }
+
+    free(results);
+    return 0;
+}
+
+static double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void EmptyJob(void* data, int begin, int end)
+{
+}
+
+// Sums a short series per item, enough to dwarf the scheduling cost.
+static void WorkJob(void* data, int begin, int end)
+{
+    float* results = (float*) data;
+    for (int i = begin; i < end; i++) {
+        float sum = 0;
+        for (int k = 1; k <= WorkPerItem; k++)
+            sum += sinf(i * 0.001f + k) / k;
+        results[i] = sum;
+    }
+}
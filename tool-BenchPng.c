@@ -0,0 +1,222 @@
+// PNG Benchmark
+// Licensed under the Creative Commons Attribution 3.0 Unported License.
+// http://creativecommons.org/licenses/by/3.0/
+//
+// Times lodepng on the given files, separately for the CRCs of all chunks, for
+// the zlib stream of the IDAT chunks (inflate only), for the whole decode to
+// RGBA, and for encoding that RGBA image again:
+//
+//     ./BenchPng [-t] [-l level] [-j threads] *.png
+//
+// -t decodes as a trusted asset, without verifying the CRCs and the Adler-32.
+// -l sets the compression level of the encoder (1 to 9, default 6).
+// -j sets the number of threads the encoder filters and deflates on (default 1).
+// Throughput is in megabytes per second, of file size for the CRCs and of
+// decoded pixels otherwise.  The checksum of the RGBA pixels is printed so that
+// runs against different builds of lodepng can be compared for identical output.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "lodepng.h"
+
+static const double MinimumSeconds = 0.5;   // per file and per measurement
+
+static double GetSeconds();
+static unsigned char* GatherIdat(const unsigned char* png, size_t pngSize, size_t* idatSize);
+static bool CheckCrcs(const unsigned char* png, size_t pngSize);
+static unsigned Checksum(const unsigned char* data, size_t size);
+
+int main(int argc, char** argv)
+{
+    bool trusted = false;
+    unsigned level = LodePNG_defaultCompressSettings.level;
+    unsigned threads = LodePNG_defaultCompressSettings.threads;
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-t")) {
+            trusted = true;
+        } else if (!strcmp(argv[1], "-l") && argc > 2) {
+            level = atoi(argv[2]);
+            argc--;
+            argv++;
+        } else if (!strcmp(argv[1], "-j") && argc > 2) {
+            threads = atoi(argv[2]);
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
+        argc--;
+        argv++;
+    }
+    if (argc < 2 || argv[1][0] == '-') {
+        fprintf(stderr, "Usage: BenchPng [-t] [-l level] [-j threads] file.png [file.png ...]\n");
+        return 1;
+    }
+
+    printf("%-20s %10s %10s %12s %12s %12s %12s %10s  %s\n", "file", "idat", "pixels",
+           "crc MB/s", "inflate MB/s", "decode MB/s", "encode MB/s", "encoded", "checksum");
+
+    for (int f = 1; f < argc; f++) {
+        const char* filename = argv[f];
+        unsigned char* png = 0;
+        size_t pngSize = 0;
+        if (LodePNG_loadFile(&png, &pngSize, filename) || !pngSize) {
+            fprintf(stderr, "%s: can't read file\n", filename);
+            return 1;
+        }
+
+        size_t idatSize;
+        unsigned char* idat = GatherIdat(png, pngSize, &idatSize);
+
+        // Chunk CRCs only:
+        int runs = 0;
+        double start = GetSeconds(), elapsed;
+        do {
+            if (CheckCrcs(png, pngSize)) {
+                fprintf(stderr, "%s: bad CRC\n", filename);
+                return 1;
+            }
+            runs++;
+            elapsed = GetSeconds() - start;
+        } while (elapsed < MinimumSeconds);
+        double crcRate = runs * (double) pngSize / elapsed / 1e6;
+
+        // Inflate only:
+        size_t inflatedSize = 0;
+        runs = 0;
+        start = GetSeconds();
+        do {
+            unsigned char* inflated = 0;
+            inflatedSize = 0;
+            unsigned error = LodePNG_zlib_decompress(&inflated, &inflatedSize, idat, idatSize,
+                                                     &LodePNG_defaultDecompressSettings);
+            free(inflated);
+            if (error) {
+                fprintf(stderr, "%s: error %u: %s\n", filename, error, LodePNG_error_text(error));
+                return 1;
+            }
+            runs++;
+            elapsed = GetSeconds() - start;
+        } while (elapsed < MinimumSeconds);
+        double inflateRate = runs * (double) inflatedSize / elapsed / 1e6;
+
+        // Whole decode:
+        unsigned char* pixels = 0;
+        size_t pixelsSize = 0;
+        unsigned width = 0, height = 0;
+        runs = 0;
+        start = GetSeconds();
+        do {
+            free(pixels);
+            pixels = 0;
+            LodePNG_Decoder decoder;
+            LodePNG_Decoder_init(&decoder);
+            decoder.settings.ignoreCrc = trusted;
+            decoder.settings.zlibsettings.ignoreAdler32 = trusted;
+            LodePNG_Decoder_decode(&decoder, &pixels, &pixelsSize, png, pngSize);
+            width = decoder.infoPng.width;
+            height = decoder.infoPng.height;
+            unsigned error = decoder.error;
+            LodePNG_Decoder_cleanup(&decoder);
+            if (error) {
+                fprintf(stderr, "%s: error %u: %s\n", filename, error, LodePNG_error_text(error));
+                return 1;
+            }
+            runs++;
+            elapsed = GetSeconds() - start;
+        } while (elapsed < MinimumSeconds);
+        double decodeRate = runs * (double) pixelsSize / elapsed / 1e6;
+
+        // Encode:
+        size_t encodedSize = 0;
+        runs = 0;
+        start = GetSeconds();
+        do {
+            unsigned char* encoded = 0;
+            LodePNG_Encoder encoder;
+            LodePNG_Encoder_init(&encoder);
+            encoder.settings.zlibsettings.level = level;
+            encoder.settings.zlibsettings.threads = threads;
+            LodePNG_Encoder_encode(&encoder, &encoded, &encodedSize, pixels, width, height);
+            unsigned error = encoder.error;
+            LodePNG_Encoder_cleanup(&encoder);
+            free(encoded);
+            if (error) {
+                fprintf(stderr, "%s: error %u: %s\n", filename, error, LodePNG_error_text(error));
+                return 1;
+            }
+            runs++;
+            elapsed = GetSeconds() - start;
+        } while (elapsed < MinimumSeconds);
+        double encodeRate = runs * (double) pixelsSize / elapsed / 1e6;
+
+        const char* name = strrchr(filename, '/');
+        printf("%-20s %10zu %10zu %12.1f %12.1f %12.1f %12.1f %10zu  %08x\n", name ? name + 1 : filename,
+               idatSize, pixelsSize, crcRate, inflateRate, decodeRate, encodeRate, encodedSize,
+               Checksum(pixels, pixelsSize));
+
+        free(pixels);
+        free(idat);
+        free(png);
+    }
+    return 0;
+}
+
+static double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Concatenates the data of all IDAT chunks, which together form one zlib stream.
+static unsigned char* GatherIdat(const unsigned char* png, size_t pngSize, size_t* idatSize)
+{
+    unsigned char* idat = (unsigned char*) malloc(pngSize);
+    *idatSize = 0;
+    const unsigned char* chunk = png + 8;
+    while (chunk + 12 <= png + pngSize) {
+        unsigned length = LodePNG_chunk_length(chunk);
+        if (chunk + 12 + length > png + pngSize)
+            break;
+        if (LodePNG_chunk_type_equals(chunk, "IDAT")) {
+            memcpy(idat + *idatSize, LodePNG_chunk_data_const(chunk), length);
+            *idatSize += length;
+        }
+        if (LodePNG_chunk_type_equals(chunk, "IEND"))
+            break;
+        chunk = LodePNG_chunk_next_const(chunk);
+    }
+    return idat;
+}
+
+// Returns true if any chunk has a bad CRC.
+static bool CheckCrcs(const unsigned char* png, size_t pngSize)
+{
+    bool bad = false;
+    const unsigned char* chunk = png + 8;
+    while (chunk + 12 <= png + pngSize) {
+        unsigned length = LodePNG_chunk_length(chunk);
+        if (chunk + 12 + length > png + pngSize)
+            break;
+        bad |= LodePNG_chunk_check_crc(chunk) != 0;
+        if (LodePNG_chunk_type_equals(chunk, "IEND"))
+            break;
+        chunk = LodePNG_chunk_next_const(chunk);
+    }
+    return bad;
+}
+
+// FNV-1a
+static unsigned Checksum(const unsigned char* data, size_t size)
+{
+    unsigned hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}